@@ -0,0 +1,267 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef BLOCKCOMPRESS_H
+#define BLOCKCOMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Built-in compression of checkpoint image payloads.
+ *
+ * A compressed payload is a sequence of blocks, each holding at most
+ * BLOCK_COMPRESS_BLOCK_SIZE bytes of memory and preceded by a
+ * BlockCompressHeader.  Blocks are compressed independently of each other
+ * with a small LZ77 codec (the LZ4 block format), so that they can be
+ * compressed in parallel and decoded without reading the rest of the image.
+ * A block whose compSize equals its rawSize is stored uncompressed.
+ *
+ * The decompressor is also compiled into mtcp_restart, so nothing here may
+ * call into libc.
+ */
+
+#define BLOCK_COMPRESS_BLOCK_SIZE    (1024 * 1024)
+#define BLOCK_COMPRESS_HASH_LOG      12
+#define BLOCK_COMPRESS_HASH_ENTRIES  (1 << BLOCK_COMPRESS_HASH_LOG)
+
+#define BLOCK_COMPRESS_MIN_MATCH     4
+#define BLOCK_COMPRESS_MAX_OFFSET    65535
+
+/* The last match must start at least MF_LIMIT bytes before the end of a
+ * block, and the last LAST_LITERALS bytes are always stored as literals. */
+#define BLOCK_COMPRESS_MF_LIMIT      12
+#define BLOCK_COMPRESS_LAST_LITERALS 5
+
+typedef struct BlockCompressHeader {
+  uint32_t rawSize;
+  uint32_t compSize;
+} BlockCompressHeader;
+
+typedef uint32_t block_compress_u32 __attribute__((aligned(1), may_alias));
+typedef uint64_t block_compress_u64 __attribute__((aligned(1), may_alias));
+
+static inline uint32_t
+block_compress_hash(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - BLOCK_COMPRESS_HASH_LOG);
+}
+
+/* Copies forward eight bytes at a time.  Also valid for an overlapping match
+ * copy as long as the match offset is at least eight. */
+static inline void
+block_compress_copy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+  while (len >= 8) {
+    *(block_compress_u64 *)dst = *(const block_compress_u64 *)src;
+    dst += 8;
+    src += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    *dst++ = *src++;
+    len--;
+  }
+}
+
+static inline uint8_t *
+block_compress_put_length(uint8_t *op, size_t len)
+{
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+/* Compresses src[0..srcLen) into dst[0..dstCap).  'table' is scratch space of
+ * BLOCK_COMPRESS_HASH_ENTRIES entries.  Returns the compressed size, or 0 if
+ * the result does not fit in dstCap bytes.
+ */
+static inline size_t
+block_compress(const uint8_t *src, size_t srcLen,
+               uint8_t *dst, size_t dstCap, uint32_t *table)
+{
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *iend = src + srcLen;
+  uint8_t *op = dst;
+  uint8_t *oend = dst + dstCap;
+  size_t litLen;
+  size_t i;
+
+  for (i = 0; i < BLOCK_COMPRESS_HASH_ENTRIES; i++) {
+    table[i] = 0;
+  }
+
+  if (srcLen > BLOCK_COMPRESS_MF_LIMIT) {
+    const uint8_t *mflimit = iend - BLOCK_COMPRESS_MF_LIMIT;
+    const uint8_t *matchlimit = iend - BLOCK_COMPRESS_LAST_LITERALS;
+
+    /* Position 0 is already in the table, since the table is zeroed. */
+    ip++;
+    while (ip < mflimit) {
+      uint32_t seq = *(const block_compress_u32 *)ip;
+      uint32_t h = block_compress_hash(seq);
+      const uint8_t *ref = src + table[h];
+      table[h] = (uint32_t)(ip - src);
+
+      if (ip - ref > BLOCK_COMPRESS_MAX_OFFSET ||
+          *(const block_compress_u32 *)ref != seq) {
+        /* Skip ahead faster the longer we go without finding a match. */
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+
+      const uint8_t *mp = ip + BLOCK_COMPRESS_MIN_MATCH;
+      const uint8_t *rp = ref + BLOCK_COMPRESS_MIN_MATCH;
+      while (mp < matchlimit && *mp == *rp) {
+        mp++;
+        rp++;
+      }
+
+      size_t matchLen = mp - ip - BLOCK_COMPRESS_MIN_MATCH;
+      size_t offset = ip - ref;
+      litLen = ip - anchor;
+      if ((size_t)(oend - op) <
+          1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1) {
+        return 0;
+      }
+
+      uint8_t *token = op++;
+      *token = (uint8_t)((litLen >= 15 ? 15 : litLen) << 4);
+      if (litLen >= 15) {
+        op = block_compress_put_length(op, litLen - 15);
+      }
+      block_compress_copy(op, anchor, litLen);
+      op += litLen;
+
+      *op++ = (uint8_t)(offset & 0xff);
+      *op++ = (uint8_t)(offset >> 8);
+      *token |= (uint8_t)(matchLen >= 15 ? 15 : matchLen);
+      if (matchLen >= 15) {
+        op = block_compress_put_length(op, matchLen - 15);
+      }
+
+      ip = mp;
+      anchor = ip;
+    }
+  }
+
+  litLen = iend - anchor;
+  if ((size_t)(oend - op) < 1 + litLen / 255 + 1 + litLen) {
+    return 0;
+  }
+  *op++ = (uint8_t)((litLen >= 15 ? 15 : litLen) << 4);
+  if (litLen >= 15) {
+    op = block_compress_put_length(op, litLen - 15);
+  }
+  block_compress_copy(op, anchor, litLen);
+  op += litLen;
+
+  return op - dst;
+}
+
+/* Decompresses src[0..srcLen) into exactly dstLen bytes at dst.  Returns 0 on
+ * success and -1 if the input is malformed.
+ */
+static inline int
+block_decompress(const uint8_t *src, size_t srcLen,
+                 uint8_t *dst, size_t dstLen)
+{
+  const uint8_t *ip = src;
+  const uint8_t *iend = src + srcLen;
+  uint8_t *op = dst;
+  uint8_t *oend = dst + dstLen;
+
+  while (1) {
+    unsigned int token;
+    size_t len;
+    size_t offset;
+    uint8_t b;
+
+    if (ip >= iend) {
+      return -1;
+    }
+    token = *ip++;
+
+    len = token >> 4;
+    if (len == 15) {
+      do {
+        if (ip >= iend) {
+          return -1;
+        }
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    if (len > (size_t)(iend - ip) || len > (size_t)(oend - op)) {
+      return -1;
+    }
+    block_compress_copy(op, ip, len);
+    op += len;
+    ip += len;
+
+    if (ip == iend) {
+      /* The last sequence has literals only. */
+      return op == oend ? 0 : -1;
+    }
+
+    if (iend - ip < 2) {
+      return -1;
+    }
+    offset = ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) {
+      return -1;
+    }
+
+    len = token & 15;
+    if (len == 15) {
+      do {
+        if (ip >= iend) {
+          return -1;
+        }
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    len += BLOCK_COMPRESS_MIN_MATCH;
+    if (len > (size_t)(oend - op)) {
+      return -1;
+    }
+
+    if (offset >= 8) {
+      block_compress_copy(op, op - offset, len);
+      op += len;
+    } else {
+      const uint8_t *match = op - offset;
+      while (len > 0) {
+        *op++ = *match++;
+        len--;
+      }
+    }
+  }
+}
+
+#endif // ifndef BLOCKCOMPRESS_H
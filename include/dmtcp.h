@@ -266,7 +266,7 @@ typedef struct {
 } MemRegion;
 
 typedef void (*PostRestartFnPtr_t)(double, int);
-#define DMTCP_CKPT_SIGNATURE "DMTCP_CHECKPOINT_IMAGE_v4.0\n"
+#define DMTCP_CKPT_SIGNATURE "DMTCP_CHECKPOINT_IMAGE_v5.0\n"
 typedef struct {
   char ckptSignature[32];
 
@@ -306,7 +306,22 @@ typedef struct {
   char procname[1024];
   char procSelfExe[1024];
 
-  char padding[1792];
+  // Incremental checkpoints: if ckptGeneration is nonzero, some pages are
+  // stored in the parent image (see src/incrementalckpt.h).
+#define DMTCP_MAX_CKPT_GENERATION 15
+  uint64_t ckptGeneration;
+  char parentCkptImage[1024];
+
+  // Set if the image was written for lazy restore (dmtcp_launch
+  // --lazy-restore): it is not compressed and the data of every area starts
+  // at a page-aligned file offset, so that mtcp_restart can mmap it.
+  uint64_t lazyRestore;
+
+  // Set if some areas are DMTCP_DEDUP_PAGES (dmtcp_launch --dedup): the
+  // chunk store holding their pages (see src/ckptdedup.h).
+  char dedupStore[512];
+
+  char padding[240];
 } DmtcpCkptHeader;
 
 static_assert(sizeof(DmtcpCkptHeader) == 4096, "DmtcpCkptHeader must be 4096 bytes");
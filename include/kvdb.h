@@ -30,7 +30,17 @@ enum class KVDBRequest {
   OR,
   XOR,
   MIN,
-  MAX
+  MAX,
+
+  // Batched requests, one round trip for many keys of the same database.
+  MGET,
+  MSET,
+  MINCRBY,
+
+  // Blocking requests, answered by the coordinator once other processes
+  // have set the keys, or at the timeout.
+  MWAIT,
+  WATCH
 };
 
 enum class KVDBResponse {
@@ -66,6 +76,52 @@ KVDBResponse set(string const& id,
                  string const& val,
                  string *oldVal = nullptr);
 
+// Batched versions of get, set and request64(INCRBY, ...).  keys[i] goes
+// with vals[i].  mget returns SUCCESS if every key was found; otherwise the
+// result of each key is in (*responses)[i], and (*vals)[i] is empty for the
+// keys that were not found.  Unlike set, mset accepts empty values.  mincrby
+// returns the old values in *oldVals.
+KVDBResponse mget(string const& id,
+                  vector<string> const& keys,
+                  vector<string> *vals,
+                  vector<KVDBResponse> *responses = nullptr);
+
+KVDBResponse mset(string const& id,
+                  vector<string> const& keys,
+                  vector<string> const& vals);
+
+KVDBResponse mincrby(string const& id,
+                     vector<string> const& keys,
+                     vector<int64_t> const& vals,
+                     vector<int64_t> *oldVals = nullptr);
+
+// Blocking versions of get and mget: they wait until each key has been set,
+// by any process, for at most timeoutMs milliseconds, or forever if
+// timeoutMs is -1.  The keys still missing at the timeout are reported as by
+// get and mget.  A process must not wait for a key that its peers only set
+// after a global barrier, since it does not reach that barrier while it
+// waits.
+KVDBResponse getWait(string const& id,
+                     string const& key,
+                     string *val,
+                     int timeoutMs = -1);
+
+KVDBResponse mgetWait(string const& id,
+                      vector<string> const& keys,
+                      vector<string> *vals,
+                      vector<KVDBResponse> *responses = nullptr,
+                      int timeoutMs = -1);
+
+// Waits until the database holds at least minKeys keys that start with
+// prefix, and returns all of them with their values.  At the timeout, the
+// keys found so far are returned with KEY_NOT_FOUND.
+KVDBResponse watch(string const& id,
+                   string const& prefix,
+                   size_t minKeys,
+                   vector<string> *keys,
+                   vector<string> *vals,
+                   int timeoutMs = -1);
+
 ostream &operator<<(ostream &o, const KVDBRequest &id);
 ostream &operator<<(ostream &o, const KVDBResponse &id);
 }
@@ -21,9 +21,11 @@
 
 #ifndef PROCMAPSAREA_H
 #define PROCMAPSAREA_H
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include "config.h" // For MTCP_PAGE_SIZE
+#include "crc32c.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -66,9 +68,18 @@ typedef char *VA;  /* VA = virtual address */
 typedef enum ProcMapsAreaProperties {
   DMTCP_ZERO_PAGE                  = 0x0001,
   DMTCP_ZERO_PAGE_PARENT_HEADER    = 0x0002,
-  DMTCP_ZERO_PAGE_CHILD_HEADER     = 0x0004
+  DMTCP_ZERO_PAGE_CHILD_HEADER     = 0x0004,
+  DMTCP_BLOCK_COMPRESSED           = 0x0008, // See include/blockcompress.h
+  DMTCP_PAGES_IN_PARENT            = 0x0010, // See src/incrementalckpt.h
+  DMTCP_DEDUP_PAGES                = 0x0020  // See src/ckptdedup.h
 } ProcMapsAreaProperties;
 
+/* The data of a DMTCP_DEDUP_PAGES area is one uint64_t per chunk of this
+ * size: the offset of the chunk in the chunk store named by
+ * DmtcpCkptHeader::dedupStore.
+ */
+#define DMTCP_DEDUP_CHUNK_SIZE 4096
+
 typedef union ProcMapsArea {
   struct {
     union {
@@ -112,12 +123,107 @@ typedef union ProcMapsArea {
     uint64_t properties;
 
     char name[FILENAMESIZE];
+
+    // CRC32C of the whole header, with headerCrc32c itself taken as zero.
+    uint32_t headerCrc32c;
   };
   char _padding[4096];
 } ProcMapsArea;
 
 typedef ProcMapsArea Area;
 
+/* Layout of a checkpoint image (DMTCP_CKPT_SIGNATURE in dmtcp.h):
+ *
+ *   DmtcpCkptHeader, twice (dmtcp_restart reads one, mtcp_restart the other)
+ *   for each area: Area header, followed by the data of the area, if any
+ *   Area header with addr == NULL
+ *   CkptIndexEntry for each of the area headers above but the last one
+ *   CkptIndexTrailer
+ *
+ * The image can still be read front to back from a pipe.  The index lets
+ * tools that have the image in a regular file find the areas without reading
+ * all of it.  Offsets are from the start of the image as written by DMTCP,
+ * i.e., before gzip compression.
+ *
+ * The checksums cover the bytes as stored in the image, e.g., the compressed
+ * blocks of a DMTCP_BLOCK_COMPRESSED area.  Each area header carries its own
+ * checksum, so a reader can trust the header before acting on it.  The data
+ * of an area can only be checksummed once it has been written out, so its
+ * checksum is kept in the index; payloadCrc32c of the trailer covers the data
+ * of all areas, in order, which mtcp_restart checks before resuming the
+ * process.
+ */
+#define CKPT_INDEX_MAGIC "DMTCP_CKPT_IDX1"
+
+typedef struct CkptIndexEntry {
+  uint64_t addr;
+  uint64_t endAddr;
+  uint64_t offset;      // Offset of the Area header in the image.
+  uint64_t dataSize;    // Bytes of memory restored from the data.
+  uint64_t storedSize;  // Bytes that follow the header in the image.
+  uint64_t properties;
+  uint32_t prot;
+  uint32_t flags;
+  uint32_t dataCrc32c;  // CRC32C of the storedSize bytes after the header.
+  uint32_t padding;
+} CkptIndexEntry;
+
+/* The trailer is always there.  If DMTCP could not build the index (no
+ * memory for it, or too many areas), it has no entries and is flagged
+ * CKPT_INDEX_INCOMPLETE, and payloadCrc32c is not set.
+ */
+#define CKPT_INDEX_INCOMPLETE 0x1
+
+typedef struct CkptIndexTrailer {
+  char magic[16];
+  uint64_t indexOffset; // Offset of the first CkptIndexEntry.
+  uint64_t numEntries;
+  uint32_t indexCrc32c;   // CRC32C of the entries.
+  uint32_t payloadCrc32c; // CRC32C of the data of all areas, in order.
+  uint32_t flags;         // CKPT_INDEX_INCOMPLETE
+  uint32_t padding[5];
+} CkptIndexTrailer;
+
+/* Does the header have data following it in the image? */
+static inline int
+area_has_data(const Area *area)
+{
+  return area->addr != NULL &&
+         (area->properties & (DMTCP_ZERO_PAGE | DMTCP_ZERO_PAGE_PARENT_HEADER |
+                              DMTCP_PAGES_IN_PARENT)) == 0;
+}
+
+/* The number of bytes stored after the header: memory, or, for a
+ * DMTCP_DEDUP_PAGES area, the offsets of its chunks in the chunk store.
+ */
+static inline size_t
+area_data_size(const Area *area)
+{
+  if (!area_has_data(area)) {
+    return 0;
+  }
+  if (area->properties & DMTCP_DEDUP_PAGES) {
+    return area->size / DMTCP_DEDUP_CHUNK_SIZE * sizeof(uint64_t);
+  }
+  if (area->mmapFileSize > 0 && area->name[0] == '/') {
+    return area->mmapFileSize;
+  }
+  return area->size;
+}
+
+static inline uint32_t
+area_header_crc32c(const Area *area)
+{
+  const size_t fieldOffset = offsetof(ProcMapsArea, headerCrc32c);
+  const uint32_t zero = 0;
+  uint32_t crc;
+
+  crc = crc32c_update(0, area, fieldOffset);
+  crc = crc32c_update(crc, &zero, sizeof(zero));
+  return crc32c_update(crc, (const char *)area + fieldOffset + sizeof(zero),
+                       sizeof(*area) - fieldOffset - sizeof(zero));
+}
+
 // The interface of dmtcp_skip_memory_region needs to allow plugins to save
 // part of the examined memory segment, and check the remaining segment in
 // the next iteration. This is required for split-process plugins in case
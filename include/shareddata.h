@@ -35,13 +35,18 @@
 #define PTS_PATH_MAX             32
 #define MAX_PID_MAPS             32768
 #define MAX_IPC_ID_MAPS          256
+
+// The id maps are open-addressing hash tables with twice as many slots as
+// the maximum number of maps they hold.
+#define PID_MAP_SLOTS            (2 * MAX_PID_MAPS)
+#define IPC_ID_MAP_SLOTS         (2 * MAX_IPC_ID_MAPS)
 #define MAX_PTY_NAME_MAPS        256
 #define MAX_INCOMING_CONNECTIONS 10240
 #define MAX_INODE_PID_MAPS       10240
 #define CON_ID_LEN \
   (sizeof(DmtcpUniqueProcessId) + sizeof(int64_t))
 
-#define SHM_VERSION_STR          "DMTCP_GLOBAL_AREA_V0.99"
+#define SHM_VERSION_STR          "DMTCP_GLOBAL_AREA_V1.00"
 #define VIRT_PTS_PREFIX_STR      "/dev/pts/v"
 
 #define SYSV_SHM_ID              1
@@ -62,14 +67,15 @@ typedef struct CoordinatorInfo {
 namespace SharedData
 {
 // All structs should be 64-bit aligned.
-struct PidMap {
-  pid_t virt;
-  pid_t real;
-};
 
-struct IPCIdMap {
-  int32_t virt;
-  int32_t real;
+// A slot of a virtual-to-real id map (pids and SysV IPC ids/keys).  A
+// process claims a free slot by a compare-and-swap of 'key' from 0 to
+// ID_MAP_KEY(virt), and then stores ID_MAP_VALUE(real) in 'value'; slots are
+// never freed.  Readers thus need no lock, and a slot whose value is still 0
+// is treated as not found.
+struct IdMap {
+  uint64_t key;
+  uint64_t value;
 };
 
 struct PtyNameMap {
@@ -101,6 +107,13 @@ struct BarrierInfo {
 
   // Posix Barrier
   pthread_barrier_t barrier;
+
+  // Node barriers (DMTCP_NODE_BARRIERS): the numCkptPeers processes meet
+  // here, and the last one to arrive reports all of them to the coordinator.
+  uint32_t nodeBarriers;
+  uint32_t nodeNumIn;
+  uint32_t nodeRound;
+  uint32_t nodeNumPeers;
 };
 
 typedef enum {
@@ -139,11 +152,11 @@ struct Header {
     char pad[128];
   };
 
-  struct PidMap pidMap[MAX_PID_MAPS];
-  struct IPCIdMap sysvShmIdMap[MAX_IPC_ID_MAPS];
-  struct IPCIdMap sysvSemIdMap[MAX_IPC_ID_MAPS];
-  struct IPCIdMap sysvMsqIdMap[MAX_IPC_ID_MAPS];
-  struct IPCIdMap sysvShmKeyMap[MAX_IPC_ID_MAPS];
+  struct IdMap pidMap[PID_MAP_SLOTS];
+  struct IdMap sysvShmIdMap[IPC_ID_MAP_SLOTS];
+  struct IdMap sysvSemIdMap[IPC_ID_MAP_SLOTS];
+  struct IdMap sysvMsqIdMap[IPC_ID_MAP_SLOTS];
+  struct IdMap sysvShmKeyMap[IPC_ID_MAP_SLOTS];
   struct PtyNameMap ptyNameMap[MAX_PTY_NAME_MAPS];
   struct IncomingConMap incomingConMap[MAX_INCOMING_CONNECTIONS];
   InodeConnIdMap inodeConnIdMap[MAX_INODE_PID_MAPS];
@@ -176,6 +189,11 @@ void resetBarrierInfo();
 void prepareForCkpt();
 void postRestart();
 void waitForBarrier(const string &barrierId);
+bool nodeBarriersEnabled();
+uint32_t numCkptPeers();
+bool arriveAtNodeBarrier(uint32_t numLocalPeers, uint32_t *round);
+void releaseNodeBarrier(uint32_t numPeers);
+bool waitForNodeBarrierRelease(uint32_t round, uint32_t *numPeers);
 
 string coordHost();
 uint32_t coordPort();
@@ -169,6 +169,7 @@ bool isValidFd(int fd);
 bool isPseudoTty(const char *path);
 size_t pageSize();
 size_t pageMask();
+void selectZeroPageScanner();
 bool areZeroPages(void *addr, size_t numPages);
 
 char *findExecutable(char *executable, const char *path_env, char *exec_path);
@@ -37,8 +37,245 @@
 
 #define MAX_VIRTUAL_ID 999
 
+// Number of optimistic reads of a VirtualIdTable that may collide with a
+// writer before the reader takes the table lock instead.
+#define VIRTUAL_ID_TABLE_READ_RETRIES 16
+
 namespace dmtcp
 {
+// An open-addressing hash table from ids to ids that can be read while it
+// is being written (see VirtualIdTable): readers may see a torn or stale
+// slot, but never memory that has been freed, because tables that have been
+// outgrown are only freed with the index.  Callers detect such reads by a
+// sequence count, and retry.  Writers must be serialized by the caller.
+template<typename IdType>
+class IdHashIndex
+{
+  public:
+#ifdef JALIB_ALLOCATOR
+    static void *operator new(size_t nbytes, void *p) { return p; }
+
+    static void *operator new(size_t nbytes) { JALLOC_HELPER_NEW(nbytes); }
+
+    static void operator delete(void *p) { JALLOC_HELPER_DELETE(p); }
+#endif // ifdef JALIB_ALLOCATOR
+    IdHashIndex() : _table(NULL) {}
+
+    IdHashIndex(const IdHashIndex &other) : _table(NULL)
+    {
+      copyFrom(other);
+    }
+
+    IdHashIndex &operator=(const IdHashIndex &other)
+    {
+      if (this != &other) {
+        clear();
+        copyFrom(other);
+      }
+      return *this;
+    }
+
+    ~IdHashIndex()
+    {
+      while (_table != NULL) {
+        Table *retired = _table->retired;
+        JALLOC_HELPER_FREE(_table->slots);
+        JALLOC_HELPER_FREE(_table);
+        _table = retired;
+      }
+    }
+
+    // May be called concurrently with writers; the result is only valid if
+    // no write overlapped the call.
+    bool find(IdType key, IdType *value) const
+    {
+      const Table *t = __atomic_load_n(&_table, __ATOMIC_ACQUIRE);
+
+      if (t == NULL) {
+        return false;
+      }
+
+      size_t mask = t->numSlots - 1;
+      size_t i = hash(key) & mask;
+      for (size_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        const Slot *slot = &t->slots[i];
+        uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+        if (state == SLOT_EMPTY) {
+          return false;
+        }
+        if (state == SLOT_USED &&
+            __atomic_load_n(&slot->key, __ATOMIC_RELAXED) == key) {
+          *value = __atomic_load_n(&slot->value, __ATOMIC_RELAXED);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void set(IdType key, IdType value)
+    {
+      if (_table == NULL ||
+          (_table->numUsed + _table->numDeleted + 1) * 2 > _table->numSlots) {
+        rehash();
+      }
+
+      size_t mask = _table->numSlots - 1;
+      size_t i = hash(key) & mask;
+      Slot *freeSlot = NULL;
+      for (size_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        Slot *slot = &_table->slots[i];
+        if (slot->state == SLOT_USED && slot->key == key) {
+          __atomic_store_n(&slot->value, value, __ATOMIC_RELAXED);
+          return;
+        }
+        if (slot->state != SLOT_USED && freeSlot == NULL) {
+          freeSlot = slot;
+        }
+        if (slot->state == SLOT_EMPTY) {
+          break;
+        }
+      }
+
+      if (freeSlot->state == SLOT_DELETED) {
+        _table->numDeleted--;
+      }
+      _table->numUsed++;
+      __atomic_store_n(&freeSlot->key, key, __ATOMIC_RELAXED);
+      __atomic_store_n(&freeSlot->value, value, __ATOMIC_RELAXED);
+      __atomic_store_n(&freeSlot->state, (uint32_t)SLOT_USED,
+                       __ATOMIC_RELAXED);
+    }
+
+    void erase(IdType key)
+    {
+      if (_table == NULL) {
+        return;
+      }
+
+      size_t mask = _table->numSlots - 1;
+      size_t i = hash(key) & mask;
+      for (size_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        Slot *slot = &_table->slots[i];
+        if (slot->state == SLOT_EMPTY) {
+          return;
+        }
+        if (slot->state == SLOT_USED && slot->key == key) {
+          __atomic_store_n(&slot->state, (uint32_t)SLOT_DELETED,
+                           __ATOMIC_RELAXED);
+          _table->numUsed--;
+          _table->numDeleted++;
+          return;
+        }
+      }
+    }
+
+    void clear()
+    {
+      if (_table == NULL) {
+        return;
+      }
+
+      for (size_t i = 0; i < _table->numSlots; i++) {
+        __atomic_store_n(&_table->slots[i].state, (uint32_t)SLOT_EMPTY,
+                         __ATOMIC_RELAXED);
+      }
+      _table->numUsed = 0;
+      _table->numDeleted = 0;
+    }
+
+  private:
+    void copyFrom(const IdHashIndex &other)
+    {
+      const Table *t = other._table;
+
+      for (size_t i = 0; t != NULL && i < t->numSlots; i++) {
+        if (t->slots[i].state == SLOT_USED) {
+          set(t->slots[i].key, t->slots[i].value);
+        }
+      }
+    }
+
+    enum SlotState { SLOT_EMPTY = 0, SLOT_USED, SLOT_DELETED };
+
+    struct Slot {
+      IdType key;
+      IdType value;
+      uint32_t state;
+    };
+
+    struct Table {
+      Table *retired;
+      size_t numSlots;
+      size_t numUsed;
+      size_t numDeleted;
+      Slot *slots;
+    };
+
+    static size_t hash(IdType key)
+    {
+      // Fibonacci hashing: spreads consecutive ids, such as pids.
+      return (size_t)(((uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ULL) >> 32);
+    }
+
+    static void insertSlot(Table *t, const Slot &slot)
+    {
+      size_t j = hash(slot.key) & (t->numSlots - 1);
+
+      while (t->slots[j].state != SLOT_EMPTY) {
+        j = (j + 1) & (t->numSlots - 1);
+      }
+      t->slots[j] = slot;
+      t->numUsed++;
+    }
+
+    // Makes room for at least four times as many slots as are used.  A
+    // larger table is published for readers, and the old one kept for those
+    // still reading it; otherwise the deleted slots are dropped in place.
+    void rehash()
+    {
+      size_t numSlots = 16;
+      size_t numUsed = _table != NULL ? _table->numUsed : 0;
+
+      while (numSlots < numUsed * 4) {
+        numSlots *= 2;
+      }
+
+      if (_table != NULL && numSlots <= _table->numSlots) {
+        Slot *used = (Slot *)JALLOC_HELPER_MALLOC(numUsed * sizeof(Slot));
+        size_t n = 0;
+        for (size_t i = 0; i < _table->numSlots; i++) {
+          if (_table->slots[i].state == SLOT_USED) {
+            used[n++] = _table->slots[i];
+          }
+        }
+        clear();
+        for (size_t i = 0; i < n; i++) {
+          insertSlot(_table, used[i]);
+        }
+        JALLOC_HELPER_FREE(used);
+        return;
+      }
+
+      Table *t = (Table *)JALLOC_HELPER_MALLOC(sizeof(Table));
+      t->retired = _table;
+      t->numSlots = numSlots;
+      t->numUsed = 0;
+      t->numDeleted = 0;
+      t->slots = (Slot *)JALLOC_HELPER_MALLOC(numSlots * sizeof(Slot));
+      memset(t->slots, 0, numSlots * sizeof(Slot));
+
+      for (size_t i = 0; _table != NULL && i < _table->numSlots; i++) {
+        if (_table->slots[i].state == SLOT_USED) {
+          insertSlot(t, _table->slots[i]);
+        }
+      }
+
+      __atomic_store_n(&_table, t, __ATOMIC_RELEASE);
+    }
+
+    Table *_table;
+};
+
 template<typename IdType>
 class VirtualIdTable
 {
@@ -53,6 +290,129 @@ class VirtualIdTable
       JASSERT(DmtcpMutexUnlock(&tblLock) == 0) (JASSERT_ERRNO);
     }
 
+    /* Lookups don't take tblLock: they read the indexes optimistically and
+     * retry if a writer was active meanwhile, as told by an odd or changed
+     * _seq (a seqlock).  Writers hold tblLock and change _idMapTable only
+     * through _setMapping(), _eraseMapping() and _clearMappings(), which
+     * keep the indexes in sync.
+     */
+    void _begin_write()
+    {
+      __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    void _end_write()
+    {
+      __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELEASE);
+    }
+
+    bool _find(const IdHashIndex<IdType> &index, IdType id, IdType *result)
+    {
+      bool found;
+
+      for (int i = 0; i < VIRTUAL_ID_TABLE_READ_RETRIES; i++) {
+        uint32_t seq = __atomic_load_n(&_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+          continue;
+        }
+        found = index.find(id, result);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&_seq, __ATOMIC_RELAXED) == seq) {
+          return found;
+        }
+      }
+
+      // Keep colliding with writers; wait for them instead.
+      _do_lock_tbl();
+      found = index.find(id, result);
+      _do_unlock_tbl();
+      return found;
+    }
+
+    // Several virtual ids may map to the same real id; the reverse index
+    // names the one mapped last, and _realIdRefs counts them.
+    void _unlinkRealId(IdType realId, IdType virtualId)
+    {
+      typename dmtcp::unordered_map<IdType, size_t>::iterator r =
+        _realIdRefs.find(realId);
+      IdType mappedId;
+
+      if (--r->second == 0) {
+        _realIdRefs.erase(r);
+        _realToVirtualIndex.erase(realId);
+      } else if (_realToVirtualIndex.find(realId, &mappedId) &&
+                 mappedId == virtualId) {
+        for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
+          if (i->second == realId && i->first != virtualId) {
+            _realToVirtualIndex.set(realId, i->first);
+            break;
+          }
+        }
+      }
+    }
+
+    void _setMapping(IdType virtualId, IdType realId)
+    {
+      id_iterator i = _idMapTable.find(virtualId);
+
+      if (i != _idMapTable.end() && i->second == realId) {
+        return;
+      }
+
+      _begin_write();
+      if (i != _idMapTable.end()) {
+        _unlinkRealId(i->second, virtualId);
+        i->second = realId;
+      } else {
+        _idMapTable[virtualId] = realId;
+      }
+      _realIdRefs[realId]++;
+      _virtualToRealIndex.set(virtualId, realId);
+      _realToVirtualIndex.set(realId, virtualId);
+      _end_write();
+    }
+
+    void _eraseMapping(IdType virtualId)
+    {
+      id_iterator i = _idMapTable.find(virtualId);
+
+      if (i == _idMapTable.end()) {
+        return;
+      }
+
+      _begin_write();
+      _unlinkRealId(i->second, virtualId);
+      _idMapTable.erase(i);
+      _virtualToRealIndex.erase(virtualId);
+      _end_write();
+    }
+
+    void _clearMappings()
+    {
+      _begin_write();
+      _idMapTable.clear();
+      _realIdRefs.clear();
+      _virtualToRealIndex.clear();
+      _realToVirtualIndex.clear();
+      _end_write();
+    }
+
+    // After _idMapTable has been deserialized.
+    void _rebuildIndexes()
+    {
+      _begin_write();
+      _realIdRefs.clear();
+      _virtualToRealIndex.clear();
+      _realToVirtualIndex.clear();
+      for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
+        _realIdRefs[i->second]++;
+        _virtualToRealIndex.set(i->first, i->second);
+        _realToVirtualIndex.set(i->second, i->first);
+      }
+      _end_write();
+    }
+
   public:
 #ifdef JALIB_ALLOCATOR
     static void *operator new(size_t nbytes, void *p) { return p; }
@@ -67,6 +427,7 @@ class VirtualIdTable
                    size_t reserveSize = MAX_VIRTUAL_ID)
     {
       DmtcpMutexInit(&tblLock, DMTCP_MUTEX_LLL);
+      _seq = 0;
       _do_lock_tbl();
       _idMapTable.clear();
       _idMapTable.reserve(reserveSize);
@@ -104,7 +465,7 @@ class VirtualIdTable
     void clear()
     {
       _do_lock_tbl();
-      _idMapTable.clear();
+      _clearMappings();
       resetNextVirtualId();
       _do_unlock_tbl();
     }
@@ -112,7 +473,7 @@ class VirtualIdTable
     void postRestart()
     {
       _do_lock_tbl();
-      _idMapTable.clear();
+      _clearMappings();
       resetNextVirtualId();
       _do_unlock_tbl();
     }
@@ -121,6 +482,7 @@ class VirtualIdTable
     {
       _base = newBase;
       DmtcpMutexInit(&tblLock, DMTCP_MUTEX_LLL);
+      _seq = 0;
       resetNextVirtualId();
     }
 
@@ -159,44 +521,29 @@ class VirtualIdTable
 
     bool virtualIdExists(IdType id)
     {
-      bool retVal = false;
-
-      _do_lock_tbl();
-      id_iterator j = _idMapTable.find(id);
-      if (j != _idMapTable.end()) {
-        retVal = true;
-      }
+      IdType realId;
 
-      _do_unlock_tbl();
-      return retVal;
+      return _find(_virtualToRealIndex, id, &realId);
     }
 
     bool realIdExists(IdType id)
     {
-      bool retval = false;
+      IdType virtualId;
 
-      _do_lock_tbl();
-      for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
-        if (i->second == id) {
-          retval = true;
-          break;
-        }
-      }
-      _do_unlock_tbl();
-      return retval;
+      return _find(_realToVirtualIndex, id, &virtualId);
     }
 
     void updateMapping(IdType virtualId, IdType realId)
     {
       _do_lock_tbl();
-      _idMapTable[virtualId] = realId;
+      _setMapping(virtualId, realId);
       _do_unlock_tbl();
     }
 
     void erase(IdType virtualId)
     {
       _do_lock_tbl();
-      _idMapTable.erase(virtualId);
+      _eraseMapping(virtualId);
       _do_unlock_tbl();
     }
 
@@ -227,54 +574,36 @@ class VirtualIdTable
 
     virtual bool virtualToReal(IdType virtualId, IdType *realId)
     {
-      bool retVal = false;
-
       /* This code is called from MTCP while the checkpoint thread is holding
          the JASSERT log lock. Therefore, don't call JTRACE/JASSERT/JINFO/etc. in
          this function. */
-      _do_lock_tbl();
-      id_iterator i = _idMapTable.find(virtualId);
-      if (i != _idMapTable.end()) {
-        *realId = i->second;
-        retVal = true;
-      }
-      _do_unlock_tbl();
-      return retVal;
+      return _find(_virtualToRealIndex, virtualId, realId);
     }
 
     virtual IdType virtualToReal(IdType virtualId)
     {
-      IdType retVal = 0;
+      IdType retVal;
 
       /* This code is called from MTCP while the checkpoint thread is holding
          the JASSERT log lock. Therefore, don't call JTRACE/JASSERT/JINFO/etc. in
          this function. */
-      _do_lock_tbl();
-      id_iterator i = _idMapTable.find(virtualId);
-      if (i == _idMapTable.end()) {
+      if (!_find(_virtualToRealIndex, virtualId, &retVal)) {
         retVal = virtualId;
-      } else {
-        retVal = i->second;
       }
-      _do_unlock_tbl();
       return retVal;
     }
 
     virtual IdType realToVirtual(IdType realId)
     {
+      IdType retVal;
+
       /* This code is called from MTCP while the checkpoint thread is holding
          the JASSERT log lock. Therefore, don't call JTRACE/JASSERT/JINFO/etc. in
          this function. */
-      _do_lock_tbl();
-      for (id_iterator i = _idMapTable.begin(); i != _idMapTable.end(); ++i) {
-        if (realId == i->second) {
-          _do_unlock_tbl();
-          return i->first;
-        }
+      if (!_find(_realToVirtualIndex, realId, &retVal)) {
+        retVal = realId;
       }
-
-      _do_unlock_tbl();
-      return realId;
+      return retVal;
     }
 
     void serialize(jalib::JBinarySerializer &o)
@@ -282,6 +611,11 @@ class VirtualIdTable
       JSERIALIZE_ASSERT_POINT("VirtualIdTable:");
       o & _idMapTable;
       JSERIALIZE_ASSERT_POINT("EOF");
+      if (o.isReader()) {
+        _do_lock_tbl();
+        _rebuildIndexes();
+        _do_unlock_tbl();
+      }
       printMaps();
     }
 
@@ -323,6 +657,7 @@ class VirtualIdTable
       while (!maprd.isEOF()) {
         maprd & _idMapTable;
       }
+      _rebuildIndexes();
 
       _do_unlock_tbl();
 
@@ -339,6 +674,10 @@ class VirtualIdTable
   private:
     string _typeStr;
     DmtcpMutex tblLock;
+    uint32_t _seq;
+    IdHashIndex<IdType> _virtualToRealIndex;
+    IdHashIndex<IdType> _realToVirtualIndex;
+    dmtcp::unordered_map<IdType, size_t> _realIdRefs;
 
   protected:
     typedef typename dmtcp::unordered_map<IdType, IdType>::iterator id_iterator;
@@ -111,7 +111,8 @@ _dealloc_raw(void *ptr, size_t n)
   }
 
 #  ifdef JALLOC_DEBUG_STATS
-  for (int i = 0; i < numAllocArenas; i++) {
+  // Arenas past the first MAX_ARENAS are counted, but not recorded.
+  for (int i = 0; i < numAllocArenas && i < MAX_ARENAS; i++) {
     if (allocArenas[i].startAddr == ptr) {
       allocArenas[i].startAddr = NULL;
       allocArenas[i].endAddr = NULL;
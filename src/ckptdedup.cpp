@@ -0,0 +1,601 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "jassert.h"
+#include "jconvert.h"
+#include "jfilesystem.h"
+#include "ckptdedup.h"
+#include "ckptserializer.h"
+#include "ckptstore.h"
+#include "ckptwriter.h"
+#include "constants.h"
+#include "processinfo.h"
+#include "shareddata.h"
+#include "syscallwrappers.h"
+#include "uniquepid.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+// Number of slots of the index.  At 16 bytes per slot, the index file takes
+// 64 MB, of which only the pages that were touched are allocated; it can
+// tell apart 16 GB of distinct memory.
+#define DEDUP_INDEX_SLOTS         (1 << 22)
+#define DEDUP_INDEX_HEADER_SIZE   8192
+
+// A chunk that finds no free slot this close to its hash is stored without
+// an index entry.
+#define DEDUP_MAX_PROBES          64
+
+// Each process reserves space in the store this many chunks at a time, and
+// writes runs of new chunks with a single pwrite().
+#define DEDUP_EXTENT_CHUNKS       256
+
+// Number of chunks of a DMTCP_DEDUP_PAGES area header.
+#define DEDUP_REFS_PER_AREA       8192
+
+// Chunks found by their hash are compared with the store this many at a
+// time, if they are contiguous in the store.
+#define DEDUP_VERIFY_CHUNKS       64
+
+// How long to wait for another process to initialize the index, or to write
+// the chunk of a slot that it claimed: this many polls, mostly 1 ms apart.
+#define DEDUP_WAIT_POLLS          10000
+
+// DedupSlot::ref is a store offset ORed with DEDUP_SLOT_READY once the
+// chunk is in the store.  Offsets are multiples of DMTCP_DEDUP_CHUNK_SIZE.
+#define DEDUP_SLOT_EMPTY          0
+#define DEDUP_SLOT_BUSY           1
+#define DEDUP_SLOT_READY          2
+
+typedef struct DedupIndexHeader {
+  uint32_t initialized;   // Set by the creator once the rest is valid.
+  uint32_t padding;
+  uint64_t numSlots;
+  uint64_t storeSize;     // Bytes of the store handed out so far.
+  char storePath[PATH_MAX];
+} DedupIndexHeader;
+
+typedef struct DedupSlot {
+  uint64_t hash;
+  uint64_t ref;
+} DedupSlot;
+
+// Private to this process; like the index, it is not part of the image.
+typedef struct DedupScratch {
+  uint64_t refs[DEDUP_REFS_PER_AREA];
+  uint8_t probes[DEDUP_REFS_PER_AREA];  // 1 + probe of an unverified ref.
+  DedupSlot *batchSlots[DEDUP_EXTENT_CHUNKS];
+  char verify[DEDUP_VERIFY_CHUNKS * DMTCP_DEDUP_CHUNK_SIZE];
+} DedupScratch;
+
+static_assert(sizeof(DedupIndexHeader) <= DEDUP_INDEX_HEADER_SIZE,
+              "DedupIndexHeader does not fit");
+
+static bool enabled = false;
+static bool pendingCommit = false;
+static char indexPath[PATH_MAX];
+static char storeTemp[PATH_MAX];
+static char storeFinal[PATH_MAX];
+
+static char *indexMap = NULL;
+static size_t indexMapSize = 0;
+static DedupIndexHeader *indexHdr = NULL;
+static DedupSlot *slots = NULL;
+static DedupScratch *scratch = NULL;
+static int storeFd = -1;
+
+// The part of the current extent of the store that is still free.
+static uint64_t extentNext = 0;
+static uint64_t extentEnd = 0;
+
+// New chunks, contiguous both in memory and in the store, that are not yet
+// written to the store.  Their slots stay busy until they are.
+static VA batchSrc = NULL;
+static uint64_t batchOffset = 0;
+static size_t batchLen = 0;
+
+static size_t numChunks = 0;
+static size_t numStored = 0;
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+hashRound(uint64_t acc, uint64_t input)
+{
+  return rotl64(acc + input * PRIME64_2, 31) * PRIME64_1;
+}
+
+// A multiply-rotate hash over four independent lanes, in the style of
+// xxHash64, so that the lanes proceed in parallel.  Chunks that hash alike
+// are compared in full before they are shared, so the hash only needs to
+// spread the chunks over the index.
+static uint64_t
+hashChunk(const char *chunk)
+{
+  const uint64_t *p = (const uint64_t *)chunk;
+  uint64_t v0 = PRIME64_1 + PRIME64_2;
+  uint64_t v1 = PRIME64_2;
+  uint64_t v2 = 0;
+  uint64_t v3 = -PRIME64_1;
+
+  for (size_t i = 0; i < DMTCP_DEDUP_CHUNK_SIZE / sizeof(uint64_t); i += 4) {
+    v0 = hashRound(v0, p[i]);
+    v1 = hashRound(v1, p[i + 1]);
+    v2 = hashRound(v2, p[i + 2]);
+    v3 = hashRound(v3, p[i + 3]);
+  }
+
+  uint64_t h = rotl64(v0, 1) + rotl64(v1, 7) + rotl64(v2, 12) + rotl64(v3, 18);
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+static bool
+isRequested()
+{
+  const char *str = getenv(ENV_VAR_CKPT_DEDUP);
+  return str != NULL && strcmp(str, "0") != 0;
+}
+
+static bool
+isIncrementalRequested()
+{
+  const char *str = getenv(ENV_VAR_INCREMENTAL_CKPT);
+  return str != NULL && atoi(str) > 0;
+}
+
+static void
+pwriteAll(int fd, const char *buf, size_t len, off_t offset)
+{
+  while (len > 0) {
+    ssize_t rc = pwrite(fd, buf, len, offset);
+    if (rc == -1 && (errno == EINTR || errno == EAGAIN)) {
+      continue;
+    }
+    JASSERT(rc > 0) (storeTemp) (JASSERT_ERRNO)
+      .Text("Failed to write to the chunk store");
+    buf += rc;
+    len -= rc;
+    offset += rc;
+  }
+}
+
+// Pauses before polling another process again.  Returns false once it has
+// been waited for DEDUP_WAIT_POLLS times.
+static bool
+pollPause(int *polls)
+{
+  if (*polls >= DEDUP_WAIT_POLLS) {
+    return false;
+  }
+  if ((*polls)++ < 100) {
+    sched_yield();
+  } else {
+    usleep(1000);
+  }
+  return true;
+}
+
+// Maps the index for this checkpoint generation, creating it if this is the
+// first process of the computation on this host to get here.
+static bool
+openIndex()
+{
+  size_t size = DEDUP_INDEX_HEADER_SIZE + DEDUP_INDEX_SLOTS * sizeof(DedupSlot);
+  bool creator = true;
+
+  int fd = _real_open(indexPath, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1 && errno == EEXIST) {
+    creator = false;
+    fd = _real_open(indexPath, O_RDWR, 0);
+  }
+  if (fd == -1) {
+    JWARNING(false) (indexPath) (JASSERT_ERRNO)
+      .Text("Failed to open the dedup index; not deduplicating");
+    return false;
+  }
+
+  if (creator) {
+    JASSERT(ftruncate(fd, size) == 0) (indexPath) (JASSERT_ERRNO);
+  } else {
+    struct stat st;
+    int polls = 0;
+    st.st_size = 0;
+    while ((fstat(fd, &st) != 0 || (size_t)st.st_size != size) &&
+           pollPause(&polls)) {
+    }
+    if ((size_t)st.st_size != size) {
+      JWARNING(false) (indexPath)
+        .Text("The dedup index was not initialized; not deduplicating");
+      _real_close(fd);
+      return false;
+    }
+  }
+
+  char *map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           fd, 0);
+  JASSERT(map != MAP_FAILED) (indexPath) (JASSERT_ERRNO);
+  _real_close(fd);
+
+  DedupIndexHeader *hdr = (DedupIndexHeader *)map;
+  if (creator) {
+    storeFd = _real_open(storeTemp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    JASSERT(storeFd != -1) (storeTemp) (JASSERT_ERRNO)
+      .Text("Failed to create the chunk store");
+    hdr->numSlots = DEDUP_INDEX_SLOTS;
+    hdr->storeSize = 0;
+    strcpy(hdr->storePath, storeTemp);
+    __atomic_store_n(&hdr->initialized, 1, __ATOMIC_RELEASE);
+  } else {
+    int polls = 0;
+    while (!__atomic_load_n(&hdr->initialized, __ATOMIC_ACQUIRE) &&
+           pollPause(&polls)) {
+    }
+    if (!__atomic_load_n(&hdr->initialized, __ATOMIC_ACQUIRE) ||
+        hdr->numSlots != DEDUP_INDEX_SLOTS ||
+        strcmp(hdr->storePath, storeTemp) != 0) {
+      // E.g., another process of the computation uses another ckpt dir.
+      JWARNING(false) (indexPath) (storeTemp) (hdr->storePath)
+        .Text("The dedup index is for another chunk store; not deduplicating");
+      JASSERT(munmap(map, size) == 0) (JASSERT_ERRNO);
+      return false;
+    }
+    storeFd = _real_open(storeTemp, O_RDWR, 0);
+    JASSERT(storeFd != -1) (storeTemp) (JASSERT_ERRNO)
+      .Text("Failed to open the chunk store");
+  }
+
+  indexMap = map;
+  indexMapSize = size;
+  indexHdr = hdr;
+  slots = (DedupSlot *)(map + DEDUP_INDEX_HEADER_SIZE);
+  return true;
+}
+
+void
+CkptDedup::prepare(DmtcpCkptHeader *hdr)
+{
+  hdr->dedupStore[0] = '\0';
+  enabled = false;
+  pendingCommit = false;
+
+  // After a restart, these point to memory that was not restored.
+  indexMap = NULL;
+  indexHdr = NULL;
+  slots = NULL;
+  scratch = NULL;
+  storeFd = -1;
+
+  if (!isRequested()) {
+    return;
+  }
+
+  if (!CkptStore::instance().isLocal() || CkptWriter::useBlockCompression() ||
+      CkptSerializer::isForkedCkpt() || CkptSerializer::useLazyRestore() ||
+      isIncrementalRequested()) {
+    JTRACE("Checkpoint mode does not support dedup; writing a plain image");
+    return;
+  }
+
+  string compId = UniquePid(SharedData::getCompId()).toString();
+  string dir = ProcessInfo::instance().getCkptDir();
+  if (dir[0] != '/') {
+    dir = jalib::Filesystem::GetCWD() + "/" + dir;
+  }
+  string store = dir + "/" + CKPT_CHUNK_STORE_PREFIX +
+                 ProcessInfo::instance().hostname() + "_" + compId +
+                 CKPT_CHUNK_STORE_SUFFIX;
+  string index = string(SharedData::getTmpDir()) + "/dmtcpDedupIndex." +
+                 compId + "." +
+                 jalib::XToString(ProcessInfo::instance().get_generation());
+  JASSERT(store.length() < sizeof(hdr->dedupStore) &&
+          store.length() + strlen(".temp") < sizeof(storeTemp) &&
+          index.length() < sizeof(indexPath)) (store) (index);
+
+  strcpy(storeFinal, store.c_str());
+  strcpy(storeTemp, (store + ".temp").c_str());
+  strcpy(indexPath, index.c_str());
+
+  if (!openIndex()) {
+    return;
+  }
+
+  // Shared, so that the kernel does not merge it with a neighboring private
+  // mapping that must be written to the image.
+  scratch = (DedupScratch *)mmap(NULL, sizeof(DedupScratch),
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  JASSERT(scratch != MAP_FAILED) (JASSERT_ERRNO);
+
+  extentNext = extentEnd = 0;
+  batchLen = 0;
+  numChunks = numStored = 0;
+  enabled = true;
+  pendingCommit = true;
+  strcpy(hdr->dedupStore, storeFinal);
+  JTRACE("Deduplicating checkpoint image") (storeTemp) (indexPath);
+}
+
+bool
+CkptDedup::isEnabled()
+{
+  return enabled;
+}
+
+bool
+CkptDedup::isDedupMapping(const ProcMapsArea &area)
+{
+  return (indexMap != NULL && area.addr == indexMap) ||
+         (scratch != NULL && area.addr == (VA)scratch);
+}
+
+// Writes the pending new chunks to the store and publishes their slots.
+static void
+flushBatch()
+{
+  if (batchLen == 0) {
+    return;
+  }
+
+  pwriteAll(storeFd, batchSrc, batchLen * DMTCP_DEDUP_CHUNK_SIZE, batchOffset);
+  for (size_t i = 0; i < batchLen; i++) {
+    DedupSlot *slot = scratch->batchSlots[i];
+    if (slot != NULL) {
+      __atomic_store_n(&slot->ref,
+                       (batchOffset + i * DMTCP_DEDUP_CHUNK_SIZE) |
+                       DEDUP_SLOT_READY,
+                       __ATOMIC_RELEASE);
+    }
+  }
+  batchLen = 0;
+}
+
+// Adds a new chunk to the store and returns its offset.  'slot', if any, is
+// published once the chunk has been written.
+static uint64_t
+appendChunk(VA chunk, DedupSlot *slot)
+{
+  if (extentNext == extentEnd) {
+    flushBatch();
+    const uint64_t extentSize = DEDUP_EXTENT_CHUNKS * DMTCP_DEDUP_CHUNK_SIZE;
+    extentNext = __atomic_fetch_add(&indexHdr->storeSize, extentSize,
+                                    __ATOMIC_RELAXED);
+    extentEnd = extentNext + extentSize;
+  }
+  if (batchLen > 0 && chunk != batchSrc + batchLen * DMTCP_DEDUP_CHUNK_SIZE) {
+    flushBatch();
+  }
+  if (batchLen == 0) {
+    batchSrc = chunk;
+    batchOffset = extentNext;
+  }
+  scratch->batchSlots[batchLen++] = slot;
+
+  uint64_t offset = extentNext;
+  extentNext += DMTCP_DEDUP_CHUNK_SIZE;
+  numStored++;
+  return offset;
+}
+
+// Reads 'len' chunks of the store at 'offset' into scratch->verify.
+// Returns the number of whole chunks read.
+static size_t
+readChunks(uint64_t offset, size_t len)
+{
+  ssize_t rc;
+  do {
+    rc = pread(storeFd, scratch->verify, len * DMTCP_DEDUP_CHUNK_SIZE, offset);
+  } while (rc == -1 && errno == EINTR);
+  return rc > 0 ? (size_t)rc / DMTCP_DEDUP_CHUNK_SIZE : 0;
+}
+
+static bool
+chunkMatches(VA chunk, uint64_t offset)
+{
+  return readChunks(offset, 1) == 1 &&
+         memcmp(scratch->verify, chunk, DMTCP_DEDUP_CHUNK_SIZE) == 0;
+}
+
+// Returns the offset in the store of a chunk equal to 'chunk', adding it to
+// the store if there is none yet.  Probing starts at 'probe'.  A chunk found
+// by its hash is compared with the store right away if 'pending' is NULL;
+// otherwise, '*pending' is set to 1 + its probe, and the caller must compare
+// it with verifyChunks().
+static uint64_t
+storeChunk(VA chunk, int probe, uint8_t *pending)
+{
+  uint64_t hash = hashChunk(chunk);
+  uint64_t mask = DEDUP_INDEX_SLOTS - 1;
+
+  while (probe < DEDUP_MAX_PROBES) {
+    DedupSlot *slot = &slots[(hash + probe) & mask];
+    uint64_t ref = __atomic_load_n(&slot->ref, __ATOMIC_ACQUIRE);
+
+    if (ref == DEDUP_SLOT_EMPTY) {
+      if (__atomic_compare_exchange_n(&slot->ref, &ref, DEDUP_SLOT_BUSY,
+                                      false, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_ACQUIRE)) {
+        slot->hash = hash;
+        return appendChunk(chunk, slot);
+      }
+      continue;
+    }
+
+    if (ref == DEDUP_SLOT_BUSY) {
+      // The slot may be in our own batch.  Publishing it before waiting
+      // also keeps two processes from waiting for each other.
+      flushBatch();
+      int polls = 0;
+      while (__atomic_load_n(&slot->ref, __ATOMIC_ACQUIRE) == DEDUP_SLOT_BUSY) {
+        if (!pollPause(&polls)) {
+          return appendChunk(chunk, NULL);
+        }
+      }
+      continue;
+    }
+
+    uint64_t offset = ref & ~(uint64_t)DEDUP_SLOT_READY;
+    if (slot->hash == hash) {
+      if (pending != NULL) {
+        *pending = probe + 1;
+        return offset;
+      }
+      if (chunkMatches(chunk, offset)) {
+        return offset;
+      }
+    }
+    probe++;
+  }
+
+  return appendChunk(chunk, NULL);
+}
+
+// Compares the 'n' chunks at 'base' that storeChunk() found by their hash
+// with the store.  A process that shares much of its memory with another
+// finds runs of chunks that the other one stored one after the other; each
+// such run is read with a single pread() rather than one per chunk.  A chunk
+// that differs from the store is looked up again past the slot it matched.
+static void
+verifyChunks(VA base, size_t n)
+{
+  size_t i = 0;
+  while (i < n) {
+    if (scratch->probes[i] == 0) {
+      i++;
+      continue;
+    }
+
+    size_t len = 1;
+    while (i + len < n && len < DEDUP_VERIFY_CHUNKS &&
+           scratch->probes[i + len] != 0 &&
+           scratch->refs[i + len] ==
+           scratch->refs[i] + len * DMTCP_DEDUP_CHUNK_SIZE) {
+      len++;
+    }
+
+    size_t numRead = readChunks(scratch->refs[i], len);
+    for (size_t j = 0; j < len; j++) {
+      VA chunk = base + (i + j) * DMTCP_DEDUP_CHUNK_SIZE;
+      if (j >= numRead ||
+          memcmp(scratch->verify + j * DMTCP_DEDUP_CHUNK_SIZE, chunk,
+                 DMTCP_DEDUP_CHUNK_SIZE) != 0) {
+        scratch->refs[i + j] = storeChunk(chunk, scratch->probes[i + j], NULL);
+      }
+    }
+    i += len;
+  }
+}
+
+// Writes the non-zero pages of 'area', a child header, as DMTCP_DEDUP_PAGES
+// areas of up to DEDUP_REFS_PER_AREA chunks each.
+void
+CkptDedup::writePages(ProcMapsArea *area)
+{
+  JASSERT(area->size % DMTCP_DEDUP_CHUNK_SIZE == 0) (area->size);
+
+  VA addr = area->addr;
+  while (addr < area->endAddr) {
+    Area a = *area;
+    size_t n = MIN((size_t)(area->endAddr - addr) / DMTCP_DEDUP_CHUNK_SIZE,
+                   (size_t)DEDUP_REFS_PER_AREA);
+    a.addr = addr;
+    a.size = n * DMTCP_DEDUP_CHUNK_SIZE;
+    a.endAddr = a.addr + a.size;
+    a.properties |= DMTCP_DEDUP_PAGES;
+
+    for (size_t i = 0; i < n; i++) {
+      scratch->probes[i] = 0;
+      scratch->refs[i] = storeChunk(a.addr + i * DMTCP_DEDUP_CHUNK_SIZE, 0,
+                                    &scratch->probes[i]);
+    }
+    verifyChunks(a.addr, n);
+    numChunks += n;
+    // An image that refers to a chunk is only complete once the chunk is.
+    flushBatch();
+
+    CkptWriter::writeArea(&a, scratch->refs, n * sizeof(uint64_t));
+    CkptWriter::drain();
+    addr = a.endAddr;
+  }
+}
+
+// Called once the image has been written.
+void
+CkptDedup::finish()
+{
+  if (!enabled) {
+    return;
+  }
+
+  flushBatch();
+  JASSERT(fsync(storeFd) == 0) (storeTemp) (JASSERT_ERRNO)
+    .Text("fsync error on chunk store");
+  _real_close(storeFd);
+  storeFd = -1;
+
+  JTRACE("Deduplicated checkpoint image") (numChunks) (numStored);
+
+  JASSERT(munmap(indexMap, indexMapSize) == 0) (JASSERT_ERRNO);
+  JASSERT(munmap(scratch, sizeof(DedupScratch)) == 0) (JASSERT_ERRNO);
+  indexMap = NULL;
+  indexHdr = NULL;
+  slots = NULL;
+  scratch = NULL;
+  enabled = false;
+}
+
+// Called after the DMT:WriteCkpt barrier, before the image is renamed into
+// place.  The first process on this host to get here moves the store.
+void
+CkptDedup::commit()
+{
+  if (!pendingCommit) {
+    return;
+  }
+  pendingCommit = false;
+
+  JWARNING(unlink(indexPath) == 0 || errno == ENOENT) (indexPath)
+    (JASSERT_ERRNO);
+  if (rename(storeTemp, storeFinal) != 0) {
+    JASSERT(errno == ENOENT && jalib::Filesystem::FileExists(storeFinal))
+      (storeTemp) (storeFinal) (JASSERT_ERRNO)
+      .Text("Failed to move the chunk store into place");
+  }
+}
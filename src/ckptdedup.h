@@ -0,0 +1,65 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_DEDUP_H
+#define CKPT_DEDUP_H
+
+#include "dmtcp.h"
+#include "procmapsarea.h"
+
+// Deduplicated checkpoint images (DMTCP_CKPT_DEDUP=1).
+//
+// The processes of a computation that run on the same host share a chunk
+// store, <ckptdir>/ckpt_chunks_<host>_<compId>.chunks, that holds each
+// distinct DMTCP_DEDUP_CHUNK_SIZE chunk of their memory once: the non-zero
+// pages of anonymous memory, and mapped files that are written in whole
+// pages.  Such memory is written to the image as DMTCP_DEDUP_PAGES child
+// headers whose data is the offsets of their chunks in the store, and
+// mtcp_restart reads the chunks back from the store named by
+// DmtcpCkptHeader::dedupStore.
+//
+// The store is written under a temporary name during a checkpoint.  Its
+// index, a hash table from chunk hash to store offset, is a file in the
+// DMTCP tmpdir that all processes of the computation on this host map
+// shared, like the SharedData area; it is created by the first process to
+// get there and is specific to the checkpoint generation.  Slots are
+// claimed with compare-and-swap, and a claimed slot becomes visible to the
+// other processes once its chunk has been written.  A chunk is only reused
+// if it compares equal to the one in the store, so a hash collision costs a
+// copy of the chunk rather than a corrupted image.  Once every process has
+// written its image (the DMT:WriteCkpt barrier), the store is renamed into
+// place along with the images and the index is removed.
+//
+// The chunks are stored uncompressed, even if the images are gzipped.
+// Deduplication is not used for block-compressed images, for incremental,
+// forked or lazily restored checkpoints, or when images go to a
+// dmtcp_ckpt_server.
+
+namespace dmtcp
+{
+namespace CkptDedup
+{
+void prepare(DmtcpCkptHeader *hdr);
+bool isEnabled();
+bool isDedupMapping(const ProcMapsArea &area);
+void writePages(ProcMapsArea *area);
+void finish();
+void commit();
+}
+}
+#endif // ifndef CKPT_DEDUP_H
@@ -41,9 +41,16 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
+#include "ckptdedup.h"
 #include "ckptserializer.h"
+#include "ckptstore.h"
+#include "ckpttiming.h"
+#include "ckptwriter.h"
 #include "constants.h"
+#include "coordinatorapi.h"
 #include "dmtcp.h"
+#include "dmtcpworker.h"
+#include "incrementalckpt.h"
 #include "protectedfds.h"
 #include "syscallwrappers.h"
 #include "util.h"
@@ -93,7 +100,7 @@ prepare_sigchld_handler()
   sigaction(SIGCHLD, &default_sigchld_action, &saved_sigchld_action);
 }
 
-static void
+static int
 restore_sigchld_handler_and_wait_for_zombie(pid_t pid)
 {
   /* This is done to avoid calling the user SIGCHLD handler when gzip
@@ -111,13 +118,15 @@ restore_sigchld_handler_and_wait_for_zombie(pid_t pid)
    * with wait4 whether it already terminated or not yet.
    */
   sigset_t suspend_sigset;
+  int status = -1;
 
   sigfillset(&suspend_sigset);
   sigdelset(&suspend_sigset, SIGCHLD);
   _real_sigsuspend(&suspend_sigset);
-  JWARNING(_real_waitpid(pid, NULL, 0) != -1) (pid) (JASSERT_ERRNO);
+  JWARNING(_real_waitpid(pid, &status, 0) != -1) (pid) (JASSERT_ERRNO);
   pid = -1;
   sigaction(SIGCHLD, &saved_sigchld_action, NULL);
+  return status;
 }
 
 /*
@@ -198,17 +207,14 @@ perform_open_ckpt_image_fd(const char *tempCkptFilename,
 {
   *use_compression = false;  /* default value */
 
-  /* 1. Open fd to checkpoint image on disk */
-  /* Create temp checkpoint file and write magic number to it */
-  int flags = O_CREAT | O_TRUNC | O_WRONLY;
-  int fd = _real_open(tempCkptFilename, flags, 0600);
+  /* 1. Open fd to checkpoint image on disk, or to dmtcp_ckpt_server */
+  int fd = CkptStore::instance().create(tempCkptFilename);
   *fdCkptFileOnDisk = fd; /* if use_compression, fd will be reset to pipe */
-  JASSERT(fd != -1) (tempCkptFilename) (JASSERT_ERRNO)
-  .Text("Error creating file.");
 
-#ifdef FAST_RST_VIA_MMAP
-  return fd;
-#endif  // ifdef FAST_RST_VIA_MMAP
+  // Images for lazy restore are mapped by mtcp_restart; no compression.
+  if (CkptSerializer::useLazyRestore()) {
+    return fd;
+  }
 
   /* 2. Test if using GZIP compression */
   int use_gzip_compression = 0;
@@ -218,6 +224,11 @@ perform_open_ckpt_image_fd(const char *tempCkptFilename,
   use_gzip_compression = test_use_compression(const_cast<char *>("GZIP"),
                                               gzip_cmd, gzip_path, 1);
 
+  // The built-in block compression of CkptWriter takes the place of gzip.
+  if (CkptWriter::useBlockCompression()) {
+    use_gzip_compression = 0;
+  }
+
   /* 3. We now have the information to pipe to gzip, or directly to fd.
   *     We do it this way, so that gzip will be direct child of forked process
   *       when using forked checkpointing.
@@ -259,8 +270,8 @@ test_and_prepare_for_forked_ckpt()
   return 1;
 #endif  // ifdef TEST_FORKED_CHECKPOINTING
 
-  if (getenv(ENV_VAR_FORKED_CKPT) == NULL) {
-    return 0;
+  if (!DmtcpWorker::isForkedCkptRequested()) {
+    return FORKED_CKPT_FAILED;
   }
 
   /* Set SIGCHLD to our own handler;
@@ -274,17 +285,27 @@ test_and_prepare_for_forked_ckpt()
     .Text("Failed to do forked checkpointing, trying normal checkpoint");
     return FORKED_CKPT_FAILED;
   } else if (forked_cpid > 0) {
-    restore_sigchld_handler_and_wait_for_zombie(forked_cpid);
-    JTRACE("checkpoint complete\n");
+    /* The child exits as soon as the grandchild, which writes the image,
+     * is connected to the coordinator.  The coordinator then waits for the
+     * grandchild to report the image before it writes the restart script.
+     */
+    int status = restore_sigchld_handler_and_wait_for_zombie(forked_cpid);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      JWARNING(false) (status)
+      .Text("Failed to do forked checkpointing, trying normal checkpoint");
+      return FORKED_CKPT_FAILED;
+    }
+    JTRACE("checkpoint image is being written in the background");
     return FORKED_CKPT_PARENT;
   } else {
+    if (!CoordinatorAPI::connectBackgroundCkptWriter()) {
+      _exit(1);
+    }
     pid_t grandchild_pid = _real_sys_fork();
-    JWARNING(grandchild_pid != -1)
-    .Text("WARNING: Forked checkpoint failed, no checkpoint available");
-    if (grandchild_pid > 0) {
+    if (grandchild_pid != 0) {
       // Use _exit() instead of exit() to avoid popping atexit() handlers
       // registered by the parent process.
-      _exit(0); /* child exits */
+      _exit(grandchild_pid == -1 ? 1 : 0); /* child exits */
     }
 
     /* grandchild continues; no need now to waitpid() on grandchild */
@@ -356,9 +377,23 @@ open_ckpt_to_write(int fd, int pipe_fds[2], char **extcomp_args)
   return fd;
 }
 
+// True if the image of the current checkpoint is written by a forked process
+// (see test_and_prepare_for_forked_ckpt()).
+bool
+CkptSerializer::isForkedCkpt()
+{
+  return forked_ckpt_status == FORKED_CKPT_PARENT ||
+         forked_ckpt_status == FORKED_CKPT_CHILD;
+}
+
 void
 CkptSerializer::createCkptDir()
 {
+  // The image goes to dmtcp_ckpt_server; nothing is written locally.
+  if (!CkptStore::instance().isLocal()) {
+    return;
+  }
+
   string ckptDir = ProcessInfo::instance().getCkptDir();
 
   JASSERT(!ckptDir.empty());
@@ -375,6 +410,13 @@ CkptSerializer::createCkptDir()
 // 'dmtcp_restart'.  And then 'dmtcp_restart' execs into 'mtcp_restart'.
 // 'mtcp_restart inherits the fd, and then reads the second copy of
 // DmtcpCkptHdr.
+bool
+CkptSerializer::useLazyRestore()
+{
+  const char *str = getenv(ENV_VAR_LAZY_RESTORE);
+  return str != NULL && strcmp(str, "0") != 0;
+}
+
 void
 CkptSerializer::writeCkptImage(DmtcpCkptHeader ckptHdr,
                                const string& ckptFilename)
@@ -399,28 +441,48 @@ CkptSerializer::writeCkptImage(DmtcpCkptHeader ckptHdr,
   JASSERT(fdCkptFileOnDisk >= 0);
   JASSERT(use_compression || fd == fdCkptFileOnDisk);
 
+  /* mtcp_writememoryareas() closes fd, but the image must stay open until
+   * CkptStore::finish() has synced it to disk, or until dmtcp_ckpt_server
+   * confirms that it has stored it.
+   */
+  if (!use_compression) {
+    fd = _real_dup(fdCkptFileOnDisk);
+    JASSERT(fd != -1) (JASSERT_ERRNO);
+  }
+
+  IncrementalCkpt::prepare(&ckptHdr, use_compression);
+  CkptDedup::prepare(&ckptHdr);
+  ckptHdr.lazyRestore = useLazyRestore();
+
   // Write ckpt header twice. It's read once by dmtcp_restart and again by
   // mtcp_restart.
   JASSERT(Util::writeAll(fd, &ckptHdr, sizeof(ckptHdr)) == sizeof(ckptHdr));
   JASSERT(Util::writeAll(fd, &ckptHdr, sizeof(ckptHdr)) == sizeof(ckptHdr));
 
   JTRACE("MTCP is about to write checkpoint image.")(ckptFilename);
+  uint64_t start = CkptTiming::now();
   mtcp_writememoryareas(fd);
+  CkptTiming::record("write-memory", start);
 
   if (use_compression) {
     /* In perform_open_ckpt_image_fd(), we set SIGCHLD to our own handler.
      * Restore it now.
      */
+    start = CkptTiming::now();
     restore_sigchld_handler_and_wait_for_zombie(ckpt_extcomp_child_pid);
-
-    /* IF OUT OF DISK SPACE, REPORT IT HERE. */
-    JASSERT(fsync(fdCkptFileOnDisk) != -1) (JASSERT_ERRNO)
-    .Text("(compression): fsync error on checkpoint file");
-    JASSERT(_real_close(fdCkptFileOnDisk) == 0) (JASSERT_ERRNO)
-    .Text("(compression): error closing checkpoint file.");
+    CkptTiming::record("compression-wait", start);
   }
 
+  CkptStore::instance().finish(fdCkptFileOnDisk, ckptFilename);
+
   if (forked_ckpt_status == FORKED_CKPT_CHILD) {
+    /* The parent has resumed by now; it is up to us to put the image in
+     * place and to report it to the coordinator.
+     */
+    CkptStore::instance().rename(ckptFilename,
+                                 ProcessInfo::instance().getCkptFilename());
+    CoordinatorAPI::sendCkptFilename();
+
     // Use _exit() instead of exit() to avoid popping atexit() handlers
     // registered by the parent process.
     _exit(0); /* grandchild exits */
@@ -34,6 +34,8 @@ int openCkptFileToWrite(const string &path);
 void createCkptDir();
 void writeCkptImage(DmtcpCkptHeader ckptHdr,
                     const string& ckptFilename);
+bool isForkedCkpt();
+bool useLazyRestore();
 }
 }
 #endif // ifndef CKPT_SERIZLIZER_H
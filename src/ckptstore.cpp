@@ -0,0 +1,186 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../jalib/jconvert.h"
+#include "../jalib/jfilesystem.h"
+#include "../jalib/jsocket.h"
+#include "ckptstore.h"
+#include "ckpttiming.h"
+#include "constants.h"
+#include "jassert.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+// Images are files in the checkpoint directory.
+class LocalCkptStore : public CkptStore
+{
+  public:
+    virtual bool isLocal() const { return true; }
+
+    virtual int create(const string &path)
+    {
+      int fd = _real_open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+      JASSERT(fd != -1) (path) (JASSERT_ERRNO)
+      .Text("Error creating file.");
+      return fd;
+    }
+
+    virtual void finish(int fd, const string &path)
+    {
+      uint64_t start = CkptTiming::now();
+
+      /* IF OUT OF DISK SPACE, REPORT IT HERE. */
+      JASSERT(fsync(fd) != -1) (path) (JASSERT_ERRNO)
+      .Text("fsync error on checkpoint file");
+      CkptTiming::record("fsync", start);
+      JASSERT(_real_close(fd) == 0) (path) (JASSERT_ERRNO)
+      .Text("error closing checkpoint file.");
+    }
+
+    virtual void rename(const string &from, const string &to)
+    {
+      JASSERT(::rename(from.c_str(), to.c_str()) == 0) (JASSERT_ERRNO)
+        (from) (to);
+    }
+
+    virtual int openForRead(const string &path)
+    {
+      int fd = _real_open(path.c_str(), O_RDONLY);
+      JASSERT(fd >= 0) (path).Text("Failed to open file.");
+      return fd;
+    }
+};
+
+// Images are kept by a dmtcp_ckpt_server; see DMTCP_CKPT_SERVER.
+class ServerCkptStore : public CkptStore
+{
+  public:
+    virtual bool isLocal() const { return false; }
+
+    virtual int create(const string &path)
+    {
+      return sendRequest(CKPT_SERVER_PUT, path);
+    }
+
+    virtual void finish(int fd, const string &path)
+    {
+      uint64_t start = CkptTiming::now();
+
+      // The server replies once it has seen the end of the image.
+      JASSERT(shutdown(fd, SHUT_WR) == 0) (path) (JASSERT_ERRNO);
+      readReply(fd, path, "Failed to store checkpoint image");
+      CkptTiming::record("store-commit", start);
+      _real_close(fd);
+    }
+
+    virtual void rename(const string &from, const string &to)
+    {
+      int sock = sendRequest(CKPT_SERVER_RENAME, from, to);
+      readReply(sock, from, "Failed to rename checkpoint image");
+      _real_close(sock);
+    }
+
+    virtual int openForRead(const string &path)
+    {
+      int sock = sendRequest(CKPT_SERVER_GET, path);
+      readReply(sock, path, "Failed to read checkpoint image");
+      return sock;
+    }
+
+  private:
+    static void serverAddress(string *host, int *port)
+    {
+      string server = getenv(ENV_VAR_CKPT_SERVER);
+      size_t colon = server.rfind(':');
+      if (colon == string::npos) {
+        *host = server;
+        *port = DEFAULT_CKPT_SERVER_PORT;
+      } else {
+        *host = server.substr(0, colon);
+        *port = jalib::StringToInt(server.substr(colon + 1));
+      }
+    }
+
+    static void writeString(int sock, const string &str)
+    {
+      JASSERT(Util::writeAll(sock, str.c_str(), str.length()) ==
+              (ssize_t)str.length()) (JASSERT_ERRNO);
+    }
+
+    // Only the basenames are sent; the server picks the directory.
+    static int sendRequest(uint32_t op, const string &path,
+                           const string &newPath = "")
+    {
+      string host;
+      int port;
+      serverAddress(&host, &port);
+
+      string name = jalib::Filesystem::BaseName(path);
+      string newName;
+      if (!newPath.empty()) {
+        newName = jalib::Filesystem::BaseName(newPath);
+      }
+
+      int sock = jalib::JClientSocket(host.c_str(), port).sockfd();
+      JASSERT(sock != -1) (host) (port) (JASSERT_ERRNO)
+      .Text("Failed to connect to dmtcp_ckpt_server");
+
+      CkptServerRequest req;
+      memset(&req, 0, sizeof(req));
+      strcpy(req.magic, CKPT_SERVER_MAGIC);
+      req.op = op;
+      req.nameLen = name.length();
+      req.newNameLen = newName.length();
+      JASSERT(Util::writeAll(sock, &req, sizeof(req)) == sizeof(req))
+        (host) (port) (JASSERT_ERRNO);
+      writeString(sock, name);
+      writeString(sock, newName);
+      return sock;
+    }
+
+    static void readReply(int sock, const string &path, const char *msg)
+    {
+      CkptServerReply reply;
+      if (Util::readAll(sock, &reply, sizeof(reply)) != sizeof(reply)) {
+        reply.status = EIO;
+      }
+      errno = reply.status;
+      JASSERT(reply.status == 0) (path) (JASSERT_ERRNO).Text(msg);
+    }
+};
+
+static LocalCkptStore localStore;
+static ServerCkptStore serverStore;
+
+CkptStore &
+CkptStore::instance()
+{
+  const char *server = getenv(ENV_VAR_CKPT_SERVER);
+  if (server != NULL && server[0] != '\0') {
+    return serverStore;
+  }
+  return localStore;
+}
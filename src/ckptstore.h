@@ -0,0 +1,83 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_STORE_H
+#define CKPT_STORE_H
+
+#include <stdint.h>
+#include "dmtcpalloc.h"
+
+// Where checkpoint images are written to and read back from.
+//
+// By default, images are files in the checkpoint directory.  If
+// DMTCP_CKPT_SERVER=HOST[:PORT] is set (dmtcp_launch/dmtcp_restart
+// --ckpt-server), images are streamed over TCP to a dmtcp_ckpt_server
+// instead, which stores them under its own checkpoint directory.  Only the
+// basename of an image path is sent to the server, so the restart script and
+// dmtcp_restart keep using the usual paths.
+//
+// An image is written sequentially to the fd returned by create(), possibly
+// through gzip.  It is complete once finish() returns, and it replaces the
+// previous image when rename() moves it from its temporary name into place.
+// openForRead() returns an fd positioned at the start of the (possibly
+// gzipped) image; a socket cannot be rewound.
+
+namespace dmtcp
+{
+class CkptStore
+{
+  public:
+    static CkptStore &instance();
+
+    virtual ~CkptStore() {}
+
+    virtual bool isLocal() const = 0;
+    virtual int create(const string &path) = 0;
+    virtual void finish(int fd, const string &path) = 0;
+    virtual void rename(const string &from, const string &to) = 0;
+    virtual int openForRead(const string &path) = 0;
+};
+
+// Wire format of dmtcp_ckpt_server.  Each connection carries one request,
+// followed by the image name (and, for a rename, the new name).
+//  PUT:    the client sends the image and shuts down its side of the
+//          connection; the server replies once the image is on disk.
+//  GET:    the server replies, and on success sends the image and closes.
+//  RENAME: the server replies once the image was renamed.
+#define CKPT_SERVER_MAGIC "DMTCP_CKPT_SRV1"
+
+enum CkptServerOp {
+  CKPT_SERVER_PUT = 1,
+  CKPT_SERVER_GET,
+  CKPT_SERVER_RENAME
+};
+
+typedef struct CkptServerRequest {
+  char magic[16];
+  uint32_t op;
+  uint32_t nameLen;
+  uint32_t newNameLen;
+  uint32_t padding;
+} CkptServerRequest;
+
+typedef struct CkptServerReply {
+  int32_t status; // 0 or an errno value.
+  int32_t padding;
+} CkptServerReply;
+}
+#endif // ifndef CKPT_STORE_H
@@ -0,0 +1,108 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include "ckpttiming.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "jassert.h"
+
+using namespace dmtcp;
+
+#define MAX_PHASES     128
+#define MAX_PHASE_NAME 64
+
+struct Phase {
+  char name[MAX_PHASE_NAME];
+  uint64_t ns;
+};
+
+static Phase phases[MAX_PHASES];
+static size_t numPhases = 0;
+static uint64_t startTime = 0;
+
+uint64_t
+CkptTiming::now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+CkptTiming::reset()
+{
+  numPhases = 0;
+  startTime = now();
+}
+
+void
+CkptTiming::add(const char *phase, uint64_t ns)
+{
+  for (size_t i = 0; i < numPhases; i++) {
+    if (strcmp(phases[i].name, phase) == 0) {
+      phases[i].ns += ns;
+      return;
+    }
+  }
+
+  if (numPhases == MAX_PHASES) {
+    JTRACE("Too many checkpoint phases; not recording") (phase);
+    return;
+  }
+
+  // Names are truncated; they only label the phase.
+  snprintf(phases[numPhases].name, MAX_PHASE_NAME, "%s", phase);
+  phases[numPhases].ns = ns;
+  numPhases++;
+}
+
+void
+CkptTiming::record(const char *phase, uint64_t startNs)
+{
+  add(phase, now() - startNs);
+}
+
+void
+CkptTiming::record(const char *kind, const char *name, uint64_t startNs)
+{
+  char phase[MAX_PHASE_NAME];
+
+  snprintf(phase, sizeof(phase), "%s/%s", kind, name);
+  record(phase, startNs);
+}
+
+// The phases in the order in which they first occurred, then the time since
+// reset() as "total".
+string
+CkptTiming::toString()
+{
+  char line[MAX_PHASE_NAME + 32];
+  string str;
+
+  for (size_t i = 0; i < numPhases; i++) {
+    snprintf(line, sizeof(line), "%s %llu\n", phases[i].name,
+             (unsigned long long)phases[i].ns);
+    str += line;
+  }
+  snprintf(line, sizeof(line), "total %llu\n",
+           (unsigned long long)(now() - startTime));
+  str += line;
+  return str;
+}
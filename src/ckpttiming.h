@@ -0,0 +1,54 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_TIMING_H
+#define CKPT_TIMING_H
+
+#include <stdint.h>
+#include "dmtcpalloc.h"
+
+// Per-phase timing of a checkpoint or a restart of this process.
+//
+// The checkpoint thread records how long each phase takes: suspending the user
+// threads, the PRESUSPEND, PRECHECKPOINT and RESTART handlers of each plugin
+// ("precheckpoint/<plugin>"), each barrier ("barrier/<name>"), writing the
+// memory, waiting for the compression process, and syncing the image ("fsync")
+// or waiting for dmtcp_ckpt_server to store it ("store-commit").  A phase that
+// occurs more than once adds up.  The phases are reset when a checkpoint
+// request arrives and when the process restarts, and are sent to the
+// coordinator along with DMT_CKPT_FILENAME, or with DMT_WORKER_RESUMING after a
+// restart, as "<phase> <nanoseconds>" lines, the last of which, "total", is the
+// time since the reset.  The coordinator summarizes them across processes;
+// see TimingReport.
+//
+// The phases are kept in a fixed-size table, so that they can be recorded
+// while memory is being written.  Only the checkpoint thread records them.
+
+namespace dmtcp
+{
+namespace CkptTiming
+{
+uint64_t now();
+void reset();
+void record(const char *phase, uint64_t startNs);
+void record(const char *kind, const char *name, uint64_t startNs);
+void add(const char *phase, uint64_t ns);
+string toString();
+}
+}
+#endif // ifndef CKPT_TIMING_H
@@ -0,0 +1,736 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "blockcompress.h"
+#include "ckptserializer.h"
+#include "ckptwriter.h"
+#include "constants.h"
+#include "crc32c.h"
+#include "futex.h"
+#include "jassert.h"
+#include "mtcp/mtcp_sys.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+#define MAX_WRITER_THREADS       64
+#define WRITER_STACK_SIZE        (256 * 1024)
+#define WRITER_JOB_RING_SIZE     4096
+
+// Writes of at most this size (area headers, small payloads) are done inline
+// by the checkpoint thread.  Larger payloads are split into chunks of at most
+// WRITER_CHUNK_SIZE bytes so that one big area is spread over all helpers.
+#define WRITER_INLINE_THRESHOLD  (64 * 1024)
+#define WRITER_CHUNK_SIZE        (64 * 1024 * 1024)
+
+// Uncompressed payloads are copied through a buffer of this size per thread;
+// see writeJob().
+#define WRITER_BOUNCE_SIZE       (1024 * 1024)
+
+// Capacity of the area index.  Only the pages that are used get allocated.
+#define WRITER_MAX_INDEX_ENTRIES (1024 * 1024)
+
+typedef struct WriteJob {
+  const char *buf;
+  size_t len;
+  off_t offset;
+  char *out;          // Compression output buffer; NULL for a pwrite() job.
+  uint32_t outLen;    // Size of the block as stored (see writeBlock()).
+  uint32_t done;      // Set once the output of a compression job is ready.
+  uint32_t busy;      // Set while the slot holds a job not yet picked up.
+  uint32_t crcFactor; // See payloadCrc().
+  uint32_t *crc;      // Checksum state of the payload; NULL if none.
+} WriteJob;
+
+// Everything shared with the helper threads lives in the arena, so that none
+// of it ends up in the checkpoint image.  The arena holds this header, the
+// area index, the bounce buffers (if not compressing), the compression hash
+// tables and output buffers (if compressing), and the stacks of the helper
+// threads, in that order.
+typedef struct WriterArenaHeader {
+  uint32_t published;  // Number of jobs handed out by the checkpoint thread.
+  uint32_t claimed;    // Number of jobs claimed by helper threads.
+  uint32_t completed;  // Number of jobs fully written.
+  uint32_t stopping;
+  int32_t ioErrno;     // First errno seen by a helper thread; 0 if none.
+  pid_t helperTids[MAX_WRITER_THREADS];
+  WriteJob jobs[WRITER_JOB_RING_SIZE];
+} WriterArenaHeader;
+
+static int ckptFd = -1;
+static int numHelpers = 0;
+static bool compressing = false;
+static off_t curOffset = 0;  // Offset in the image of the next byte written.
+static char *arena = NULL;
+static size_t arenaSize = 0;
+static WriterArenaHeader *shared = NULL;
+
+// The area index; see CkptIndexEntry in include/procmapsarea.h.
+static CkptIndexEntry *areaIndex = NULL;
+static size_t numIndexEntries = 0;
+static bool indexOverflow = false;
+
+// Bounce buffer 0 belongs to the checkpoint thread and buffer i + 1 to
+// helper i.
+static char *bounceBufs = NULL;
+
+// Compression state.  Hash table 0 belongs to the checkpoint thread and table
+// i + 1 to helper i.  Job n uses output buffer n % numOutBufs; blocks are
+// written out in job order, and 'consumed' counts the ones written so far.
+static uint32_t *hashTables = NULL;
+static char *outBufs = NULL;
+static uint32_t numOutBufs = 0;
+static uint32_t consumed = 0;
+
+bool
+CkptWriter::useBlockCompression()
+{
+  const char *str = getenv(ENV_VAR_BLOCK_COMPRESSION);
+  return str != NULL && strcmp(str, "0") != 0 &&
+         !CkptSerializer::useLazyRestore();
+}
+
+static int
+numWriterThreads()
+{
+  const char *str = getenv(ENV_VAR_CKPT_WRITER_THREADS);
+  if (str == NULL) {
+    return 0;
+  }
+
+  int n = atoi(str);
+  if (n > MAX_WRITER_THREADS) {
+    JWARNING(false) (n) (MAX_WRITER_THREADS)
+      .Text("Too many checkpoint writer threads requested; using the maximum");
+    n = MAX_WRITER_THREADS;
+  }
+  return n;
+}
+
+// While the image is written, CkptIndexEntry::dataCrc32c holds the CRC32C
+// state of the payload without the initial and final inversion.  That state
+// is linear in the data, so the helper threads checksum their chunks
+// separately and XOR them in, each multiplied by crcFactor, i.e., shifted
+// past the rest of the payload.  finishIndex() turns the state into the
+// CRC32C of the payload.
+static uint32_t
+crcState(uint32_t state, const void *buf, size_t len)
+{
+  return ~crc32c_update(~state, buf, len);
+}
+
+static uint32_t
+payloadCrc(uint32_t state, size_t len)
+{
+  return ~(crc32c_multmodp(crc32c_shift_factor(len), ~0U) ^ state);
+}
+
+// The helper threads are cloned without CLONE_SETTLS, and so share the TLS of
+// the checkpoint thread, errno included.  They make their system calls
+// inline, as in mtcp_sys.h: a failed call returns -errno, and errno is left
+// alone.  Besides that, they use only memcpy() and the compression and
+// checksum code, and never JASSERT/JTRACE.  Where mtcp_sys.h has no
+// INTERNAL_SYSCALL, the checkpoint thread writes the image by itself.
+#ifdef INTERNAL_SYSCALL
+# define WRITER_HAS_HELPERS 1
+# define writer_syscall(name, nr, args ...) INTERNAL_SYSCALL(name, , nr, args)
+#else
+# define WRITER_HAS_HELPERS 0
+# define writer_syscall(name, nr, args ...) (-ENOSYS)
+#endif
+
+static inline void
+helperFutexWait(uint32_t *uaddr, uint32_t old_val)
+{
+  writer_syscall(futex, 4, uaddr, FUTEX_WAIT, old_val, NULL);
+}
+
+static inline void
+helperFutexWake(uint32_t *uaddr, uint32_t num)
+{
+  writer_syscall(futex, 4, uaddr, FUTEX_WAKE, num, NULL);
+}
+
+static inline long
+helperPwrite(const char *buf, size_t len, off_t offset)
+{
+#ifdef __i386__
+  uint64_t pos = (uint64_t)offset;
+  return writer_syscall(pwrite64, 5, ckptFd, buf, len,
+                        (long)(pos & 0xffffffff), (long)(pos >> 32));
+#else
+  return writer_syscall(pwrite64, 4, ckptFd, buf, len, offset);
+#endif
+}
+
+// Also used by the checkpoint thread, for small jobs; see writeRaw().
+static bool
+pwriteAll(const char *buf, size_t len, off_t offset)
+{
+  while (len > 0) {
+    long rc = helperPwrite(buf, len, offset);
+    if (rc == -EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      int err = (rc == 0) ? EIO : -rc;
+      int32_t noErr = 0;
+      __atomic_compare_exchange_n(&shared->ioErrno, &noErr, err, false,
+                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return false;
+    }
+    buf += rc;
+    len -= rc;
+    offset += rc;
+  }
+  return true;
+}
+
+// The memory being written may still change: DMTCP itself keeps running, and
+// shared memory may be written by processes outside of the computation.  So a
+// payload is copied to a bounce buffer, and the copy is checksummed and
+// written, for the checksum to match what ends up in the image.
+static void
+writeJob(const WriteJob *job, char *bounce)
+{
+  if (job->crc == NULL) {
+    pwriteAll(job->buf, job->len, job->offset);
+    return;
+  }
+
+  uint32_t state = 0;
+  for (size_t done = 0; done < job->len; ) {
+    size_t n = MIN(job->len - done, (size_t)WRITER_BOUNCE_SIZE);
+    memcpy(bounce, job->buf + done, n);
+    state = crcState(state, bounce, n);
+    if (!pwriteAll(bounce, n, job->offset + done)) {
+      return;
+    }
+    done += n;
+  }
+  __atomic_fetch_xor(job->crc, crc32c_multmodp(job->crcFactor, state),
+                     __ATOMIC_RELAXED);
+}
+
+// Returns the compressed size, or 0 if the block is to be stored as is.
+static uint32_t
+compressBlock(const char *buf, size_t len, char *out, uint32_t *table)
+{
+  return block_compress((const uint8_t *)buf, len, (uint8_t *)out, len - 1,
+                        table);
+}
+
+// Leaves the block as it is to be stored in 'out', and returns its size.  A
+// block that does not shrink is copied as is, for the same reason as in
+// writeJob().
+static uint32_t
+prepareBlock(const char *buf, size_t len, char *out, uint32_t *table)
+{
+  uint32_t outLen = compressBlock(buf, len, out, table);
+  if (outLen == 0) {
+    memcpy(out, buf, len);
+    outLen = len;
+  }
+  return outLen;
+}
+
+static int
+writerThread(void *arg)
+{
+  uint32_t *table = NULL;
+  char *bounce = NULL;
+  if (hashTables != NULL) {
+    table = hashTables + ((long)arg + 1) * BLOCK_COMPRESS_HASH_ENTRIES;
+  }
+  if (bounceBufs != NULL) {
+    bounce = bounceBufs + ((long)arg + 1) * WRITER_BOUNCE_SIZE;
+  }
+
+  while (1) {
+    uint32_t idx = __atomic_fetch_add(&shared->claimed, 1, __ATOMIC_SEQ_CST);
+
+    uint32_t published;
+    while (idx >= (published = __atomic_load_n(&shared->published,
+                                               __ATOMIC_ACQUIRE))) {
+      if (__atomic_load_n(&shared->stopping, __ATOMIC_ACQUIRE)) {
+        return 0;
+      }
+      helperFutexWait(&shared->published, published);
+    }
+
+    // Copy the job out and release the slot right away; jobs complete out
+    // of order, so the checkpoint thread reuses slots based on this flag.
+    WriteJob *slot = &shared->jobs[idx % WRITER_JOB_RING_SIZE];
+    WriteJob job = *slot;
+    __atomic_store_n(&slot->busy, 0, __ATOMIC_RELEASE);
+    helperFutexWake(&slot->busy, 1);
+
+    if (job.out != NULL) {
+      // The slot stays ours until the checkpoint thread has written out the
+      // result.
+      slot->outLen = prepareBlock(job.buf, job.len, job.out, table);
+      __atomic_store_n(&slot->done, 1, __ATOMIC_RELEASE);
+      helperFutexWake(&slot->done, 1);
+    } else {
+      writeJob(&job, bounce);
+    }
+
+    __atomic_fetch_add(&shared->completed, 1, __ATOMIC_RELEASE);
+    helperFutexWake(&shared->completed, 1);
+  }
+  return 0;
+}
+
+static void
+waitForCompletedJobs(uint32_t target)
+{
+  uint32_t completed;
+  while ((completed = __atomic_load_n(&shared->completed, __ATOMIC_ACQUIRE))
+         < target) {
+    futex_wait(&shared->completed, completed);
+  }
+}
+
+static void
+publishJob(const char *buf, size_t len, char *out, uint32_t *crc,
+           uint32_t crcFactor)
+{
+  uint32_t idx = shared->published;
+  WriteJob *job = &shared->jobs[idx % WRITER_JOB_RING_SIZE];
+
+  // Wait for the slot to be picked up if the ring is full.
+  while (__atomic_load_n(&job->busy, __ATOMIC_ACQUIRE)) {
+    futex_wait(&job->busy, 1);
+  }
+
+  job->buf = buf;
+  job->len = len;
+  job->offset = curOffset;
+  job->out = out;
+  job->outLen = 0;
+  job->done = 0;
+  job->crc = crc;
+  job->crcFactor = crcFactor;
+  job->busy = 1;
+  if (out == NULL) {
+    // The output of a compression job is written by writeOldestBlock().
+    curOffset += len;
+  }
+
+  __atomic_store_n(&shared->published, idx + 1, __ATOMIC_RELEASE);
+  futex_wake(&shared->published, 1);
+}
+
+static void
+writeAll(const void *buf, size_t len)
+{
+  JASSERT(Util::writeAll(ckptFd, buf, len) == (ssize_t)len)
+    .Text("writeAll failed during ckpt");
+  curOffset += len;
+}
+
+static void
+writeBlock(size_t rawLen, const char *out, uint32_t outLen, uint32_t *crc)
+{
+  BlockCompressHeader hdr;
+  hdr.rawSize = rawLen;
+  hdr.compSize = outLen;
+  if (crc != NULL) {
+    *crc = crcState(*crc, &hdr, sizeof(hdr));
+    *crc = crcState(*crc, out, outLen);
+  }
+  writeAll(&hdr, sizeof(hdr));
+  writeAll(out, outLen);
+}
+
+static void
+writeOldestBlock()
+{
+  WriteJob *job = &shared->jobs[consumed % WRITER_JOB_RING_SIZE];
+  while (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+    futex_wait(&job->done, 0);
+  }
+  writeBlock(job->len, job->out, job->outLen, job->crc);
+  job->done = 0;
+  consumed++;
+}
+
+static void
+flushBlocks()
+{
+  while (consumed != shared->published) {
+    writeOldestBlock();
+  }
+}
+
+void
+CkptWriter::init(int fd, off_t offset)
+{
+  ckptFd = fd;
+  curOffset = offset;
+  numHelpers = 0;
+  shared = NULL;
+  consumed = 0;
+  numIndexEntries = 0;
+  indexOverflow = false;
+  compressing = useBlockCompression();
+
+  int n = WRITER_HAS_HELPERS ? numWriterThreads() : 0;
+  if (compressing) {
+    // Without helpers, the checkpoint thread compresses the blocks itself.
+    n = (n <= 1) ? 0 : n;
+  } else if (n <= 1) {
+    n = 0;
+  } else {
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1 || !S_ISREG(statbuf.st_mode)) {
+      JTRACE("Checkpoint fd is not a regular file (compression enabled?); "
+             "using a single writer thread.") (n);
+      n = 0;
+    } else {
+      curOffset = lseek(fd, 0, SEEK_CUR);
+      JASSERT(curOffset != -1) (JASSERT_ERRNO);
+    }
+  }
+
+  size_t headerSize = CEIL(sizeof(WriterArenaHeader), Util::pageSize());
+  size_t indexSize = CEIL(WRITER_MAX_INDEX_ENTRIES * sizeof(CkptIndexEntry),
+                          Util::pageSize());
+  size_t bounceSize = 0;
+  size_t tablesSize = 0;
+  numOutBufs = 0;
+  if (compressing) {
+    tablesSize = CEIL((n + 1) * BLOCK_COMPRESS_HASH_ENTRIES * sizeof(uint32_t),
+                      Util::pageSize());
+    numOutBufs = MAX(2 * n, 1);
+  } else {
+    bounceSize = (size_t)(n + 1) * WRITER_BOUNCE_SIZE;
+  }
+  size_t outBufsSize = (size_t)numOutBufs * BLOCK_COMPRESS_BLOCK_SIZE;
+
+  // A shared anonymous mapping is never merged with its neighbors, so the
+  // arena shows up as a separate entry in /proc/self/maps.
+  arenaSize = headerSize + indexSize + bounceSize + tablesSize + outBufsSize +
+              n * WRITER_STACK_SIZE;
+  arena = (char *)mmap(NULL, arenaSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (arena == MAP_FAILED) {
+    JWARNING(false) (JASSERT_ERRNO)
+      .Text("Failed to allocate checkpoint writer arena; writing an "
+            "uncompressed image without an area index with a single thread.");
+    arena = NULL;
+    compressing = false;
+    return;
+  }
+  shared = (WriterArenaHeader *)arena;
+  areaIndex = (CkptIndexEntry *)(arena + headerSize);
+  bounceBufs = bounceSize > 0 ? arena + headerSize + indexSize : NULL;
+  hashTables = (uint32_t *)(arena + headerSize + indexSize + bounceSize);
+  outBufs = arena + headerSize + indexSize + bounceSize + tablesSize;
+
+  char *stacks = outBufs + outBufsSize;
+  int flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM |
+              CLONE_SIGHAND | CLONE_THREAD | CLONE_CHILD_CLEARTID;
+  for (int i = 0; i < n; i++) {
+    char *stackTop = stacks + (i + 1) * WRITER_STACK_SIZE;
+    shared->helperTids[i] = -1;
+    pid_t tid = _real_clone(writerThread, stackTop, flags, (void *)(long)i,
+                            NULL, NULL, &shared->helperTids[i]);
+    if (tid == -1) {
+      JWARNING(false) (i) (JASSERT_ERRNO)
+        .Text("Failed to create checkpoint writer thread.");
+      shared->helperTids[i] = 0;
+      break;
+    }
+    // The kernel clears helperTids[i] on thread exit (CLONE_CHILD_CLEARTID).
+    __atomic_store_n(&shared->helperTids[i], tid, __ATOMIC_RELEASE);
+    numHelpers++;
+  }
+
+  JTRACE("Using checkpoint writer threads")
+    (numHelpers) (compressing) (curOffset);
+}
+
+// Pending compressed blocks precede anything written next, so they are
+// flushed first.
+static off_t
+currentOffset()
+{
+  if (compressing) {
+    flushBlocks();
+  }
+  return curOffset;
+}
+
+// Writes data that needs no checksum of its own: area headers, the index.
+static void
+writeRaw(const void *buf, size_t len)
+{
+  if (compressing) {
+    // Pending blocks precede this data in the image.
+    flushBlocks();
+    writeAll(buf, len);
+    return;
+  }
+
+  if (numHelpers == 0) {
+    writeAll(buf, len);
+    return;
+  }
+
+  if (len <= WRITER_INLINE_THRESHOLD) {
+    WriteJob job = { (const char *)buf, len, curOffset, NULL };
+    writeJob(&job, NULL);
+    curOffset += len;
+    return;
+  }
+
+  const char *ptr = (const char *)buf;
+  while (len > 0) {
+    size_t chunk = MIN(len, (size_t)WRITER_CHUNK_SIZE);
+    publishJob(ptr, chunk, NULL, NULL, 0);
+    ptr += chunk;
+    len -= chunk;
+  }
+}
+
+// Writes 'buf' as a sequence of compressed blocks.
+static void
+writeCompressed(const char *buf, size_t len, uint32_t *crc)
+{
+  while (len > 0) {
+    size_t blockLen = MIN(len, (size_t)BLOCK_COMPRESS_BLOCK_SIZE);
+    if (numHelpers == 0) {
+      writeBlock(blockLen, outBufs,
+                 prepareBlock(buf, blockLen, outBufs, hashTables), crc);
+    } else {
+      // Free up the output buffer of the oldest job if all are in use.
+      if (shared->published - consumed == numOutBufs) {
+        writeOldestBlock();
+      }
+      uint32_t idx = shared->published % numOutBufs;
+      publishJob(buf, blockLen, outBufs + idx * BLOCK_COMPRESS_BLOCK_SIZE,
+                 crc, 0);
+    }
+    buf += blockLen;
+    len -= blockLen;
+  }
+}
+
+// Writes the data of an area, and accumulates its checksum in *crc (see
+// crcState()).
+static void
+writePayload(const char *buf, size_t len, uint32_t *crc)
+{
+  if (crc == NULL) {
+    // No arena, or no room left in the index.
+    writeRaw(buf, len);
+  } else if (compressing) {
+    writeCompressed(buf, len, crc);
+  } else if (numHelpers == 0) {
+    while (len > 0) {
+      size_t n = MIN(len, (size_t)WRITER_BOUNCE_SIZE);
+      memcpy(bounceBufs, buf, n);
+      *crc = crcState(*crc, bounceBufs, n);
+      writeAll(bounceBufs, n);
+      buf += n;
+      len -= n;
+    }
+  } else if (len <= WRITER_INLINE_THRESHOLD) {
+    WriteJob job = { buf, len, curOffset, NULL };
+    job.crc = crc;
+    job.crcFactor = crc32c_shift_factor(0);
+    writeJob(&job, bounceBufs);
+    curOffset += len;
+  } else {
+    while (len > 0) {
+      size_t chunk = MIN(len, (size_t)WRITER_CHUNK_SIZE);
+      publishJob(buf, chunk, NULL, crc, crc32c_shift_factor(len - chunk));
+      buf += chunk;
+      len -= chunk;
+    }
+  }
+}
+
+static CkptIndexEntry *
+addIndexEntry(const Area *area, off_t offset, size_t dataSize)
+{
+  if (shared == NULL || indexOverflow) {
+    return NULL;
+  }
+  if (numIndexEntries == WRITER_MAX_INDEX_ENTRIES) {
+    JWARNING(false) (numIndexEntries)
+      .Text("Too many memory areas; writing the image without an index.");
+    indexOverflow = true;
+    return NULL;
+  }
+
+  CkptIndexEntry *entry = &areaIndex[numIndexEntries++];
+  memset(entry, 0, sizeof(*entry));
+  entry->addr = (uint64_t)area->addr;
+  entry->endAddr = (uint64_t)area->endAddr;
+  entry->offset = offset;
+  entry->dataSize = dataSize;
+  entry->properties = area->properties;
+  entry->prot = area->prot;
+  entry->flags = area->flags;
+  return entry;
+}
+
+// Writes the header of an area followed by the first 'len' bytes of its
+// memory, compressing the memory if block compression is enabled.
+void
+CkptWriter::writeArea(Area *area, size_t len)
+{
+  writeArea(area, area->addr, len);
+}
+
+// Same, but the 'len' bytes following the header are taken from 'data'.
+// They may still be read after this returns; see drain().
+void
+CkptWriter::writeArea(Area *area, const void *data, size_t len)
+{
+  if (compressing && len > 0) {
+    area->properties |= DMTCP_BLOCK_COMPRESSED;
+  }
+  area->headerCrc32c = area_header_crc32c(area);
+
+  CkptIndexEntry *entry = addIndexEntry(area, currentOffset(), len);
+  writeRaw(area, sizeof(*area));
+  if (len > 0) {
+    writePayload((const char *)data, len,
+                 entry != NULL ? &entry->dataCrc32c : NULL);
+  }
+}
+
+// Waits until every payload handed out so far has been written.  Callers use
+// this before changing the protection of a memory area that is still queued,
+// or before reusing a buffer passed to writeArea().
+void
+CkptWriter::drain()
+{
+  if (numHelpers == 0) {
+    return;
+  }
+  if (compressing) {
+    flushBlocks();
+  } else {
+    waitForCompletedJobs(shared->published);
+  }
+}
+
+// Writes the last area header, followed by the index and its trailer (see
+// CKPT_INDEX_INCOMPLETE).  Every payload must have been written.
+static void
+writeEndOfImage()
+{
+  Area area;
+  memset(&area, 0, sizeof(area));
+  area.addr = NULL; // End of data
+  area.size = -1; // End of data
+  area.headerCrc32c = area_header_crc32c(&area);
+
+  off_t endOfAreas = currentOffset();
+  writeRaw(&area, sizeof(area));
+
+  CkptIndexTrailer trailer;
+  memset(&trailer, 0, sizeof(trailer));
+  strcpy(trailer.magic, CKPT_INDEX_MAGIC);
+  trailer.indexOffset = endOfAreas + sizeof(area);
+  if (shared == NULL || indexOverflow) {
+    trailer.flags = CKPT_INDEX_INCOMPLETE;
+    writeRaw(&trailer, sizeof(trailer));
+    return;
+  }
+  trailer.numEntries = numIndexEntries;
+
+  for (size_t i = 0; i < numIndexEntries; i++) {
+    CkptIndexEntry *entry = &areaIndex[i];
+    off_t next = (i + 1 < numIndexEntries) ? areaIndex[i + 1].offset
+                                           : endOfAreas;
+    entry->storedSize = next - entry->offset - sizeof(Area);
+    entry->dataCrc32c = payloadCrc(entry->dataCrc32c, entry->storedSize);
+    trailer.payloadCrc32c = crc32c_combine(trailer.payloadCrc32c,
+                                           entry->dataCrc32c,
+                                           entry->storedSize);
+  }
+  trailer.indexCrc32c = crc32c(areaIndex,
+                               numIndexEntries * sizeof(CkptIndexEntry));
+
+  writeRaw(areaIndex, numIndexEntries * sizeof(CkptIndexEntry));
+  writeRaw(&trailer, sizeof(trailer));
+}
+
+void
+CkptWriter::finish()
+{
+  drain();
+  writeEndOfImage();
+  if (shared == NULL) {
+    return;
+  }
+
+  drain();
+
+  __atomic_store_n(&shared->stopping, 1, __ATOMIC_RELEASE);
+  futex_wake(&shared->published, INT_MAX);
+  for (int i = 0; i < numHelpers; i++) {
+    pid_t tid;
+    while ((tid = __atomic_load_n(&shared->helperTids[i],
+                                  __ATOMIC_ACQUIRE)) != 0) {
+      futex_wait((uint32_t *)&shared->helperTids[i], tid);
+    }
+  }
+
+  int ioErrno = shared->ioErrno;
+  bool usedPwrite = numHelpers > 0 && !compressing;
+
+  JASSERT(munmap(arena, arenaSize) == 0) (JASSERT_ERRNO);
+  arena = NULL;
+  shared = NULL;
+  areaIndex = NULL;
+  bounceBufs = NULL;
+  hashTables = NULL;
+  outBufs = NULL;
+  numHelpers = 0;
+  compressing = false;
+
+  errno = ioErrno;
+  JASSERT(ioErrno == 0) (JASSERT_ERRNO)
+    .Text("Checkpoint writer thread failed to write the image");
+
+  // Leave the file offset where a serial writer would have left it.
+  if (usedPwrite) {
+    JASSERT(lseek(ckptFd, curOffset, SEEK_SET) == curOffset) (JASSERT_ERRNO);
+  }
+}
+
+bool
+CkptWriter::isWriterArena(const ProcMapsArea &area)
+{
+  return arena != NULL && area.addr == arena;
+}
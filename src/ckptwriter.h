@@ -0,0 +1,65 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_WRITER_H
+#define CKPT_WRITER_H
+
+#include <sys/types.h>
+#include "procmapsarea.h"
+
+// Output stage for mtcp_writememoryareas().  writeArea() writes the header
+// of a memory area followed by its data, and finish() ends the image with
+// the area index (see CkptIndexEntry in include/procmapsarea.h).  'offset'
+// passed to init() is the offset in the image of the first byte written;
+// the index records offsets in the image whether or not the fd is a pipe to
+// gzip.  By default, every write goes straight to the checkpoint fd from the
+// checkpoint thread.
+//
+// If DMTCP_BLOCK_COMPRESSION is set, the data of each area is split into
+// independently compressed blocks (see include/blockcompress.h).  With
+// DMTCP_CKPT_WRITER_THREADS greater than one, the blocks are compressed by a
+// pool of helper threads while the checkpoint thread writes out the results
+// in order.
+//
+// Otherwise, if DMTCP_CKPT_WRITER_THREADS is greater than one and the fd is a
+// regular file (i.e., not a pipe to gzip), the checkpoint thread lays out the
+// image by itself and hands large payloads to the helper threads, which
+// pwrite() them at their preassigned offsets.  The resulting image is
+// byte-for-byte identical to the one written serially.
+//
+// The helper threads are created with a raw clone() and are invisible to
+// libc and to DMTCP's ThreadList.  Their stacks, the job queue, the area
+// index and all buffers live in a single shared-anonymous mapping (the
+// "writer arena") that is created before /proc/self/maps is read and is
+// skipped while writing the image.
+
+namespace dmtcp
+{
+namespace CkptWriter
+{
+bool useBlockCompression();
+
+void init(int fd, off_t offset);
+void writeArea(ProcMapsArea *area, size_t len);
+void writeArea(ProcMapsArea *area, const void *data, size_t len);
+void drain();
+void finish();
+bool isWriterArena(const ProcMapsArea &area);
+}
+}
+#endif // ifndef CKPT_WRITER_H
@@ -50,6 +50,8 @@
 #define CKPT_FILE_SUFFIX_LEN     strlen(".dmtcp")
 #define CKPT_FILES_SUBDIR_PREFIX "ckpt_"
 #define CKPT_FILES_SUBDIR_SUFFIX "_files"
+#define CKPT_CHUNK_STORE_PREFIX  "ckpt_chunks_"
+#define CKPT_CHUNK_STORE_SUFFIX  ".chunks"
 
 // Not used
 // #define X11_LISTENER_PORT_START 6000
@@ -65,6 +67,7 @@
 
 #define DEFAULT_HOST "127.0.0.1"
 #define DEFAULT_PORT 7779
+#define DEFAULT_CKPT_SERVER_PORT 7780
 #define UNINITIALIZED_PORT          -1 /* used with getCoordHostAndPort() */
 
 // this next string can be at most 16 chars long
@@ -97,6 +100,7 @@
 
 #define ENV_VAR_COORD_LOGFILE       "DMTCP_COORD_LOG_FILENAME"
 #define ENV_VAR_COORD_WRITE_KVDB    "DMTCP_COORD_WRITE_KV_DATA"
+#define ENV_VAR_COORD_IO_THREADS    "DMTCP_COORD_IO_THREADS"
 
 // it is not yet safe to change these; these names are hard-wired in the code
 #define ENV_VAR_STDERR_PATH         "JALIB_STDERR_PATH"
@@ -105,6 +109,14 @@
 #define ENV_VAR_DL_PLUGIN           "DMTCP_DL_PLUGIN"
 
 #define ENV_VAR_FORKED_CKPT             "DMTCP_FORKED_CHECKPOINT"
+#define ENV_VAR_CKPT_WRITER_THREADS     "DMTCP_CKPT_WRITER_THREADS"
+#define ENV_VAR_BLOCK_COMPRESSION       "DMTCP_BLOCK_COMPRESSION"
+#define ENV_VAR_INCREMENTAL_CKPT        "DMTCP_INCREMENTAL_CKPT"
+#define ENV_VAR_LAZY_RESTORE            "DMTCP_LAZY_RESTORE"
+#define ENV_VAR_RESTORE_THREADS         "DMTCP_RESTORE_THREADS"
+#define ENV_VAR_CKPT_DEDUP              "DMTCP_CKPT_DEDUP"
+#define ENV_VAR_CKPT_SERVER             "DMTCP_CKPT_SERVER"
+#define ENV_VAR_NODE_BARRIERS           "DMTCP_NODE_BARRIERS"
 #define ENV_VAR_SIGCKPT                 "DMTCP_SIGCKPT"
 #define ENV_VAR_SCREENDIR               "SCREENDIR"
 #define ENV_VAR_DISABLE_STRICT_CHECKING "DMTCP_DISABLE_STRICT_CHECKING"
@@ -131,6 +143,15 @@
   ENV_VAR_QUIET,                      \
   ENV_VAR_STDERR_PATH,                \
   ENV_VAR_COMPRESSION,                \
+  ENV_VAR_CKPT_WRITER_THREADS,        \
+  ENV_VAR_BLOCK_COMPRESSION,          \
+  ENV_VAR_INCREMENTAL_CKPT,           \
+  ENV_VAR_FORKED_CKPT,                \
+  ENV_VAR_LAZY_RESTORE,               \
+  ENV_VAR_RESTORE_THREADS,            \
+  ENV_VAR_CKPT_DEDUP,                 \
+  ENV_VAR_CKPT_SERVER,                \
+  ENV_VAR_NODE_BARRIERS,              \
   ENV_VAR_ALLOC_PLUGIN,               \
   ENV_VAR_DL_PLUGIN,                  \
   ENV_VAR_SIGCKPT,                    \
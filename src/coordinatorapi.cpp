@@ -28,12 +28,15 @@
 #include <netdb.h>
 #include <poll.h>
 #include <semaphore.h>  // for sem_post(&sem_launch)
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
 #include "../jalib/jsocket.h"
+#include "ckptstore.h"
+#include "ckpttiming.h"
 #include "kvdb.h"
 #include "dmtcp.h"
 #include "processinfo.h"
@@ -54,6 +57,11 @@ const int coordinatorSocket = PROTECTED_COORD_FD;
 int nsSock = -1;
 static int childCoordinatorSocket = -1;
 
+// The number of processes on this node that meet at a node barrier before a
+// global barrier is reported to the coordinator; zero if each process
+// reports by itself.  See setNodeBarriers().
+static uint32_t numNodeBarrierPeers = 0;
+
 // Shared between getCoordHostAndPort() and setCoordPort()
 static int _cachedPort = 0;
 static string *_cachedHost = nullptr;
@@ -68,6 +76,7 @@ int createNewSocketToCoordinator(CoordinatorMode mode);
 DmtcpMessage sendRecvHandshake(int fd,
                                DmtcpMessage msg,
                                string progname,
+                               const string &tmpDir,
                                UniquePid *compId = NULL);
 
 void sendMsgToCoordinatorRaw(int fd,
@@ -426,13 +435,27 @@ void recvMsgFromCoordinator(DmtcpMessage *msg, void **extraData)
   recvMsgFromCoordinatorRaw(coordinatorSocket, msg, extraData);
 }
 
-bool waitForBarrier(const string& barrier,
-                    uint32_t *numPeers)
+void
+setNodeBarriers(bool enable)
+{
+  numNodeBarrierPeers = 0;
+  if (enable && SharedData::nodeBarriersEnabled()) {
+    numNodeBarrierPeers = SharedData::numCkptPeers();
+  }
+}
+
+// Reports numArrivals processes at the barrier to the coordinator, and waits
+// for it to release them.
+static bool
+sendBarrierAndWait(const string& barrier,
+                   uint32_t numArrivals,
+                   uint32_t *numPeers)
 {
   DmtcpMessage barrierMsg(DMT_BARRIER);
 
   JASSERT(barrier.length() < sizeof(barrierMsg.barrier)) (barrier);
   strcpy(barrierMsg.barrier, barrier.c_str());
+  barrierMsg.numPeers = numArrivals;
 
   sendMsgToCoordinator(barrierMsg);
 
@@ -471,6 +494,75 @@ bool waitForBarrier(const string& barrier,
   return true;
 }
 
+// The processes that are not the last to arrive at a node barrier are
+// released through SharedData.  Meanwhile, they keep an eye on their own
+// socket, so as not to miss a DMT_KILL_PEER or the loss of the coordinator.
+static bool
+waitForNodeBarrier(const string& barrier, uint32_t *numPeers)
+{
+  uint32_t round;
+  uint32_t n;
+
+  if (SharedData::arriveAtNodeBarrier(numNodeBarrierPeers, &round)) {
+    if (!sendBarrierAndWait(barrier, numNodeBarrierPeers, &n)) {
+      return false;
+    }
+    SharedData::releaseNodeBarrier(n);
+  } else {
+    bool released = false;
+    while (!released && !SharedData::waitForNodeBarrierRelease(round, &n)) {
+      struct pollfd pfd = { coordinatorSocket, POLLIN, 0 };
+      if (poll(&pfd, 1, 0) <= 0) {
+        continue;
+      }
+
+      char *extraData = NULL;
+      DmtcpMessage msg;
+      recvMsgFromCoordinator(&msg, (void**)&extraData);
+      if (!msg.isValid()) {
+        return false;
+      }
+
+      if (msg.type == DMT_BARRIER_RELEASED) {
+        // The process that reported us died before it could release us, and
+        // the coordinator did so instead.  The node is one process short
+        // now, so report by ourselves for the rest of this checkpoint, as
+        // the other processes of the node do.
+        JASSERT(extraData != NULL && barrier == extraData) (barrier);
+        numNodeBarrierPeers = 0;
+        n = msg.numPeers;
+        released = true;
+      } else {
+        // A duplicate DMT_DO_CHECKPOINT; see sendBarrierAndWait().
+        JASSERT(msg.type == DMT_DO_CHECKPOINT) (msg.type);
+      }
+      if (extraData != NULL) {
+        JALLOC_FREE(extraData);
+      }
+    }
+  }
+
+  if (numPeers != NULL) {
+    *numPeers = n;
+  }
+  return true;
+}
+
+bool waitForBarrier(const string& barrier,
+                    uint32_t *numPeers)
+{
+  uint64_t start = CkptTiming::now();
+  bool released;
+
+  if (numNodeBarrierPeers > 0) {
+    released = waitForNodeBarrier(barrier, numPeers);
+  } else {
+    released = sendBarrierAndWait(barrier, 1, numPeers);
+  }
+  CkptTiming::record("barrier", barrier.c_str(), start);
+  return released;
+}
+
 void
 startNewCoordinator(CoordinatorMode mode)
 {
@@ -578,6 +670,7 @@ DmtcpMessage
 sendRecvHandshake(int fd,
                   DmtcpMessage msg,
                   string progname,
+                  const string &tmpDir,
                   UniquePid *compId)
 {
   if (dmtcp_virtual_to_real_pid) {
@@ -590,10 +683,13 @@ sendRecvHandshake(int fd,
 
   string hostname = jalib::Filesystem::GetCurrentHostname();
 
-  size_t buflen = hostname.length() + progname.length() + 2;
+  // The processes with the same host and tmpdir share a SharedData area, and
+  // thus a node barrier; see DmtcpCoordinator::onDisconnect().
+  size_t buflen = hostname.length() + progname.length() + tmpDir.length() + 3;
   char buf[buflen];
   strcpy(buf, hostname.c_str());
   strcpy(&buf[hostname.length() + 1], progname.c_str());
+  strcpy(&buf[hostname.length() + progname.length() + 2], tmpDir.c_str());
 
   sendMsgToCoordinatorRaw(fd, msg, buf, buflen);
 
@@ -629,6 +725,7 @@ sendRecvHandshake(int fd,
 void
 connectToCoordOnStartup(CoordinatorMode mode,
                         string progname,
+                        const string &tmpDir,
                         DmtcpUniqueProcessId *compId,
                         CoordinatorInfo *coordInfo,
                         struct in_addr  *localIP)
@@ -642,7 +739,8 @@ connectToCoordOnStartup(CoordinatorMode mode,
 
   DmtcpMessage hello_remote = sendRecvHandshake(coordinatorSocket,
                                                 hello_local,
-                                                progname);
+                                                progname,
+                                                tmpDir);
 
   JASSERT(hello_remote.virtualPid != -1);
   JTRACE("Got virtual pid from coordinator") (hello_remote.virtualPid);
@@ -673,7 +771,8 @@ createNewConnectionBeforeFork(string& progname)
   JASSERT(sock != -1);
 
   DmtcpMessage hello_local(DMT_NEW_WORKER);
-  DmtcpMessage hello_remote = sendRecvHandshake(sock, hello_local, progname);
+  DmtcpMessage hello_remote = sendRecvHandshake(sock, hello_local, progname,
+                                                SharedData::getTmpDir());
   JASSERT(hello_remote.virtualPid != -1);
 
   if (dmtcp_virtual_to_real_pid) {
@@ -685,9 +784,36 @@ createNewConnectionBeforeFork(string& progname)
   return sock;
 }
 
+// The forked process that writes a checkpoint image in the background (see
+// ckptserializer.cpp) reports to the coordinator over its own connection,
+// which replaces the coordinator socket inherited from the worker.
+bool
+connectBackgroundCkptWriter()
+{
+  struct sockaddr_storage addr;
+  uint32_t len;
+  SharedData::getCoordAddr((struct sockaddr *)&addr, &len);
+  socklen_t addrlen = len;
+  int sock = jalib::JClientSocket((struct sockaddr *)&addr, addrlen);
+  if (sock == -1) {
+    return false;
+  }
+
+  DmtcpMessage hello_local(DMT_BACKGROUND_CKPT_WRITER);
+  if (Util::writeAll(sock, &hello_local, sizeof(hello_local)) !=
+      sizeof(hello_local)) {
+    _real_close(sock);
+    return false;
+  }
+
+  Util::changeFd(sock, coordinatorSocket);
+  return true;
+}
+
 void
 connectToCoordOnRestart(CoordinatorMode  mode,
                         string progname,
+                        const string &tmpDir,
                         UniquePid compGroup,
                         int np,
                         CoordinatorInfo *coordInfo,
@@ -703,6 +829,7 @@ connectToCoordOnRestart(CoordinatorMode  mode,
   DmtcpMessage hello_remote = sendRecvHandshake(coordinatorSocket,
                                                 hello_local,
                                                 progname,
+                                                tmpDir,
                                                 &compGroup);
 
   if (coordInfo != NULL) {
@@ -741,22 +868,21 @@ sendCkptFilename()
   }
   JTRACE("recording filenames") (ckptFilename) (hostname) (shellType);
 
-  size_t buflen = hostname.length() + shellType.length() +
-                  ckptFilename.length() + 3;
-  char buf[buflen];
-  strcpy(buf, ckptFilename.c_str());
-  strcpy(&buf[ckptFilename.length() + 1], shellType.c_str());
-  strcpy(&buf[ckptFilename.length() + 1 + shellType.length() + 1],
-         hostname.c_str());
+  // The size of an image kept by dmtcp_ckpt_server is not known here.
+  struct stat st;
+  if (CkptStore::instance().isLocal() &&
+      stat(ckptFilename.c_str(), &st) == 0) {
+    msg.ckptImageSize = st.st_size;
+  }
 
-  sendMsgToCoordinator(msg, buf, buflen);
+  // The phase timings of this checkpoint follow; see CkptTiming.
+  string data = ckptFilename + '\0' + shellType + '\0' + hostname + '\0' +
+                CkptTiming::toString();
+  sendMsgToCoordinator(msg, data);
 }
 
-kvdb::KVDBResponse
-kvdbRequest(DmtcpMessage const& msg,
-            string const& key,
-            string const& val,
-            string *oldVal)
+static int
+kvdbSocket()
 {
   int sock = coordinatorSocket;
 
@@ -774,6 +900,17 @@ kvdbRequest(DmtcpMessage const& msg,
     sock = nsSock;
   }
 
+  return sock;
+}
+
+kvdb::KVDBResponse
+kvdbRequest(DmtcpMessage const& msg,
+            string const& key,
+            string const& val,
+            string *oldVal)
+{
+  int sock = kvdbSocket();
+
   JASSERT(Util::writeAll(sock, &msg, sizeof(msg)) == sizeof(msg));
   JASSERT(Util::writeAll(sock, key.data(), msg.keyLen) ==
     (ssize_t)msg.keyLen);
@@ -797,5 +934,31 @@ kvdbRequest(DmtcpMessage const& msg,
 
   return reply.kvdbResponse;
 }
+
+DmtcpMessage
+kvdbMultiRequest(DmtcpMessage const& msg,
+                 const char *extraData,
+                 vector<char> *replyData)
+{
+  int sock = kvdbSocket();
+
+  JASSERT(Util::writeAll(sock, &msg, sizeof(msg)) == sizeof(msg));
+  JASSERT(Util::writeAll(sock, extraData, msg.extraBytes) ==
+    (ssize_t)msg.extraBytes);
+
+  DmtcpMessage reply;
+  reply.poison();
+  JASSERT(Util::readAll(sock, &reply, sizeof(reply)) == sizeof(reply));
+  reply.assertValid();
+  JASSERT(reply.type == DMT_KVDB_RESPONSE);
+
+  replyData->resize(reply.extraBytes);
+  if (reply.extraBytes != 0) {
+    JASSERT(Util::readAll(sock, replyData->data(), reply.extraBytes) ==
+            (ssize_t)reply.extraBytes);
+  }
+
+  return reply;
+}
 } // namespace CoordinatorAPI {
 } // namespace dmtcp {
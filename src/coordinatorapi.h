@@ -54,12 +54,15 @@ void getCoordHostAndPort(CoordinatorMode mode, string *host, int *port);
 
 void connectToCoordOnStartup(CoordinatorMode  mode,
                              string           progname,
+                             const string    &tmpDir,
                              DmtcpUniqueProcessId *compId,
                              CoordinatorInfo *coordInfo,
                              struct in_addr  *localIP);
 int  createNewConnectionBeforeFork(string& progname);
+bool connectBackgroundCkptWriter();
 void connectToCoordOnRestart(CoordinatorMode  mode,
                              string progname,
+                             const string &tmpDir,
                              UniquePid compGroup,
                              int np,
                              CoordinatorInfo *coordInfo,
@@ -71,6 +74,12 @@ void sendMsgToCoordinator(DmtcpMessage msg,
 void sendMsgToCoordinator(const DmtcpMessage &msg, const string &data);
 void recvMsgFromCoordinator(DmtcpMessage *msg, void **extraData = NULL);
 bool waitForBarrier(const string& barrier, uint32_t *numPeers = NULL);
+
+// With DMTCP_NODE_BARRIERS, global barriers are first gathered on each node,
+// among the processes counted by SharedData::prepareForCkpt().  That set is
+// only fixed from the DMT:CHECKPOINT (or DMT:Restart) barrier until the
+// processes resume, so node barriers are enabled for that stretch only.
+void setNodeBarriers(bool enable);
 char *connectAndSendUserCommand(char c,
                                 int *coordCmdStatus = NULL,
                                 int *numPeers = NULL,
@@ -86,6 +95,12 @@ kvdbRequest(DmtcpMessage const& msg,
             string const& val,
             string *oldVal);
 
+// Batched KVDB requests: msg.extraBytes of keys and values are sent from
+// extraData, and the extra data of the reply is returned in *replyData.
+DmtcpMessage kvdbMultiRequest(DmtcpMessage const& msg,
+                              const char *extraData,
+                              vector<char> *replyData);
+
 } // namespace CoordinatorAPI
 } // namespace dmtcp
 #endif // ifndef COORDINATORAPI_H
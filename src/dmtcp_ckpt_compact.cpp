@@ -0,0 +1,374 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jassert.h"
+#include "constants.h"
+#include "dmtcp.h"
+#include "procmapsarea.h"
+#include "util.h"
+
+#define BINARY_NAME "dmtcp_ckpt_compact"
+
+// Data of PAGES_IN_PARENT areas is gathered in chunks of this size.
+#define COMPACT_CHUNK_SIZE (16 * 1024 * 1024)
+
+using namespace dmtcp;
+
+static const char *theUsage =
+  "Usage:  dmtcp_ckpt_compact [OPTIONS] <ckpt-image>\n"
+  "Rewrite an incremental checkpoint image (see dmtcp_launch"
+  " --incremental-ckpt)\n"
+  "as a full image that no longer depends on its parent images.\n\n"
+  "Options:\n\n"
+  "  -o, --output FILE\n"
+  "              Write the full image to FILE instead of replacing"
+  " <ckpt-image>\n"
+  "  --remove-parents\n"
+  "              Delete the chain of parent images afterwards\n"
+  "  --help\n"
+  "              Print this message and exit.\n"
+  "  --version\n"
+  "              Print version information and exit.\n"
+  "\n"
+  HELP_AND_CONTACT_INFO
+  "\n";
+
+// An image of the chain of parent images, read front to back.  See
+// read_from_parent_images() in src/mtcp/mtcp_restart.c.
+struct ParentImage {
+  string path;
+  int fd;
+  bool eof;
+  off_t nextArea;
+  off_t data;
+  Area area;
+  DmtcpCkptHeader hdr;
+};
+
+static vector<ParentImage *> parents;
+
+// The image being written; see the layout in include/procmapsarea.h.
+static int out = -1;
+static off_t outOffset = 0;
+static vector<CkptIndexEntry> areaIndex;
+
+static void
+readAt(int fd, void *buf, size_t len, off_t offset, const string &path)
+{
+  char *p = (char *)buf;
+  while (len > 0) {
+    ssize_t rc = pread(fd, p, len, offset);
+    JASSERT(rc > 0 || (rc == -1 && errno == EINTR)) (JASSERT_ERRNO) (path)
+      .Text("Error reading checkpoint image");
+    if (rc > 0) {
+      p += rc;
+      len -= rc;
+      offset += rc;
+    }
+  }
+}
+
+static void
+readCkptHeader(int fd, DmtcpCkptHeader *hdr, const string &path)
+{
+  // The second copy of the header is the one read by mtcp_restart.
+  readAt(fd, hdr, sizeof(*hdr), sizeof(*hdr), path);
+  JASSERT(strcmp(hdr->ckptSignature, DMTCP_CKPT_SIGNATURE) == 0) (path)
+    .Text("Not an uncompressed DMTCP checkpoint image");
+}
+
+static ParentImage *
+getParentImage(size_t level, const char *path)
+{
+  JASSERT(level < DMTCP_MAX_CKPT_GENERATION && path[0] != '\0') (level)
+    .Text("Bad chain of parent images");
+
+  if (level == parents.size()) {
+    ParentImage *img = new ParentImage;
+    img->path = path;
+    img->fd = open(path, O_RDONLY);
+    JASSERT(img->fd != -1) (JASSERT_ERRNO) (path)
+      .Text("Cannot open parent checkpoint image");
+    readCkptHeader(img->fd, &img->hdr, img->path);
+    img->eof = false;
+    img->nextArea = 2 * sizeof(DmtcpCkptHeader);
+    img->area.addr = NULL;
+    img->area.endAddr = NULL;
+    parents.push_back(img);
+  }
+  return parents[level];
+}
+
+static void
+nextParentArea(ParentImage *img)
+{
+  readAt(img->fd, &img->area, sizeof(img->area), img->nextArea, img->path);
+  JASSERT(img->area.headerCrc32c == area_header_crc32c(&img->area))
+    (img->path) (img->nextArea)
+    .Text("Corrupted area header in parent checkpoint image");
+  if (img->area.addr == NULL) {
+    img->eof = true;
+    return;
+  }
+  JASSERT(!(img->area.properties & DMTCP_BLOCK_COMPRESSED)) (img->path)
+    .Text("Compressed area in parent checkpoint image");
+  img->data = img->nextArea + sizeof(img->area);
+  img->nextArea = img->data + area_data_size(&img->area);
+}
+
+// Fills buf with the memory at [addr, addr + size) as recorded in the parent
+// image at 'level' (or further up the chain).  buf must be zeroed.
+static void
+readFromParentImages(size_t level, const char *path, VA addr, size_t size,
+                     char *buf)
+{
+  ParentImage *img = getParentImage(level, path);
+  VA end = addr + size;
+
+  while (addr < end) {
+    Area *area = &img->area;
+    while (!img->eof &&
+           (area->addr == NULL || area->endAddr <= addr ||
+            (area->properties & DMTCP_ZERO_PAGE_PARENT_HEADER))) {
+      nextParentArea(img);
+    }
+    JASSERT(!img->eof && area->addr <= addr) ((void *)addr) (img->path)
+      .Text("Address not found in parent checkpoint image");
+
+    VA chunkEnd = MIN(end, area->endAddr);
+    if (area->properties & DMTCP_PAGES_IN_PARENT) {
+      readFromParentImages(level + 1, img->hdr.parentCkptImage,
+                           addr, chunkEnd - addr, buf);
+    } else {
+      size_t offset = addr - area->addr;
+      size_t dataSize = area_data_size(area);
+      if (offset < dataSize) {
+        size_t len = MIN((size_t)(chunkEnd - addr), dataSize - offset);
+        readAt(img->fd, buf, len, img->data + offset, img->path);
+      }
+    }
+    buf += chunkEnd - addr;
+    addr = chunkEnd;
+  }
+}
+
+static void
+writeOut(const void *buf, size_t len)
+{
+  JASSERT(Util::writeAll(out, buf, len) == (ssize_t)len) (JASSERT_ERRNO);
+  outOffset += len;
+}
+
+// Writes the header of an area with a fresh checksum, and starts its index
+// entry.  The data, if any, is added by writeAreaData().
+static void
+writeAreaHeader(Area *area)
+{
+  area->headerCrc32c = area_header_crc32c(area);
+
+  CkptIndexEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.addr = (uint64_t)area->addr;
+  entry.endAddr = (uint64_t)area->endAddr;
+  entry.offset = outOffset;
+  entry.dataSize = area_data_size(area);
+  entry.properties = area->properties;
+  entry.prot = area->prot;
+  entry.flags = area->flags;
+  areaIndex.push_back(entry);
+
+  writeOut(area, sizeof(*area));
+}
+
+static void
+writeAreaData(const void *buf, size_t len)
+{
+  CkptIndexEntry *entry = &areaIndex.back();
+  entry->dataCrc32c = crc32c_update(entry->dataCrc32c, buf, len);
+  entry->storedSize += len;
+  writeOut(buf, len);
+}
+
+static void
+copyData(int in, off_t offset, size_t len, char *buf, const string &path)
+{
+  while (len > 0) {
+    size_t n = MIN(len, (size_t)COMPACT_CHUNK_SIZE);
+    readAt(in, buf, n, offset, path);
+    writeAreaData(buf, n);
+    offset += n;
+    len -= n;
+  }
+}
+
+static void
+writeEndOfImage()
+{
+  Area area;
+  memset(&area, 0, sizeof(area));
+  area.addr = NULL; // End of data
+  area.size = -1; // End of data
+  area.headerCrc32c = area_header_crc32c(&area);
+  writeOut(&area, sizeof(area));
+
+  CkptIndexTrailer trailer;
+  memset(&trailer, 0, sizeof(trailer));
+  strcpy(trailer.magic, CKPT_INDEX_MAGIC);
+  trailer.indexOffset = outOffset;
+  trailer.numEntries = areaIndex.size();
+  for (size_t i = 0; i < areaIndex.size(); i++) {
+    trailer.payloadCrc32c = crc32c_combine(trailer.payloadCrc32c,
+                                           areaIndex[i].dataCrc32c,
+                                           areaIndex[i].storedSize);
+  }
+  trailer.indexCrc32c = crc32c(areaIndex.data(),
+                               areaIndex.size() * sizeof(CkptIndexEntry));
+
+  writeOut(areaIndex.data(), areaIndex.size() * sizeof(CkptIndexEntry));
+  writeOut(&trailer, sizeof(trailer));
+}
+
+// shift args
+#define shift argc--, argv++
+
+int
+main(int argc, char **argv)
+{
+  string image;
+  string output;
+  bool removeParents = false;
+
+  initializeJalib();
+
+  shift;
+  while (argc > 0) {
+    string s = argv[0];
+    if (s == "--help" || s == "-h") {
+      printf("%s", theUsage);
+      return 0;
+    } else if (s == "--version") {
+      printf("%s", DMTCP_VERSION_AND_COPYRIGHT_INFO);
+      return 0;
+    } else if (argc > 1 && (s == "-o" || s == "--output")) {
+      output = argv[1];
+      shift; shift;
+    } else if (s == "--remove-parents") {
+      removeParents = true;
+      shift;
+    } else if (argc == 1 && s[0] != '-') {
+      image = s;
+      shift;
+    } else {
+      fprintf(stderr, "%s", theUsage);
+      return 1;
+    }
+  }
+
+  if (image.empty()) {
+    fprintf(stderr, "%s", theUsage);
+    return 1;
+  }
+
+  int in = open(image.c_str(), O_RDONLY);
+  JASSERT(in != -1) (JASSERT_ERRNO) (image)
+    .Text("Cannot open checkpoint image");
+
+  DmtcpCkptHeader hdr;
+  readCkptHeader(in, &hdr, image);
+  if (hdr.ckptGeneration == 0) {
+    printf("%s is already a full checkpoint image.\n", image.c_str());
+    return 0;
+  }
+  string parentImage = hdr.parentCkptImage;
+
+  string tmpOutput = (output.empty() ? image : output) + ".temp";
+  out = open(tmpOutput.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  JASSERT(out != -1) (JASSERT_ERRNO) (tmpOutput);
+
+  hdr.ckptGeneration = 0;
+  memset(hdr.parentCkptImage, 0, sizeof(hdr.parentCkptImage));
+  writeOut(&hdr, sizeof(hdr));
+  writeOut(&hdr, sizeof(hdr));
+
+  char *buf = (char *)malloc(COMPACT_CHUNK_SIZE);
+  JASSERT(buf != NULL);
+
+  off_t offset = 2 * sizeof(DmtcpCkptHeader);
+  while (1) {
+    Area area;
+    readAt(in, &area, sizeof(area), offset, image);
+    JASSERT(area.headerCrc32c == area_header_crc32c(&area)) (image) (offset)
+      .Text("Corrupted area header in checkpoint image");
+    offset += sizeof(area);
+    if (area.addr == NULL) {
+      writeEndOfImage();
+      break;
+    }
+    JASSERT(!(area.properties & DMTCP_BLOCK_COMPRESSED)) (image)
+      .Text("Compressed area in incremental checkpoint image");
+
+    if (!(area.properties & DMTCP_PAGES_IN_PARENT)) {
+      writeAreaHeader(&area);
+      copyData(in, offset, area_data_size(&area), buf, image);
+      offset += area_data_size(&area);
+      continue;
+    }
+
+    // Write the pages from the parent images as a regular child area.
+    area.properties &= ~DMTCP_PAGES_IN_PARENT;
+    writeAreaHeader(&area);
+    for (VA addr = area.addr; addr < area.endAddr; ) {
+      size_t n = MIN((size_t)(area.endAddr - addr), (size_t)COMPACT_CHUNK_SIZE);
+      memset(buf, 0, n);
+      readFromParentImages(0, parentImage.c_str(), addr, n, buf);
+      writeAreaData(buf, n);
+      addr += n;
+    }
+  }
+
+  JASSERT(fsync(out) == 0) (JASSERT_ERRNO);
+  JASSERT(close(out) == 0) (JASSERT_ERRNO);
+  close(in);
+
+  string target = output.empty() ? image : output;
+  JASSERT(rename(tmpOutput.c_str(), target.c_str()) == 0) (JASSERT_ERRNO)
+    (tmpOutput) (target);
+
+  if (removeParents) {
+    // Also visit the parents that held no pages needed for this image.
+    const char *path = parentImage.c_str();
+    for (size_t level = 0; path[0] != '\0'; level++) {
+      ParentImage *img = getParentImage(level, path);
+      path = img->hdr.ckptGeneration > 0 ? img->hdr.parentCkptImage : "";
+    }
+    for (size_t i = 0; i < parents.size(); i++) {
+      close(parents[i]->fd);
+      JWARNING(unlink(parents[i]->path.c_str()) == 0) (JASSERT_ERRNO)
+        (parents[i]->path);
+    }
+  }
+
+  printf("Wrote full checkpoint image %s\n", target.c_str());
+  return 0;
+}
@@ -0,0 +1,301 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../jalib/jconvert.h"
+#include "../jalib/jsocket.h"
+#include "jassert.h"
+#include "ckptstore.h"
+#include "constants.h"
+#include "util.h"
+
+#define BINARY_NAME "dmtcp_ckpt_server"
+
+// Images are copied between the socket and the disk in chunks of this size.
+#define CKPT_SERVER_BUF_SIZE (1024 * 1024)
+
+using namespace dmtcp;
+
+static const char *theUsage =
+  "Usage:  dmtcp_ckpt_server [OPTIONS]\n"
+  "Store checkpoint images streamed by processes launched with\n"
+  "dmtcp_launch --ckpt-server, and serve them to dmtcp_restart"
+  " --ckpt-server.\n"
+  "Each connection is handled by its own thread.\n\n"
+  "Options:\n\n"
+  "  -p, --port PORT_NUM\n"
+  "              Port to listen on (default: "
+                                STRINGIFY(DEFAULT_CKPT_SERVER_PORT) ")\n"
+  "  --port-file FILENAME\n"
+  "              File to write listener port number.\n"
+  "              (Useful with '--port 0', in order to assign a random port)\n"
+  "  -c, --ckptdir PATH\n"
+  "              Directory to store checkpoint images (default: ./)\n"
+  "  -q, --quiet\n"
+  "              Skip startup msg\n"
+  "  --help\n"
+  "              Print this message and exit.\n"
+  "  --version\n"
+  "              Print version information and exit.\n"
+  "\n"
+  HELP_AND_CONTACT_INFO
+  "\n";
+
+static string ckptDir = ".";
+
+// Image names are plain file names inside ckptDir.
+static bool
+isValidName(const string &name)
+{
+  return !name.empty() && name.length() < NAME_MAX &&
+         name.find('/') == string::npos && name != "." && name != "..";
+}
+
+static bool
+readName(int sock, uint32_t len, string *name)
+{
+  if (len == 0) {
+    return true;
+  }
+  if (len >= NAME_MAX) {
+    return false;
+  }
+  char buf[NAME_MAX];
+  if (Util::readAll(sock, buf, len) != (ssize_t)len) {
+    return false;
+  }
+  *name = string(buf, len);
+  return isValidName(*name);
+}
+
+static void
+sendReply(int sock, int status)
+{
+  CkptServerReply reply;
+  memset(&reply, 0, sizeof(reply));
+  reply.status = status;
+  Util::writeAll(sock, &reply, sizeof(reply));
+}
+
+// Reads the image until the client shuts down its side of the connection.
+// On error, the rest of the image is drained so that the client gets to see
+// the reply.
+static int
+receiveImage(int sock, const string &path, char *buf)
+{
+  int status = 0;
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+  if (fd == -1) {
+    status = errno;
+  }
+
+  while (1) {
+    ssize_t rc = read(sock, buf, CKPT_SERVER_BUF_SIZE);
+    if (rc == -1 && errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      if (rc == -1 && status == 0) {
+        status = errno;
+      }
+      break;
+    }
+    if (status == 0 && Util::writeAll(fd, buf, rc) != rc) {
+      status = errno;
+    }
+  }
+
+  if (fd != -1) {
+    if (status == 0 && fsync(fd) == -1) {
+      status = errno;
+    }
+    if (close(fd) == -1 && status == 0) {
+      status = errno;
+    }
+  }
+  return status;
+}
+
+static void
+sendImage(int sock, const string &path, char *buf)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    sendReply(sock, errno);
+    return;
+  }
+  sendReply(sock, 0);
+
+  while (1) {
+    ssize_t rc = Util::readAll(fd, buf, CKPT_SERVER_BUF_SIZE);
+    if (rc <= 0 || Util::writeAll(sock, buf, rc) != rc) {
+      JWARNING(rc == 0) (path) (JASSERT_ERRNO)
+        .Text("Failed to send checkpoint image");
+      break;
+    }
+  }
+  close(fd);
+}
+
+static void *
+serveConnection(void *arg)
+{
+  int sock = (int)(long)arg;
+  CkptServerRequest req;
+  string name;
+  string newName;
+
+  if (Util::readAll(sock, &req, sizeof(req)) != sizeof(req) ||
+      strncmp(req.magic, CKPT_SERVER_MAGIC, sizeof(req.magic)) != 0 ||
+      !readName(sock, req.nameLen, &name) || name.empty() ||
+      !readName(sock, req.newNameLen, &newName)) {
+    JWARNING(false).Text("Invalid request; closing connection");
+    close(sock);
+    return NULL;
+  }
+
+  string path = ckptDir + "/" + name;
+  char *buf = NULL;
+  if (req.op == CKPT_SERVER_PUT || req.op == CKPT_SERVER_GET) {
+    buf = (char *)malloc(CKPT_SERVER_BUF_SIZE);
+    JASSERT(buf != NULL);
+  }
+
+  switch (req.op) {
+  case CKPT_SERVER_PUT:
+    JTRACE("Receiving checkpoint image") (path);
+    sendReply(sock, receiveImage(sock, path, buf));
+    break;
+
+  case CKPT_SERVER_GET:
+    JTRACE("Sending checkpoint image") (path);
+    sendImage(sock, path, buf);
+    break;
+
+  case CKPT_SERVER_RENAME:
+    JTRACE("Renaming checkpoint image") (path) (newName);
+    if (newName.empty()) {
+      sendReply(sock, EINVAL);
+    } else if (rename(path.c_str(), (ckptDir + "/" + newName).c_str()) != 0) {
+      sendReply(sock, errno);
+    } else {
+      sendReply(sock, 0);
+    }
+    break;
+
+  default:
+    JWARNING(false) (req.op).Text("Unknown request");
+    sendReply(sock, EINVAL);
+    break;
+  }
+
+  free(buf);
+  close(sock);
+  return NULL;
+}
+
+// shift args
+#define shift argc--, argv++
+
+int
+main(int argc, char **argv)
+{
+  int port = DEFAULT_CKPT_SERVER_PORT;
+  string portFile;
+  bool quiet = false;
+
+  initializeJalib();
+
+  shift;
+  while (argc > 0) {
+    string s = argv[0];
+    if (s == "--help" || s == "-h") {
+      printf("%s", theUsage);
+      return 0;
+    } else if (s == "--version") {
+      printf("%s", DMTCP_VERSION_AND_COPYRIGHT_INFO);
+      return 0;
+    } else if (argc > 1 && (s == "-p" || s == "--port")) {
+      port = jalib::StringToInt(argv[1]);
+      shift; shift;
+    } else if (argc > 1 && s == "--port-file") {
+      portFile = argv[1];
+      shift; shift;
+    } else if (argc > 1 && (s == "-c" || s == "--ckptdir")) {
+      ckptDir = argv[1];
+      shift; shift;
+    } else if (s == "-q" || s == "--quiet") {
+      quiet = true;
+      shift;
+    } else {
+      fprintf(stderr, "%s", theUsage);
+      return 1;
+    }
+  }
+
+  JASSERT(mkdir(ckptDir.c_str(), S_IRWXU) == 0 || errno == EEXIST)
+    (JASSERT_ERRNO) (ckptDir)
+    .Text("Error creating checkpoint directory");
+
+  // A client that goes away must not take the server with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  jalib::JServerSocket listenSock(jalib::JSockAddr::ANY, port, 128);
+  JASSERT(listenSock.isValid()) (port) (JASSERT_ERRNO)
+    .Text("Failed to create listen socket.");
+  port = listenSock.port();
+  Util::writeCoordPortToFile(port, portFile.c_str());
+
+  if (!quiet) {
+    fprintf(stderr, BINARY_NAME " starting..."
+                    "\n    Port: %d"
+                    "\n    Checkpoint Dir: %s\n",
+            port, ckptDir.c_str());
+  }
+
+  while (1) {
+    int sock = accept(listenSock.sockfd(), NULL, NULL);
+    if (sock == -1) {
+      JWARNING(errno == EINTR || errno == ECONNABORTED) (JASSERT_ERRNO);
+      continue;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, serveConnection,
+                       (void *)(long)sock) != 0) {
+      JWARNING(false) (JASSERT_ERRNO).Text("Failed to create thread");
+      close(sock);
+    }
+    pthread_attr_destroy(&attr);
+  }
+  return 0;
+}
@@ -49,12 +49,16 @@ static const char *theUsage =
   "Commands for Coordinator:\n"
   "    -s, --status:          Print status message\n"
   "    -l, --list:            List connected clients\n"
+  "    -m, --metrics:         Print metrics of the coordinator (Prometheus\n"
+  "                           text format)\n"
   "    -c, --checkpoint:      Checkpoint all nodes\n"
 // Could add -B as synonym for -bc
   "    -bc, --bcheckpoint:    Checkpoint all nodes, dmtcp_command blocks until"
                                                                       " done\n"
 // Could add -K as synonym for -kc
   "    -kc, --kcheckpoint     Checkpoint all nodes, kill all nodes when done\n"
+  "    -fc, --fcheckpoint     Checkpoint all nodes, resume them while forked\n"
+  "                           processes write the checkpoint images\n"
 // "    -xc, --xcheckpoint  deprecated synonym for '-kc': kill nodes if done\n"
   "    -i, --interval <val>   Update ckpt interval to <val> seconds (0=never)\n"
   "    -k, --kill             Kill all nodes\n"
@@ -114,15 +118,18 @@ main(int argc, char **argv)
       if (*cmd == 'k' && *(cmd+1) == 'c') { // if this is "-kc":
         *cmd = 'K';  // Need to disambiguate '-k' from '-kc' (now '-Kc')
       }
+      if (*cmd == 'f') { // "-fc" is sent to the coordinator as 'F'
+        *cmd = 'F';
+      }
       s = cmd;
 
-      if ((*cmd == 'b' || *cmd == 'K') && *(cmd + 1) != 'c') {
+      if ((*cmd == 'b' || *cmd == 'K' || *cmd == 'F') && *(cmd + 1) != 'c') {
         // If blocking ckpt, next letter must be 'c'; else print the usage
         fprintf(stderr, theUsage, "");
         return 1;
       } else if (*cmd == 's' || *cmd == 'i' || *cmd == 'c' || *cmd == 'b' ||
-                 *cmd == 'K' || *cmd == 'k' ||
-                 *cmd == 'q' || *cmd == 'l') {
+                 *cmd == 'K' || *cmd == 'F' || *cmd == 'k' ||
+                 *cmd == 'q' || *cmd == 'l' || *cmd == 'm') {
         request = s;
         if (*cmd == 'i') {
           if (isdigit(cmd[1])) { // if -i5, for example
@@ -149,6 +156,8 @@ main(int argc, char **argv)
   int isRunning;
   int ckptInterval;
   char *workerList = NULL;
+  char *ckptTimings = NULL;
+  char *metrics = NULL;
   // After this, the first char of the request is unique.  We only need that.
   char cmdChar = *(char *)request.c_str();
   switch (cmdChar) {
@@ -171,17 +180,23 @@ main(int argc, char **argv)
     CoordinatorAPI::connectAndSendUserCommand('c', &coordCmdStatus);
     break;
   case 's':
-    CoordinatorAPI::connectAndSendUserCommand(cmdChar,
-                                              &coordCmdStatus,
-                                              &numPeers,
-                                              &isRunning,
-                                              &ckptInterval);
+    ckptTimings =
+      CoordinatorAPI::connectAndSendUserCommand(cmdChar,
+                                                &coordCmdStatus,
+                                                &numPeers,
+                                                &isRunning,
+                                                &ckptInterval);
     break;
   case 'l':
     workerList =
       CoordinatorAPI::connectAndSendUserCommand(cmdChar, &coordCmdStatus);
     break;
+  case 'm':
+    metrics =
+      CoordinatorAPI::connectAndSendUserCommand(cmdChar, &coordCmdStatus);
+    break;
   case 'c':
+  case 'F':
   case 'k':
   case 'q':
     workerList =
@@ -225,6 +240,12 @@ main(int argc, char **argv)
     return 2;
   }
 
+  // Only the metrics, so that they can be passed on as they are.
+  if (metrics) {
+    printf("%s", metrics);
+    JALLOC_HELPER_FREE(metrics);
+  }
+
   if(cmdChar == 's' || cmdChar == 'l'){
     printf("Coordinator:\n");
     char *host = getenv(ENV_VAR_NAME_HOST);
@@ -247,6 +268,10 @@ main(int argc, char **argv)
       } else {
         printf("  CKPT_INTERVAL=0 (checkpoint manually)\n");
       }
+      if (ckptTimings) {
+        printf("%s", ckptTimings);
+        JALLOC_HELPER_FREE(ckptTimings);
+      }
     } else {
       if (workerList) {
         printf("%s", workerList);
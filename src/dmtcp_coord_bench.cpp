@@ -0,0 +1,787 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+// A load generator for the dmtcp_coordinator.  For each number of workers,
+// a fresh coordinator is started, and that many simulated workers connect
+// to it over loopback, with the DMT_NEW_WORKER handshake of dmtcp_launch.
+// The workers are then driven by a few threads or processes (drivers), each
+// of which sends the messages of its share of the workers before reading
+// their replies, through one of these workloads:
+//
+//   barrier:  a global barrier per round.
+//   ckpt:     a checkpoint per round, as requested by 'dmtcp_command -c':
+//             DMT_DO_CHECKPOINT, the DMT:SUSPEND, DMT:CHECKPOINT and
+//             DMT:WriteCkpt barriers, DMT_CKPT_FILENAME and
+//             DMT_WORKER_RESUMING, with the worker states of a real one.
+//   kvdb:     KVDB sets and gets of every worker, or with --batch, an MSET
+//             and an MGET of all its keys.
+//
+// The latency of a barrier is the time from its first DMT_BARRIER sent to
+// its last DMT_BARRIER_RELEASED received; that of a KVDB request is its
+// round trip.  Stragglers are workers that never read from the coordinator,
+// so that their socket buffers fill up.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../jalib/jalib.h"
+#include "../jalib/jassert.h"
+#include "../jalib/jconvert.h"
+#include "../jalib/jfilesystem.h"
+#include "constants.h"
+#include "dmtcpmessagetypes.h"
+#include "tokenize.h"
+#include "util.h"
+
+#define BINARY_NAME "dmtcp_coord_bench"
+
+using namespace dmtcp;
+
+static const char *theUsage =
+  "Usage:  dmtcp_coord_bench [OPTIONS]\n"
+  "Generate load on dmtcp_coordinator with simulated workers, and measure\n"
+  "its latency, throughput and CPU time as a function of the number of\n"
+  "workers.  For each number of workers, a new coordinator is started on\n"
+  "a random port, and the workers connect to it over loopback.\n\n"
+  "Options:\n\n"
+  "  -n, --workers N[,N...]\n"
+  "              Numbers of simulated workers (default: 16,64,256,900)\n"
+  "  -w, --workload barrier|ckpt|kvdb\n"
+  "              What each round does (default: barrier):\n"
+  "                barrier: one global barrier\n"
+  "                ckpt:    one checkpoint, with its barriers, checkpoint\n"
+  "                         filenames and resume messages\n"
+  "                kvdb:    K KVDB sets and K KVDB gets by every worker\n"
+  "  -r, --rounds R\n"
+  "              Rounds for each number of workers (default: 100)\n"
+  "  -k, --kvdb-ops K\n"
+  "              KVDB sets and gets per worker and round (default: 10)\n"
+  "  -b, --batch\n"
+  "              Send the K sets and the K gets of a worker and round as one\n"
+  "              MSET and one MGET request\n"
+  "  -t, --threads T\n"
+  "              Drive the workers from T threads (default: 1)\n"
+  "  -p, --processes P\n"
+  "              Drive the workers from P processes instead of threads\n"
+  "  -s, --stragglers S\n"
+  "              Of the workers, S never read from the coordinator\n"
+  "              (default: 0)\n"
+  "  --help\n"
+  "              Print this message and exit.\n"
+  "  --version\n"
+  "              Print version information and exit.\n"
+  "\n"
+  "Latencies are those of the barriers for the barrier and ckpt workloads,\n"
+  "and of the requests for the kvdb workload.  coordCPU is the CPU time of\n"
+  "the coordinator as a percentage of the elapsed time.\n"
+  "\n"
+  HELP_AND_CONTACT_INFO
+  "\n";
+
+enum Workload {
+  WORKLOAD_BARRIER,
+  WORKLOAD_CKPT,
+  WORKLOAD_KVDB
+};
+
+// The barriers of a checkpoint, and the worker state in which each of them
+// is reached.
+static const char *ckptBarriers[] = {
+  "DMT:SUSPEND", "DMT:CHECKPOINT", "DMT:WriteCkpt"
+};
+static const WorkerState::eWorkerState ckptBarrierStates[] = {
+  WorkerState::PRESUSPEND, WorkerState::SUSPENDED, WorkerState::CHECKPOINTED
+};
+#define NUM_CKPT_BARRIERS (sizeof(ckptBarriers) / sizeof(ckptBarriers[0]))
+
+// State shared by the drivers, which may be processes; it lives in a
+// MAP_SHARED mapping, followed by the arrays below.
+struct SharedState {
+  pthread_barrier_t startBarrier;
+  uint64_t numMsgs;
+  uint32_t roundsDone;
+};
+
+static string tmpDir;
+static Workload workload = WORKLOAD_BARRIER;
+static int numWorkers;
+static int rounds = 100;
+static int kvdbOps = 10;
+static bool kvdbBatch = false;
+static int numDrivers = 1;
+static bool useProcesses = false;
+static int numStragglers = 0;
+static vector<int> socks;
+
+static SharedState *shared;
+static size_t sharedSize;
+static size_t numBarrierOps;
+static uint64_t *opFirst;      // first DMT_BARRIER sent, per barrier
+static uint64_t *opLast;       // last DMT_BARRIER_RELEASED received
+static uint64_t *roundStart;   // checkpoint requested, per round
+static uint64_t *roundEnd;     // last DMT_WORKER_RESUMING sent
+static size_t numKvdbSamples;
+static uint64_t *kvdbSamples;  // round trip of each KVDB request, or 0
+
+static uint64_t
+nowNs()
+{
+  struct timespec ts;
+  JASSERT(clock_gettime(CLOCK_MONOTONIC, &ts) == 0) (JASSERT_ERRNO);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+atomicMin(uint64_t *ptr, uint64_t value)
+{
+  uint64_t old = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+  while (value < old &&
+         !__atomic_compare_exchange_n(ptr, &old, value, false,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void
+atomicMax(uint64_t *ptr, uint64_t value)
+{
+  uint64_t old = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+  while (value > old &&
+         !__atomic_compare_exchange_n(ptr, &old, value, false,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+// Starts a coordinator that exits once the last worker disconnects, and
+// returns its port.
+static int
+startCoordinator(pid_t *pid)
+{
+  string portFile = tmpDir + "/port";
+  unlink(portFile.c_str());
+
+  string coordinator =
+    jalib::Filesystem::GetProgramDir() + "/dmtcp_coordinator";
+  *pid = fork();
+  JASSERT(*pid != -1) (JASSERT_ERRNO);
+  if (*pid == 0) {
+    int fd = open("/dev/null", O_RDWR);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    dup2(fd, jalib::stderrFd());
+    execl(coordinator.c_str(), coordinator.c_str(), "-q", "-q",
+          "--exit-on-last", "--port", "0", "--port-file", portFile.c_str(),
+          "--ckptdir", tmpDir.c_str(), "--tmpdir", tmpDir.c_str(), NULL);
+    JASSERT(false) (coordinator) (JASSERT_ERRNO)
+      .Text("Failed to start coordinator");
+  }
+
+  // Wait for the port file.
+  for (int i = 0; i < 1000; i++) {
+    char buf[32] = "";
+    if (Util::readAll(portFile.c_str(), buf, sizeof(buf) - 1) > 0) {
+      return jalib::StringToInt(buf);
+    }
+    struct timespec sleepTime = { 0, 10 * 1000 * 1000 };
+    nanosleep(&sleepTime, NULL);
+  }
+  JASSERT(false).Text("Coordinator did not start");
+  return -1;
+}
+
+// Returns the CPU time used by the coordinator so far, in seconds.
+static double
+coordCpuTime(pid_t pid)
+{
+  char path[64];
+  char buf[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  ssize_t len = Util::readAll(path, buf, sizeof(buf) - 1);
+  JASSERT(len > 0) (path) (JASSERT_ERRNO);
+  buf[len] = '\0';
+
+  // The fields after the command name, which is in parentheses, start with
+  // the state; utime and stime are the 12th and 13th of them.
+  vector<string> fields = tokenizeString(strrchr(buf, ')') + 1, " ");
+  JASSERT(fields.size() > 12) (buf);
+  uint64_t ticks = jalib::StringToInt64(fields[11]) +
+                   jalib::StringToInt64(fields[12]);
+  return (double)ticks / sysconf(_SC_CLK_TCK);
+}
+
+static void
+sendMsg(int sock, const DmtcpMessage &msg, const void *extraData = NULL)
+{
+  JASSERT(Util::writeAll(sock, &msg, sizeof(msg)) == sizeof(msg))
+    (JASSERT_ERRNO);
+  if (msg.extraBytes > 0) {
+    JASSERT(Util::writeAll(sock, extraData, msg.extraBytes) ==
+            (ssize_t)msg.extraBytes) (JASSERT_ERRNO);
+  }
+}
+
+static void
+recvMsg(int sock, DmtcpMessage *msg, char *extraData, size_t len)
+{
+  JASSERT(Util::readAll(sock, msg, sizeof(*msg)) == sizeof(*msg))
+    (JASSERT_ERRNO);
+  msg->assertValid();
+  JASSERT(msg->extraBytes <= len) (msg->extraBytes) (len);
+  if (msg->extraBytes > 0) {
+    JASSERT(Util::readAll(sock, extraData, msg->extraBytes) ==
+            (ssize_t)msg->extraBytes) (JASSERT_ERRNO);
+  }
+}
+
+static int
+connectToCoordinator(int port)
+{
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  JASSERT(sock != -1) (JASSERT_ERRNO);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  JASSERT(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    (port) (JASSERT_ERRNO);
+
+  int one = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return sock;
+}
+
+// Connects a worker as dmtcp_launch would: a DMT_NEW_WORKER handshake,
+// carrying the hostname and program name.
+static int
+connectWorker(int port, int n)
+{
+  int sock = connectToCoordinator(port);
+
+  const char processInfo[] = "localhost\0dmtcp_coord_bench";
+  DmtcpMessage hello(DMT_NEW_WORKER);
+  hello.state = WorkerState::RUNNING;
+  hello.from = UniquePid(UniquePid::ThisProcess().hostid(),
+                         INITIAL_VIRTUAL_PID + n,
+                         UniquePid::ThisProcess().time());
+  hello.extraBytes = sizeof(processInfo);
+  sendMsg(sock, hello, processInfo);
+
+  DmtcpMessage reply;
+  char extraData[PATH_MAX];
+  recvMsg(sock, &reply, extraData, sizeof(extraData));
+  JASSERT(reply.type == DMT_ACCEPT) (reply.type);
+  return sock;
+}
+
+// Sends a command to the coordinator as dmtcp_command does, and returns its
+// status.
+static int
+sendUserCommand(int port, char cmd)
+{
+  int sock = connectToCoordinator(port);
+
+  DmtcpMessage msg(DMT_USER_CMD);
+  msg.coordCmd = cmd;
+  sendMsg(sock, msg);
+
+  DmtcpMessage reply;
+  char extraData[PATH_MAX];
+  recvMsg(sock, &reply, extraData, sizeof(extraData));
+  JASSERT(reply.type == DMT_USER_CMD_RESULT) (reply.type);
+  close(sock);
+  return reply.coordCmdStatus;
+}
+
+static bool
+isStraggler(int w)
+{
+  return w < numStragglers;
+}
+
+// Runs one barrier across the workers of driver d.  Returns the number of
+// messages sent and received.
+static uint64_t
+runBarrier(int d, const char *name, size_t op,
+           WorkerState::eWorkerState state)
+{
+  uint64_t numMsgs = 0;
+  DmtcpMessage msg(DMT_BARRIER);
+  msg.state = state;
+  msg.numPeers = 1;
+  strncpy(msg.barrier, name, sizeof(msg.barrier) - 1);
+
+  atomicMin(&opFirst[op], nowNs());
+  for (int w = d; w < numWorkers; w += numDrivers) {
+    sendMsg(socks[w], msg);
+    numMsgs++;
+  }
+
+  for (int w = d; w < numWorkers; w += numDrivers) {
+    if (isStraggler(w)) {
+      continue;
+    }
+    DmtcpMessage reply;
+    char extraData[sizeof(msg.barrier)];
+    recvMsg(socks[w], &reply, extraData, sizeof(extraData));
+    JASSERT(reply.type == DMT_BARRIER_RELEASED) (reply.type);
+    JASSERT(strcmp(extraData, msg.barrier) == 0) (extraData) (msg.barrier);
+    numMsgs++;
+  }
+  atomicMax(&opLast[op], nowNs());
+  return numMsgs;
+}
+
+// Runs the worker side of a checkpoint, as DmtcpWorker does, with
+// checkpoint images that are never written.
+static uint64_t
+runCkpt(int d, int round)
+{
+  uint64_t numMsgs = 0;
+
+  for (int w = d; w < numWorkers; w += numDrivers) {
+    if (isStraggler(w)) {
+      continue;
+    }
+    DmtcpMessage msg;
+    char extraData[PATH_MAX];
+    recvMsg(socks[w], &msg, extraData, sizeof(extraData));
+    JASSERT(msg.type == DMT_DO_CHECKPOINT) (msg.type);
+    numMsgs++;
+  }
+
+  for (size_t i = 0; i < NUM_CKPT_BARRIERS; i++) {
+    numMsgs += runBarrier(d, ckptBarriers[i], round * NUM_CKPT_BARRIERS + i,
+                          ckptBarrierStates[i]);
+  }
+
+  // The filename, the remote shell type and the hostname.
+  for (int w = d; w < numWorkers; w += numDrivers) {
+    char extraData[PATH_MAX];
+    int len = snprintf(extraData, sizeof(extraData),
+                       "%s/ckpt_bench_%d.dmtcp%c%clocalhost",
+                       tmpDir.c_str(), w, '\0', '\0');
+    JASSERT(len > 0 && len < (int)sizeof(extraData)) (len);
+    DmtcpMessage msg(DMT_CKPT_FILENAME);
+    msg.state = WorkerState::CHECKPOINTED;
+    msg.extraBytes = len + 1;
+    sendMsg(socks[w], msg, extraData);
+    numMsgs++;
+  }
+
+  for (int w = d; w < numWorkers; w += numDrivers) {
+    DmtcpMessage msg(DMT_WORKER_RESUMING);
+    msg.state = WorkerState::RUNNING;
+    sendMsg(socks[w], msg);
+    numMsgs++;
+  }
+  atomicMax(&roundEnd[round], nowNs());
+  return numMsgs;
+}
+
+// Sends a KVDB set or get for each of the workers of driver d, and then
+// reads the responses.  With --batch, op is 0 and each request is an MSET or
+// an MGET of all kvdbOps keys of the worker.
+static uint64_t
+runKvdb(int d, int round, int op, bool isSet)
+{
+  uint64_t numMsgs = 0;
+  int numKeys = kvdbBatch ? kvdbOps : 1;
+  vector<uint64_t> sendTime(numWorkers);
+  vector<char> extraData;
+  char val[64];
+  memset(val, 'v', sizeof(val) - 1);
+  val[sizeof(val) - 1] = '\0';
+
+  for (int w = d; w < numWorkers; w += numDrivers) {
+    DmtcpMessage msg(DMT_KVDB_REQUEST);
+    msg.state = WorkerState::RUNNING;
+    if (kvdbBatch) {
+      msg.kvdbRequest = isSet ? kvdb::KVDBRequest::MSET
+                              : kvdb::KVDBRequest::MGET;
+      msg.numKeys = numKeys;
+    } else {
+      msg.kvdbRequest = isSet ? kvdb::KVDBRequest::SET
+                              : kvdb::KVDBRequest::GET;
+    }
+    strncpy(msg.kvdbId, "/bench", sizeof(msg.kvdbId) - 1);
+
+    extraData.clear();
+    for (int k = 0; k < numKeys; k++) {
+      char key[32];
+      snprintf(key, sizeof(key), "%d.%d", w, op + k);
+      extraData.insert(extraData.end(), key, key + strlen(key) + 1);
+    }
+    msg.keyLen = extraData.size();
+    for (int k = 0; k < numKeys; k++) {
+      if (isSet) {
+        extraData.insert(extraData.end(), val, val + sizeof(val));
+      } else if (!kvdbBatch) {
+        extraData.push_back('\0');
+      }
+    }
+    msg.valLen = extraData.size() - msg.keyLen;
+    msg.extraBytes = extraData.size();
+
+    sendTime[w] = nowNs();
+    sendMsg(socks[w], msg, extraData.data());
+    numMsgs++;
+  }
+
+  vector<char> replyData(numKeys * (sizeof(kvdb::KVDBResponse) + sizeof(val)));
+  for (int w = d; w < numWorkers; w += numDrivers) {
+    if (isStraggler(w)) {
+      continue;
+    }
+    DmtcpMessage reply;
+    recvMsg(socks[w], &reply, replyData.data(), replyData.size());
+    JASSERT(reply.type == DMT_KVDB_RESPONSE) (reply.type);
+    JASSERT(reply.kvdbResponse == kvdb::KVDBResponse::SUCCESS)
+      ((int)reply.kvdbResponse);
+    numMsgs++;
+
+    size_t sample = ((size_t)(round * kvdbOps + op) * 2 + isSet) * numWorkers;
+    kvdbSamples[sample + w] = nowNs() - sendTime[w];
+  }
+  return numMsgs;
+}
+
+static void
+runDriver(int d)
+{
+  uint64_t numMsgs = 0;
+
+  pthread_barrier_wait(&shared->startBarrier);
+  for (int round = 0; round < rounds; round++) {
+    if (workload == WORKLOAD_BARRIER) {
+      char name[32];
+      snprintf(name, sizeof(name), "BENCH:%d", round);
+      numMsgs += runBarrier(d, name, round, WorkerState::RUNNING);
+    } else if (workload == WORKLOAD_CKPT) {
+      numMsgs += runCkpt(d, round);
+      __atomic_add_fetch(&shared->roundsDone, 1, __ATOMIC_RELEASE);
+    } else {
+      for (int op = 0; op < kvdbOps; op += kvdbBatch ? kvdbOps : 1) {
+        numMsgs += runKvdb(d, round, op, true);
+        numMsgs += runKvdb(d, round, op, false);
+      }
+    }
+  }
+  __atomic_add_fetch(&shared->numMsgs, numMsgs, __ATOMIC_RELAXED);
+}
+
+static void *
+driverThread(void *arg)
+{
+  runDriver((int)(intptr_t)arg);
+  return NULL;
+}
+
+// Requests a checkpoint for each round, once the previous one is done.
+static void
+requestCheckpoints(int port)
+{
+  for (int round = 0; round < rounds; round++) {
+    while (__atomic_load_n(&shared->roundsDone, __ATOMIC_ACQUIRE) <
+           (uint32_t)(round * numDrivers)) {
+      sched_yield();
+    }
+
+    // The last DMT_WORKER_RESUMING may still be on its way.
+    while (true) {
+      roundStart[round] = nowNs();
+      int status = sendUserCommand(port, 'c');
+      if (status == CoordCmdStatus::NOERROR) {
+        break;
+      }
+      JASSERT(status == CoordCmdStatus::ERROR_NOT_RUNNING_STATE) (status);
+      struct timespec sleepTime = { 0, 100 * 1000 };
+      nanosleep(&sleepTime, NULL);
+    }
+  }
+}
+
+// Maps the state shared by the drivers.
+static void
+mapSharedState()
+{
+  numBarrierOps = workload == WORKLOAD_CKPT ? rounds * NUM_CKPT_BARRIERS
+                                            : rounds;
+  numKvdbSamples = workload == WORKLOAD_KVDB
+                   ? (size_t)rounds * kvdbOps * 2 * numWorkers : 0;
+  sharedSize = sizeof(SharedState) +
+               (2 * numBarrierOps + 2 * rounds + numKvdbSamples) *
+               sizeof(uint64_t);
+
+  void *addr = mmap(NULL, sharedSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  JASSERT(addr != MAP_FAILED) (sharedSize) (JASSERT_ERRNO);
+  shared = (SharedState *)addr;
+  opFirst = (uint64_t *)(shared + 1);
+  opLast = opFirst + numBarrierOps;
+  roundStart = opLast + numBarrierOps;
+  roundEnd = roundStart + rounds;
+  kvdbSamples = roundEnd + rounds;
+
+  for (size_t i = 0; i < numBarrierOps; i++) {
+    opFirst[i] = UINT64_MAX;
+  }
+
+  pthread_barrierattr_t attr;
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  JASSERT(pthread_barrier_init(&shared->startBarrier, &attr,
+                               numDrivers + 1) == 0);
+  pthread_barrierattr_destroy(&attr);
+}
+
+static void
+unmapSharedState()
+{
+  pthread_barrier_destroy(&shared->startBarrier);
+  JASSERT(munmap(shared, sharedSize) == 0) (JASSERT_ERRNO);
+}
+
+// Removes the port file and the restart scripts that the coordinator wrote.
+static void
+removeTmpFiles()
+{
+  vector<string> files = jalib::Filesystem::ListDirEntries(tmpDir);
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i] != "." && files[i] != "..") {
+      unlink((tmpDir + "/" + files[i]).c_str());
+    }
+  }
+}
+
+static void
+runBenchmark()
+{
+  pid_t coordPid;
+  int port = startCoordinator(&coordPid);
+
+  for (int i = 0; i < numWorkers; i++) {
+    socks.push_back(connectWorker(port, i));
+  }
+
+  mapSharedState();
+  vector<pthread_t> threads;
+  vector<pid_t> children;
+  for (int d = 0; d < numDrivers; d++) {
+    if (useProcesses) {
+      pid_t pid = fork();
+      JASSERT(pid != -1) (JASSERT_ERRNO);
+      if (pid == 0) {
+        runDriver(d);
+        _exit(0);
+      }
+      children.push_back(pid);
+    } else {
+      pthread_t thread;
+      JASSERT(pthread_create(&thread, NULL, driverThread,
+                             (void *)(intptr_t)d) == 0);
+      threads.push_back(thread);
+    }
+  }
+
+  double startCpu = coordCpuTime(coordPid);
+  uint64_t start = nowNs();
+  pthread_barrier_wait(&shared->startBarrier);
+  if (workload == WORKLOAD_CKPT) {
+    requestCheckpoints(port);
+  }
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    JASSERT(pthread_join(threads[i], NULL) == 0);
+  }
+  for (size_t i = 0; i < children.size(); i++) {
+    int status;
+    JASSERT(waitpid(children[i], &status, 0) == children[i]) (JASSERT_ERRNO);
+    JASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0) (status)
+      .Text("Driver failed");
+  }
+  uint64_t elapsed = nowNs() - start;
+  double coordCpu = coordCpuTime(coordPid) - startCpu;
+
+  for (size_t i = 0; i < socks.size(); i++) {
+    close(socks[i]);
+  }
+  socks.clear();
+  JASSERT(waitpid(coordPid, NULL, 0) == coordPid) (JASSERT_ERRNO);
+  removeTmpFiles();
+
+  vector<uint64_t> latencies;
+  if (workload != WORKLOAD_KVDB) {
+    for (size_t i = 0; i < numBarrierOps; i++) {
+      latencies.push_back(opLast[i] - opFirst[i]);
+    }
+  }
+  for (size_t i = 0; i < numKvdbSamples; i++) {
+    if (kvdbSamples[i] != 0) {
+      latencies.push_back(kvdbSamples[i]);
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  size_t n = latencies.size();
+
+  double usecPerRound = elapsed / 1000.0 / rounds;
+  if (workload == WORKLOAD_CKPT) {
+    uint64_t total = 0;
+    for (int i = 0; i < rounds; i++) {
+      total += roundEnd[i] - roundStart[i];
+    }
+    usecPerRound = total / 1000.0 / rounds;
+  }
+
+  printf("%8d %7d %7d %11.0f %11.1f %9.1f %9.1f %9.1f %9.1f %7.1f%%\n",
+         numWorkers, numDrivers, rounds,
+         shared->numMsgs / (elapsed / 1e9), usecPerRound,
+         latencies[n / 2] / 1000.0, latencies[n * 90 / 100] / 1000.0,
+         latencies[n * 99 / 100] / 1000.0, latencies[n - 1] / 1000.0,
+         100 * coordCpu / (elapsed / 1e9));
+  fflush(stdout);
+  unmapSharedState();
+}
+
+// shift args
+#define shift argc--, argv++
+
+int
+main(int argc, char **argv)
+{
+  vector<int> workerCounts;
+  string workloadName = "barrier";
+
+  setenv("DMTCP_COMMAND", "1", 1); // for jalloc.cpp/sync_bool_compare_adn_swap
+  initializeJalib();
+
+  shift;
+  while (argc > 0) {
+    string s = argv[0];
+    if (s == "--help" || s == "-h") {
+      printf("%s", theUsage);
+      return 0;
+    } else if (s == "--version") {
+      printf("%s", DMTCP_VERSION_AND_COPYRIGHT_INFO);
+      return 0;
+    } else if (argc > 1 && (s == "-n" || s == "--workers")) {
+      vector<string> list = tokenizeString(argv[1], ",");
+      for (size_t i = 0; i < list.size(); i++) {
+        workerCounts.push_back(jalib::StringToInt(list[i]));
+      }
+      shift; shift;
+    } else if (argc > 1 && (s == "-w" || s == "--workload")) {
+      workloadName = argv[1];
+      shift; shift;
+    } else if (argc > 1 && (s == "-r" || s == "--rounds")) {
+      rounds = jalib::StringToInt(argv[1]);
+      shift; shift;
+    } else if (argc > 1 && (s == "-k" || s == "--kvdb-ops")) {
+      kvdbOps = jalib::StringToInt(argv[1]);
+      shift; shift;
+    } else if (s == "-b" || s == "--batch") {
+      kvdbBatch = true;
+      shift;
+    } else if (argc > 1 && (s == "-t" || s == "--threads")) {
+      numDrivers = jalib::StringToInt(argv[1]);
+      useProcesses = false;
+      shift; shift;
+    } else if (argc > 1 && (s == "-p" || s == "--processes")) {
+      numDrivers = jalib::StringToInt(argv[1]);
+      useProcesses = true;
+      shift; shift;
+    } else if (argc > 1 && (s == "-s" || s == "--stragglers")) {
+      numStragglers = jalib::StringToInt(argv[1]);
+      shift; shift;
+    } else {
+      fprintf(stderr, "%s", theUsage);
+      return 1;
+    }
+  }
+
+  if (workloadName == "barrier") {
+    workload = WORKLOAD_BARRIER;
+  } else if (workloadName == "ckpt") {
+    workload = WORKLOAD_CKPT;
+  } else if (workloadName == "kvdb") {
+    workload = WORKLOAD_KVDB;
+  } else {
+    fprintf(stderr, "%s", theUsage);
+    return 1;
+  }
+
+  if (workerCounts.empty()) {
+    workerCounts.push_back(16);
+    workerCounts.push_back(64);
+    workerCounts.push_back(256);
+    workerCounts.push_back(900);
+  }
+  JASSERT(rounds > 0 && kvdbOps > 0 && numDrivers > 0 && numStragglers >= 0)
+    (rounds) (kvdbOps) (numDrivers) (numStragglers);
+
+  struct rlimit rlim;
+  JASSERT(getrlimit(RLIMIT_NOFILE, &rlim) == 0) (JASSERT_ERRNO);
+  rlim.rlim_cur = rlim.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rlim);
+
+  // The coordinator hands out one range of virtual pids per process, and
+  // each worker takes a socket here and in the coordinator.
+  const int maxWorkers =
+    (MAX_VIRTUAL_PID - INITIAL_VIRTUAL_PID) / VIRTUAL_PID_STEP;
+  for (size_t i = 0; i < workerCounts.size(); i++) {
+    JASSERT(workerCounts[i] > numStragglers && workerCounts[i] <= maxWorkers)
+      (workerCounts[i]) (numStragglers) (maxWorkers);
+    JASSERT((rlim_t)workerCounts[i] + 64 <= rlim.rlim_cur)
+      (workerCounts[i]) (rlim.rlim_cur)
+      .Text("Too many workers for the open file limit");
+  }
+
+  char dirTemplate[] = "/tmp/dmtcp_coord_bench.XXXXXX";
+  JASSERT(mkdtemp(dirTemplate) != NULL) (JASSERT_ERRNO);
+  tmpDir = dirTemplate;
+
+  printf("workload: %s\n", workloadName.c_str());
+  printf("%8s %7s %7s %11s %11s %9s %9s %9s %9s %8s\n",
+         "workers", "drivers", "rounds", "msgs/sec", "usec/round",
+         "p50(us)", "p90(us)", "p99(us)", "max(us)", "coordCPU");
+  for (size_t i = 0; i < workerCounts.size(); i++) {
+    numWorkers = workerCounts[i];
+    runBenchmark();
+  }
+
+  JWARNING(rmdir(tmpDir.c_str()) == 0) (tmpDir) (JASSERT_ERRNO);
+  return 0;
+}
@@ -35,6 +35,23 @@
  * The prefix command 'b' (blocking) from dmtcp_command modifies behavior   *
  *   of 'c' so that the reply to dmtcp_command happens only when clients    *
  *   are back in RUNNING state.                                             *
+ * With forked checkpointing ('fc' or dmtcp_launch --forked-ckpt), workers  *
+ *   resume while forked copies of them write the images.  Each copy        *
+ *   connects as DMT_BACKGROUND_CKPT_WRITER and sends DMT_CKPT_FILENAME     *
+ *   when done; the restart script is written once all of them reported.   *
+ * DMT_CKPT_FILENAME, and DMT_WORKER_RESUMING after a restart, carry the    *
+ *   phase timings of the worker, which are summarized in a TimingReport    *
+ *   once all workers have reported.                                        *
+ * The user command 'm' (dmtcp_command --metrics) returns the metrics of   *
+ *   the coordinator in the Prometheus text format; see printMetrics().     *
+ * With node barriers (DMTCP_NODE_BARRIERS), a DMT_BARRIER msg may count    *
+ *   several processes of one node, and only its sender is released.       *
+ * Messages to clients never block the coordinator on a slow worker: each   *
+ *   CoordClient queues what its socket does not take at once, and sends    *
+ *   it on EPOLLOUT.  broadcastMessage serializes its msg only once.        *
+ * With --io-threads N, N CoordIOThreads read the client sockets, answer    *
+ *   KVDB requests themselves, and queue every other msg for this thread,   *
+ *   which alone changes the state of the computation.                      *
  * onData called when a message arrives at a client's port.  It either      *
  *   processes a per-client special request, or continues the protocol      *
  *   for a checkpoint or restart sequence (see below).                      *
@@ -43,6 +60,9 @@
  * The coordinator keeps a ComputationStatus, with minimumState and         *
  *   maximumState for states of all workers, accessed through getStatus()   *
  *   or through minimumState()                                              *
+ * getStatus() is computed from a count of peers in each state, which       *
+ *   CoordClient::setState() and CoordClient::setPeer() keep up to date,    *
+ *   so that it does not depend on the number of peers.                     *
  * The states for a worker (client) are:                                    *
  * Checkpoint: RUNNING -> SUSPENDED -> CHECKPOINTING                        *
  *                     -> (Checkpoint barriers) -> CHECKPOINTED             *
@@ -61,9 +81,13 @@
 #include <fcntl.h>
 #include <limits.h>  // for HOST_NAME_MAX
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -82,6 +106,7 @@
 #include "lookup_service.h"
 #include "protectedfds.h"
 #include "restartscript.h"
+#include "timingreport.h"
 #include "tokenize.h"
 #include "syscallwrappers.h"
 #include "util.h"
@@ -97,9 +122,12 @@ static const char *theHelpMessage =
   "COMMANDS:\n"
   "  l: List connected nodes\n"
   "  s: Print status message\n"
+  "  m: Print metrics\n"
   "  c: Checkpoint all nodes\n"
   "  ck: kc: \n"
   "     Checkpoint and then kill all nodes\n"
+  "  fc: Checkpoint all nodes; resume them while forked processes\n"
+  "      write the checkpoint images\n"
   "  i: Print current checkpoint interval\n"
   "     (To change checkpoint interval, use dmtcp_command)\n"
   "  k: Kill all nodes\n"
@@ -137,6 +165,9 @@ static const char *theUsage =
   "  --daemon\n"
   "      Run silently in the background after detaching from the parent "
   "process.\n"
+  "  --io-threads N (environment variable DMTCP_COORD_IO_THREADS)\n"
+  "      Read the messages of the processes on N threads, which also answer\n"
+  "      their key-value requests (default: 0, all on the main thread)\n"
   "  -i, --interval (environment variable DMTCP_CHECKPOINT_INTERVAL):\n"
   "      Time in seconds between automatic checkpoints\n"
   "      (default: 0, disabled)\n"
@@ -160,6 +191,7 @@ CoordFlags flags;
 static int offset_after_first_line = 0;
 static bool blockUntilDone = false;
 static bool killAfterCkptOnce = false;
+static bool forkedCkptOnce = false;
 static int blockUntilDoneRemote = -1;
 
 static DmtcpCoordinator theCoordinator;
@@ -180,6 +212,11 @@ static DmtcpCoordinator theCoordinator;
 */
 static bool workersRunningAndSuspendMsgSent = false;
 
+/* Set once the workers have resumed from a forked checkpoint whose images
+ * are still being written.  No new checkpoint is started until then.
+ */
+static bool forkedCkptInProgress = false;
+
 static bool killInProgress = false;
 static bool uniqueCkptFilenames = false;
 
@@ -189,6 +226,7 @@ JTIMER(checkpoint);
 JTIMER(restart);
 
 static int workersAtCurrentBarrier = 0;
+static int numPeersInState[WorkerState::_MAX];
 static string currentBarrier;
 static string prevBarrier;
 static ssize_t eventId = 0;
@@ -199,6 +237,46 @@ static time_t curTimeStamp = -1;
 static time_t ckptTimeStamp = -1;
 
 static LookupService lookupService;
+static TimingReport ckptTimings("checkpoint");
+static TimingReport restartTimings("restart");
+
+// The last checkpoints, for the metrics; see printMetrics().
+#define CKPT_HISTORY_SIZE 16
+struct CkptRecord {
+  uint32_t generation;
+  time_t timestamp;
+  uint64_t durationNs;
+  uint64_t imageBytes;
+  uint32_t numProcesses;
+  bool failed;
+};
+static CkptRecord ckptHistory[CKPT_HISTORY_SIZE];
+static size_t numCkpts = 0;
+static size_t numFailedCkpts = 0;
+static uint64_t ckptStartNs = 0;
+static uint64_t ckptImageBytes = 0;
+
+// The time taken to handle the events returned by one epoll_wait(), during
+// which new events wait.
+static uint64_t loopLagNs = 0;
+static uint64_t maxLoopLagNs = 0;
+static uint64_t loopBusyNs = 0;
+static uint64_t numLoopIterations = 0;
+
+// With --io-threads; see CoordIOThread.
+static vector<CoordIOThread *> ioThreads;
+
+// The messages and lost connections that the I/O threads queue for the
+// control thread.  A message of type DMT_NULL stands for a lost connection.
+// queuedEventsFd, an eventfd, wakes up the control thread.
+struct CoordEvent {
+  CoordClient *client;
+  DmtcpMessage msg;
+  char *extraData;
+};
+static vector<CoordEvent> queuedEvents;
+static DmtcpMutex queuedEventsLock = DMTCP_MUTEX_INITIALIZER;
+static int queuedEventsFd = -1;
 
 static string coordHostname;
 static struct in_addr localhostIPAddr;
@@ -267,9 +345,16 @@ CoordClient::CoordClient(const jalib::JSocket &sock,
                          DmtcpMessage &hello_remote,
                          int isNSWorker)
   : _sock(sock),
-    _barrier("")
+    _barrier(""),
+    _numArrivals(0),
+    _ioThread(NULL),
+    _outHead(0),
+    _watchingOutput(false)
 {
+  DmtcpMutexInit(&_outLock, DMTCP_MUTEX_NORMAL);
   _isNSWorker = isNSWorker;
+  _isCkptWriter = false;
+  _isPeer = false;
   _realPid = hello_remote.realPid;
   _clientNumber = theNextClientNumber++;
   _identity = hello_remote.from;
@@ -278,6 +363,230 @@ CoordClient::CoordClient(const jalib::JSocket &sock,
   _ip = inet_ntoa(in->sin_addr);
 }
 
+CoordClient::~CoordClient()
+{
+  clearOutput();
+}
+
+void
+CoordClient::setState(WorkerState::eWorkerState value)
+{
+  if (_isPeer) {
+    numPeersInState[_state]--;
+    numPeersInState[value]++;
+  }
+  _state = value;
+}
+
+void
+CoordClient::setPeer(bool value)
+{
+  if (value != _isPeer) {
+    numPeersInState[_state] += value ? 1 : -1;
+    _isPeer = value;
+  }
+}
+
+// Recycled CoordMsgBuffers; a broadcast to any number of clients takes one.
+#define MAX_FREE_MSG_BUFFERS 64
+static vector<CoordMsgBuffer *> freeMsgBuffers;
+static DmtcpMutex freeMsgBuffersLock = DMTCP_MUTEX_INITIALIZER;
+
+CoordMsgBuffer *
+CoordMsgBuffer::create(const DmtcpMessage &msg, const void *extraData)
+{
+  CoordMsgBuffer *buf = NULL;
+  DmtcpMutexLock(&freeMsgBuffersLock);
+  if (!freeMsgBuffers.empty()) {
+    buf = freeMsgBuffers.back();
+    freeMsgBuffers.pop_back();
+  }
+  DmtcpMutexUnlock(&freeMsgBuffersLock);
+  if (buf == NULL) {
+    buf = new CoordMsgBuffer();
+  }
+
+  buf->_data.resize(sizeof(msg) + msg.extraBytes);
+  memcpy(&buf->_data[0], &msg, sizeof(msg));
+  if (msg.extraBytes > 0) {
+    JASSERT(extraData != NULL) (msg.type) (msg.extraBytes);
+    memcpy(&buf->_data[sizeof(msg)], extraData, msg.extraBytes);
+  }
+  buf->_refCount = 1;
+  return buf;
+}
+
+void
+CoordMsgBuffer::release()
+{
+  int refCount = __sync_sub_and_fetch(&_refCount, 1);
+  JASSERT(refCount >= 0) (refCount);
+  if (refCount > 0) {
+    return;
+  }
+
+  DmtcpMutexLock(&freeMsgBuffersLock);
+  bool recycled = freeMsgBuffers.size() < MAX_FREE_MSG_BUFFERS;
+  if (recycled) {
+    freeMsgBuffers.push_back(this);
+  }
+  DmtcpMutexUnlock(&freeMsgBuffersLock);
+  if (!recycled) {
+    delete this;
+  }
+}
+
+// Returns the number of bytes sent, 0 if the socket is full, or -1 if the
+// connection is broken; the latter is handled once epoll reports it.
+static ssize_t
+sendNonBlocking(int fd, const char *buf, size_t len)
+{
+  ssize_t ret;
+  do {
+    ret = ::send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (ret == -1 && errno == EINTR);
+
+  if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
+  return ret;
+}
+
+static uint32_t
+clientEvents(bool watchOutput)
+{
+#ifdef EPOLLRDHUP
+  uint32_t events = EPOLLIN | EPOLLRDHUP;
+#else // ifdef EPOLLRDHUP
+  uint32_t events = EPOLLIN;
+#endif // ifdef EPOLLRDHUP
+  return watchOutput ? events | EPOLLOUT : events;
+}
+
+void
+CoordClient::send(const DmtcpMessage &msg, const void *extraData)
+{
+  CoordMsgBuffer *buf = CoordMsgBuffer::create(msg, extraData);
+  send(buf);
+  buf->release();
+}
+
+void
+CoordClient::send(CoordMsgBuffer *buf)
+{
+  size_t offset = 0;
+
+  DmtcpMutexLock(&_outLock);
+  // Later messages must not overtake the ones still queued.
+  if (!hasPendingOutput()) {
+    ssize_t ret = sendNonBlocking(_sock.sockfd(), buf->data(), buf->size());
+    if (ret < 0) {
+      JTRACE("Failed to send message; probably dead connection.")
+        (_identity) (JASSERT_ERRNO);
+      DmtcpMutexUnlock(&_outLock);
+      return;
+    }
+    if ((size_t)ret == buf->size()) {
+      DmtcpMutexUnlock(&_outLock);
+      return;
+    }
+    offset = ret;
+    watchOutput(true);
+  }
+
+  PendingOutput out = { buf, offset };
+  buf->addRef();
+  _outQueue.push_back(out);
+  DmtcpMutexUnlock(&_outLock);
+}
+
+void
+CoordClient::flushOutput()
+{
+  DmtcpMutexLock(&_outLock);
+  while (hasPendingOutput()) {
+    PendingOutput &out = _outQueue[_outHead];
+    ssize_t ret = sendNonBlocking(_sock.sockfd(),
+                                  out.buf->data() + out.offset,
+                                  out.buf->size() - out.offset);
+    if (ret < 0) {
+      JTRACE("Failed to send message; probably dead connection.")
+        (_identity) (JASSERT_ERRNO);
+      break;
+    }
+    out.offset += ret;
+    if (out.offset < out.buf->size()) {
+      DmtcpMutexUnlock(&_outLock);
+      return;
+    }
+    out.buf->release();
+    _outHead++;
+  }
+
+  clearOutput();
+  watchOutput(false);
+  DmtcpMutexUnlock(&_outLock);
+}
+
+// Waits up to timeoutMs for the queued messages to go out, e.g., the
+// DMT_KILL_PEER before the coordinator exits.
+void
+CoordClient::drainOutput(int timeoutMs)
+{
+  flushOutput();
+  while (hasPendingOutput()) {
+    struct pollfd pfd = { _sock.sockfd(), POLLOUT, 0 };
+    int ret = poll(&pfd, 1, timeoutMs);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+      JWARNING(false) (_identity) (_progname)
+        .Text("Dropping messages to unresponsive worker");
+      DmtcpMutexLock(&_outLock);
+      clearOutput();
+      DmtcpMutexUnlock(&_outLock);
+      return;
+    }
+    flushOutput();
+  }
+}
+
+void
+CoordClient::clearOutput()
+{
+  for (size_t i = _outHead; i < _outQueue.size(); i++) {
+    _outQueue[i].buf->release();
+  }
+  _outQueue.clear();
+  _outHead = 0;
+}
+
+void
+CoordClient::watchOutput(bool value)
+{
+  struct epoll_event ev;
+  int ret;
+
+  // Before addDataSocket(), there is nothing to modify; it watches the
+  // output itself if need be.
+  ev.data.ptr = this;
+  if (_ioThread == NULL) {
+    ev.events = clientEvents(value);
+    ret = epoll_ctl(epollFd, EPOLL_CTL_MOD, _sock.sockfd(), &ev);
+  } else if (value != _watchingOutput) {
+    // The input is watched by the I/O thread; the control thread sends what
+    // is left once the socket is writable.
+    ev.events = EPOLLOUT;
+    ret = epoll_ctl(epollFd, value ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                    _sock.sockfd(), &ev);
+  } else {
+    return;
+  }
+  JWARNING(ret != -1 || errno == ENOENT) (_sock.sockfd()) (JASSERT_ERRNO);
+  _watchingOutput = value && ret != -1;
+}
+
 void
 CoordClient::readProcessInfo(DmtcpMessage &msg)
 {
@@ -286,6 +595,11 @@ CoordClient::readProcessInfo(DmtcpMessage &msg)
     _sock.readAll(extraData, msg.extraBytes);
     _hostname = extraData;
     _progname = extraData + _hostname.length() + 1;
+    size_t offset = _hostname.length() + _progname.length() + 2;
+    if (offset < msg.extraBytes) {
+      _tmpDir = string(extraData + offset, strnlen(extraData + offset,
+                                                   msg.extraBytes - offset));
+    }
     delete[] extraData;
   }
 }
@@ -325,7 +639,8 @@ DmtcpCoordinator::handleUserCommand(string cmd, DmtcpMessage *reply /*= NULL*/)
     reply->coordCmdStatus = CoordCmdStatus::NOERROR;
   }
 
-  if (cmd == "bc" || cmd == "kc" || cmd == "ck" || cmd == "K" || cmd == "c") {
+  if (cmd == "bc" || cmd == "kc" || cmd == "ck" || cmd == "K" || cmd == "c" ||
+      cmd == "fc" || cmd == "F") {
     if (cmd == "bc") {
       blockUntilDone = true;
       JTRACE("blocking checkpoint beginning...");
@@ -333,6 +648,10 @@ DmtcpCoordinator::handleUserCommand(string cmd, DmtcpMessage *reply /*= NULL*/)
       // dmtcp_command encodes this as 'cmd == "K"; '-kc' is the user flag.
       JTRACE("Will kill peers after creating the checkpoint...");
       killAfterCkptOnce = true;
+    } else if (cmd == "fc" || cmd == "F") {
+      // dmtcp_command encodes '-fc' as 'cmd == "F"'.
+      JTRACE("forked checkpoint beginning...");
+      forkedCkptOnce = true;
     } else {
       JTRACE("checkpointing...");
     }
@@ -342,6 +661,7 @@ DmtcpCoordinator::handleUserCommand(string cmd, DmtcpMessage *reply /*= NULL*/)
         reply->numPeers = getStatus().numPeers;
       }
     } else {
+      forkedCkptOnce = false;
       if (reply != NULL) {
         reply->coordCmdStatus = CoordCmdStatus::ERROR_NOT_RUNNING_STATE;
       }
@@ -353,6 +673,13 @@ DmtcpCoordinator::handleUserCommand(string cmd, DmtcpMessage *reply /*= NULL*/)
     } else {
       JASSERT_STDERR << printList();
     }
+  } else if (cmd == "m") {
+    if (reply != NULL) {
+      replyData = printMetrics();
+      reply->extraBytes = replyData.length() + 1;
+    } else {
+      JASSERT_STDERR << printMetrics();
+    }
   } else if (cmd == "u") {
     JASSERT_STDERR << "Host List:\n";
     JASSERT_STDERR << "HOST => # connected clients \n";
@@ -374,6 +701,7 @@ DmtcpCoordinator::handleUserCommand(string cmd, DmtcpMessage *reply /*= NULL*/)
     broadcastMessage(DMT_KILL_PEER);
     JASSERT_STDERR << "DMTCP coordinator exiting... (per request)\n";
     for (size_t i = 0; i < clients.size(); i++) {
+      clients[i]->drainOutput(1000);
       clients[i]->sock().close();
     }
     listenSock->close();
@@ -397,6 +725,10 @@ DmtcpCoordinator::handleUserCommand(string cmd, DmtcpMessage *reply /*= NULL*/)
       reply->numPeers = s.numPeers;
       reply->isRunning = running;
       reply->theCheckpointInterval = CoordPluginMgr::ckptIntervalManager->theCheckpointInterval;
+      replyData = ckptTimings.summary() + restartTimings.summary();
+      if (!replyData.empty()) {
+        reply->extraBytes = replyData.length() + 1;
+      }
     } else {
       printStatus(s.numPeers, running);
     }
@@ -451,6 +783,8 @@ DmtcpCoordinator::printStatus(size_t numPeers, bool isRunning)
     << "Checkpoint Dir: " << flags.ckptDir << std::endl
     << "NUM_PEERS=" << numPeers << std::endl
     << "RUNNING=" << (isRunning ? "yes" : "no") << std::endl
+    << ckptTimings.summary()
+    << restartTimings.summary()
     << std::endl;
   printf("%s", o.str().c_str());
   fflush(stdout);
@@ -477,6 +811,124 @@ DmtcpCoordinator::printList()
   return o.str();
 }
 
+// A label value in the Prometheus text format.
+static string
+metricLabel(const string &value)
+{
+  string label;
+
+  for (size_t i = 0; i < value.length(); i++) {
+    if (value[i] == '\\' || value[i] == '"') {
+      label += '\\';
+      label += value[i];
+    } else if (value[i] == '\n') {
+      label += "\\n";
+    } else {
+      label += value[i];
+    }
+  }
+  return label;
+}
+
+// A snapshot of the state of the coordinator, in the Prometheus text format,
+// for monitoring tools: the clients in each state, the current barrier, the
+// last CKPT_HISTORY_SIZE checkpoints, the KVDB, and how long the event loop
+// takes to handle the events of one epoll_wait().  Rates are left to the
+// monitoring tool, which can derive them from the counters ("_total").
+string
+DmtcpCoordinator::printMetrics()
+{
+  ostringstream o;
+
+  o << "# HELP dmtcp_coordinator_clients Connected processes, by state.\n"
+    << "# TYPE dmtcp_coordinator_clients gauge\n";
+  for (int state = WorkerState::UNKNOWN; state < WorkerState::_MAX; state++) {
+    ostringstream name;
+    name << (WorkerState::eWorkerState)state;
+    o << "dmtcp_coordinator_clients{state=\""
+      << name.str().substr(strlen("WorkerState::")) << "\"} "
+      << numPeersInState[state] << "\n";
+  }
+
+  o << "# HELP dmtcp_coordinator_barrier_arrivals"
+    << " Processes at the current barrier.\n"
+    << "# TYPE dmtcp_coordinator_barrier_arrivals gauge\n"
+    << "dmtcp_coordinator_barrier_arrivals{barrier=\""
+    << metricLabel(currentBarrier) << "\"} " << workersAtCurrentBarrier
+    << "\n";
+
+  o << "# HELP dmtcp_computation_generation"
+    << " Checkpoints started since the computation began.\n"
+    << "# TYPE dmtcp_computation_generation gauge\n"
+    << "dmtcp_computation_generation " << compId.computationGeneration()
+    << "\n"
+    << "# HELP dmtcp_checkpoint_in_progress"
+    << " Whether a checkpoint is in progress.\n"
+    << "# TYPE dmtcp_checkpoint_in_progress gauge\n"
+    << "dmtcp_checkpoint_in_progress "
+    << (workersRunningAndSuspendMsgSent || forkedCkptInProgress ? 1 : 0)
+    << "\n"
+    << "# HELP dmtcp_checkpoints_total Checkpoints completed or failed.\n"
+    << "# TYPE dmtcp_checkpoints_total counter\n"
+    << "dmtcp_checkpoints_total " << numCkpts << "\n"
+    << "# HELP dmtcp_checkpoint_failures_total"
+    << " Checkpoints with images that could not be written.\n"
+    << "# TYPE dmtcp_checkpoint_failures_total counter\n"
+    << "dmtcp_checkpoint_failures_total " << numFailedCkpts << "\n";
+
+  size_t first = numCkpts > CKPT_HISTORY_SIZE ?
+                 numCkpts - CKPT_HISTORY_SIZE : 0;
+  const char *names[] = {
+    "duration_seconds", "image_bytes", "processes", "timestamp_seconds"
+  };
+  const char *help[] = {
+    "Time from the checkpoint request until all images were written.",
+    "Size of the images written by the checkpoint (0 if unknown).",
+    "Processes that wrote an image.",
+    "Time at which the checkpoint started, in seconds since the epoch."
+  };
+  for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+    o << "# HELP dmtcp_checkpoint_" << names[n] << " " << help[n] << "\n"
+      << "# TYPE dmtcp_checkpoint_" << names[n] << " gauge\n";
+    for (size_t i = first; i < numCkpts; i++) {
+      const CkptRecord &record = ckptHistory[i % CKPT_HISTORY_SIZE];
+      o << "dmtcp_checkpoint_" << names[n] << "{generation=\""
+        << record.generation << "\"} ";
+      switch (n) {
+      case 0: o << record.durationNs / 1e9; break;
+      case 1: o << record.imageBytes; break;
+      case 2: o << record.numProcesses; break;
+      case 3: o << record.timestamp; break;
+      }
+      o << "\n";
+    }
+  }
+
+  lookupService.writeMetrics(&o);
+
+  o << "# HELP dmtcp_coordinator_event_loop_lag_seconds"
+    << " Time taken to handle the last batch of events.\n"
+    << "# TYPE dmtcp_coordinator_event_loop_lag_seconds gauge\n"
+    << "dmtcp_coordinator_event_loop_lag_seconds " << loopLagNs / 1e9 << "\n"
+    << "# HELP dmtcp_coordinator_event_loop_max_lag_seconds"
+    << " Longest time taken to handle a batch of events.\n"
+    << "# TYPE dmtcp_coordinator_event_loop_max_lag_seconds gauge\n"
+    << "dmtcp_coordinator_event_loop_max_lag_seconds " << maxLoopLagNs / 1e9
+    << "\n"
+    << "# HELP dmtcp_coordinator_event_loop_busy_seconds_total"
+    << " Time spent handling events.\n"
+    << "# TYPE dmtcp_coordinator_event_loop_busy_seconds_total counter\n"
+    << "dmtcp_coordinator_event_loop_busy_seconds_total " << loopBusyNs / 1e9
+    << "\n"
+    << "# HELP dmtcp_coordinator_event_loop_iterations_total"
+    << " Batches of events handled.\n"
+    << "# TYPE dmtcp_coordinator_event_loop_iterations_total counter\n"
+    << "dmtcp_coordinator_event_loop_iterations_total " << numLoopIterations
+    << "\n";
+
+  return o.str();
+}
+
 void
 DmtcpCoordinator::recordEvent(string const& event)
 {
@@ -531,7 +983,7 @@ DmtcpCoordinator::releaseBarrier(const string &barrier)
 }
 
 void
-DmtcpCoordinator::processBarrier(const string &barrier)
+DmtcpCoordinator::processBarrier(const string &barrier, uint32_t numArrivals)
 {
   // Check if this is the first process to reach barrier.
   if (currentBarrier.empty()) {
@@ -540,13 +992,34 @@ DmtcpCoordinator::processBarrier(const string &barrier)
     JASSERT(barrier == currentBarrier) (barrier) (currentBarrier);
   }
 
-  ++workersAtCurrentBarrier;
+  workersAtCurrentBarrier += numArrivals;
 
   releaseBarrier(barrier);
 }
 
+// The name under which the phase timings of client are reported.
+static string
+timingProcessName(CoordClient *client)
+{
+  ostringstream o;
+  o << client->progname() << "[" << client->identity().pid() << "]@"
+    << client->hostname();
+  return o.str();
+}
+
+// The file with the phase timings of the last checkpoint or restart.
+static string
+timingFile(const char *event)
+{
+  ostringstream o;
+  o << flags.ckptDir << "/dmtcp_" << event << "_timings_" << compId << ".json";
+  return o.str();
+}
+
 void
-DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
+DmtcpCoordinator::recordCkptFilename(CoordClient *client,
+                                     const char *extraData,
+                                     size_t len)
 {
   client->setState(WorkerState::CHECKPOINTED);
   JASSERT(extraData != NULL)
@@ -560,6 +1033,13 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
   shellType = extraData + ckptFilename.length() + 1;
   hostname = extraData + shellType.length() + 1 + ckptFilename.length() + 1;
 
+  size_t timingsOffset = ckptFilename.length() + 1 + shellType.length() + 1 +
+                         hostname.length() + 1;
+  if (timingsOffset < len) {
+    ckptTimings.add(timingProcessName(client), extraData + timingsOffset,
+                    len - timingsOffset);
+  }
+
   JTRACE("recording restart info") (ckptFilename) (hostname);
   JTRACE ( "recording restart info with shellType" )
     ( ckptFilename ) ( hostname ) (shellType);
@@ -575,7 +1055,15 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
   }
   _numRestartFilenames++;
 
-  if (_numRestartFilenames == _numCkptWorkers) {
+  if (_numRestartFilenames + _numFailedCkptWriters == _numCkptWorkers) {
+    finishCheckpoint();
+  }
+}
+
+void
+DmtcpCoordinator::finishCheckpoint()
+{
+  if (_numFailedCkptWriters == 0) {
     const string restartScriptPath =
       RestartScript::writeScript(
         flags.ckptDir,
@@ -589,29 +1077,58 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
         _sshCmdFileNames);
 
     JNOTE("Checkpoint complete. Wrote restart script") (restartScriptPath);
-
-    JTIMER_STOP(checkpoint);
     recordEvent("Ckpt-Complete");
-    serializeKVDB();
+  } else {
+    JWARNING(false) (_numFailedCkptWriters)
+      .Text("Some checkpoint images could not be written."
+            "  The restart script was not updated.");
+    recordEvent("Ckpt-Failed");
+  }
 
-    if (blockUntilDone) {
-      DmtcpMessage blockUntilDoneReply(DMT_USER_CMD_RESULT);
-      JNOTE("replying to dmtcp_command:  we're done");
+  JTIMER_STOP(checkpoint);
+  ckptTimings.finish(timingFile("ckpt"));
+
+  CkptRecord *record = &ckptHistory[numCkpts++ % CKPT_HISTORY_SIZE];
+  record->generation = compId.computationGeneration();
+  record->timestamp = ckptTimeStamp;
+  record->durationNs = getCurrTimestamp() - ckptStartNs;
+  record->imageBytes = ckptImageBytes;
+  record->numProcesses = _numRestartFilenames;
+  record->failed = _numFailedCkptWriters > 0;
+  if (record->failed) {
+    numFailedCkpts++;
+  }
+  serializeKVDB();
 
-      // These were set in DmtcpCoordinator::onConnect in this file
-      jalib::JSocket remote(blockUntilDoneRemote);
-      remote << blockUntilDoneReply;
-      remote.close();
-      blockUntilDone = false;
-      blockUntilDoneRemote = -1;
-    }
+  if (blockUntilDone) {
+    DmtcpMessage blockUntilDoneReply(DMT_USER_CMD_RESULT);
+    JNOTE("replying to dmtcp_command:  we're done");
 
-    killAfterCkptOnce = false;
-    _numRestartFilenames = 0;
-    _numCkptWorkers = 0;
+    // These were set in DmtcpCoordinator::onConnect in this file
+    jalib::JSocket remote(blockUntilDoneRemote);
+    remote << blockUntilDoneReply;
+    remote.close();
+    blockUntilDone = false;
+    blockUntilDoneRemote = -1;
+  }
+
+  killAfterCkptOnce = false;
+  forkedCkptOnce = false;
+  _numRestartFilenames = 0;
+  _numFailedCkptWriters = 0;
+  _numCkptWorkers = 0;
 
-    // All the workers have checkpointed so now it is safe to reset this flag.
-    workersRunningAndSuspendMsgSent = false;
+  // All the workers have checkpointed so now it is safe to reset this flag.
+  workersRunningAndSuspendMsgSent = false;
+
+  if (forkedCkptInProgress) {
+    forkedCkptInProgress = false;
+
+    // The last client may have exited while its image was being written.
+    if (flags.exitOnLast && getStatus().numPeers < 1) {
+      JNOTE("last client exited, shutting down..");
+      handleUserCommand("q");
+    }
   }
 }
 
@@ -635,6 +1152,15 @@ DmtcpCoordinator::onData(CoordClient *client)
     client->sock().readAll(extraData, msg.extraBytes);
   }
 
+  processMessage(client, msg, extraData);
+  delete[] extraData;
+}
+
+void
+DmtcpCoordinator::processMessage(CoordClient *client,
+                                 DmtcpMessage &msg,
+                                 char *extraData)
+{
   WorkerState::eWorkerState prevClientState = client->state();
   client->setState(msg.state);
 
@@ -646,6 +1172,10 @@ DmtcpCoordinator::onData(CoordClient *client)
 
     client->setBarrier("");
 
+    if (prevClientState == WorkerState::RESTARTING && extraData != NULL) {
+      restartTimings.add(timingProcessName(client), extraData, msg.extraBytes);
+    }
+
     ComputationStatus s = getStatus();
 
     if (s.minimumStateUnanimous && s.minimumState == WorkerState::RUNNING) {
@@ -654,10 +1184,19 @@ DmtcpCoordinator::onData(CoordClient *client)
       if (prevClientState == WorkerState::RESTARTING) {
           JTIMER_STOP(restart);
           recordEvent("Restart-Complete");
+          restartTimings.finish(timingFile("restart"));
           serializeKVDB();
           CoordPluginMgr::resumeAfterRestart(s);
         } else {
           CoordPluginMgr::resumeAfterCkpt(s);
+          if (workersRunningAndSuspendMsgSent) {
+            // Forked checkpoint: the workers resumed before all of the images
+            // were written.  See finishCheckpoint().
+            JNOTE("Workers resumed; checkpoint images still being written")
+              (_numCkptWorkers - _numRestartFilenames);
+            workersRunningAndSuspendMsgSent = false;
+            forkedCkptInProgress = true;
+          }
         }
     }
 
@@ -672,8 +1211,12 @@ DmtcpCoordinator::onData(CoordClient *client)
 
     // Warn if we have two consecutive barriers of the same name.
     JWARNING(barrier != client->barrier()) (barrier) (client->barrier());
+    JWARNING(msg.numPeers > 0) (msg.numPeers) (barrier) (client->identity())
+      .Text("Barrier message without any process; counting its sender");
+    uint32_t numArrivals = std::max(msg.numPeers, (uint32_t)1);
     client->setBarrier(barrier);
-    processBarrier(barrier);
+    client->setNumArrivals(numArrivals);
+    processBarrier(barrier, numArrivals);
     break;
   }
 
@@ -682,15 +1225,15 @@ DmtcpCoordinator::onData(CoordClient *client)
 
   // Fall though
   case DMT_CKPT_FILENAME:
-    recordCkptFilename(client, extraData);
+    ckptImageBytes += msg.ckptImageSize;
+    recordCkptFilename(client, extraData, msg.extraBytes);
     break;
 
   case DMT_GET_CKPT_DIR:
   {
     DmtcpMessage reply(DMT_GET_CKPT_DIR_RESULT);
     reply.extraBytes = flags.ckptDir.length() + 1;
-    client->sock() << reply;
-    client->sock().writeAll(flags.ckptDir.c_str(), reply.extraBytes);
+    client->send(reply, flags.ckptDir.c_str());
     break;
   }
   case DMT_UPDATE_CKPT_DIR:
@@ -750,18 +1293,21 @@ DmtcpCoordinator::onData(CoordClient *client)
   case DMT_KVDB_REQUEST:
   {
     JTRACE("received DMT_KVDB_REQUEST msg") (client->identity());
-    lookupService.processRequest(client->sock(), msg, extraData);
+    lookupService.processRequest(client, msg, extraData);
     break;
   }
 
   default:
     JWARNING(false) (msg.type) (client->identity()) .Text(
       "unexpected message from worker. Closing connection");
-    onDisconnect(client);
+    if (client->ioThread() != NULL) {
+      // The I/O thread of the client reports the lost connection.
+      shutdown(client->sock().sockfd(), SHUT_RDWR);
+    } else {
+      onDisconnect(client);
+    }
     break;
   }
-
-  delete[] extraData;
 }
 
 static void
@@ -786,14 +1332,32 @@ preExitCleanup()
 void
 DmtcpCoordinator::onDisconnect(CoordClient *client)
 {
+  lookupService.clientDisconnected(client);
+
   if (client->isNSWorker()) {
     client->sock().close();
     delete client;
     return;
   }
+  if (client->isCkptWriter()) {
+    // The process writing a forked checkpoint image exits right after it
+    // has sent DMT_CKPT_FILENAME.
+    client->sock().close();
+    if (client->state() != WorkerState::CHECKPOINTED) {
+      JWARNING(false) (client->identity())
+        .Text("Process writing a checkpoint image exited prematurely");
+      _numFailedCkptWriters++;
+      if (_numRestartFilenames + _numFailedCkptWriters == _numCkptWorkers) {
+        finishCheckpoint();
+      }
+    }
+    delete client;
+    return;
+  }
   for (size_t i = 0; i < clients.size(); i++) {
     if (clients[i] == client) {
       clients.erase(clients.begin() + i);
+      client->setPeer(false);
       break;
     }
   }
@@ -803,7 +1367,9 @@ DmtcpCoordinator::onDisconnect(CoordClient *client)
 
   ComputationStatus s = getStatus();
   if (s.numPeers < 1) {
-    if (flags.exitOnLast) {
+    if (flags.exitOnLast && forkedCkptInProgress) {
+      JNOTE("last client exited; waiting for its checkpoint image");
+    } else if (flags.exitOnLast) {
       JNOTE("last client exited, shutting down..");
       handleUserCommand("q");
     } else {
@@ -819,8 +1385,19 @@ DmtcpCoordinator::onDisconnect(CoordClient *client)
     if (!currentBarrier.empty()) {
       // If already registered as a worker at current barrier,
       // decrement the worker counter before try to release the barrier.
-      if (client->barrier() == currentBarrier) {
-        --workersAtCurrentBarrier;
+      // With DMTCP_NODE_BARRIERS, it may have reported the other processes
+      // of its node as well.  They are still counted, but wait for it to
+      // release them; have the coordinator release them directly instead.
+      if (client->numArrivals() > 0) {
+        workersAtCurrentBarrier--;
+      }
+      if (client->numArrivals() > 1) {
+        for (size_t i = 0; i < clients.size(); i++) {
+          if (clients[i]->isPeer() && clients[i]->sameNode(client) &&
+              clients[i]->numArrivals() == 0) {
+            clients[i]->setNumArrivals(1);
+          }
+        }
       }
       releaseBarrier(currentBarrier);
     }
@@ -848,6 +1425,7 @@ DmtcpCoordinator::initializeComputation()
   numRestartPeers = -1; // Drop number of peers to unknown
   blockUntilDone = false;
   killAfterCkptOnce = false;
+  forkedCkptOnce = false;
   workersAtCurrentBarrier = 0;
 
   prevBarrier.clear();
@@ -896,6 +1474,15 @@ DmtcpCoordinator::onConnect()
     return;
   }
 
+  if (hello_remote.type == DMT_BACKGROUND_CKPT_WRITER) {
+    CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
+                                          hello_remote);
+    client->setCkptWriter(true);
+    JTRACE("checkpoint writer connected") (hello_remote.from);
+    addDataSocket(client);
+    return;
+  }
+
   if (killInProgress) {
     JNOTE("Connection request received in the middle of killing computation. "
           "Sending it the kill message.");
@@ -942,6 +1529,7 @@ DmtcpCoordinator::onConnect()
   JNOTE("worker connected") (hello_remote.from) (client->progname());
 
   clients.push_back(client);
+  client->setPeer(true);
   addDataSocket(client);
 
   ComputationStatus status = getStatus();
@@ -1024,6 +1612,7 @@ DmtcpCoordinator::validateRestartingWorkerProcess(
       (numRestartPeers) (curTimeStamp) (compId);
     JTIMER_START(restart);
     recordEvent("Restart-Start");
+    restartTimings.clear();
   } else if (minimumState() != WorkerState::RESTARTING) {
     JNOTE("Computation not in RESTARTING state."
           "  Reject incoming computation process requesting restart.")
@@ -1095,7 +1684,7 @@ DmtcpCoordinator::ResendDoCheckpointMsgToWorker(CoordClient *client)
   // participate in the current checkpoint
   DmtcpMessage suspendMsg(DMT_DO_CHECKPOINT);
   suspendMsg.compGroup = compId;
-  client->sock() << suspendMsg;
+  client->send(suspendMsg);
 }
 
 bool
@@ -1191,11 +1780,14 @@ DmtcpCoordinator::startCheckpoint()
 {
   ComputationStatus s = getStatus();
   if (s.minimumState == WorkerState::RUNNING && s.minimumStateUnanimous
-      && !workersRunningAndSuspendMsgSent) {
+      && !workersRunningAndSuspendMsgSent && !forkedCkptInProgress) {
     uniqueCkptFilenames = false;
     time(&ckptTimeStamp);
+    ckptStartNs = getCurrTimestamp();
+    ckptImageBytes = 0;
     JTIMER_START(checkpoint);
     recordEvent("Ckpt-Start");
+    ckptTimings.clear();
     _numRestartFilenames = 0;
     numRestartPeers = -1;
     _restartFilenames.clear();
@@ -1219,7 +1811,10 @@ DmtcpCoordinator::startCheckpoint()
     workersRunningAndSuspendMsgSent = true;
     return true;
   } else {
-    if (s.numPeers > 0) {
+    if (forkedCkptInProgress) {
+      JNOTE("delaying checkpoint, previous images still being written")
+        (_numCkptWorkers - _numRestartFilenames);
+    } else if (s.numPeers > 0) {
       JTRACE("delaying checkpoint, workers not ready") (s.minimumState)
         (s.numPeers);
     }
@@ -1240,6 +1835,7 @@ DmtcpCoordinator::broadcastMessage(DmtcpMessageType type,
   // From DMTCP coord viewpoint, we are killing peers after ckpt.
   // From DMTCP peer viewpoint, we will exit after ckpt.
   msg.exitAfterCkpt = flags.killAfterCkpt || killAfterCkptOnce;
+  msg.backgroundCkpt = forkedCkptOnce;
   msg.extraBytes = extraBytes;
 
   if (msg.type == DMT_KILL_PEER && clients.size() > 0) {
@@ -1247,12 +1843,19 @@ DmtcpCoordinator::broadcastMessage(DmtcpMessageType type,
   }
 
   JTRACE("sending message")(type);
+  CoordMsgBuffer *buf = CoordMsgBuffer::create(msg, extraData);
   for (size_t i = 0; i < clients.size(); i++) {
-    clients[i]->sock() << msg;
-    if (extraBytes > 0) {
-      clients[i]->sock().writeAll((const char *)extraData, extraBytes);
+    if (type == DMT_BARRIER_RELEASED) {
+      // With DMTCP_NODE_BARRIERS, the other processes of a node are released
+      // by the one that reported them.
+      if (clients[i]->numArrivals() == 0) {
+        continue;
+      }
+      clients[i]->setNumArrivals(0);
     }
+    clients[i]->send(buf);
   }
+  buf->release();
   workersAtCurrentBarrier = 0;
 }
 
@@ -1264,21 +1867,20 @@ DmtcpCoordinator::getStatus() const
   const static WorkerState::eWorkerState INITIAL_MAX = WorkerState::UNKNOWN;
   int min = INITIAL_MIN;
   int max = INITIAL_MAX;
-  int count = 0;
-  bool unanimous = true;
+  int count = clients.size();
 
-  for (size_t i = 0; i < clients.size(); i++) {
-    WorkerState::eWorkerState cliState = clients[i]->state();
-    count++;
-    unanimous = unanimous && (min == cliState || min == INITIAL_MIN);
-    if (cliState < min) {
-      min = cliState;
-    }
-    if (cliState > max) {
-      max = cliState;
+  for (int state = WorkerState::UNKNOWN; state < WorkerState::_MAX; state++) {
+    if (numPeersInState[state] > 0) {
+      if (state < min) {
+        min = state;
+      }
+      max = state;
     }
   }
 
+  // Unanimous if all peers are in the same state (or there are none).
+  bool unanimous = count == 0 || numPeersInState[min] == count;
+
   status.minimumStateUnanimous = unanimous;
   status.minimumState = (min == INITIAL_MIN ? WorkerState::UNKNOWN
                          : (WorkerState::eWorkerState)min);
@@ -1445,6 +2047,168 @@ void DmtcpCoordinator::queueCheckpoint()
   theCoordinator.checkpointQueued = true;
 }
 
+#define IO_THREAD_MAX_EVENTS 256
+
+static void
+queueEvent(CoordClient *client, const DmtcpMessage &msg, char *extraData)
+{
+  CoordEvent event = { client, msg, extraData };
+
+  DmtcpMutexLock(&queuedEventsLock);
+  bool wakeUp = queuedEvents.empty();
+  queuedEvents.push_back(event);
+  DmtcpMutexUnlock(&queuedEventsLock);
+
+  if (wakeUp) {
+    uint64_t one = 1;
+    JASSERT(write(queuedEventsFd, &one, sizeof(one)) == sizeof(one))
+      (JASSERT_ERRNO);
+  }
+}
+
+CoordIOThread::CoordIOThread()
+{
+  _epollFd = epoll_create(IO_THREAD_MAX_EVENTS);
+  JASSERT(_epollFd != -1) (JASSERT_ERRNO);
+}
+
+void
+CoordIOThread::start()
+{
+  JASSERT(pthread_create(&_thread, NULL, threadMain, this) == 0);
+}
+
+void *
+CoordIOThread::threadMain(void *arg)
+{
+  // Signals are for the control thread, whose epoll_wait() they interrupt.
+  sigset_t set;
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  ((CoordIOThread *)arg)->run();
+  return NULL;
+}
+
+// Called by the control thread.  From now on, only this thread reads from
+// the client, until it reports the connection lost.
+void
+CoordIOThread::addClient(CoordClient *client)
+{
+  struct epoll_event ev;
+
+  client->setIOThread(this);
+  client->_ioState = client->state();
+
+  ev.events = clientEvents(false);
+  ev.data.ptr = client;
+  JASSERT(epoll_ctl(_epollFd, EPOLL_CTL_ADD, client->sock().sockfd(), &ev)
+          != -1) (JASSERT_ERRNO);
+
+  DmtcpMutexLock(&client->_outLock);
+  if (client->hasPendingOutput()) {
+    client->watchOutput(true);
+  }
+  DmtcpMutexUnlock(&client->_outLock);
+}
+
+void
+CoordIOThread::run()
+{
+  struct epoll_event events[IO_THREAD_MAX_EVENTS];
+
+  while (true) {
+    int nfds = epoll_wait(_epollFd, events, IO_THREAD_MAX_EVENTS, -1);
+    JASSERT(nfds != -1 || errno == EINTR) (JASSERT_ERRNO);
+
+    for (int n = 0; n < nfds; ++n) {
+      CoordClient *client = (CoordClient *)events[n].data.ptr;
+      bool connected = true;
+
+      if (events[n].events & EPOLLIN) {
+        connected = readMessage(client);
+      }
+
+      if (!connected ||
+          (events[n].events & EPOLLHUP) ||
+#ifdef EPOLLRDHUP
+          (events[n].events & EPOLLRDHUP) ||
+#endif // ifdef EPOLLRDHUP
+          (events[n].events & EPOLLERR)) {
+        // The control thread deletes the client once it has processed the
+        // messages queued before.
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, client->sock().sockfd(), NULL);
+        queueEvent(client, DmtcpMessage(DMT_NULL), NULL);
+      }
+    }
+  }
+}
+
+// Reads one message of the client.  Returns false if the connection is lost.
+bool
+CoordIOThread::readMessage(CoordClient *client)
+{
+  DmtcpMessage msg;
+
+  if (client->sock().readAll((char*)&msg, sizeof(msg)) != sizeof(msg)) {
+    JTRACE("Failed to read DmtcpMessage; probably dead connection.")
+      (client->identity());
+    return false;
+  }
+  msg.assertValid();
+
+  // A KVDB request is answered here unless it reports a new state of the
+  // worker, which only the control thread may record.
+  if (msg.type == DMT_KVDB_REQUEST && msg.state == client->_ioState) {
+    _buf.resize(msg.extraBytes + 1);
+    if (msg.extraBytes > 0 &&
+        client->sock().readAll(&_buf[0], msg.extraBytes) != msg.extraBytes) {
+      return false;
+    }
+    lookupService.processRequest(client, msg, &_buf[0]);
+    return true;
+  }
+
+  char *extraData = NULL;
+  if (msg.extraBytes > 0) {
+    extraData = new char[msg.extraBytes];
+    if (client->sock().readAll(extraData, msg.extraBytes) != msg.extraBytes) {
+      delete[] extraData;
+      return false;
+    }
+  }
+  client->_ioState = msg.state;
+  queueEvent(client, msg, extraData);
+  return true;
+}
+
+void
+DmtcpCoordinator::processQueuedEvents()
+{
+  static vector<CoordEvent> processing;
+  uint64_t count;
+
+  // Reset the eventfd before taking the events; whatever is queued after
+  // this wakes up the control thread again.
+  JASSERT(read(queuedEventsFd, &count, sizeof(count)) != -1 ||
+          errno == EAGAIN) (JASSERT_ERRNO);
+
+  DmtcpMutexLock(&queuedEventsLock);
+  processing.swap(queuedEvents);
+  DmtcpMutexUnlock(&queuedEventsLock);
+
+  for (size_t i = 0; i < processing.size(); i++) {
+    CoordEvent &event = processing[i];
+    if (event.msg.type == DMT_NULL) {
+      onDisconnect(event.client);
+    } else {
+      processMessage(event.client, event.msg, event.extraData);
+      delete[] event.extraData;
+    }
+  }
+  processing.clear();
+}
+
 void
 DmtcpCoordinator::eventLoop()
 {
@@ -1474,6 +2238,21 @@ DmtcpCoordinator::eventLoop()
       (JASSERT_ERRNO);
   }
 
+  if (flags.ioThreads > 0) {
+    queuedEventsFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    JASSERT(queuedEventsFd != -1) (JASSERT_ERRNO);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &queuedEventsFd;
+    JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, queuedEventsFd, &ev) != -1)
+      (JASSERT_ERRNO);
+
+    for (int i = 0; i < flags.ioThreads; i++) {
+      ioThreads.push_back(new CoordIOThread());
+      ioThreads.back()->start();
+    }
+    JTRACE("Started I/O threads") (flags.ioThreads);
+  }
+
   while (true) {
     // Update plugins in case there was some client activity.
     CoordPluginMgr::tick(getStatus());
@@ -1481,10 +2260,12 @@ DmtcpCoordinator::eventLoop()
     printPrompt();
 
     // Wait until either there is some activity on client sockets, or the timer
-    // has expired.
+    // has expired.  Parked KVDB requests are answered at their timeout.
     int nfds;
     do {
-      nfds = epoll_wait(epollFd, events, MAX_EVENTS, 1000);
+      nfds = epoll_wait(epollFd, events, MAX_EVENTS,
+                        lookupService.waitTimeout(1000));
+      lookupService.expireWaits();
       if (nfds == 0) {
         // Epoll due to timeout. Let's trigger a tick() for plugins.
         // The plugins can use status.timestamp to handle timeouts, etc.
@@ -1498,9 +2279,27 @@ DmtcpCoordinator::eventLoop()
     // For example, any signal, including signal 0 or SIGWINCH can cause this.
     JASSERT(nfds != -1 || errno == EINTR) (JASSERT_ERRNO);
 
+    uint64_t loopStart = getCurrTimestamp();
+    bool eventsQueued = false;
+
     for (int n = 0; n < nfds; ++n) {
       void *ptr = events[n].data.ptr;
 
+      // The queued events may delete clients, so they are processed once
+      // the events returned by epoll_wait() are done with.
+      if (ptr == (void *)&queuedEventsFd) {
+        eventsQueued = true;
+        continue;
+      }
+
+      // With I/O threads, a client is here only while output for it is
+      // pending.  Its I/O thread reports the lost connection.
+      if (!ioThreads.empty() && ptr != (void *)listenSock &&
+          ptr != (void *)STDIN_FILENO) {
+        ((CoordClient *)ptr)->flushOutput();
+        continue;
+      }
+
       // Epoll wait may return EPOLLIN along with EPOLLHUP if the client closed
       // the socket right after sending a message to the coordinator. This is
       // noticed when using kill-after-checkpoint flag where the client sends
@@ -1509,7 +2308,13 @@ DmtcpCoordinator::eventLoop()
       // EPOLLIN before processing EPOLLHUP, we lose the DMTCP_CKPT_FILENAME
       // message altogether and fail to write restart script.
 
-      // First read any available data from the client socket.
+      // Send what is queued for the client before reading from it, since
+      // onData() may disconnect it.
+      if (events[n].events & EPOLLOUT) {
+        ((CoordClient *)ptr)->flushOutput();
+      }
+
+      // Then read any available data from the client socket.
       if (events[n].events & EPOLLIN) {
         if (ptr == (void *)listenSock) {
           onConnect();
@@ -1551,10 +2356,19 @@ DmtcpCoordinator::eventLoop()
       }
     }
 
+    if (eventsQueued) {
+      processQueuedEvents();
+    }
+
     if (checkpointQueued) {
       checkpointQueued = false;
       startCheckpoint();
     }
+
+    loopLagNs = getCurrTimestamp() - loopStart;
+    maxLoopLagNs = std::max(maxLoopLagNs, loopLagNs);
+    loopBusyNs += loopLagNs;
+    numLoopIterations++;
   }
 }
 
@@ -1563,11 +2377,12 @@ DmtcpCoordinator::addDataSocket(CoordClient *client)
 {
   struct epoll_event ev;
 
-#ifdef EPOLLRDHUP
-  ev.events = EPOLLIN | EPOLLRDHUP;
-#else // ifdef EPOLLRDHUP
-  ev.events = EPOLLIN;
-#endif // ifdef EPOLLRDHUP
+  if (!ioThreads.empty()) {
+    ioThreads[client->clientNumber() % ioThreads.size()]->addClient(client);
+    return;
+  }
+
+  ev.events = clientEvents(client->hasPendingOutput());
   ev.data.ptr = client;
   JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, client->sock().sockfd(), &ev) != -1)
     (JASSERT_ERRNO);
@@ -1673,6 +2488,9 @@ main(int argc, char **argv)
     } else if (s == "--daemon") {
       flags.daemon = true;
       shift;
+    } else if (argc > 1 && s == "--io-threads") {
+      flags.ioThreads = jalib::StringToInt(argv[1]);
+      shift; shift;
     } else if (s == "--coord-logfile") {
       flags.useLogFile = true;
       flags.logFilename = argv[1];
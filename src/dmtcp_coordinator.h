@@ -22,13 +22,41 @@
 #ifndef DMTCPDMTCPCOORDINATOR_H
 #define DMTCPDMTCPCOORDINATOR_H
 
+#include <pthread.h>
 #include "../jalib/jsocket.h"
 #include "../jalib/jconvert.h"
+#include "dmtcp.h"
 #include "dmtcpalloc.h"
 #include "dmtcpmessagetypes.h"
 
 namespace dmtcp
 {
+class CoordIOThread;
+
+// A message, serialized once, that may be queued on several clients at a
+// time, e.g., a barrier release.  Buffers are recycled once the last client
+// has sent them.
+class CoordMsgBuffer
+{
+  public:
+    static CoordMsgBuffer *create(const DmtcpMessage &msg,
+                                  const void *extraData = NULL);
+
+    void addRef() { __sync_fetch_and_add(&_refCount, 1); }
+
+    void release();
+
+    const char *data() const { return &_data[0]; }
+
+    size_t size() const { return _data.size(); }
+
+  private:
+    CoordMsgBuffer() : _refCount(0) {}
+
+    vector<char> _data;
+    int _refCount;
+};
+
 class CoordClient
 {
   public:
@@ -38,6 +66,8 @@ class CoordClient
                 DmtcpMessage &hello_remote,
                 int isNSWorker = 0);
 
+    ~CoordClient();
+
     jalib::JSocket &sock() { return _sock; }
 
     const UniquePid &identity() const { return _identity; }
@@ -50,12 +80,24 @@ class CoordClient
 
     WorkerState::eWorkerState state() const { return _state; }
 
-    void setState(WorkerState::eWorkerState value) { _state = value; }
+    void setState(WorkerState::eWorkerState value);
+
+    // Only peers, i.e., the clients in the coordinator's client list, are
+    // counted in the computation status.
+    bool isPeer() const { return _isPeer; }
+
+    void setPeer(bool value);
 
     string barrier() const { return _barrier; }
 
     void setBarrier(const string &value) { _barrier = value; }
 
+    // Number of processes this client reported at the current barrier: one
+    // for itself, or all of its node with DMTCP_NODE_BARRIERS.
+    uint32_t numArrivals() const { return _numArrivals; }
+
+    void setNumArrivals(uint32_t value) { _numArrivals = value; }
+
     void progname(string pname) { _progname = pname; }
 
     string progname(void) const { return _progname; }
@@ -64,6 +106,14 @@ class CoordClient
 
     string hostname(void) const { return _hostname; }
 
+    // With DMTCP_NODE_BARRIERS, the processes of a node share the node
+    // barrier of their SharedData area, and thus both host and tmpdir.
+    bool sameNode(const CoordClient *other) const
+    {
+      return !_tmpDir.empty() &&
+             _hostname == other->_hostname && _tmpDir == other->_tmpDir;
+    }
+
     pid_t realPid(void) const { return _realPid; }
 
     void realPid(pid_t pid) { _realPid = pid; }
@@ -74,9 +124,37 @@ class CoordClient
 
     int isNSWorker() { return _isNSWorker; }
 
+    bool isCkptWriter() const { return _isCkptWriter; }
+
+    void setCkptWriter(bool value) { _isCkptWriter = value; }
+
+    // With --io-threads, the I/O thread that reads from this client.
+    CoordIOThread *ioThread() const { return _ioThread; }
+
+    void setIOThread(CoordIOThread *thread) { _ioThread = thread; }
+
     void readProcessInfo(DmtcpMessage &msg);
 
+    // Messages to the client never block the coordinator: whatever the
+    // socket does not take at once is queued, and sent by flushOutput() as
+    // the socket becomes writable (EPOLLOUT).  With --io-threads, messages
+    // may be sent from any thread; the queue is guarded by _outLock.
+    void send(const DmtcpMessage &msg, const void *extraData = NULL);
+    void send(CoordMsgBuffer *buf);
+    void flushOutput();
+    void drainOutput(int timeoutMs);
+
+    bool hasPendingOutput() const { return _outHead < _outQueue.size(); }
+
   private:
+    struct PendingOutput {
+      CoordMsgBuffer *buf;
+      size_t offset;
+    };
+
+    void clearOutput();
+    void watchOutput(bool value);
+
     UniquePid _identity;
     int _clientNumber;
     jalib::JSocket _sock;
@@ -84,12 +162,50 @@ class CoordClient
     WorkerState::eWorkerState _prevState;
     string _hostname;
     string _progname;
+    string _tmpDir;
     string _ip;
     string _barrier;
     string _prevBarrier;
+    uint32_t _numArrivals;
     pid_t _realPid;
     pid_t _virtualPid;
     int _isNSWorker;
+    bool _isCkptWriter;
+    bool _isPeer;
+    CoordIOThread *_ioThread;
+    WorkerState::eWorkerState _ioState;
+    DmtcpMutex _outLock;
+    vector<PendingOutput> _outQueue;
+    size_t _outHead;
+    bool _watchingOutput;
+
+    friend class CoordIOThread;
+};
+
+// With --io-threads N, the clients are shared out among N I/O threads, each
+// with its own epoll set.  An I/O thread reads the messages of its clients
+// into its own buffer and answers their KVDB requests itself.  Any other
+// message, and the loss of a client, is queued for the control thread
+// (DmtcpCoordinator::eventLoop()), which alone accepts connections, changes
+// the state of the computation and deletes clients.  A client's messages
+// reach the control thread in the order in which they were sent.  Output to
+// a client that must wait for EPOLLOUT is sent by the control thread.
+class CoordIOThread
+{
+  public:
+    CoordIOThread();
+
+    void start();
+    void addClient(CoordClient *client);
+
+  private:
+    static void *threadMain(void *arg);
+    void run();
+    bool readMessage(CoordClient *client);
+
+    int _epollFd;
+    pthread_t _thread;
+    vector<char> _buf;
 };
 
 typedef struct {
@@ -121,6 +237,7 @@ class CoordFlags {
       string tmpDir = "";
       string tmpDirArg = "";
       bool writeKvData = false;
+      int ioThreads = 0;
 
       CoordFlags()
       {
@@ -151,6 +268,10 @@ class CoordFlags {
           }
         }
 
+        if (getenv(ENV_VAR_COORD_IO_THREADS) != NULL) {
+          ioThreads = jalib::StringToInt(getenv(ENV_VAR_COORD_IO_THREADS));
+        }
+
       }
 };
 
@@ -158,6 +279,10 @@ class DmtcpCoordinator
 {
   public:
     void onData(CoordClient *client);
+    void processMessage(CoordClient *client,
+                        DmtcpMessage &msg,
+                        char *extraData);
+    void processQueuedEvents();
     void onConnect();
     void onDisconnect(CoordClient *client);
     void eventLoop();
@@ -174,17 +299,21 @@ class DmtcpCoordinator
     void recordEvent(string const &event);
     void serializeKVDB();
 
-    void processBarrier(const string &barrier);
+    void processBarrier(const string &barrier, uint32_t numArrivals);
     void releaseBarrier(const string &barrier);
 
     bool startCheckpoint();
-    void recordCkptFilename(CoordClient *client, const char *barrierList);
+    void recordCkptFilename(CoordClient *client,
+                            const char *extraData,
+                            size_t len);
+    void finishCheckpoint();
 
     void handleUserCommand(dmtcp::string cmd, DmtcpMessage *reply = NULL);
     void getStatusStr(ostream *o);
     void writeStatusToFile();
     void printStatus(size_t numPeers, bool isRunning);
     string printList();
+    string printMetrics();
 
     void processDmtUserCmd(DmtcpMessage &hello_remote, jalib::JSocket &remote);
     bool validateNewWorkerProcess(DmtcpMessage &hello_remote,
@@ -213,6 +342,7 @@ class DmtcpCoordinator
   private:
     size_t _numCkptWorkers;
     size_t _numRestartFilenames;
+    size_t _numFailedCkptWriters;
     bool checkpointQueued = false;
 
     // Store whether rsh/ssh was used
@@ -93,9 +93,43 @@ static const char *theUsage =
   "  --gzip, --no-gzip, (environment variable DMTCP_GZIP=[01])\n"
   "              Enable/disable compression of checkpoint images (default: 1)\n"
   "              WARNING: gzip adds seconds. Without gzip, ckpt is often < 1s\n"
+  "  --block-compression, (environment variable DMTCP_BLOCK_COMPRESSION=[01])\n"
+  "              Compress checkpoint images in-process, in independent blocks,\n"
+  "              instead of piping them through gzip (default: 0)\n"
+  "  --ckpt-writer-threads N (environment variable DMTCP_CKPT_WRITER_THREADS)\n"
+  "              Use N threads to write (or, with --block-compression, to\n"
+  "              compress) the checkpoint image in parallel.\n"
+  "              Requires --no-gzip or --block-compression.  (default: 1)\n"
+  "  --incremental-ckpt N (environment variable DMTCP_INCREMENTAL_CKPT)\n"
+  "              After each full checkpoint image, write up to N incremental\n"
+  "              images holding only the pages modified since the previous\n"
+  "              checkpoint (at most 15).  Requires --no-gzip.  (default: 0)\n"
+  "  --forked-ckpt (environment variable DMTCP_FORKED_CHECKPOINT)\n"
+  "              Write checkpoint images from a forked copy of each process,\n"
+  "              so that the computation resumes right after the fork.\n"
+  "              The restart script is written once all images are complete.\n"
+  "  --lazy-restore (environment variable DMTCP_LAZY_RESTORE=[01])\n"
+  "              Write uncompressed images laid out so that, on restart,\n"
+  "              memory is mapped from the image and read in on first access.\n"
+  "              The image must not be modified while the restarted process\n"
+  "              runs.  Implies --no-gzip.  (default: 0)\n"
+  "  --dedup (environment variable DMTCP_CKPT_DEDUP=[01])\n"
+  "              Store each distinct page of the processes on a host once, in\n"
+  "              a chunk store next to the checkpoint images that they refer\n"
+  "              to.  Not used with --block-compression, --incremental-ckpt,\n"
+  "              --forked-ckpt, --lazy-restore or --ckpt-server.  (default: 0)\n"
+  "  --node-barriers (environment variable DMTCP_NODE_BARRIERS=[01])\n"
+  "              Gather the processes on each host at a global barrier before\n"
+  "              one of them reports them all to the coordinator, which\n"
+  "              releases the host through that process.  (default: 0)\n"
   "  --ckptdir PATH (environment variable DMTCP_CHECKPOINT_DIR)\n"
   "              Directory to store checkpoint images\n"
   "              (default: curr dir at launch)\n"
+  "  --ckpt-server HOST[:PORT] (environment variable DMTCP_CKPT_SERVER)\n"
+  "              Stream checkpoint images to the dmtcp_ckpt_server at HOST\n"
+  "              (default port: " STRINGIFY(DEFAULT_CKPT_SERVER_PORT) ")"
+  " instead of writing them to PATH.\n"
+  "              Implies full (non-incremental) checkpoints.\n"
   "  --ckpt-open-files\n"
   "  --checkpoint-open-files\n"
   "              Checkpoint open files and restore old working dir.\n"
@@ -243,6 +277,24 @@ processArgs(int *orig_argc, const char ***orig_argv)
     } else if (s == "--no-gzip") {
       setenv(ENV_VAR_COMPRESSION, "0", 1);
       shift;
+    } else if (s == "--block-compression") {
+      setenv(ENV_VAR_BLOCK_COMPRESSION, "1", 1);
+      shift;
+    } else if (s == "--forked-ckpt") {
+      setenv(ENV_VAR_FORKED_CKPT, "1", 1);
+      shift;
+    } else if (s == "--lazy-restore") {
+      setenv(ENV_VAR_LAZY_RESTORE, "1", 1);
+      shift;
+    } else if (s == "--dedup") {
+      setenv(ENV_VAR_CKPT_DEDUP, "1", 1);
+      shift;
+    } else if (s == "--node-barriers") {
+      setenv(ENV_VAR_NODE_BARRIERS, "1", 1);
+      shift;
+    } else if (argc > 1 && s == "--ckpt-server") {
+      setenv(ENV_VAR_CKPT_SERVER, argv[1], 1);
+      shift; shift;
     }
     else if (s == "--new-coordinator") {
       allowedModes = COORD_NEW;
@@ -284,6 +336,12 @@ processArgs(int *orig_argc, const char ***orig_argv)
     } else if (argc > 1 && s == "--ckpt-signal") {
       setenv(ENV_VAR_SIGCKPT, argv[1], 1);
       shift; shift;
+    } else if (argc > 1 && s == "--ckpt-writer-threads") {
+      setenv(ENV_VAR_CKPT_WRITER_THREADS, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 && s == "--incremental-ckpt") {
+      setenv(ENV_VAR_INCREMENTAL_CKPT, argv[1], 1);
+      shift; shift;
     } else if (s == "--checkpoint-open-files" || s == "--ckpt-open-files") {
       checkpointOpenFiles = true;
       shift;
@@ -333,8 +391,8 @@ processArgs(int *orig_argc, const char ***orig_argv)
   }
 
 #ifdef FAST_RST_VIA_MMAP
-  // In case of fast restart, we shall not use gzip.
-  setenv(ENV_VAR_COMPRESSION, "0", 1);
+  // configure --enable-fast-restart makes --lazy-restore the default.
+  setenv(ENV_VAR_LAZY_RESTORE, "1", 1);
 #endif
 
 #if __aarch64__
@@ -407,7 +465,7 @@ main(int argc, const char **argv)
 
   // Initialize host and port now.  Will be used in low-level functions.
   CoordinatorAPI::getCoordHostAndPort(allowedModes, &coord_host, &coord_port);
-  CoordinatorAPI::connectToCoordOnStartup(allowedModes, argv[0],
+  CoordinatorAPI::connectToCoordOnStartup(allowedModes, argv[0], tmpDir,
                                           &compId, &coordInfo,
                                           &localIPAddr);
 
@@ -426,10 +484,7 @@ main(int argc, const char **argv)
 
 #ifdef FORKED_CHECKPOINTING
 
-  /* When this is robust, add --forked-checkpointing option on command-line,
-   * with #ifdef FORKED_CHECKPOINTING around the option, change default of
-   * configure.ac, dmtcp/configure.ac, to enable, and change them
-   * from enable-forked... to disable-...
+  /* configure --enable-forked-checkpointing makes --forked-ckpt the default.
    */
   setenv(ENV_VAR_FORKED_CKPT, "1", 1);
 #endif // ifdef FORKED_CHECKPOINTING
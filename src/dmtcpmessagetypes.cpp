@@ -41,6 +41,10 @@ DmtcpMessage::DmtcpMessage(DmtcpMessageType t /*= DMT_NULL*/)
   , coordTimeStamp(0)
   , theCheckpointInterval(DMTCPMESSAGE_SAME_CKPT_INTERVAL)
   , exitAfterCkpt(0)
+  , backgroundCkpt(0)
+  , numKeys(0)
+  , kvdbTimeoutMs(-1)
+  , ckptImageSize(0)
 {
   // struct sockaddr_storage _addr;
   // socklen_t _addrlen;
@@ -108,6 +112,7 @@ dmtcp::operator<<(dmtcp::ostream &o, const DmtcpMessageType &s)
     OSHIFTPRINTF(DMT_USER_CMD_RESULT)
     OSHIFTPRINTF(DMT_CKPT_FILENAME)
     OSHIFTPRINTF(DMT_UNIQUE_CKPT_FILENAME)
+    OSHIFTPRINTF(DMT_BACKGROUND_CKPT_WRITER)
 
     // OSHIFTPRINTF ( DMT_RESTART_PROCESS )
     // OSHIFTPRINTF ( DMT_RESTART_PROCESS_REPLY )
@@ -52,6 +52,9 @@ enum DmtcpMessageType {
                              // coordinator
   DMT_UNIQUE_CKPT_FILENAME,  // same as DMT_CKPT_FILENAME, except when
                              // unique-ckpt plugin is being used.
+  DMT_BACKGROUND_CKPT_WRITER,  // on connect established by the process
+                               // writing a forked checkpoint image; it sends
+                               // DMT_CKPT_FILENAME once the image is complete.
 
   DMT_USER_CMD,              // on connect established dmtcp_command ->
                              // coordinator
@@ -73,6 +76,10 @@ enum DmtcpMessageType {
   //    The callback function may call dmtcp_global_barrier, which sends back
   //    a DMT_BARRIER msg to coordinator.  The coordinator then implements the
   //    barrier by responding with DMT_BARRIER_RESPONSE.
+  //    The numPeers field of a DMT_BARRIER msg counts the processes it stands
+  //    for: more than one when the processes of a node have met at a node
+  //    barrier first (DMTCP_NODE_BARRIERS).  Only the senders of DMT_BARRIER
+  //    msgs are sent DMT_BARRIER_RELEASED; they release the rest of the node.
 
   DMT_DO_CHECKPOINT,         // when coordinator wants worker to checkpoint
 
@@ -83,6 +90,13 @@ enum DmtcpMessageType {
 
   DMT_KILL_PEER,             // send kill message to peer
 
+  // KVDB requests carry the key (keyLen bytes) and the value (valLen bytes)
+  // as NUL-terminated strings.  The batched requests (MGET, MSET, MINCRBY)
+  // carry numKeys keys followed by numKeys values; MGET and MWAIT have no
+  // values.  The response to MGET and MWAIT has the numKeys results (keyLen
+  // bytes), then the values; the one to MINCRBY has the old values; the one to
+  // MSET has none.  WATCH carries a prefix and the minimum number of keys as
+  // its value; its response has the numKeys matching keys, then their values.
   DMT_KVDB_REQUEST,
   DMT_KVDB_RESPONSE
 };
@@ -145,6 +159,11 @@ struct DmtcpMessage {
 
   uint32_t uniqueIdOffset;
   uint32_t exitAfterCkpt;
+  uint32_t backgroundCkpt;
+  uint32_t numKeys;  // Batched KVDB requests.
+  int32_t kvdbTimeoutMs;  // MWAIT and WATCH; -1 waits forever.
+  uint32_t _pad2;  // Keep the size a multiple of 8 bytes.
+  uint64_t ckptImageSize;  // DMT_CKPT_FILENAME; 0 if unknown.
 
   DmtcpMessage(DmtcpMessageType t = DMT_NULL);
   void assertValid() const;
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <dlfcn.h>
 
+#include "ckpttiming.h"
 #include "coordinatorapi.h"
 #include "dmtcp.h"
 #include "dmtcpworker.h"
@@ -467,7 +468,9 @@ EXTERNC void
 dmtcp_local_barrier(const char *barrier)
 {
   JTRACE("Waiting for local barrier") (barrier);
+  uint64_t start = CkptTiming::now();
   SharedData::waitForBarrier(barrier);
+  CkptTiming::record("barrier", barrier, start);
 }
 
 EXTERNC void
@@ -24,6 +24,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include "config.h"
@@ -34,6 +35,7 @@
 #include "../jalib/jassert.h"
 #include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
+#include "ckptstore.h"
 #include "constants.h"
 #include "coordinatorapi.h"
 #include "dmtcprestartinternal.h"
@@ -98,6 +100,18 @@ static const char *theUsage =
   "              Directory to store checkpoint images\n"
   "              (default: use the same dir used in previous checkpoint)\n"
   "  --restartdir Directory that contains checkpoint image directories\n"
+  "  --ckpt-server HOST[:PORT] (environment variable DMTCP_CKPT_SERVER)\n"
+  "              Read the checkpoint images, by their basenames, from the\n"
+  "              dmtcp_ckpt_server at HOST (default port: "
+                                      STRINGIFY(DEFAULT_CKPT_SERVER_PORT) ")\n"
+  "  --restore-threads N (environment variable DMTCP_RESTORE_THREADS)\n"
+  "              Use N threads to read the memory of each process from its\n"
+  "              checkpoint image in parallel.  Ignored for gzipped images\n"
+  "              and with --ckpt-server.  (default: 1, at most 16)\n"
+  "  --node-barriers (environment variable DMTCP_NODE_BARRIERS=[01])\n"
+  "              Gather the restarted processes on each host at a global\n"
+  "              barrier before one of them reports them all to the\n"
+  "              coordinator.  (default: 0)\n"
   "  --mpi       Use as MPI proxy (default: no MPI proxy)\n"
   "  --tmpdir PATH (environment variable DMTCP_TMPDIR)\n"
   "              Directory to store temp files (default: $TMDPIR or /tmp)\n"
@@ -173,12 +187,26 @@ checkVdsoOffsetMismatch(DmtcpCkptHeader *ckptHdr)
 RestoreTarget::RestoreTarget(const string &path)
   : _path(path)
 {
-  JASSERT(jalib::Filesystem::FileExists(_path))
+  JASSERT(!CkptStore::instance().isLocal() ||
+          jalib::Filesystem::FileExists(_path))
   (_path).Text("checkpoint file missing");
 
   _fd = readCkptHeader(_path, &_ckptHdr);
   checkVdsoOffsetMismatch(&_ckptHdr);
 
+  // mtcp_restart reads the unmodified pages of an incremental checkpoint
+  // from the chain of parent images.
+  JASSERT(_ckptHdr.ckptGeneration == 0 ||
+          jalib::Filesystem::FileExists(_ckptHdr.parentCkptImage))
+    (_path) (_ckptHdr.parentCkptImage)
+    .Text("parent of incremental checkpoint file missing");
+
+  // mtcp_restart reads the pages of a deduplicated image from its chunk store.
+  JASSERT(_ckptHdr.dedupStore[0] == '\0' ||
+          jalib::Filesystem::FileExists(_ckptHdr.dedupStore))
+    (_path) (_ckptHdr.dedupStore)
+    .Text("chunk store of deduplicated checkpoint file missing");
+
   JTRACE("restore target")(_path)(numPeers())(compGroup());
 }
 
@@ -196,7 +224,7 @@ RestoreTarget::initialize()
 
   // FIXME:  We will use the new HOST and PORT here, but after restart,
   // we will use the old HOST and PORT from the ckpt image.
-  CoordinatorAPI::connectToCoordOnRestart(allowedModes, procname(),
+  CoordinatorAPI::connectToCoordOnRestart(allowedModes, procname(), tmpDir,
                                           compGroup(), numPeers(),
                                           &coordInfo, &localIPAddr);
 
@@ -218,6 +246,11 @@ RestoreTarget::initialize()
     // Create the ckpt-dir fd so that the restarted process can know about
     // the abs-path of ckpt-image.
     string dirName = jalib::Filesystem::DirName(_path);
+    if (!CkptStore::instance().isLocal() &&
+        !jalib::Filesystem::FileExists(dirName)) {
+      // The image came from dmtcp_ckpt_server.
+      dirName = jalib::Filesystem::GetCWD();
+    }
     int dirfd = open(dirName.c_str(), O_RDONLY);
     JASSERT(dirfd != -1)(JASSERT_ERRNO);
     if (dirfd != PROTECTED_CKPT_DIR_FD) {
@@ -535,21 +568,29 @@ openCkptFileToRead(const string &filename)
 
   pid_t cpid;
 
-  fd = open(filename.c_str(), O_RDONLY);
-  JASSERT(fd >= 0)(filename).Text("Failed to open file.");
+  fd = CkptStore::instance().openForRead(filename);
+
+  if (!CkptStore::instance().isLocal()) {
+    // A socket from dmtcp_ckpt_server cannot be rewound; just peek.
+    ASSERT_EQ(1, recv(fd, &fc, 1, MSG_PEEK | MSG_WAITALL));
+    if (fc == DMTCP_CKPT_SIGNATURE[0]) {
+      return fd;
+    }
+  } else {
+    DmtcpCkptHeader ckptHdr;
+    ASSERT_EQ(sizeof(ckptHdr),
+              (size_t)Util::readAll(fd, &ckptHdr, sizeof(ckptHdr)));
+    if (string(ckptHdr.ckptSignature) == DMTCP_CKPT_SIGNATURE) {
+      // Uncompressed file. Rewind and return.
+      ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
+      return fd;
+    }
 
-  DmtcpCkptHeader ckptHdr;
-  ASSERT_EQ(sizeof(ckptHdr), (size_t)Util::readAll(fd, &ckptHdr, sizeof(ckptHdr)));
-  if (string(ckptHdr.ckptSignature) == DMTCP_CKPT_SIGNATURE) {
-    // Uncompressed file. Rewind and return.
     ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
-    return fd;
+    ASSERT_EQ(1, Util::readAll(fd, &fc, 1));
+    ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
   }
 
-  ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
-  ASSERT_EQ(1, Util::readAll(fd, &fc, 1));
-  ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
-
   if (fc == GZIP_FIRST) {
     decomp_path = gzip_path;
     decomp_args = gzip_args;
@@ -752,6 +793,15 @@ DmtcpRestart::DmtcpRestart(int argc, char **argv, const string& binaryName, cons
     } else if (argc > 1 && (s == "-r" || s == "--restartdir")) {
       restartDir = string(argv[1]);
       shift; shift;
+    } else if (argc > 1 && s == "--ckpt-server") {
+      setenv(ENV_VAR_CKPT_SERVER, argv[1], 1);
+      shift; shift;
+    } else if (s == "--node-barriers") {
+      setenv(ENV_VAR_NODE_BARRIERS, "1", 1);
+      shift;
+    } else if (argc > 1 && s == "--restore-threads") {
+      setenv(ENV_VAR_RESTORE_THREADS, argv[1], 1);
+      shift; shift;
     } else if (argc > 1 && (s == "--gdb")) {
       requestedDebugLevel = atoi(argv[1]);
       shift; shift;
@@ -818,6 +868,9 @@ DmtcpRestart::DmtcpRestart(int argc, char **argv, const string& binaryName, cons
     exit(DMTCP_FAIL_RC);
   }
 
+  JASSERT(restartDir.empty() || CkptStore::instance().isLocal())
+  .Text("--restartdir cannot be used with --ckpt-server");
+
   if (!restartDir.empty()) { // --restartdir is provided
     vector<string> files = jalib::Filesystem::ListDirEntries(restartDir);
     for (const string &file : files) {
@@ -842,7 +895,9 @@ DmtcpRestart::DmtcpRestart(int argc, char **argv, const string& binaryName, cons
     for (; argc > 0; shift) {
       string restorename(argv[0]);
       struct stat buf;
-      JASSERT(stat(restorename.c_str(), &buf) != -1);
+      // Images on a dmtcp_ckpt_server are not local files.
+      bool isLocal = CkptStore::instance().isLocal();
+      JASSERT(!isLocal || stat(restorename.c_str(), &buf) != -1);
 
       if (Util::strEndsWith(restorename.c_str(), "_files")) {
         continue;
@@ -851,7 +906,7 @@ DmtcpRestart::DmtcpRestart(int argc, char **argv, const string& binaryName, cons
         // Don't test for --quiet here.  We're aborting.  We need to say why.
         JASSERT_STDERR << theUsage;
         exit(DMTCP_FAIL_RC);
-      } else if (buf.st_uid != getuid() && !noStrictChecking) {
+      } else if (isLocal && buf.st_uid != getuid() && !noStrictChecking) {
         /*Could also run if geteuid() matches*/
         JASSERT(false) (getuid()) (buf.st_uid) (restorename)
           .Text("Process uid doesn't match uid of checkpoint image.\n"      \
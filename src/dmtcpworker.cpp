@@ -27,7 +27,12 @@
 #include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
 #include "../jalib/jsocket.h"
+#include "ckptdedup.h"
+#include "ckptserializer.h"
+#include "ckptstore.h"
+#include "ckpttiming.h"
 #include "coordinatorapi.h"
+#include "incrementalckpt.h"
 #include "kvdb.h"
 #include "pluginmanager.h"
 #include "processinfo.h"
@@ -51,6 +56,7 @@ EXTERNC ProcSelfMaps *procSelfMaps;
  */
 static ATOMIC_SHARED_GLOBAL bool exitInProgress = false;
 static bool exitAfterCkpt = 0;
+static bool forkedCkpt = false;
 static bool dmtcp_initialized = false;
 
 
@@ -371,6 +377,19 @@ DmtcpWorker::waitForPreSuspendMessage()
 
   ProcessInfo::instance().compGroup = SharedData::getCompId();
   exitAfterCkpt = msg.exitAfterCkpt;
+
+  // Forked checkpointing lets the computation resume early; there is no
+  // point if it is going to exit after the checkpoint.
+  const char *forked = getenv(ENV_VAR_FORKED_CKPT);
+  forkedCkpt = (msg.backgroundCkpt ||
+                (forked != NULL && strcmp(forked, "0") != 0)) &&
+               !exitAfterCkpt;
+}
+
+bool
+DmtcpWorker::isForkedCkptRequested()
+{
+  return forkedCkpt;
 }
 
 void
@@ -383,6 +402,7 @@ DmtcpWorker::waitForCheckpointRequest()
   PluginManager::eventHook(DMTCP_EVENT_RUNNING);
 
   waitForPreSuspendMessage();
+  CkptTiming::reset();
 
   WorkerState::setCurrentState(WorkerState::PRESUSPEND);
 
@@ -445,6 +465,7 @@ DmtcpWorker::preCheckpoint()
   JTRACE("Waiting for DMT_CHECKPOINT barrier");
   CoordinatorAPI::waitForBarrier("DMT:CHECKPOINT", &numPeers);
   JTRACE("Computation information") (numPeers);
+  CoordinatorAPI::setNodeBarriers(true);
 
   // initialize global number of peers:
   ProcessInfo::instance().numPeers = numPeers;
@@ -456,8 +477,10 @@ DmtcpWorker::preCheckpoint()
 void
 DmtcpWorker::postCheckpoint()
 {
-  // Send ckpt maps to coordinator.
+  // Send ckpt maps to coordinator, in a single request.
   string workerPath("/worker/" + ProcessInfo::instance().upidStr());
+  vector<string> keys;
+  vector<string> vals;
 
   jalib::JAllocArena *arenas;
   int numArenas = 0;
@@ -472,15 +495,20 @@ DmtcpWorker::postCheckpoint()
       }
     }
 
-    kvdb::set(workerPath, "ProcSelfMaps_JAllocArenas", o.str());
+    keys.push_back("ProcSelfMaps_JAllocArenas");
+    vals.push_back(o.str());
   }
 
-  {
-    kvdb::set(
-      workerPath,
-      "ProcSelfMaps_Ckpt",
-      procSelfMaps->getData());
+  keys.push_back("ProcSelfMaps_Ckpt");
+  if (CkptSerializer::isForkedCkpt()) {
+    // The memory maps were read by the forked process writing the image, but
+    // they are the same as ours.
+    ProcSelfMaps maps;
+    vals.push_back(maps.getData());
+  } else {
+    vals.push_back(procSelfMaps->getData());
   }
+  kvdb::mset(workerPath, keys, vals);
 
   WorkerState::setCurrentState(WorkerState::CHECKPOINTED);
 
@@ -488,14 +516,31 @@ DmtcpWorker::postCheckpoint()
   JTRACE("Waiting for Write-Ckpt barrier");
   CoordinatorAPI::waitForBarrier("DMT:WriteCkpt");
 
-  /* Now that temp checkpoint file is complete, rename it over old permanent
-   * checkpoint file.  Uses rename() syscall, which doesn't change i-nodes.
-   * So, gzip process can continue to write to file even after renaming.
-   */
-  JASSERT(rename(ProcessInfo::instance().getTempCkptFilename().c_str(),
-                 ProcessInfo::instance().getCkptFilename().c_str()) == 0);
-
-  CoordinatorAPI::sendCkptFilename();
+  if (CkptSerializer::isForkedCkpt()) {
+    /* The image is still being written by the forked process, which renames
+     * it and reports it to the coordinator by itself.  Soft-dirty bits were
+     * not cleared in this process, so the next image must be a full one.
+     */
+    IncrementalCkpt::commit(ProcessInfo::instance().getCkptFilename());
+  } else {
+    /* Now that temp checkpoint file is complete, rename it over old permanent
+     * checkpoint file.  Uses rename() syscall, which doesn't change i-nodes.
+     * So, gzip process can continue to write to file even after renaming.
+     * For an incremental checkpoint, the old image is first moved to where
+     * the new one expects to find its parent.  The chunk store of a
+     * deduplicated image is moved into place along with it.  A full image
+     * that replaces an incremental one makes the parents of the latter stale.
+     */
+    uint64_t start = CkptTiming::now();
+    IncrementalCkpt::commit(ProcessInfo::instance().getCkptFilename());
+    CkptDedup::commit();
+    CkptStore::instance().rename(ProcessInfo::instance().getTempCkptFilename(),
+                                 ProcessInfo::instance().getCkptFilename());
+    IncrementalCkpt::removeStaleParents();
+    CkptTiming::record("commit", start);
+
+    CoordinatorAPI::sendCkptFilename();
+  }
 
   if (exitAfterCkpt) {
     JTRACE("Asked to exit after checkpoint. Exiting!");
@@ -503,6 +548,7 @@ DmtcpWorker::postCheckpoint()
   }
 
   PluginManager::eventHook(DMTCP_EVENT_RESUME);
+  CoordinatorAPI::setNodeBarriers(false);
 
   // Inform Coordinator of RUNNING state.
   WorkerState::setCurrentState(WorkerState::RUNNING);
@@ -515,9 +561,18 @@ DmtcpWorker::postRestart(double ckptReadTime)
 {
   JTRACE("begin postRestart()");
   WorkerState::setCurrentState(WorkerState::RESTARTING);
+  CkptTiming::reset();
+  CkptTiming::add("read-image", (uint64_t)(ckptReadTime * 1e9));
+  IncrementalCkpt::reset();
+  Util::selectZeroPageScanner();
+
+  // The image was written with node barriers enabled, for the nodes of the
+  // checkpoint.  The processes may be restarted on other nodes.
+  CoordinatorAPI::setNodeBarriers(false);
 
   JTRACE("Waiting for Restart barrier");
   CoordinatorAPI::waitForBarrier("DMT:Restart");
+  CoordinatorAPI::setNodeBarriers(true);
 
   PluginManager::eventHook(DMTCP_EVENT_RESTART);
 
@@ -532,9 +587,11 @@ DmtcpWorker::postRestart(double ckptReadTime)
       "ProcSelfMaps_Rst",
       procSelfMaps.getData());
   }
+  CoordinatorAPI::setNodeBarriers(false);
 
-  // Inform Coordinator of RUNNING state.
+  // Inform Coordinator of RUNNING state, along with the restart timings.
   WorkerState::setCurrentState(WorkerState::RUNNING);
   JTRACE("Informing coordinator of RUNNING status") (UniquePid::ThisProcess());
-  CoordinatorAPI::sendMsgToCoordinator(DMT_WORKER_RESUMING);
+  CoordinatorAPI::sendMsgToCoordinator(DmtcpMessage(DMT_WORKER_RESUMING),
+                                       CkptTiming::toString());
 }
@@ -49,6 +49,7 @@ namespace DmtcpWorker
   int determineCkptSignal();
   void ckptThreadPerformExit();
   bool isExitInProgress();
+  bool isForkedCkptRequested();
 };
 }
 #endif // ifndef DMTCPDMTCPWORKER_H
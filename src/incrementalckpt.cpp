@@ -0,0 +1,588 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "jassert.h"
+#include "jconvert.h"
+#include "jfilesystem.h"
+#include "ckptserializer.h"
+#include "ckptstore.h"
+#include "ckptwriter.h"
+#include "constants.h"
+#include "incrementalckpt.h"
+#include "procselfmaps.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+// Bits of a /proc/self/pagemap entry.  See Documentation/admin-guide/mm/
+// pagemap.rst and soft-dirty.rst in the kernel sources.
+#define PM_SOFT_DIRTY             (1ULL << 55)
+#define PM_SWAP                   (1ULL << 62)
+#define PM_PRESENT                (1ULL << 63)
+
+#define CLEAR_REFS_SOFT_DIRTY     "4"
+
+// Number of pagemap entries read with a single pread().
+#define PAGEMAP_CHUNK             4096
+
+// Slack for mappings created between sizing the dirty map and filling it in.
+#define DIRTY_MAP_EXTRA_RANGES    64
+#define DIRTY_MAP_EXTRA_PAGES     16384
+
+typedef struct DirtyRange {
+  VA start;
+  VA end;
+  size_t firstPage;  // Index of the first page of the range in cleanBits.
+} DirtyRange;
+
+typedef struct WrittenRange {
+  VA start;
+  VA end;
+} WrittenRange;
+
+// The dirty map holds this header followed by the arrays that it points to.
+// It is recreated at every checkpoint.  Only 'written' is carried over to the
+// next checkpoint, which needs it to decide which pages its parent holds.
+typedef struct DirtyMapHeader {
+  size_t numRanges;
+  size_t maxRanges;
+  size_t numWritten;
+  size_t maxWritten;
+  bool writtenOverflow;
+  DirtyRange *ranges;
+  WrittenRange *written;
+  uint64_t *cleanBits;    // One bit per page; set if the page is unmodified.
+  uint64_t *pagemapBuf;   // PAGEMAP_CHUNK entries.
+} DirtyMapHeader;
+
+static int maxGeneration = -1;
+static int softDirtySupported = -1;
+
+// State of the checkpoint in progress.
+static bool tracking = false;
+static bool delta = false;
+static bool softDirtyCleared = false;
+static uint64_t curGeneration = 0;
+static char parentImage[PATH_MAX];
+
+// State of the last committed checkpoint image.
+static bool armed = false;
+static uint64_t generation = 0;
+static char prevImage[PATH_MAX];
+
+// The chain of parent images of the previous image, once a full image has
+// replaced it; see removeStaleParents().
+static uint64_t staleGenerations = 0;
+static char staleImage[PATH_MAX];
+
+static char *dirtyMap = NULL;
+static size_t dirtyMapSize = 0;
+static DirtyMapHeader *dm = NULL;
+static int pagemapFd = -1;
+
+// Cache of the current pagemap entries, used by nextPageRun().
+static VA cachedStart = NULL;
+static size_t cachedPages = 0;
+
+static int
+maxDeltaImages()
+{
+  if (maxGeneration == -1) {
+    const char *str = getenv(ENV_VAR_INCREMENTAL_CKPT);
+    maxGeneration = (str == NULL) ? 0 : atoi(str);
+    if (maxGeneration < 0) {
+      maxGeneration = 0;
+    } else if (maxGeneration > DMTCP_MAX_CKPT_GENERATION) {
+      JWARNING(false) (maxGeneration) (DMTCP_MAX_CKPT_GENERATION)
+        .Text("Too many incremental checkpoints requested; using the maximum");
+      maxGeneration = DMTCP_MAX_CKPT_GENERATION;
+    }
+  }
+  return maxGeneration;
+}
+
+static bool
+isUnmodified(uint64_t entry)
+{
+  return (entry & (PM_PRESENT | PM_SWAP)) != 0 && (entry & PM_SOFT_DIRTY) == 0;
+}
+
+static bool
+readPagemap(int fd, VA addr, size_t numPages, uint64_t *buf)
+{
+  size_t len = numPages * sizeof(uint64_t);
+  off_t offset = ((uint64_t)addr / Util::pageSize()) * sizeof(uint64_t);
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t rc = pread(fd, (char *)buf + done, len - done, offset + done);
+    if (rc == -1 && errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      return false;
+    }
+    done += rc;
+  }
+  return true;
+}
+
+// A newly created mapping is reported as soft-dirty if, and only if, the
+// kernel was built with CONFIG_MEM_SOFT_DIRTY.
+static bool
+isSoftDirtySupported()
+{
+  if (softDirtySupported != -1) {
+    return softDirtySupported;
+  }
+
+  softDirtySupported = 0;
+  int fd = _real_open("/proc/self/pagemap", O_RDONLY, 0);
+  if (fd == -1) {
+    return false;
+  }
+
+  size_t pagesize = Util::pageSize();
+  void *page = mmap(NULL, pagesize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (page != MAP_FAILED) {
+    uint64_t entry = 0;
+    *(volatile char *)page = 1;
+    if (readPagemap(fd, (VA)page, 1, &entry) &&
+        (entry & PM_PRESENT) && (entry & PM_SOFT_DIRTY)) {
+      softDirtySupported = 1;
+    }
+    munmap(page, pagesize);
+  }
+  _real_close(fd);
+
+  JWARNING(softDirtySupported)
+    .Text("The kernel does not track soft-dirty pages;"
+          " writing full checkpoint images only.");
+  return softDirtySupported;
+}
+
+static string
+parentImagePath(const char *image, uint64_t gen)
+{
+  string base = image;
+  if (Util::strEndsWith(base.c_str(), CKPT_FILE_SUFFIX)) {
+    base = base.substr(0, base.length() - CKPT_FILE_SUFFIX_LEN);
+  }
+  return base + CKPT_FILES_SUBDIR_SUFFIX + "/" +
+         jalib::Filesystem::BaseName(base) + "." + jalib::XToString(gen) +
+         CKPT_FILE_SUFFIX;
+}
+
+void
+IncrementalCkpt::prepare(DmtcpCkptHeader *hdr, bool imageIsCompressed)
+{
+  hdr->ckptGeneration = 0;
+  hdr->parentCkptImage[0] = '\0';
+  tracking = false;
+  delta = false;
+
+  if (maxDeltaImages() == 0) {
+    return;
+  }
+
+  // The parent images must be local files; see read_from_parent_images()
+  // in src/mtcp/mtcp_restart.c.
+  if (!CkptStore::instance().isLocal()) {
+    JTRACE("Image goes to dmtcp_ckpt_server; writing a full checkpoint image");
+    armed = false;
+    return;
+  }
+
+  if (imageIsCompressed || CkptWriter::useBlockCompression() ||
+      CkptSerializer::isForkedCkpt()) {
+    JTRACE("Compressed or forked ckpt; writing a full checkpoint image");
+    armed = false;
+    return;
+  }
+
+  if (!isSoftDirtySupported()) {
+    return;
+  }
+
+  tracking = true;
+  curGeneration = 0;
+  if (armed && generation < (uint64_t)maxDeltaImages()) {
+    string parent = parentImagePath(prevImage, generation);
+    JASSERT(parent.length() < sizeof(hdr->parentCkptImage)) (parent);
+    strcpy(parentImage, parent.c_str());
+    strcpy(hdr->parentCkptImage, parentImage);
+    curGeneration = generation + 1;
+    delta = true;
+  }
+  hdr->ckptGeneration = curGeneration;
+  JTRACE("Incremental checkpoint") (curGeneration) (parentImage);
+}
+
+bool
+IncrementalCkpt::isDelta()
+{
+  return delta;
+}
+
+bool
+IncrementalCkpt::isDirtyMap(const ProcMapsArea &area)
+{
+  return dirtyMap != NULL && area.addr == dirtyMap;
+}
+
+static void
+createDirtyMap(size_t numAreas, size_t numPages)
+{
+  size_t maxRanges = numAreas + DIRTY_MAP_EXTRA_RANGES;
+  size_t maxWritten = 2 * maxRanges;
+  size_t maxPages = numPages + DIRTY_MAP_EXTRA_PAGES;
+  size_t bitmapWords = (maxPages + 63) / 64;
+
+  size_t size = sizeof(DirtyMapHeader) +
+                maxRanges * sizeof(DirtyRange) +
+                maxWritten * sizeof(WrittenRange) +
+                bitmapWords * sizeof(uint64_t) +
+                PAGEMAP_CHUNK * sizeof(uint64_t);
+  size = (size + Util::pageSize() - 1) & ~(Util::pageSize() - 1);
+
+  char *map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  JASSERT(map != MAP_FAILED) (JASSERT_ERRNO) (size);
+
+  DirtyMapHeader *hdr = (DirtyMapHeader *)map;
+  char *p = map + sizeof(DirtyMapHeader);
+  hdr->numRanges = 0;
+  hdr->maxRanges = maxRanges;
+  hdr->numWritten = 0;
+  hdr->maxWritten = maxWritten;
+  hdr->writtenOverflow = false;
+  hdr->ranges = (DirtyRange *)p;
+  p += maxRanges * sizeof(DirtyRange);
+  hdr->written = (WrittenRange *)p;
+  p += maxWritten * sizeof(WrittenRange);
+  hdr->cleanBits = (uint64_t *)p;
+  p += bitmapWords * sizeof(uint64_t);
+  hdr->pagemapBuf = (uint64_t *)p;
+
+  dirtyMap = map;
+  dirtyMapSize = size;
+  dm = hdr;
+}
+
+// Marks the pages of 'range' that were not modified since the previous
+// checkpoint (and that the previous checkpoint wrote) as clean.  'written'
+// is the list of ranges written by the previous checkpoint, in address order.
+static void
+snapshotRange(const DirtyRange *range, const DirtyMapHeader *prev,
+              size_t *writtenIdx)
+{
+  size_t pagesize = Util::pageSize();
+  VA addr = range->start;
+  size_t page = range->firstPage;
+
+  while (addr < range->end) {
+    size_t n = MIN((size_t)PAGEMAP_CHUNK,
+                   (size_t)(range->end - addr) / pagesize);
+    if (!readPagemap(pagemapFd, addr, n, dm->pagemapBuf)) {
+      return;
+    }
+
+    for (size_t i = 0; i < n; i++, addr += pagesize, page++) {
+      while (*writtenIdx < prev->numWritten &&
+             prev->written[*writtenIdx].end <= addr) {
+        (*writtenIdx)++;
+      }
+      if (*writtenIdx == prev->numWritten) {
+        return;
+      }
+      if (addr >= prev->written[*writtenIdx].start &&
+          isUnmodified(dm->pagemapBuf[i])) {
+        dm->cleanBits[page / 64] |= 1ULL << (page % 64);
+      }
+    }
+  }
+}
+
+// Called at the start of mtcp_writememoryareas(), before /proc/self/maps is
+// read for writing the image.  Between reading the soft-dirty bits and
+// clearing them, only the stack of this thread and the dirty map itself may
+// be modified.  The stack is always treated as modified.
+void
+IncrementalCkpt::snapshotDirtyPages()
+{
+  softDirtyCleared = false;
+  if (!tracking) {
+    return;
+  }
+
+  char *prevMap = dirtyMap;
+  size_t prevMapSize = dirtyMapSize;
+  DirtyMapHeader *prev = dm;
+
+  size_t numAreas = 0;
+  size_t numPages = 0;
+  {
+    ProcSelfMaps procSelfMaps;
+    Area area;
+    while (procSelfMaps.getNextArea(&area)) {
+      numAreas++;
+      numPages += area.size / Util::pageSize();
+    }
+  }
+
+  createDirtyMap(numAreas, numPages);
+
+  bool overflow = false;
+  {
+    size_t maxPages = numPages + DIRTY_MAP_EXTRA_PAGES;
+    size_t page = 0;
+    ProcSelfMaps procSelfMaps;
+    Area area;
+    while (procSelfMaps.getNextArea(&area)) {
+      if (isDirtyMap(area) || (prevMap != NULL && area.addr == prevMap)) {
+        continue;
+      }
+      if (dm->numRanges == dm->maxRanges ||
+          page + area.size / Util::pageSize() > maxPages) {
+        overflow = true;
+        break;
+      }
+      DirtyRange *range = &dm->ranges[dm->numRanges++];
+      range->start = area.addr;
+      range->end = area.endAddr;
+      range->firstPage = page;
+      page += area.size / Util::pageSize();
+    }
+  }
+
+  pagemapFd = _real_open("/proc/self/pagemap", O_RDONLY, 0);
+  int clearRefsFd = _real_open("/proc/self/clear_refs", O_WRONLY, 0);
+  JWARNING(pagemapFd != -1 && clearRefsFd != -1) (JASSERT_ERRNO)
+    .Text("Cannot access soft-dirty bits; writing a full checkpoint image");
+
+  if (delta && prev != NULL && !overflow && pagemapFd != -1) {
+    char stackVar;
+    size_t writtenIdx = 0;
+    for (size_t i = 0; i < dm->numRanges; i++) {
+      const DirtyRange *range = &dm->ranges[i];
+      if (&stackVar >= range->start && &stackVar < range->end) {
+        continue;
+      }
+      snapshotRange(range, prev, &writtenIdx);
+    }
+  }
+
+  if (clearRefsFd != -1) {
+    ssize_t rc = write(clearRefsFd, CLEAR_REFS_SOFT_DIRTY,
+                       strlen(CLEAR_REFS_SOFT_DIRTY));
+    softDirtyCleared = (rc == (ssize_t)strlen(CLEAR_REFS_SOFT_DIRTY));
+    JWARNING(softDirtyCleared) (JASSERT_ERRNO)
+      .Text("Failed to clear soft-dirty bits");
+    _real_close(clearRefsFd);
+  }
+
+  if (prevMap != NULL) {
+    JASSERT(munmap(prevMap, prevMapSize) == 0) (JASSERT_ERRNO);
+  }
+  cachedStart = NULL;
+  cachedPages = 0;
+}
+
+void
+IncrementalCkpt::recordWrittenArea(VA addr, size_t size)
+{
+  if (!tracking || dm == NULL) {
+    return;
+  }
+
+  if (dm->numWritten > 0 && dm->written[dm->numWritten - 1].end == addr) {
+    dm->written[dm->numWritten - 1].end = addr + size;
+  } else if (dm->numWritten < dm->maxWritten) {
+    dm->written[dm->numWritten].start = addr;
+    dm->written[dm->numWritten].end = addr + size;
+    dm->numWritten++;
+  } else {
+    dm->writtenOverflow = true;
+  }
+}
+
+static const DirtyRange *
+findRange(VA addr)
+{
+  size_t lo = 0;
+  size_t hi = dm->numRanges;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (dm->ranges[mid].end <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < dm->numRanges && dm->ranges[lo].start <= addr) {
+    return &dm->ranges[lo];
+  }
+  return NULL;
+}
+
+static bool
+isPageClean(const DirtyRange *range, VA addr)
+{
+  size_t pagesize = Util::pageSize();
+  size_t page = range->firstPage + (addr - range->start) / pagesize;
+  if ((dm->cleanBits[page / 64] & (1ULL << (page % 64))) == 0) {
+    return false;
+  }
+
+  // The page may have been modified since the soft-dirty bits were cleared.
+  if (addr < cachedStart || addr >= cachedStart + cachedPages * pagesize) {
+    size_t n = MIN((size_t)PAGEMAP_CHUNK,
+                   (size_t)(range->end - addr) / pagesize);
+    cachedStart = addr;
+    cachedPages = readPagemap(pagemapFd, addr, n, dm->pagemapBuf) ? n : 0;
+    if (cachedPages == 0) {
+      return false;
+    }
+  }
+  return isUnmodified(dm->pagemapBuf[(addr - cachedStart) / pagesize]);
+}
+
+// Returns true if the pages starting at 'addr' must be written out, and false
+// if they are unmodified and can be found in the parent image.  '*runSize' is
+// set to the number of bytes (at most 'size') in the same state.
+bool
+IncrementalCkpt::nextPageRun(VA addr, size_t size, size_t *runSize)
+{
+  *runSize = size;
+  if (!delta || !softDirtyCleared || pagemapFd == -1) {
+    return true;
+  }
+
+  const DirtyRange *range = findRange(addr);
+  if (range == NULL) {
+    return true;
+  }
+
+  size_t pagesize = Util::pageSize();
+  VA end = MIN(addr + size, range->end);
+  bool clean = isPageClean(range, addr);
+  VA p = addr + pagesize;
+  while (p < end && isPageClean(range, p) == clean) {
+    p += pagesize;
+  }
+  *runSize = p - addr;
+  return !clean;
+}
+
+void
+IncrementalCkpt::finish()
+{
+  if (pagemapFd != -1) {
+    _real_close(pagemapFd);
+    pagemapFd = -1;
+  }
+}
+
+// Called before the temporary checkpoint image is renamed to 'ckptFilename'.
+void
+IncrementalCkpt::commit(const string &ckptFilename)
+{
+  string path = ckptFilename;
+  if (path[0] != '/') {
+    path = jalib::Filesystem::GetCWD() + "/" + path;
+  }
+
+  // A full image that replaces a delta image leaves nothing that refers to
+  // the parents of the latter.
+  if (!delta && generation > 0) {
+    if (path == prevImage) {
+      strcpy(staleImage, prevImage);
+      staleGenerations = generation;
+    }
+    generation = 0;
+  }
+
+  if (!tracking) {
+    armed = false;
+    return;
+  }
+
+  if (delta) {
+    string parent = parentImage;
+    string dir = jalib::Filesystem::DirName(parent);
+    JASSERT(mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST)
+      (JASSERT_ERRNO) (dir);
+    JASSERT(rename(prevImage, parentImage) == 0) (JASSERT_ERRNO)
+      (prevImage) (parentImage)
+      .Text("Failed to move the parent of the incremental checkpoint image");
+  }
+
+  JASSERT(path.length() < sizeof(prevImage)) (path);
+  strcpy(prevImage, path.c_str());
+
+  generation = curGeneration;
+  armed = softDirtyCleared && !dm->writtenOverflow;
+  tracking = false;
+  delta = false;
+}
+
+// Called once the image passed to commit() has been renamed into place.
+void
+IncrementalCkpt::removeStaleParents()
+{
+  if (staleGenerations == 0) {
+    return;
+  }
+
+  for (uint64_t gen = 0; gen < staleGenerations; gen++) {
+    string parent = parentImagePath(staleImage, gen);
+    JWARNING(unlink(parent.c_str()) == 0 || errno == ENOENT)
+      (parent) (JASSERT_ERRNO) .Text("Failed to remove a stale parent image");
+  }
+  staleGenerations = 0;
+
+  // The directory also holds the files saved by the file plugin, if any.
+  string dir = jalib::Filesystem::DirName(parentImagePath(staleImage, 0));
+  rmdir(dir.c_str());
+}
+
+// After restart, the whole address space has been recreated and every page
+// reads as soft-dirty; start over with a full checkpoint image.
+void
+IncrementalCkpt::reset()
+{
+  tracking = false;
+  delta = false;
+  armed = false;
+
+  // The dirty map was not part of the checkpoint image.
+  dirtyMap = NULL;
+  dirtyMapSize = 0;
+  dm = NULL;
+  pagemapFd = -1;
+}
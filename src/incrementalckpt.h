@@ -0,0 +1,73 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef INCREMENTAL_CKPT_H
+#define INCREMENTAL_CKPT_H
+
+#include "dmtcp.h"
+#include "dmtcpalloc.h"
+#include "procmapsarea.h"
+
+// Incremental checkpoints (DMTCP_INCREMENTAL_CKPT=N).
+//
+// After a checkpoint image has been written, up to N following checkpoints
+// are written as delta images.  A delta image has the usual layout, but the
+// pages of anonymous areas that were not modified since the previous
+// checkpoint are stored as child headers with DMTCP_PAGES_IN_PARENT and no
+// data; their contents are found at the same address in the parent image
+// named by DmtcpCkptHeader::parentCkptImage.  mtcp_restart follows the chain
+// of parent images, and dmtcp_ckpt_compact turns a delta image back into a
+// full one.
+//
+// Modified pages are found with the kernel's soft-dirty bits: at the start
+// of each checkpoint, /proc/self/pagemap is read into a bitmap (the "dirty
+// map", which, like the writer arena, is skipped while writing the image) and
+// the bits are cleared through /proc/self/clear_refs.  A page is then written
+// if it was dirty in the bitmap, if it has been dirtied since (e.g., by the
+// checkpoint thread itself), or if it was not written by the previous
+// checkpoint.
+//
+// When a delta image is committed, the previous image is moved out of the
+// way to <ckpt>_files/<ckpt>.<generation>.dmtcp, so that the checkpoint
+// directory holds the same file names as with full checkpoints.  Once a
+// full image has replaced a delta image, the parent images of the latter
+// are removed, along with the <ckpt>_files directory if it is empty (except
+// with forked checkpointing, where the full image is renamed by the forked
+// process).  A delta image that was restarted from, or compacted, thus
+// takes no extra space after the next checkpoint.  Delta
+// images are only written if the image is neither gzip- nor
+// block-compressed, not with forked checkpointing, and not to a
+// dmtcp_ckpt_server.
+
+namespace dmtcp
+{
+namespace IncrementalCkpt
+{
+void prepare(DmtcpCkptHeader *hdr, bool imageIsCompressed);
+void snapshotDirtyPages();
+bool isDelta();
+bool isDirtyMap(const ProcMapsArea &area);
+void recordWrittenArea(VA addr, size_t size);
+bool nextPageRun(VA addr, size_t size, size_t *runSize);
+void finish();
+void commit(const string &ckptFilename);
+void removeStaleParents();
+void reset();
+}
+}
+#endif // ifndef INCREMENTAL_CKPT_H
@@ -30,6 +30,14 @@ KVDBResponse request(KVDBRequest request,
     return KVDBResponse::INVALID_REQUEST;
   }
 
+  if (request == KVDBRequest::MGET ||
+      request == KVDBRequest::MSET ||
+      request == KVDBRequest::MINCRBY ||
+      request == KVDBRequest::MWAIT ||
+      request == KVDBRequest::WATCH) {
+    return KVDBResponse::INVALID_REQUEST;
+  }
+
   JWARNING(id.length() < sizeof(msg.kvdbId));
   strncpy(msg.kvdbId, id.data(), sizeof msg.kvdbId);
   msg.keyLen = key.length() + 1;
@@ -81,6 +89,193 @@ set(string const& id, string const& key, string const& val, string *oldVal)
   return request(KVDBRequest::SET, id, key, val, oldVal);
 }
 
+static KVDBResponse
+mrequest(KVDBRequest request,
+         string const& id,
+         vector<string> const& keys,
+         vector<string> const *vals,
+         vector<string> *oldVals,
+         vector<KVDBResponse> *responses,
+         int timeoutMs = -1)
+{
+  if (id.empty() || (vals != NULL && vals->size() != keys.size())) {
+    return KVDBResponse::INVALID_REQUEST;
+  }
+
+  if (keys.empty()) {
+    return KVDBResponse::SUCCESS;
+  }
+
+  DmtcpMessage msg(DMT_KVDB_REQUEST);
+  msg.kvdbRequest = request;
+  msg.numKeys = keys.size();
+  msg.kvdbTimeoutMs = timeoutMs;
+
+  JWARNING(id.length() < sizeof(msg.kvdbId));
+  strncpy(msg.kvdbId, id.data(), sizeof msg.kvdbId);
+
+  vector<char> data;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (keys[i].empty()) {
+      return KVDBResponse::INVALID_REQUEST;
+    }
+    data.insert(data.end(), keys[i].c_str(),
+                keys[i].c_str() + keys[i].length() + 1);
+  }
+  msg.keyLen = data.size();
+
+  if (vals != NULL) {
+    for (size_t i = 0; i < vals->size(); i++) {
+      const string &val = (*vals)[i];
+      data.insert(data.end(), val.c_str(), val.c_str() + val.length() + 1);
+    }
+  }
+  msg.valLen = data.size() - msg.keyLen;
+  msg.extraBytes = data.size();
+
+  vector<char> replyData;
+  DmtcpMessage reply =
+    CoordinatorAPI::kvdbMultiRequest(msg, data.data(), &replyData);
+  JASSERT(reply.numKeys == keys.size()) (reply.numKeys) (keys.size());
+
+  if (responses != NULL) {
+    responses->assign(keys.size(), reply.kvdbResponse);
+    if (reply.keyLen == keys.size() * sizeof(KVDBResponse)) {
+      memcpy(responses->data(), replyData.data(), reply.keyLen);
+    }
+  }
+
+  if (oldVals != NULL) {
+    oldVals->clear();
+    const char *val = replyData.data() + reply.keyLen;
+    const char *end = val + reply.valLen;
+    while (val < end) {
+      oldVals->push_back(val);
+      val += oldVals->back().length() + 1;
+    }
+    oldVals->resize(keys.size());
+  }
+
+  return reply.kvdbResponse;
+}
+
+KVDBResponse
+mget(string const& id,
+     vector<string> const& keys,
+     vector<string> *vals,
+     vector<KVDBResponse> *responses)
+{
+  return mrequest(KVDBRequest::MGET, id, keys, NULL, vals, responses);
+}
+
+KVDBResponse
+mset(string const& id,
+     vector<string> const& keys,
+     vector<string> const& vals)
+{
+  return mrequest(KVDBRequest::MSET, id, keys, &vals, NULL, NULL);
+}
+
+KVDBResponse
+mincrby(string const& id,
+        vector<string> const& keys,
+        vector<int64_t> const& vals,
+        vector<int64_t> *oldVals)
+{
+  vector<string> valStrs;
+  for (size_t i = 0; i < vals.size(); i++) {
+    valStrs.push_back(jalib::XToString(vals[i]));
+  }
+
+  vector<string> oldValStrs;
+  KVDBResponse response = mrequest(KVDBRequest::MINCRBY, id, keys, &valStrs,
+                                   &oldValStrs, NULL);
+  if (response == KVDBResponse::SUCCESS && oldVals != NULL) {
+    oldVals->clear();
+    for (size_t i = 0; i < oldValStrs.size(); i++) {
+      oldVals->push_back(jalib::StringToInt64(oldValStrs[i]));
+    }
+  }
+
+  return response;
+}
+
+KVDBResponse
+mgetWait(string const& id,
+         vector<string> const& keys,
+         vector<string> *vals,
+         vector<KVDBResponse> *responses,
+         int timeoutMs)
+{
+  return mrequest(KVDBRequest::MWAIT, id, keys, NULL, vals, responses,
+                  timeoutMs);
+}
+
+KVDBResponse
+getWait(string const& id, string const& key, string *val, int timeoutMs)
+{
+  vector<string> keys(1, key);
+  vector<string> vals;
+
+  KVDBResponse response = mgetWait(id, keys, &vals, NULL, timeoutMs);
+  if (response == KVDBResponse::SUCCESS && val != NULL) {
+    *val = vals[0];
+  }
+
+  return response;
+}
+
+KVDBResponse
+watch(string const& id,
+      string const& prefix,
+      size_t minKeys,
+      vector<string> *keys,
+      vector<string> *vals,
+      int timeoutMs)
+{
+  if (id.empty() || prefix.empty()) {
+    return KVDBResponse::INVALID_REQUEST;
+  }
+
+  DmtcpMessage msg(DMT_KVDB_REQUEST);
+  msg.kvdbRequest = KVDBRequest::WATCH;
+  msg.numKeys = 1;
+  msg.kvdbTimeoutMs = timeoutMs;
+
+  JWARNING(id.length() < sizeof(msg.kvdbId));
+  strncpy(msg.kvdbId, id.data(), sizeof msg.kvdbId);
+
+  string minKeysStr = jalib::XToString(minKeys);
+  vector<char> data;
+  data.insert(data.end(), prefix.c_str(),
+              prefix.c_str() + prefix.length() + 1);
+  data.insert(data.end(), minKeysStr.c_str(),
+              minKeysStr.c_str() + minKeysStr.length() + 1);
+  msg.keyLen = prefix.length() + 1;
+  msg.valLen = minKeysStr.length() + 1;
+  msg.extraBytes = data.size();
+
+  vector<char> replyData;
+  DmtcpMessage reply =
+    CoordinatorAPI::kvdbMultiRequest(msg, data.data(), &replyData);
+
+  keys->clear();
+  vals->clear();
+  const char *str = replyData.data();
+  for (uint32_t i = 0; i < reply.numKeys; i++) {
+    keys->push_back(str);
+    str += keys->back().length() + 1;
+  }
+  for (uint32_t i = 0; i < reply.numKeys; i++) {
+    vals->push_back(str);
+    str += vals->back().length() + 1;
+  }
+  JASSERT(str == replyData.data() + replyData.size())
+    (reply.numKeys) (replyData.size());
+
+  return reply.kvdbResponse;
+}
+
 ostream &
 operator<<(ostream &o, const KVDBRequest &id)
 {
@@ -109,6 +304,21 @@ operator<<(ostream &o, const KVDBRequest &id)
     case KVDBRequest::MAX:
       o << "KVDBRequest::MAX";
       break;
+    case KVDBRequest::MGET:
+      o << "KVDBRequest::MGET";
+      break;
+    case KVDBRequest::MSET:
+      o << "KVDBRequest::MSET";
+      break;
+    case KVDBRequest::MINCRBY:
+      o << "KVDBRequest::MINCRBY";
+      break;
+    case KVDBRequest::MWAIT:
+      o << "KVDBRequest::MWAIT";
+      break;
+    case KVDBRequest::WATCH:
+      o << "KVDBRequest::WATCH";
+      break;
   }
 
   return o;
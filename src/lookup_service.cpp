@@ -19,64 +19,294 @@
  *  <http://www.gnu.org/licenses/>.                                         *
  ****************************************************************************/
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
 #include "dmtcp.h"
+#include "dmtcp_coordinator.h"
 #include "util.h"
 #include "lookup_service.h"
 #include "tokenize.h"
 #include "../jalib/jassert.h"
 #include "../jalib/jconvert.h"
-#include "../jalib/jsocket.h"
 
 using namespace dmtcp;
 
 using kvdb::KVDBRequest;
 using kvdb::KVDBResponse;
 
+#define KEY_ARENA_BLOCK_SIZE (64 * 1024)
+#define MIN_KEY_INDEX_SLOTS  16
+#define NUM_REQUEST_TYPES    ((size_t)KVDBRequest::WATCH + 1)
+
+// FNV-1a; keys are short.
+uint32_t
+LookupService::KeyIndex::hash(const char *key, size_t len)
+{
+  uint32_t h = 2166136261u;
+
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)key[i]) * 16777619u;
+  }
+  return h;
+}
+
+// Returns the slot holding key, or the free slot where it would go.
+size_t
+LookupService::KeyIndex::findSlot(const char *key,
+                                  size_t len,
+                                  uint32_t hash) const
+{
+  size_t mask = _slots.size() - 1;
+
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    const Slot &slot = _slots[i];
+    if (slot.index == 0 ||
+        (slot.hash == hash &&
+         strncmp(_keys[slot.index - 1], key, len) == 0 &&
+         _keys[slot.index - 1][len] == '\0')) {
+      return i;
+    }
+  }
+}
+
+size_t
+LookupService::KeyIndex::find(const char *key, size_t len) const
+{
+  if (_keys.empty()) {
+    return NOT_FOUND;
+  }
+
+  const Slot &slot = _slots[findSlot(key, len, hash(key, len))];
+  return slot.index == 0 ? NOT_FOUND : slot.index - 1;
+}
+
+size_t
+LookupService::KeyIndex::insert(const char *key, size_t len, bool *inserted)
+{
+  // Keep the table at most half full.
+  if (2 * (_keys.size() + 1) > _slots.size()) {
+    grow();
+  }
+
+  uint32_t h = hash(key, len);
+  Slot &slot = _slots[findSlot(key, len, h)];
+  *inserted = slot.index == 0;
+  if (*inserted) {
+    _keys.push_back(copyKey(key, len));
+    slot.hash = h;
+    slot.index = _keys.size();
+  }
+  return slot.index - 1;
+}
+
+void
+LookupService::KeyIndex::grow()
+{
+  size_t numSlots = MAX(_slots.size() * 2, MIN_KEY_INDEX_SLOTS);
+  vector<Slot> slots(numSlots);
+
+  for (size_t i = 0; i < _slots.size(); i++) {
+    if (_slots[i].index != 0) {
+      size_t j = _slots[i].hash & (numSlots - 1);
+      while (slots[j].index != 0) {
+        j = (j + 1) & (numSlots - 1);
+      }
+      slots[j] = _slots[i];
+    }
+  }
+  _slots.swap(slots);
+}
+
+const char *
+LookupService::KeyIndex::copyKey(const char *key, size_t len)
+{
+  char *copy;
+
+  if (len + 1 > KEY_ARENA_BLOCK_SIZE / 4) {
+    // A large key gets a block of its own; the current one stays current.
+    copy = new char[len + 1];
+    _blocks.push_back(copy);
+  } else {
+    if (len + 1 > _blockLeft) {
+      _block = new char[KEY_ARENA_BLOCK_SIZE];
+      _blockLeft = KEY_ARENA_BLOCK_SIZE;
+      _blocks.push_back(_block);
+    }
+    copy = _block;
+    _block += len + 1;
+    _blockLeft -= len + 1;
+  }
+
+  memcpy(copy, key, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+void
+LookupService::KeyIndex::clear()
+{
+  for (size_t i = 0; i < _blocks.size(); i++) {
+    delete [] _blocks[i];
+  }
+  _blocks.clear();
+  _block = NULL;
+  _blockLeft = 0;
+  _keys.clear();
+  _slots.clear();
+}
+
+struct KeyOrder {
+  KeyOrder(const vector<const char *> &keys) : keys(keys) {}
+
+  bool operator()(size_t a, size_t b) const
+  {
+    return strcmp(keys[a], keys[b]) < 0;
+  }
+
+  const vector<const char *> &keys;
+};
+
+void
+LookupService::KeyIndex::sorted(vector<size_t> *order) const
+{
+  order->resize(_keys.size());
+  for (size_t i = 0; i < _keys.size(); i++) {
+    (*order)[i] = i;
+  }
+  std::sort(order->begin(), order->end(), KeyOrder(_keys));
+}
+
+string
+LookupService::Value::str() const
+{
+  return isInt ? jalib::XToString(intVal) : strVal;
+}
+
+void
+LookupService::Value::appendTo(string *s) const
+{
+  if (isInt) {
+    *s += jalib::XToString(intVal);
+  } else {
+    *s += strVal;
+  }
+}
+
+int64_t
+LookupService::Value::toInt64() const
+{
+  return isInt ? intVal : jalib::StringToInt64(strVal);
+}
+
 void
 LookupService::reset()
 {
-  _maps.clear();
+  DmtcpMutexLock(&_lock);
+  for (size_t i = 0; i < _waits.size(); i++) {
+    delete _waits[i];
+  }
+  _waits.clear();
+
+  for (size_t i = 0; i < _dbs.size(); i++) {
+    delete _dbs[i];
+  }
+  _dbs.clear();
+  _ids.clear();
+  DmtcpMutexUnlock(&_lock);
+}
+
+LookupService::Database *
+LookupService::findDatabase(const char *id, size_t len) const
+{
+  size_t i = _ids.find(id, len);
+  return i == KeyIndex::NOT_FOUND ? NULL : _dbs[i];
+}
+
+LookupService::Database *
+LookupService::getDatabase(const char *id, size_t len)
+{
+  bool inserted;
+  size_t i = _ids.insert(id, len, &inserted);
+
+  if (inserted) {
+    _dbs.push_back(new Database());
+  }
+  return _dbs[i];
 }
 
 void
 LookupService::set(string const& id, string const& key, string const& val)
 {
-  _maps[id][key] = val;
+  DmtcpMutexLock(&_lock);
+  Database *db = getDatabase(id.data(), id.length());
+  bool inserted;
+  size_t i = db->keys.insert(key.data(), key.length(), &inserted);
+
+  if (inserted) {
+    db->vals.push_back(Value());
+  }
+  db->vals[i].isInt = false;
+  db->vals[i].strVal = val;
+
+  if (inserted) {
+    keyInserted(db, db->keys.key(i));
+  }
+  DmtcpMutexUnlock(&_lock);
 }
 
-KVDBResponse
-LookupService::get(string const& id, string const& key, string *val)
+const LookupService::Value *
+LookupService::lookup(const char *id,
+                      size_t idLen,
+                      const char *key,
+                      size_t keyLen,
+                      KVDBResponse *response) const
 {
-  if (_maps.find(id) == _maps.end()) {
+  Database *db = findDatabase(id, idLen);
+  if (db == NULL) {
     JTRACE("Lookup Failed, database not found.") (id);
-    return KVDBResponse::DB_NOT_FOUND;
+    *response = KVDBResponse::DB_NOT_FOUND;
+    return NULL;
   }
 
-  KeyValueMap &kvmap = _maps[id];
-  if (kvmap.find(key) == kvmap.end()) {
+  size_t i = db->keys.find(key, keyLen);
+  if (i == KeyIndex::NOT_FOUND) {
     JTRACE("Lookup Failed, Key not found.") (id) (key);
-    return KVDBResponse::KEY_NOT_FOUND;
+    *response = KVDBResponse::KEY_NOT_FOUND;
+    return NULL;
   }
 
-  *val = kvmap[key];
+  *response = KVDBResponse::SUCCESS;
+  return &db->vals[i];
+}
 
-  return KVDBResponse::SUCCESS;
+KVDBResponse
+LookupService::get(string const& id, string const& key, string *val)
+{
+  KVDBResponse response;
+  DmtcpMutexLock(&_lock);
+  const Value *value = lookup(id.data(), id.length(),
+                              key.data(), key.length(), &response);
+
+  if (value != NULL) {
+    *val = value->str();
+  }
+  DmtcpMutexUnlock(&_lock);
+  return response;
 }
 
 void
-LookupService::sendResponse(jalib::JSocket &remote,
+LookupService::sendResponse(CoordClient *client,
                             KVDBResponse response)
 {
   DmtcpMessage reply(DMT_KVDB_RESPONSE);
   reply.kvdbResponse = response;
-  remote << reply;
+  client->send(reply);
 }
 
 void
-LookupService::sendResponse(jalib::JSocket &remote,
+LookupService::sendResponse(CoordClient *client,
                             string const& val)
 {
   DmtcpMessage reply(DMT_KVDB_RESPONSE);
@@ -84,101 +314,527 @@ LookupService::sendResponse(jalib::JSocket &remote,
   reply.valLen = val.size() + 1;
   reply.extraBytes = reply.valLen;
 
-  remote << reply;
-  remote.writeAll(val.data(), reply.valLen);
+  client->send(reply, val.c_str());
 }
 
 void
-LookupService::processRequest(jalib::JSocket &remote,
+LookupService::processRequest(CoordClient *client,
                          const DmtcpMessage &msg,
                          const void *extraData)
 {
-  JASSERT(msg.keyLen > 0 &&
-          msg.valLen > 0 &&
-          (msg.keyLen + msg.valLen) == msg.extraBytes)
-  (msg.keyLen)(msg.valLen)(msg.extraBytes);
-
-  if (msg.kvdbRequest == KVDBRequest::GET) {
-    processGet(remote, msg, extraData);
-    return;
+  DmtcpMutexLock(&_lock);
+  if ((size_t)msg.kvdbRequest < NUM_REQUEST_TYPES) {
+    _numRequests[(int)msg.kvdbRequest]++;
   }
 
-  processSet(remote, msg, extraData);
-  return;
+  if (msg.kvdbRequest == KVDBRequest::MGET ||
+      msg.kvdbRequest == KVDBRequest::MSET ||
+      msg.kvdbRequest == KVDBRequest::MINCRBY ||
+      msg.kvdbRequest == KVDBRequest::MWAIT ||
+      msg.kvdbRequest == KVDBRequest::WATCH) {
+    processMulti(client, msg, extraData);
+  } else {
+    JASSERT(msg.keyLen > 0 &&
+            msg.valLen > 0 &&
+            (msg.keyLen + msg.valLen) == msg.extraBytes)
+    (msg.keyLen)(msg.valLen)(msg.extraBytes);
+
+    if (msg.kvdbRequest == KVDBRequest::GET) {
+      processGet(client, msg, extraData);
+    } else {
+      processSet(client, msg, extraData);
+    }
+  }
+  DmtcpMutexUnlock(&_lock);
 }
 
 void
-LookupService::processGet(jalib::JSocket &remote,
+LookupService::processGet(CoordClient *client,
                          const DmtcpMessage &msg,
                          const void *extraData)
 {
   const char *key = (const char*)extraData;
-  string val;
+  KVDBResponse response;
+  const Value *value = lookup(msg.kvdbId,
+                              strnlen(msg.kvdbId, sizeof(msg.kvdbId)),
+                              key, strlen(key), &response);
 
-  KVDBResponse response = get(msg.kvdbId, key, &val);
-
-  if (response == KVDBResponse::SUCCESS) {
-    sendResponse(remote, val);
+  if (value != NULL) {
+    sendResponse(client, value->str());
   } else {
-    sendResponse(remote, response);
+    sendResponse(client, response);
   }
   return;
 }
 
 void
-LookupService::processSet(jalib::JSocket &remote,
+LookupService::processSet(CoordClient *client,
                           const DmtcpMessage &msg,
                           const void *extraData)
 {
-  KeyValueMap &kvmap = _maps[msg.kvdbId];
+  Database *db = getDatabase(msg.kvdbId,
+                             strnlen(msg.kvdbId, sizeof(msg.kvdbId)));
   const char *key = (const char*)extraData;
   const char *val = key + msg.keyLen;
 
-  string oldVal("0");
-  get(msg.kvdbId, key, &oldVal);
+  string oldVal;
+  update(db, msg.kvdbRequest, key, val, &oldVal);
+  sendResponse(client, oldVal);
+}
 
-  if (msg.kvdbRequest == KVDBRequest::SET ||
-      kvmap.find(key) == kvmap.end()) {
-    kvmap[key] = val;
-    sendResponse(remote, oldVal);
+// Splits len bytes of NUL-terminated strings; there must be n of them.
+static void
+splitStrings(const char *buf, size_t len, size_t n, vector<const char*> *strs)
+{
+  const char *end = buf + len;
+
+  JASSERT(len == 0 || end[-1] == '\0') (len);
+  strs->reserve(n);
+  while (buf < end) {
+    strs->push_back(buf);
+    buf += strlen(buf) + 1;
+  }
+  JASSERT(strs->size() == n) (strs->size()) (n);
+}
+
+void
+LookupService::processMulti(CoordClient *client,
+                            const DmtcpMessage &msg,
+                            const void *extraData)
+{
+  JASSERT(msg.numKeys > 0 &&
+          msg.keyLen > 0 &&
+          (msg.keyLen + msg.valLen) == msg.extraBytes)
+  (msg.numKeys)(msg.keyLen)(msg.valLen)(msg.extraBytes);
+
+  vector<const char*> keys;
+  vector<const char*> vals;
+  const char *data = (const char*)extraData;
+  size_t idLen = strnlen(msg.kvdbId, sizeof(msg.kvdbId));
+  splitStrings(data, msg.keyLen, msg.numKeys, &keys);
+  if (msg.kvdbRequest != KVDBRequest::MGET &&
+      msg.kvdbRequest != KVDBRequest::MWAIT) {
+    splitStrings(data + msg.keyLen, msg.valLen, msg.numKeys, &vals);
+  }
+
+  if (msg.kvdbRequest == KVDBRequest::MGET) {
+    sendValues(client, findDatabase(msg.kvdbId, idLen), keys);
+    return;
+  }
+
+  if (msg.kvdbRequest == KVDBRequest::MWAIT ||
+      msg.kvdbRequest == KVDBRequest::WATCH) {
+    processWait(client, msg, extraData, keys, vals);
+    return;
+  }
+
+  KVDBRequest request = msg.kvdbRequest == KVDBRequest::MSET
+    ? KVDBRequest::SET : KVDBRequest::INCRBY;
+  Database *db = getDatabase(msg.kvdbId, idLen);
+  bool wantOldVals = msg.kvdbRequest == KVDBRequest::MINCRBY;
+  string oldVal;
+  vector<char> replyData;
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    update(db, request, keys[i], vals[i], wantOldVals ? &oldVal : NULL);
+    if (wantOldVals) {
+      replyData.insert(replyData.end(), oldVal.c_str(),
+                       oldVal.c_str() + oldVal.length() + 1);
+    }
+  }
+
+  DmtcpMessage reply(DMT_KVDB_RESPONSE);
+  reply.kvdbResponse = KVDBResponse::SUCCESS;
+  reply.numKeys = msg.numKeys;
+  reply.valLen = replyData.size();
+  reply.extraBytes = replyData.size();
+  client->send(reply, replyData.data());
+}
+
+// The response to MGET and MWAIT: the result for each key, then the values.
+void
+LookupService::sendValues(CoordClient *client,
+                          const Database *db,
+                          vector<const char *> const &keys)
+{
+  DmtcpMessage reply(DMT_KVDB_RESPONSE);
+  reply.kvdbResponse = KVDBResponse::SUCCESS;
+  reply.numKeys = keys.size();
+
+  vector<KVDBResponse> responses(keys.size(), KVDBResponse::SUCCESS);
+  string valData;
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    size_t k = KeyIndex::NOT_FOUND;
+    if (db == NULL) {
+      responses[i] = KVDBResponse::DB_NOT_FOUND;
+    } else if ((k = db->keys.find(keys[i], strlen(keys[i]))) ==
+               KeyIndex::NOT_FOUND) {
+      responses[i] = KVDBResponse::KEY_NOT_FOUND;
+    } else {
+      db->vals[k].appendTo(&valData);
+    }
+    valData += '\0';
+
+    if (responses[i] != KVDBResponse::SUCCESS &&
+        reply.kvdbResponse == KVDBResponse::SUCCESS) {
+      JTRACE("Lookup Failed.") (keys[i]) ((int)responses[i]);
+      reply.kvdbResponse = responses[i];
+    }
+  }
+
+  reply.keyLen = responses.size() * sizeof(KVDBResponse);
+  reply.valLen = valData.size();
+  reply.extraBytes = reply.keyLen + reply.valLen;
+
+  vector<char> replyData(reply.extraBytes);
+  memcpy(replyData.data(), responses.data(), reply.keyLen);
+  memcpy(replyData.data() + reply.keyLen, valData.data(), reply.valLen);
+  client->send(reply, replyData.data());
+}
+
+// The response to WATCH: the keys that start with prefix, then their values.
+void
+LookupService::sendMatches(CoordClient *client,
+                           const Database *db,
+                           const char *prefix,
+                           size_t minKeys)
+{
+  DmtcpMessage reply(DMT_KVDB_RESPONSE);
+  size_t prefixLen = strlen(prefix);
+  string keyData;
+  string valData;
+
+  for (size_t i = 0; i < db->keys.size(); i++) {
+    const char *key = db->keys.key(i);
+    if (strncmp(key, prefix, prefixLen) == 0) {
+      keyData.append(key, strlen(key) + 1);
+      db->vals[i].appendTo(&valData);
+      valData += '\0';
+      reply.numKeys++;
+    }
+  }
+
+  reply.kvdbResponse = reply.numKeys >= minKeys ? KVDBResponse::SUCCESS
+                                                : KVDBResponse::KEY_NOT_FOUND;
+  reply.keyLen = keyData.size();
+  reply.valLen = valData.size();
+  reply.extraBytes = reply.keyLen + reply.valLen;
+
+  keyData += valData;
+  client->send(reply, keyData.data());
+}
+
+static uint64_t
+nowMs()
+{
+  struct timespec ts;
+
+  JASSERT(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void
+LookupService::processWait(CoordClient *client,
+                           const DmtcpMessage &msg,
+                           const void *extraData,
+                           vector<const char *> const &keys,
+                           vector<const char *> const &vals)
+{
+  Wait *wait = new Wait();
+  wait->client = client;
+  wait->request = msg.kvdbRequest;
+  wait->db = getDatabase(msg.kvdbId, strnlen(msg.kvdbId, sizeof(msg.kvdbId)));
+  wait->keyData.assign((const char *)extraData,
+                       (const char *)extraData + msg.keyLen);
+  for (size_t i = 0; i < keys.size(); i++) {
+    wait->keys.push_back(&wait->keyData[keys[i] - (const char *)extraData]);
+  }
+  wait->minKeys = 0;
+  wait->missing = 0;
+  wait->deadline = 0;
+
+  Database *db = wait->db;
+  if (wait->request == KVDBRequest::WATCH) {
+    const char *prefix = wait->keys[0];
+    size_t prefixLen = strlen(prefix);
+    size_t numMatches = 0;
+
+    wait->minKeys = jalib::StringToInt64(vals[0]);
+    for (size_t i = 0; i < db->keys.size(); i++) {
+      if (strncmp(db->keys.key(i), prefix, prefixLen) == 0) {
+        numMatches++;
+      }
+    }
+    if (numMatches < wait->minKeys) {
+      wait->missing = wait->minKeys - numMatches;
+    }
+  } else {
+    for (size_t i = 0; i < wait->keys.size(); i++) {
+      if (db->keys.find(wait->keys[i], strlen(wait->keys[i])) ==
+          KeyIndex::NOT_FOUND) {
+        wait->missing++;
+      }
+    }
+  }
+
+  if (wait->missing == 0 || msg.kvdbTimeoutMs == 0) {
+    finishWait(wait);
+    return;
+  }
+
+  if (msg.kvdbTimeoutMs > 0) {
+    wait->deadline = nowMs() + msg.kvdbTimeoutMs;
+  }
+
+  if (wait->request == KVDBRequest::WATCH) {
+    db->watches.push_back(wait);
+  } else {
+    for (size_t i = 0; i < wait->keys.size(); i++) {
+      if (db->keys.find(wait->keys[i], strlen(wait->keys[i])) ==
+          KeyIndex::NOT_FOUND) {
+        db->waiters[wait->keys[i]].push_back(wait);
+      }
+    }
+  }
+  _waits.push_back(wait);
+  JTRACE("Parked KVDB request") (client->identity()) ((int)wait->request)
+    (wait->missing);
+}
+
+// Called once for each key inserted into db; answers the requests that were
+// waiting for it.
+void
+LookupService::keyInserted(Database *db, const char *key)
+{
+  vector<Wait *> ready;
+
+  if (!db->waiters.empty()) {
+    map<string, vector<Wait *> >::iterator it = db->waiters.find(key);
+    if (it != db->waiters.end()) {
+      for (size_t i = 0; i < it->second.size(); i++) {
+        Wait *wait = it->second[i];
+        if (--wait->missing == 0) {
+          ready.push_back(wait);
+        }
+      }
+      db->waiters.erase(it);
+    }
+  }
+
+  for (size_t i = 0; i < db->watches.size(); i++) {
+    Wait *wait = db->watches[i];
+    const char *prefix = wait->keys[0];
+    if (wait->missing > 0 && strncmp(key, prefix, strlen(prefix)) == 0 &&
+        --wait->missing == 0) {
+      ready.push_back(wait);
+    }
+  }
+
+  for (size_t i = 0; i < ready.size(); i++) {
+    finishWait(ready[i]);
+  }
+}
+
+void
+LookupService::finishWait(Wait *wait)
+{
+  if (wait->request == KVDBRequest::WATCH) {
+    sendMatches(wait->client, wait->db, wait->keys[0], wait->minKeys);
+  } else {
+    sendValues(wait->client, wait->db, wait->keys);
+  }
+  removeWait(wait);
+}
+
+void
+LookupService::removeWait(Wait *wait)
+{
+  Database *db = wait->db;
+
+  if (wait->request == KVDBRequest::WATCH) {
+    db->watches.erase(std::remove(db->watches.begin(), db->watches.end(),
+                                  wait),
+                      db->watches.end());
+  } else if (wait->missing > 0) {
+    for (size_t i = 0; i < wait->keys.size(); i++) {
+      map<string, vector<Wait *> >::iterator it =
+        db->waiters.find(wait->keys[i]);
+      if (it != db->waiters.end()) {
+        it->second.erase(std::remove(it->second.begin(), it->second.end(),
+                                     wait),
+                         it->second.end());
+        if (it->second.empty()) {
+          db->waiters.erase(it);
+        }
+      }
+    }
+  }
+
+  _waits.erase(std::remove(_waits.begin(), _waits.end(), wait), _waits.end());
+  delete wait;
+}
+
+void
+LookupService::clientDisconnected(CoordClient *client)
+{
+  DmtcpMutexLock(&_lock);
+  for (size_t i = 0; i < _waits.size();) {
+    if (_waits[i]->client == client) {
+      removeWait(_waits[i]);
+    } else {
+      i++;
+    }
+  }
+  DmtcpMutexUnlock(&_lock);
+}
+
+// Answers the parked requests whose timeout has expired.
+void
+LookupService::expireWaits()
+{
+  DmtcpMutexLock(&_lock);
+  uint64_t now = _waits.empty() ? 0 : nowMs();
+  for (size_t i = 0; i < _waits.size();) {
+    Wait *wait = _waits[i];
+    if (wait->deadline != 0 && wait->deadline <= now) {
+      JTRACE("KVDB request timed out") (wait->client->identity())
+        ((int)wait->request) (wait->missing);
+      finishWait(wait);
+    } else {
+      i++;
+    }
+  }
+  DmtcpMutexUnlock(&_lock);
+}
+
+// The time until the next parked request expires, at most maxTimeoutMs.
+int
+LookupService::waitTimeout(int maxTimeoutMs) const
+{
+  DmtcpMutexLock(&_lock);
+  uint64_t now = _waits.empty() ? 0 : nowMs();
+  int timeout = maxTimeoutMs;
+  for (size_t i = 0; i < _waits.size(); i++) {
+    uint64_t deadline = _waits[i]->deadline;
+    if (deadline != 0) {
+      timeout = MIN(timeout, deadline > now ? (int)(deadline - now) : 0);
+    }
+  }
+  DmtcpMutexUnlock(&_lock);
+  return timeout;
+}
+
+// Applies a SET or an arithmetic request to key.  Its old value, "0" if it
+// had none, is returned in *oldVal unless oldVal is NULL.
+void
+LookupService::update(Database *db,
+                      KVDBRequest request,
+                      const char *key,
+                      const char *val,
+                      string *oldVal)
+{
+  bool inserted;
+  size_t i = db->keys.insert(key, strlen(key), &inserted);
+
+  if (inserted) {
+    db->vals.push_back(Value());
+    db->vals[i].strVal = val;
+    if (oldVal != NULL) {
+      *oldVal = "0";
+    }
+    keyInserted(db, db->keys.key(i));
+    return;
+  }
+
+  Value &value = db->vals[i];
+  int64_t oldVal64 = request == KVDBRequest::SET ? 0 : value.toInt64();
+
+  if (oldVal != NULL) {
+    if (value.isInt) {
+      *oldVal = jalib::XToString(value.intVal);
+    } else {
+      oldVal->swap(value.strVal);
+    }
+  }
+
+  if (request == KVDBRequest::SET) {
+    value.isInt = false;
+    value.strVal = val;
     return;
   }
 
   int64_t val64 = jalib::StringToInt64(val);
-  int64_t oldVal64 = jalib::StringToInt64(kvmap[key]);
 
-  switch (msg.kvdbRequest)
+  switch (request)
   {
   case KVDBRequest::INCRBY:
-    kvmap[key] = jalib::XToString(oldVal64 + val64);
+    value.intVal = oldVal64 + val64;
     break;
 
   case KVDBRequest::OR:
-    kvmap[key] = jalib::XToString(oldVal64 | val64);
+    value.intVal = oldVal64 | val64;
     break;
 
   case KVDBRequest::XOR:
-    kvmap[key] = jalib::XToString(oldVal64 ^ val64);
+    value.intVal = oldVal64 ^ val64;
     break;
 
   case KVDBRequest::AND:
-    kvmap[key] = jalib::XToString(oldVal64 & val64);
+    value.intVal = oldVal64 & val64;
     break;
 
   case KVDBRequest::MIN:
-    kvmap[key] = jalib::XToString(MIN(oldVal64, val64));
+    value.intVal = MIN(oldVal64, val64);
     break;
 
   case KVDBRequest::MAX:
-    kvmap[key] = jalib::XToString(MAX(oldVal64, val64));
+    value.intVal = MAX(oldVal64, val64);
     break;
 
   default:
     JASSERT(false).Text("Invalid operation");
   }
 
-  sendResponse(remote, oldVal);
-  return;
+  value.isInt = true;
+  value.strVal.clear();
+}
+
+// In the Prometheus text format, like the rest of the coordinator's metrics.
+void
+LookupService::writeMetrics(ostream *o) const
+{
+  static const char *requestNames[NUM_REQUEST_TYPES] = {
+    "GET", "SET", "INCRBY", "AND", "OR", "XOR", "MIN", "MAX",
+    "MGET", "MSET", "MINCRBY", "MWAIT", "WATCH"
+  };
+
+  DmtcpMutexLock(&_lock);
+  size_t numDatabases = _dbs.size();
+  size_t numKeys = 0;
+  for (size_t i = 0; i < _dbs.size(); i++) {
+    numKeys += _dbs[i]->keys.size();
+  }
+  size_t numWaits = _waits.size();
+  uint64_t numRequests[NUM_REQUEST_TYPES];
+  memcpy(numRequests, _numRequests, sizeof(numRequests));
+  DmtcpMutexUnlock(&_lock);
+
+  *o << "# HELP dmtcp_kvdb_databases Key-value databases.\n"
+     << "# TYPE dmtcp_kvdb_databases gauge\n"
+     << "dmtcp_kvdb_databases " << numDatabases << "\n"
+     << "# HELP dmtcp_kvdb_keys Keys in all key-value databases.\n"
+     << "# TYPE dmtcp_kvdb_keys gauge\n"
+     << "dmtcp_kvdb_keys " << numKeys << "\n"
+     << "# HELP dmtcp_kvdb_waits MWAIT and WATCH requests not answered yet.\n"
+     << "# TYPE dmtcp_kvdb_waits gauge\n"
+     << "dmtcp_kvdb_waits " << numWaits << "\n"
+     << "# HELP dmtcp_kvdb_requests_total Key-value database requests.\n"
+     << "# TYPE dmtcp_kvdb_requests_total counter\n";
+  for (size_t i = 0; i < NUM_REQUEST_TYPES; i++) {
+    *o << "dmtcp_kvdb_requests_total{request=\"" << requestNames[i] << "\"} "
+       << numRequests[i] << "\n";
+  }
 }
 
 void
@@ -202,26 +858,24 @@ LookupService::serialize(ofstream& o, string const& str)
 }
 
 void
-LookupService::serialize(ofstream& o, KeyValueMap const& kvmap)
+LookupService::serialize(ofstream& o, Database const& db)
 {
-  KeyValueMap::const_iterator it = kvmap.begin();
+  vector<size_t> order;
+  db.keys.sorted(&order);
 
   o << "{\n";
 
-  if (it != kvmap.end()) {
-    o << "    " << std::quoted(it->first) << ": ";
-    serialize(o, it->second);
-    it++;
-  }
-
-  for (; it != kvmap.end(); it++) {
-    o << ",\n    " << std::quoted(it->first) << ": ";
-    serialize(o, it->second);
+  for (size_t i = 0; i < order.size(); i++) {
+    o << (i == 0 ? "    " : ",\n    ") << std::quoted(db.keys.key(order[i]))
+      << ": ";
+    serialize(o, db.vals[order[i]].str());
   }
 
   o << "\n  }";
 }
 
+// The databases and their keys are written in sorted order, as they were
+// when they were kept in std::maps.
 void
 LookupService::serialize(string const& file)
 {
@@ -232,17 +886,15 @@ LookupService::serialize(string const& file)
 
   o << "{\n";
 
-  map<string, KeyValueMap>::iterator it = _maps.begin();
-  if (it != _maps.end()) {
-    o << "  " << std::quoted(it->first) << ": ";
-    serialize(o, it->second);
-    it++;
+  DmtcpMutexLock(&_lock);
+  vector<size_t> order;
+  _ids.sorted(&order);
 
-    for (; it != _maps.end(); it++) {
-      o << ",\n  " << std::quoted(it->first) << ": ";
-      serialize(o, it->second);
-    }
+  for (size_t i = 0; i < order.size(); i++) {
+    o << (i == 0 ? "  " : ",\n  ") << std::quoted(_ids.key(order[i])) << ": ";
+    serialize(o, *_dbs[order[i]]);
   }
+  DmtcpMutexUnlock(&_lock);
 
   o << "\n}";
 
@@ -24,18 +24,40 @@
 
 #include <string.h>
 #include <map>
-#include "../jalib/jsocket.h"
+#include "dmtcp.h"
 #include "dmtcpmessagetypes.h"
 #include "kvdb.h"
 
 namespace dmtcp
 {
+class CoordClient;
+
+// The key-value databases of the coordinator.  Each database is an
+// open-addressing hash table from keys to values, and the databases
+// themselves are found through another such table.  Keys are copied once
+// into an arena and never freed until reset().  A value that has been the
+// target of INCRBY and the like is kept as an int64, so that repeated
+// arithmetic on it does not parse and format it every time.
+//
+// MWAIT and WATCH requests that cannot be answered yet are parked until the
+// keys they wait for are inserted, their timeout expires, or their client
+// disconnects.
+//
+// The number of requests of each type is counted for the metrics of the
+// coordinator; see writeMetrics().
+//
+// The public methods may be called from any thread; with --io-threads, the
+// I/O threads of the coordinator answer the requests of their clients.  They
+// all hold _lock, so requests are still served one at a time, whatever
+// database they are for; the I/O threads only spread the socket work.
 class LookupService
 {
   public:
-    typedef map<string, string>KeyValueMap;
-
-    LookupService() {}
+    LookupService()
+    {
+      DmtcpMutexInit(&_lock, DMTCP_MUTEX_NORMAL);
+      memset(_numRequests, 0, sizeof(_numRequests));
+    }
 
     ~LookupService() { reset(); }
 
@@ -44,26 +66,151 @@ class LookupService
     void set(string const& id, string const& key, string const& val);
     kvdb::KVDBResponse get(string const &id, string const &key, string *val);
 
-    void processRequest(jalib::JSocket &remote,
+    void processRequest(CoordClient *client,
                         const DmtcpMessage &msg,
                         const void *extraData);
 
-    void serialize(ofstream &o, string const& str);
-    void serialize(ofstream &o, KeyValueMap const &kvmap);
     void serialize(string const& file);
 
+    void clientDisconnected(CoordClient *client);
+    void expireWaits();
+    int waitTimeout(int maxTimeoutMs) const;
+
+    void writeMetrics(ostream *o) const;
+
   private:
-    void sendResponse(jalib::JSocket &remote, kvdb::KVDBResponse response);
-    void sendResponse(jalib::JSocket &remote, string const &val);
+    // Linear probing over a power-of-two table of slots, each holding the
+    // hash of a key and its index.  Keys are numbered densely in the order
+    // they were inserted, so that their values can be kept in a vector.
+    class KeyIndex
+    {
+      public:
+        static const size_t NOT_FOUND = (size_t)-1;
+
+        KeyIndex() : _block(NULL), _blockLeft(0) {}
+
+        ~KeyIndex() { clear(); }
+
+        size_t find(const char *key, size_t len) const;
+        size_t insert(const char *key, size_t len, bool *inserted);
+
+        const char *key(size_t i) const { return _keys[i]; }
+
+        size_t size() const { return _keys.size(); }
+
+        // The indices of the keys, in the order of the keys.
+        void sorted(vector<size_t> *order) const;
+
+        void clear();
+
+      private:
+        struct Slot {
+          uint32_t hash;
+          uint32_t index;  // Index of the key + 1, or 0 if the slot is free.
+        };
+
+        static uint32_t hash(const char *key, size_t len);
+        size_t findSlot(const char *key, size_t len, uint32_t hash) const;
+        void grow();
+        const char *copyKey(const char *key, size_t len);
+
+        KeyIndex(const KeyIndex &);
+        KeyIndex &operator=(const KeyIndex &);
+
+        vector<Slot>_slots;
+        vector<const char *>_keys;
+        vector<char *>_blocks;
+        char *_block;
+        size_t _blockLeft;
+    };
 
-    void processGet(jalib::JSocket &remote,
+    struct Value {
+      Value() : isInt(false), intVal(0) {}
+
+      string str() const;
+      void appendTo(string *s) const;
+      int64_t toInt64() const;
+
+      bool isInt;
+      int64_t intVal;
+      string strVal;
+    };
+
+    struct Wait;
+
+    struct Database {
+      KeyIndex keys;
+      vector<Value>vals;
+
+      map<string, vector<Wait *> >waiters;  // MWAITs, by missing key
+      vector<Wait *>watches;
+    };
+
+    struct Wait {
+      CoordClient *client;
+      kvdb::KVDBRequest request;
+      Database *db;
+      vector<char>keyData;
+      vector<const char *>keys;  // In keyData; the prefix for WATCH.
+      size_t minKeys;            // WATCH only.
+      size_t missing;            // Keys still to be inserted.
+      uint64_t deadline;         // CLOCK_MONOTONIC ms, or 0 for none.
+    };
+
+    Database *findDatabase(const char *id, size_t len) const;
+    Database *getDatabase(const char *id, size_t len);
+    const Value *lookup(const char *id,
+                        size_t idLen,
+                        const char *key,
+                        size_t keyLen,
+                        kvdb::KVDBResponse *response) const;
+
+    void sendResponse(CoordClient *client, kvdb::KVDBResponse response);
+    void sendResponse(CoordClient *client, string const &val);
+
+    void processGet(CoordClient *client,
                     const DmtcpMessage &msg,
                     const void *extraData);
-    void processSet(jalib::JSocket &remote,
+    void processSet(CoordClient *client,
                     const DmtcpMessage &msg,
                     const void *extraData);
+    void processMulti(CoordClient *client,
+                      const DmtcpMessage &msg,
+                      const void *extraData);
+
+    void processWait(CoordClient *client,
+                     const DmtcpMessage &msg,
+                     const void *extraData,
+                     vector<const char *> const &keys,
+                     vector<const char *> const &vals);
+    void keyInserted(Database *db, const char *key);
+    void finishWait(Wait *wait);
+    void removeWait(Wait *wait);
+
+    void sendValues(CoordClient *client,
+                    const Database *db,
+                    vector<const char *> const &keys);
+    void sendMatches(CoordClient *client,
+                     const Database *db,
+                     const char *prefix,
+                     size_t minKeys);
+
+    void update(Database *db,
+                kvdb::KVDBRequest request,
+                const char *key,
+                const char *val,
+                string *oldVal);
+
+    void serialize(ofstream &o, string const& str);
+    void serialize(ofstream &o, Database const &db);
+
+    mutable DmtcpMutex _lock;
+    KeyIndex _ids;
+    vector<Database *>_dbs;
+    vector<Wait *>_waits;
 
-    map<string, KeyValueMap>_maps;
+    // Requests since the coordinator started, by kvdb::KVDBRequest.
+    uint64_t _numRequests[(int)kvdb::KVDBRequest::WATCH + 1];
 };
 }
 #endif // ifndef LOOKUP_SERVICE_H
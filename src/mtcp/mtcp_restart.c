@@ -41,6 +41,7 @@
 #include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/futex.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -55,6 +56,7 @@
 #include <stddef.h>
 
 #include "../membarrier.h"
+#include "blockcompress.h"
 #include "config.h"
 #include "mtcp_header.h"
 #include "mtcp_sys.h"
@@ -62,10 +64,6 @@
 #include "mtcp_util.h"
 #include "procmapsarea.h"
 
-#ifdef FAST_RST_VIA_MMAP
-static void mmapfile(int fd, void *buf, size_t size, int prot, int flags);
-#endif
-
 #define BINARY_NAME     "mtcp_restart"
 
 /* struct RestoreInfo to pass all parameters from one function to next.
@@ -76,11 +74,36 @@ static void mmapfile(int fd, void *buf, size_t size, int prot, int flags);
  */
 #define STACKSIZE 4 * 1024 * 1024
 
+// Parallel restore; see start_restore_helpers().
+#define RESTORE_MAX_THREADS 16
+#define RESTORE_STACK_SIZE  (256 * 1024)
+#define RESTORE_QUEUE_SIZE  256
+#define RESTORE_CHUNK_SIZE  (16 * 1024 * 1024)
+
+// Chunk offsets of a DMTCP_DEDUP_PAGES area read at a time.
+#define DEDUP_READ_REFS     256
+
 static RestoreInfo rinfo;
 
 /* Internal routines */
-static void readmemoryareas(int fd, VA endOfStack);
-static int read_one_memory_area(int fd, VA endOfStack);
+static void readmemoryareas(RestoreInfo *rinfo);
+static int read_one_memory_area(RestoreInfo *rinfo);
+static int map_area_data_lazily(RestoreInfo *rinfo, Area *area,
+                                size_t dataSize);
+static void check_block_header(BlockCompressHeader *hdr, size_t size, VA addr);
+static void read_compressed_blocks(int fd, VA addr, size_t size, VA blockBuf,
+                                   uint32_t *crc);
+static void start_restore_helpers(RestoreInfo *rinfo);
+static int queue_area_data(RestoreInfo *rinfo, Area *area, size_t dataSize);
+static void finish_restore_helpers(RestoreInfo *rinfo);
+static size_t restore_queue_size(int n);
+static void check_area_index(RestoreInfo *rinfo);
+static void skip_compressed_blocks(int fd, size_t size);
+static void read_from_parent_images(RestoreInfo *rinfo, int level,
+                                    const char *path, VA addr, size_t size);
+static void close_parent_images(RestoreInfo *rinfo);
+static void open_dedup_store(RestoreInfo *rinfo);
+static void read_dedup_pages(RestoreInfo *rinfo, Area *area);
 static void restorememoryareas(RestoreInfo *rinfo_ptr);
 static void restore_brk(RestoreInfo *rinfo);
 static int doAreasOverlap(Area *area, MemRegion *memRegion);
@@ -151,6 +174,10 @@ mtcp_simulateread(RestoreInfo *rinfo)
   mtcp_printf("**** vvar: %p..%p\n", hdr.vvar.startAddr, hdr.vvar.endAddr);
   mtcp_printf("**** vvar_vclock: %p..%p\n", hdr.vvarVClock.startAddr, hdr.vvarVClock.endAddr);
   mtcp_printf("**** end of stack: %p\n", hdr.endOfStack);
+  if (hdr.ckptGeneration > 0) {
+    mtcp_printf("**** incremental image (generation %d), parent: %s\n",
+                (int)hdr.ckptGeneration, hdr.parentCkptImage);
+  }
 
   Area area;
   mtcp_printf("\n**** Listing ckpt image area:\n");
@@ -161,13 +188,19 @@ mtcp_simulateread(RestoreInfo *rinfo)
     }
 
     if ((area.properties & DMTCP_ZERO_PAGE) == 0 &&
-        (area.properties & DMTCP_ZERO_PAGE_PARENT_HEADER) == 0) {
+        (area.properties & DMTCP_ZERO_PAGE_PARENT_HEADER) == 0 &&
+        (area.properties & DMTCP_PAGES_IN_PARENT) == 0) {
 
       off_t seekLen = area.size;
       if (!(area.flags & MAP_ANONYMOUS) && area.mmapFileSize > 0) {
         seekLen =  area.mmapFileSize;
       }
-      if (mtcp_sys_lseek(rinfo->fd, seekLen, SEEK_CUR) < 0) {
+      if (area.properties & DMTCP_DEDUP_PAGES) {
+        seekLen = area_data_size(&area);
+      }
+      if (area.properties & DMTCP_BLOCK_COMPRESSED) {
+        skip_compressed_blocks(rinfo->fd, seekLen);
+      } else if (mtcp_sys_lseek(rinfo->fd, seekLen, SEEK_CUR) < 0) {
          mtcp_printf("Could not seek!\n");
          break;
       }
@@ -209,6 +242,16 @@ mtcp_restart_process_args(int argc, char *argv[], char **environ, void (*restore
   rinfo.use_gdb = 0;
 
 
+  char *lazy_restore_str = mtcp_getenv("DMTCP_LAZY_RESTORE", environ);
+  rinfo.lazy_restore = (lazy_restore_str == NULL ||
+                        mtcp_strcmp(lazy_restore_str, "0") != 0);
+
+  char *restore_threads_str = mtcp_getenv("DMTCP_RESTORE_THREADS", environ);
+  if (restore_threads_str != NULL) {
+    rinfo.restore_threads = MIN(mtcp_strtol(restore_threads_str),
+                                RESTORE_MAX_THREADS);
+  }
+
   char *restart_pause_str = mtcp_getenv("DMTCP_RESTART_PAUSE", environ);
   if (restart_pause_str == NULL) {
     rinfo.restart_pause = 0; /* false */
@@ -403,9 +446,7 @@ mtcp_restart(RestoreInfo *rinfo)
   // In GDB, 'set rinfo.restart_pause=2' to continue to next statement.
   MTCP_RESTART_PAUSE_WHILE(rinfo->restart_pause == 1);
 
-#ifdef TIMING
   mtcp_sys_gettimeofday(&rinfo->startValue, NULL);
-#endif
 
   restore_vdso_vvar(rinfo);
   restore_brk(rinfo);
@@ -567,20 +608,23 @@ restorememoryareas(RestoreInfo *rinfo)
   int mtcp_sys_errno;
   /* Restore memory areas */
   DPRINTF("restoring memory areas\n");
-  readmemoryareas(rinfo->fd, (VA) rinfo->ckptHdr.endOfStack);
+  readmemoryareas(rinfo);
 
   /* Everything restored, close file and finish up */
 
   DPRINTF("close cpfd %d\n", rinfo->fd);
   mtcp_sys_close(rinfo->fd);
+  close_parent_images(rinfo);
+  if (rinfo->dedup_fd != -1) {
+    mtcp_sys_close(rinfo->dedup_fd);
+  }
+  // Reported by the restarted process as its "read-image" phase.
   double readTime = 0.0;
-#ifdef TIMING
   struct timeval endValue;
   mtcp_sys_gettimeofday(&endValue, NULL);
   struct timeval diff;
   timersub(&endValue, &rinfo->startValue, &diff);
   readTime = diff.tv_sec + (diff.tv_usec / 1000000.0);
-#endif
 
   IMB; /* flush instruction cache, since mtcp_restart.c code is now gone. */
 
@@ -710,13 +754,18 @@ restore_vdso_vvar(RestoreInfo *rinfo)
  *
  **************************************************************************/
 static void
-readmemoryareas(int fd, VA endOfStack)
+readmemoryareas(RestoreInfo *rinfo)
 {
+  open_dedup_store(rinfo);
+  start_restore_helpers(rinfo);
   while (1) {
-    if (read_one_memory_area(fd, endOfStack) == -1) {
+    if (read_one_memory_area(rinfo) == -1) {
       break; /* error */
     }
   }
+
+  finish_restore_helpers(rinfo);
+  check_area_index(rinfo);
 #if defined(__arm__) || defined(__aarch64__)
 
   /* On ARM, with gzip enabled, we sometimes see SEGFAULT without this.
@@ -729,16 +778,27 @@ readmemoryareas(int fd, VA endOfStack)
 
 NO_OPTIMIZE
 static int
-read_one_memory_area(int fd, VA endOfStack)
+read_one_memory_area(RestoreInfo *rinfo)
 {
   int mtcp_sys_errno;
+  int fd = rinfo->fd;
+  VA endOfStack = (VA) rinfo->ckptHdr.endOfStack;
   int imagefd;
   void *mmappedat;
+  size_t dataSize;
 
   /* Read header of memory area into area; mtcp_readfile() will read header */
   Area area;
 
-  mtcp_readfile(fd, &area, sizeof area);
+  if (mtcp_readfile(fd, &area, sizeof area) != sizeof area) {
+    MTCP_PRINTF("***ERROR: ckpt image is truncated\n");
+    mtcp_abort();
+  }
+  if (area.headerCrc32c != area_header_crc32c(&area)) {
+    MTCP_PRINTF("***ERROR: corrupted memory area header in ckpt image"
+                " (%p-%p)\n", area.addr, area.endAddr);
+    mtcp_abort();
+  }
   if (area.addr == NULL) {
     return -1;
   }
@@ -789,19 +849,6 @@ read_one_memory_area(int fd, VA endOfStack)
     }
   }
 
-#ifdef FAST_RST_VIA_MMAP
-    /* CASE MAP_ANONYMOUS with FAST_RST enabled
-     * We only want to do this in the MAP_ANONYMOUS case, since we don't want
-     *   any writes to RAM to be reflected back into the underlying file.
-     * Note that in order to map from a file (ckpt image), we must turn off
-     *   anonymous (~MAP_ANONYMOUS).  It's okay, since the fd
-     *   should have been opened with read permission, only.
-     */
-    else if (area.flags & MAP_ANONYMOUS) {
-      mmapfile (fd, area.addr, area.size, area.prot,
-                area.flags & ~MAP_ANONYMOUS);
-    }
-#endif
 
   /* CASE MAP_ANONYMOUS (usually implies MAP_PRIVATE):
    * For anonymous areas, the checkpoint file contains the memory contents
@@ -894,12 +941,35 @@ read_one_memory_area(int fd, VA endOfStack)
       if (area.mmapFileSize > 0 && area.name[0] == '/') {
         DPRINTF("restoring memory region %p of %p bytes at %p\n",
                     area.mmapFileSize, area.size, area.addr);
-        mtcp_readfile(fd, area.addr, area.mmapFileSize);
+        dataSize = area.mmapFileSize;
+      } else {
+        dataSize = area.size;
+      }
+
+      int queued = 0;
+      if (area.properties & DMTCP_PAGES_IN_PARENT) {
+        read_from_parent_images(rinfo, 0, rinfo->ckptHdr.parentCkptImage,
+                                area.addr, dataSize);
+      } else if (area.properties & DMTCP_DEDUP_PAGES) {
+        read_dedup_pages(rinfo, &area);
+      } else if (map_area_data_lazily(rinfo, &area, dataSize)) {
+        // Checking the data would read all of it.
+        rinfo->payload_unchecked = 1;
+        DPRINTF("mapped %p bytes at %p from the ckpt image\n",
+                dataSize, area.addr);
+      } else if (rinfo->restore_queue != NULL) {
+        queued = queue_area_data(rinfo, &area, dataSize);
+      } else if (area.properties & DMTCP_BLOCK_COMPRESSED) {
+        read_compressed_blocks(fd, area.addr, dataSize,
+                               rinfo->compressed_block_buf,
+                               &rinfo->payload_crc);
       } else {
-        mtcp_readfile(fd, area.addr, area.size);
+        mtcp_readfile(fd, area.addr, dataSize);
+        rinfo->payload_crc = crc32c_update(rinfo->payload_crc, area.addr,
+                                           dataSize);
       }
 
-      if (!(area.prot & PROT_WRITE)) {
+      if (!(area.prot & PROT_WRITE) && !queued) {
         if (mtcp_sys_mprotect(area.addr, area.size, area.prot) < 0) {
           MTCP_PRINTF("error %d write-protecting %p bytes at %p\n",
                       mtcp_sys_errno, area.size, area.addr);
@@ -911,6 +981,762 @@ read_one_memory_area(int fd, VA endOfStack)
   return 0;
 }
 
+NO_OPTIMIZE
+static void
+check_block_header(BlockCompressHeader *hdr, size_t size, VA addr)
+{
+  int mtcp_sys_errno;
+
+  if (hdr->rawSize == 0 || hdr->rawSize > size ||
+      hdr->rawSize > BLOCK_COMPRESS_BLOCK_SIZE ||
+      hdr->compSize > hdr->rawSize) {
+    MTCP_PRINTF("***ERROR: bad compressed block header (%u, %u) at %p\n",
+                hdr->rawSize, hdr->compSize, addr);
+    mtcp_abort();
+  }
+}
+
+/* Reads 'size' bytes of memory stored as compressed blocks (see
+ * include/blockcompress.h) into 'addr'.  A compressed block is first read
+ * into 'blockBuf', which must hold BLOCK_COMPRESS_BLOCK_SIZE bytes.  The
+ * checksum *crc is continued over the blocks as stored.
+ */
+NO_OPTIMIZE
+static void
+read_compressed_blocks(int fd, VA addr, size_t size, VA blockBuf,
+                       uint32_t *crc)
+{
+  int mtcp_sys_errno;
+  BlockCompressHeader hdr;
+
+  while (size > 0) {
+    if (mtcp_readfile(fd, &hdr, sizeof hdr) != sizeof hdr) {
+      MTCP_PRINTF("***ERROR: ckpt image is truncated\n");
+      mtcp_abort();
+    }
+    check_block_header(&hdr, size, addr);
+
+    *crc = crc32c_update(*crc, &hdr, sizeof hdr);
+    if (hdr.compSize == hdr.rawSize) {
+      mtcp_readfile(fd, addr, hdr.rawSize);
+      *crc = crc32c_update(*crc, addr, hdr.rawSize);
+    } else {
+      mtcp_readfile(fd, blockBuf, hdr.compSize);
+      *crc = crc32c_update(*crc, blockBuf, hdr.compSize);
+      if (block_decompress((uint8_t *)blockBuf, hdr.compSize,
+                           (uint8_t *)addr, hdr.rawSize) != 0) {
+        MTCP_PRINTF("***ERROR: corrupted compressed block at %p\n", addr);
+        mtcp_abort();
+      }
+    }
+    addr += hdr.rawSize;
+    size -= hdr.rawSize;
+  }
+}
+
+/* The area index and its trailer follow the last area (see
+ * include/procmapsarea.h).  Reading them to the end also lets a gzip process
+ * or a dmtcp_ckpt_server that feeds the image through a pipe or a socket
+ * finish normally.  Only the trailer is kept; the index itself is checked
+ * against its checksum as it goes by.  Any mismatch aborts the restart
+ * before the process resumes.
+ */
+NO_OPTIMIZE
+static void
+check_area_index(RestoreInfo *rinfo)
+{
+  int mtcp_sys_errno;
+  char *buf = rinfo->compressed_block_buf;
+  size_t pending = 0;
+  size_t indexSize = 0;
+  uint32_t indexCrc = 0;
+  CkptIndexTrailer trailer;
+
+  while (1) {
+    ssize_t rc = mtcp_sys_read(rinfo->fd, buf + pending,
+                               BLOCK_COMPRESS_BLOCK_SIZE - pending);
+    if (rc == -1 && mtcp_sys_errno == EINTR) {
+      continue;
+    }
+    if (rc < 0) {
+      MTCP_PRINTF("error %d reading ckpt image\n", mtcp_sys_errno);
+      mtcp_abort();
+    }
+    if (rc == 0) {
+      break;
+    }
+    pending += rc;
+
+    // Everything but the last sizeof(trailer) bytes belongs to the index.
+    if (pending > sizeof trailer) {
+      size_t n = pending - sizeof trailer;
+      indexCrc = crc32c_update(indexCrc, buf, n);
+      indexSize += n;
+      for (size_t i = 0; i < sizeof trailer; i++) {
+        buf[i] = buf[n + i];
+      }
+      pending = sizeof trailer;
+    }
+  }
+
+  if (pending != sizeof trailer) {
+    MTCP_PRINTF("***ERROR: ckpt image ends without an area index"
+                " (truncated?)\n");
+    mtcp_abort();
+  }
+
+  mtcp_memcpy(&trailer, buf, sizeof trailer);
+  if (mtcp_strncmp(trailer.magic, CKPT_INDEX_MAGIC, sizeof trailer.magic) ||
+      indexSize != trailer.numEntries * sizeof(CkptIndexEntry) ||
+      indexCrc != trailer.indexCrc32c) {
+    MTCP_PRINTF("***ERROR: corrupted area index in ckpt image\n");
+    mtcp_abort();
+  }
+  if (trailer.flags & CKPT_INDEX_INCOMPLETE) {
+    DPRINTF("ckpt image has no checksum of its memory data\n");
+    return;
+  }
+  if (!rinfo->payload_unchecked &&
+      rinfo->payload_crc != trailer.payloadCrc32c) {
+    MTCP_PRINTF("***ERROR: checksum mismatch in the memory data of the"
+                " ckpt image\n");
+    mtcp_abort();
+  }
+}
+
+/* Parallel restore (DMTCP_RESTORE_THREADS).  If the ckpt image is a regular
+ * file, the main thread only reads the area headers and maps the areas.
+ * The data of each area is handed to a pool of helper threads as jobs of up
+ * to RESTORE_CHUNK_SIZE bytes of memory, which the helpers pread() straight
+ * into place.  Jobs are retired in the order of the image: the checksums of
+ * their data are combined into rinfo->payload_crc, and an area that must not
+ * be writable is write-protected once its last job is retired.  All jobs are
+ * retired and the helpers have exited before check_area_index() runs.
+ *
+ * The helpers are created with a raw clone(), like the checkpoint writer
+ * threads (see src/ckptwriter.h), and may only make system calls.
+ */
+typedef struct RestoreJob {
+  VA addr;            // Memory to fill.
+  size_t rawSize;     // Bytes of memory.
+  off_t offset;       // Offset of the data in the ckpt image.
+  size_t storedSize;  // Bytes of the ckpt image that hold the data.
+  int compressed;     // Stored as compressed blocks.
+
+  // Set for the last job of an area without PROT_WRITE.
+  int protect;
+  VA protAddr;
+  size_t protSize;
+  int prot;
+
+  uint32_t crc;       // CRC32C of the stored bytes.
+  uint32_t done;
+} RestoreJob;
+
+typedef struct RestoreHelper {
+  struct RestoreQueue *queue;
+  VA blockBuf;        // BLOCK_COMPRESS_BLOCK_SIZE bytes.
+  VA stackTop;
+  int tid;            // Cleared by the kernel when the helper exits.
+} RestoreHelper;
+
+typedef struct RestoreQueue {
+  int fd;
+  int numHelpers;
+  uint32_t published;  // Jobs handed out so far.
+  uint32_t claimed;    // Jobs taken by a helper so far.
+  uint32_t retired;    // Jobs whose results were collected.
+  uint32_t stopping;
+  uint32_t wakeups;    // Bumped whenever 'published' or 'stopping' changes.
+  RestoreHelper helpers[RESTORE_MAX_THREADS];
+  RestoreJob jobs[RESTORE_QUEUE_SIZE];
+} RestoreQueue;
+
+/* Restore buffer space for the queue and for 'n' helpers. */
+static size_t
+restore_queue_size(int n)
+{
+  size_t queueSize = (sizeof(RestoreQueue) + MTCP_PAGE_SIZE - 1) &
+                     ~(MTCP_PAGE_SIZE - 1);
+  return queueSize + n * (RESTORE_STACK_SIZE + BLOCK_COMPRESS_BLOCK_SIZE);
+}
+
+NO_OPTIMIZE
+static void
+futex_wait(uint32_t *addr, uint32_t val)
+{
+  int mtcp_sys_errno;
+
+  mtcp_sys_kernel_futex(addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+NO_OPTIMIZE
+static void
+futex_wake(uint32_t *addr, int count)
+{
+  int mtcp_sys_errno;
+
+  mtcp_sys_kernel_futex(addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/* Starts a thread that runs fn(arg) on the stack ending at 'stackTop' and
+ * then exits.  Returns the thread id, or -1 if this architecture has no
+ * support for it.
+ */
+NO_OPTIMIZE
+static long
+clone_thread(int (*fn)(void *), void *arg, VA stackTop, int *tidptr)
+{
+  int flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM |
+              CLONE_SIGHAND | CLONE_THREAD | CLONE_PARENT_SETTID |
+              CLONE_CHILD_CLEARTID;
+
+  // The new thread pops fn and arg off its stack.
+  void **sp = (void **)stackTop - 2;
+  sp[0] = (void *)fn;
+  sp[1] = arg;
+
+#if defined(__x86_64__)
+  long ret;
+  register long r10 asm ("r10") = (long)tidptr;
+  register long r8 asm ("r8") = 0;
+
+  asm volatile ("syscall\n\t"
+                "test %%rax, %%rax\n\t"
+                "jnz 1f\n\t"
+                "xor %%ebp, %%ebp\n\t"
+                "pop %%rax\n\t"
+                "pop %%rdi\n\t"
+                "call *%%rax\n\t"
+                "mov %%eax, %%edi\n\t"
+                "mov %[nr_exit], %%eax\n\t"
+                "syscall\n\t"
+                "hlt\n\t"
+                "1:\n\t"
+                : "=a" (ret)
+                : "0" (__NR_clone), "D" (flags), "S" (sp), "d" (tidptr),
+                  "r" (r10), "r" (r8), [nr_exit] "i" (__NR_exit)
+                : "rcx", "r11", "memory");
+  return ret;
+#elif defined(__aarch64__)
+  register long x0 asm ("x0") = flags;
+  register long x1 asm ("x1") = (long)sp;
+  register long x2 asm ("x2") = (long)tidptr;
+  register long x3 asm ("x3") = 0;
+  register long x4 asm ("x4") = (long)tidptr;
+  register long x8 asm ("x8") = __NR_clone;
+
+  asm volatile ("svc #0\n\t"
+                "cbnz x0, 1f\n\t"
+                "mov x29, xzr\n\t"
+                "ldp x9, x0, [sp], #16\n\t"
+                "blr x9\n\t"
+                "mov x8, %[nr_exit]\n\t"
+                "svc #0\n\t"
+                "1:\n\t"
+                : "+r" (x0)
+                : "r" (x1), "r" (x2), "r" (x3), "r" (x4), "r" (x8),
+                  [nr_exit] "i" (__NR_exit)
+                : "x9", "x30", "memory");
+  return x0;
+#else
+  return -1;
+#endif
+}
+
+NO_OPTIMIZE
+static void
+pread_all(int fd, VA buf, size_t len, off_t offset)
+{
+  int mtcp_sys_errno;
+
+  while (len > 0) {
+    ssize_t rc = mtcp_sys_pread(fd, buf, len, offset);
+    if (rc == -1 && (mtcp_sys_errno == EINTR || mtcp_sys_errno == EAGAIN)) {
+      continue;
+    }
+    if (rc <= 0) {
+      if (rc == 0) {
+        MTCP_PRINTF("***ERROR: ckpt image is truncated\n");
+      } else {
+        MTCP_PRINTF("error %d reading ckpt image\n", mtcp_sys_errno);
+      }
+      mtcp_abort();
+    }
+    buf += rc;
+    len -= rc;
+    offset += rc;
+  }
+}
+
+NO_OPTIMIZE
+static void
+run_restore_job(int fd, RestoreJob *job, VA blockBuf)
+{
+  int mtcp_sys_errno;
+  VA addr = job->addr;
+  size_t size = job->rawSize;
+  off_t offset = job->offset;
+  uint32_t crc = 0;
+  BlockCompressHeader hdr;
+
+  if (!job->compressed) {
+    pread_all(fd, addr, size, offset);
+    job->crc = crc32c(addr, size);
+    return;
+  }
+
+  while (size > 0) {
+    pread_all(fd, (VA)&hdr, sizeof hdr, offset);
+    check_block_header(&hdr, size, addr);
+    crc = crc32c_update(crc, &hdr, sizeof hdr);
+    offset += sizeof hdr;
+    if (hdr.compSize == hdr.rawSize) {
+      pread_all(fd, addr, hdr.rawSize, offset);
+      crc = crc32c_update(crc, addr, hdr.rawSize);
+    } else {
+      pread_all(fd, blockBuf, hdr.compSize, offset);
+      crc = crc32c_update(crc, blockBuf, hdr.compSize);
+      if (block_decompress((uint8_t *)blockBuf, hdr.compSize,
+                           (uint8_t *)addr, hdr.rawSize) != 0) {
+        MTCP_PRINTF("***ERROR: corrupted compressed block at %p\n", addr);
+        mtcp_abort();
+      }
+    }
+    offset += hdr.compSize;
+    addr += hdr.rawSize;
+    size -= hdr.rawSize;
+  }
+  job->crc = crc;
+}
+
+NO_OPTIMIZE
+static int
+restore_helper(void *arg)
+{
+  RestoreHelper *self = (RestoreHelper *)arg;
+  RestoreQueue *q = self->queue;
+
+  while (1) {
+    uint32_t ticket = __atomic_fetch_add(&q->claimed, 1, __ATOMIC_ACQ_REL);
+
+    while (1) {
+      uint32_t wakeups = __atomic_load_n(&q->wakeups, __ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&q->published, __ATOMIC_ACQUIRE) > ticket) {
+        break;
+      }
+      if (__atomic_load_n(&q->stopping, __ATOMIC_ACQUIRE)) {
+        return 0;
+      }
+      futex_wait(&q->wakeups, wakeups);
+    }
+
+    RestoreJob *job = &q->jobs[ticket % RESTORE_QUEUE_SIZE];
+    run_restore_job(q->fd, job, self->blockBuf);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    futex_wake(&job->done, 1);
+  }
+}
+
+/* Starts the helpers if DMTCP_RESTORE_THREADS asks for them and the ckpt
+ * image can be read at any offset.
+ */
+NO_OPTIMIZE
+static void
+start_restore_helpers(RestoreInfo *rinfo)
+{
+  int mtcp_sys_errno;
+  RestoreQueue *q = (RestoreQueue *)rinfo->restore_queue;
+
+  if (q == NULL) {
+    return;
+  }
+  if (mtcp_sys_lseek(rinfo->fd, 0, SEEK_CUR) == -1) {
+    DPRINTF("ckpt image is not seekable; restoring with a single thread\n");
+    rinfo->restore_queue = NULL;
+    return;
+  }
+
+  q->fd = rinfo->fd;
+  for (int i = 0; i < rinfo->restore_threads; i++) {
+    RestoreHelper *helper = &q->helpers[i];
+    helper->queue = q;
+    if (clone_thread(restore_helper, helper, helper->stackTop,
+                     &helper->tid) <= 0) {
+      break;
+    }
+    q->numHelpers++;
+  }
+  DPRINTF("restoring with %d helper threads\n", q->numHelpers);
+  if (q->numHelpers == 0) {
+    rinfo->restore_queue = NULL;
+  }
+}
+
+NO_OPTIMIZE
+static void
+retire_restore_job(RestoreInfo *rinfo)
+{
+  int mtcp_sys_errno;
+  RestoreQueue *q = (RestoreQueue *)rinfo->restore_queue;
+  RestoreJob *job = &q->jobs[q->retired % RESTORE_QUEUE_SIZE];
+
+  while (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+    futex_wait(&job->done, 0);
+  }
+  rinfo->payload_crc = crc32c_combine(rinfo->payload_crc, job->crc,
+                                      job->storedSize);
+  if (job->protect &&
+      mtcp_sys_mprotect(job->protAddr, job->protSize, job->prot) < 0) {
+    MTCP_PRINTF("error %d write-protecting %p bytes at %p\n",
+                mtcp_sys_errno, job->protSize, job->protAddr);
+    mtcp_abort();
+  }
+  q->retired++;
+}
+
+NO_OPTIMIZE
+static RestoreJob *
+publish_restore_job(RestoreInfo *rinfo, VA addr, size_t rawSize,
+                    off_t offset, size_t storedSize, int compressed)
+{
+  RestoreQueue *q = (RestoreQueue *)rinfo->restore_queue;
+
+  if (q->published - q->retired == RESTORE_QUEUE_SIZE) {
+    retire_restore_job(rinfo);
+  }
+
+  RestoreJob *job = &q->jobs[q->published % RESTORE_QUEUE_SIZE];
+  mtcp_memset(job, 0, sizeof(*job));
+  job->addr = addr;
+  job->rawSize = rawSize;
+  job->offset = offset;
+  job->storedSize = storedSize;
+  job->compressed = compressed;
+
+  __atomic_store_n(&q->published, q->published + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&q->wakeups, 1, __ATOMIC_RELEASE);
+  futex_wake(&q->wakeups, q->numHelpers);
+  return job;
+}
+
+/* Hands out the data of an area that starts at the current offset of the
+ * ckpt image, and moves past it.  Write-protecting the area, if needed, is
+ * left to retire_restore_job().  Returns 0 if there was no data.
+ */
+NO_OPTIMIZE
+static int
+queue_area_data(RestoreInfo *rinfo, Area *area, size_t dataSize)
+{
+  int mtcp_sys_errno;
+  int fd = rinfo->fd;
+  off_t offset = mtcp_sys_lseek(fd, 0, SEEK_CUR);
+  RestoreJob *job = NULL;
+  VA addr = area->addr;
+  size_t size = dataSize;
+
+  MTCP_ASSERT(offset != -1);
+  while (size > 0) {
+    size_t rawSize = 0;
+    size_t storedSize = 0;
+
+    if (area->properties & DMTCP_BLOCK_COMPRESSED) {
+      // Only the block headers are read here; the helper reads them again.
+      BlockCompressHeader hdr;
+      while (size > 0 && rawSize < RESTORE_CHUNK_SIZE) {
+        if (mtcp_readfile(fd, &hdr, sizeof hdr) != sizeof hdr) {
+          MTCP_PRINTF("***ERROR: ckpt image is truncated\n");
+          mtcp_abort();
+        }
+        check_block_header(&hdr, size, addr + rawSize);
+        if (mtcp_sys_lseek(fd, hdr.compSize, SEEK_CUR) == -1) {
+          MTCP_PRINTF("mtcp_sys_lseek failed with errno %d\n", mtcp_sys_errno);
+          mtcp_abort();
+        }
+        rawSize += hdr.rawSize;
+        storedSize += sizeof hdr + hdr.compSize;
+        size -= hdr.rawSize;
+      }
+    } else {
+      rawSize = MIN(size, RESTORE_CHUNK_SIZE);
+      storedSize = rawSize;
+      size -= rawSize;
+    }
+
+    job = publish_restore_job(rinfo, addr, rawSize, offset, storedSize,
+                              (area->properties & DMTCP_BLOCK_COMPRESSED) != 0);
+    addr += rawSize;
+    offset += storedSize;
+  }
+
+  if (!(area->properties & DMTCP_BLOCK_COMPRESSED) &&
+      mtcp_sys_lseek(fd, offset, SEEK_SET) == -1) {
+    MTCP_PRINTF("mtcp_sys_lseek failed with errno %d\n", mtcp_sys_errno);
+    mtcp_abort();
+  }
+
+  if (job != NULL && !(area->prot & PROT_WRITE)) {
+    // The helper does not look at these.
+    job->protAddr = area->addr;
+    job->protSize = area->size;
+    job->prot = area->prot;
+    job->protect = 1;
+  }
+  return job != NULL;
+}
+
+/* Waits for all jobs and stops the helpers. */
+NO_OPTIMIZE
+static void
+finish_restore_helpers(RestoreInfo *rinfo)
+{
+  RestoreQueue *q = (RestoreQueue *)rinfo->restore_queue;
+
+  if (q == NULL) {
+    return;
+  }
+  while (q->retired < q->published) {
+    retire_restore_job(rinfo);
+  }
+
+  __atomic_store_n(&q->stopping, 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&q->wakeups, 1, __ATOMIC_RELEASE);
+  futex_wake(&q->wakeups, q->numHelpers);
+  for (int i = 0; i < q->numHelpers; i++) {
+    int tid;
+    while ((tid = __atomic_load_n(&q->helpers[i].tid, __ATOMIC_ACQUIRE)) != 0) {
+      futex_wait((uint32_t *)&q->helpers[i].tid, tid);
+    }
+  }
+  rinfo->restore_queue = NULL;
+}
+
+NO_OPTIMIZE
+static void
+skip_compressed_blocks(int fd, size_t size)
+{
+  int mtcp_sys_errno;
+  BlockCompressHeader hdr;
+
+  while (size > 0) {
+    mtcp_readfile(fd, &hdr, sizeof hdr);
+    if (hdr.rawSize == 0 || hdr.rawSize > size) {
+      mtcp_printf("Bad compressed block header!\n");
+      return;
+    }
+    if (mtcp_sys_lseek(fd, hdr.compSize, SEEK_CUR) < 0) {
+      mtcp_printf("Could not seek!\n");
+      return;
+    }
+    size -= hdr.rawSize;
+  }
+}
+
+/* An area of an incremental ckpt image with DMTCP_PAGES_IN_PARENT has no
+ * data of its own: its pages are found at the same addresses in the parent
+ * image, or further up the chain of parent images (see
+ * src/incrementalckpt.h).  Areas are restored in address order, so each image
+ * of the chain is read front to back only once.
+ */
+typedef struct ParentImage {
+  int fd;
+  int eof;
+  off_t nextArea;   /* File offset of the next area header. */
+  off_t data;       /* File offset of the data of 'area'. */
+  Area area;
+  DmtcpCkptHeader hdr;
+} ParentImage;
+
+NO_OPTIMIZE
+static void
+open_parent_image(ParentImage *img, const char *path)
+{
+  int mtcp_sys_errno;
+
+  img->fd = mtcp_sys_open2(path, O_RDONLY);
+  if (img->fd < 0) {
+    MTCP_PRINTF("***ERROR opening parent ckpt image (%s); errno: %d\n",
+                path, mtcp_sys_errno);
+    mtcp_abort();
+  }
+
+  mtcp_readfile(img->fd, &img->hdr, sizeof img->hdr);
+  mtcp_readfile(img->fd, &img->hdr, sizeof img->hdr);
+  if (mtcp_strcmp(img->hdr.ckptSignature, DMTCP_CKPT_SIGNATURE) != 0) {
+    MTCP_PRINTF("***ERROR: parent ckpt image (%s) doesn't match"
+                " DMTCP_CKPT_SIGNATURE\n", path);
+    mtcp_abort();
+  }
+
+  img->eof = 0;
+  img->nextArea = 2 * sizeof img->hdr;
+  img->area.addr = NULL;
+  img->area.endAddr = NULL;
+}
+
+NO_OPTIMIZE
+static void
+next_parent_area(ParentImage *img)
+{
+  int mtcp_sys_errno;
+
+  if (mtcp_sys_lseek(img->fd, img->nextArea, SEEK_SET) < 0) {
+    MTCP_PRINTF("error %d seeking in parent ckpt image\n", mtcp_sys_errno);
+    mtcp_abort();
+  }
+  if (mtcp_readfile(img->fd, &img->area, sizeof img->area) !=
+        sizeof img->area ||
+      img->area.headerCrc32c != area_header_crc32c(&img->area)) {
+    MTCP_PRINTF("***ERROR: corrupted memory area header in parent ckpt"
+                " image\n");
+    mtcp_abort();
+  }
+  if (img->area.addr == NULL) {
+    img->eof = 1;
+    return;
+  }
+  if (img->area.properties & DMTCP_BLOCK_COMPRESSED) {
+    MTCP_PRINTF("***ERROR: compressed area %p in parent ckpt image\n",
+                img->area.addr);
+    mtcp_abort();
+  }
+  img->data = img->nextArea + sizeof img->area;
+  img->nextArea = img->data + area_data_size(&img->area);
+}
+
+NO_OPTIMIZE
+static void
+read_from_parent_images(RestoreInfo *rinfo, int level, const char *path,
+                        VA addr, size_t size)
+{
+  int mtcp_sys_errno;
+  ParentImage *img = (ParentImage *)rinfo->parent_images + level;
+  VA end = addr + size;
+
+  if (level >= DMTCP_MAX_CKPT_GENERATION || path[0] == '\0') {
+    MTCP_PRINTF("***ERROR: bad chain of parent ckpt images at %p\n", addr);
+    mtcp_abort();
+  }
+  if (img->fd == -1) {
+    open_parent_image(img, path);
+  }
+
+  while (addr < end) {
+    Area *area = &img->area;
+    while (!img->eof &&
+           (area->addr == NULL || area->endAddr <= addr ||
+            (area->properties & DMTCP_ZERO_PAGE_PARENT_HEADER))) {
+      next_parent_area(img);
+    }
+    if (img->eof || area->addr > addr) {
+      MTCP_PRINTF("***ERROR: %p not found in parent ckpt image (%s)\n",
+                  addr, path);
+      mtcp_abort();
+    }
+
+    VA chunkEnd = MIN(end, area->endAddr);
+    if (area->properties & DMTCP_PAGES_IN_PARENT) {
+      read_from_parent_images(rinfo, level + 1, img->hdr.parentCkptImage,
+                              addr, chunkEnd - addr);
+    } else {
+      /* Zero pages (and pages past the end of a file) need no work, since
+       * the area was freshly mmapped. */
+      size_t offset = addr - area->addr;
+      size_t dataSize = area_data_size(area);
+      if (offset < dataSize) {
+        size_t len = MIN((size_t)(chunkEnd - addr), dataSize - offset);
+        if (mtcp_sys_lseek(img->fd, img->data + offset, SEEK_SET) < 0) {
+          MTCP_PRINTF("error %d seeking in parent ckpt image\n",
+                      mtcp_sys_errno);
+          mtcp_abort();
+        }
+        mtcp_readfile(img->fd, addr, len);
+      }
+    }
+    addr = chunkEnd;
+  }
+}
+
+NO_OPTIMIZE
+static void
+close_parent_images(RestoreInfo *rinfo)
+{
+  int mtcp_sys_errno;
+  int i;
+  ParentImage *img = (ParentImage *)rinfo->parent_images;
+
+  for (i = 0; i < DMTCP_MAX_CKPT_GENERATION; i++) {
+    if (img[i].fd != -1) {
+      mtcp_sys_close(img[i].fd);
+    }
+  }
+}
+
+/* The data of a DMTCP_DEDUP_PAGES area is the offset of each of its chunks
+ * in the chunk store shared by the processes of the computation on the host
+ * that wrote the image (see src/ckptdedup.h).
+ */
+NO_OPTIMIZE
+static void
+open_dedup_store(RestoreInfo *rinfo)
+{
+  int mtcp_sys_errno;
+
+  rinfo->dedup_fd = -1;
+  if (rinfo->ckptHdr.dedupStore[0] == '\0') {
+    return;
+  }
+  rinfo->dedup_fd = mtcp_sys_open2(rinfo->ckptHdr.dedupStore, O_RDONLY);
+  if (rinfo->dedup_fd < 0) {
+    MTCP_PRINTF("***ERROR opening chunk store (%s); errno: %d\n",
+                rinfo->ckptHdr.dedupStore, mtcp_sys_errno);
+    mtcp_abort();
+  }
+}
+
+/* Chunks that are adjacent in the store are read with a single pread(). */
+NO_OPTIMIZE
+static void
+read_dedup_pages(RestoreInfo *rinfo, Area *area)
+{
+  int mtcp_sys_errno;
+  RestoreQueue *q = (RestoreQueue *)rinfo->restore_queue;
+  uint64_t refs[DEDUP_READ_REFS];
+  size_t numChunks = area->size / DMTCP_DEDUP_CHUNK_SIZE;
+  VA addr = area->addr;
+
+  if (rinfo->dedup_fd == -1) {
+    MTCP_PRINTF("***ERROR: deduplicated area %p without a chunk store\n",
+                area->addr);
+    mtcp_abort();
+  }
+
+  // payload_crc must take in the data of the queued areas first.
+  while (q != NULL && q->retired < q->published) {
+    retire_restore_job(rinfo);
+  }
+
+  while (numChunks > 0) {
+    size_t n = MIN(numChunks, DEDUP_READ_REFS);
+    size_t i = 0;
+
+    mtcp_readfile(rinfo->fd, refs, n * sizeof(uint64_t));
+    rinfo->payload_crc = crc32c_update(rinfo->payload_crc, refs,
+                                       n * sizeof(uint64_t));
+    while (i < n) {
+      size_t j = i + 1;
+      while (j < n && refs[j] == refs[j - 1] + DMTCP_DEDUP_CHUNK_SIZE) {
+        j++;
+      }
+      pread_all(rinfo->dedup_fd, addr + i * DMTCP_DEDUP_CHUNK_SIZE,
+                (j - i) * DMTCP_DEDUP_CHUNK_SIZE, refs[i]);
+      i = j;
+    }
+    addr += n * DMTCP_DEDUP_CHUNK_SIZE;
+    numChunks -= n;
+  }
+}
+
 #if 0
 
 // See note above.
@@ -1183,6 +2009,63 @@ remapExistingAreasToReservedArea(RestoreInfo *rinfo,
                    (unsigned long int) rinfo->currentVdso.startAddr);
   }
 
+  // Reserve space for reading compressed blocks of the ckpt image.
+  rinfo->compressed_block_buf = (VA)
+    mtcp_sys_mmap(endAddr,
+                  BLOCK_COMPRESS_BLOCK_SIZE,
+                  PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+                  -1,
+                  0);
+  MTCP_ASSERT(rinfo->compressed_block_buf == endAddr);
+  endAddr += BLOCK_COMPRESS_BLOCK_SIZE;
+
+  // Reserve space for reading the parent images of an incremental ckpt image.
+  size_t parentImagesSize =
+    (DMTCP_MAX_CKPT_GENERATION * sizeof(ParentImage) + MTCP_PAGE_SIZE - 1) &
+    ~(MTCP_PAGE_SIZE - 1);
+  rinfo->parent_images = (VA)
+    mtcp_sys_mmap(endAddr,
+                  parentImagesSize,
+                  PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+                  -1,
+                  0);
+  MTCP_ASSERT(rinfo->parent_images == endAddr);
+  endAddr += parentImagesSize;
+  for (int i = 0; i < DMTCP_MAX_CKPT_GENERATION; i++) {
+    ((ParentImage *)rinfo->parent_images)[i].fd = -1;
+  }
+
+  // Reserve space for the helper threads of a parallel restore, as many as
+  // fit next to the stack.
+  int numThreads = rinfo->restore_threads;
+  uint64_t available = rinfo->ckptHdr.restoreBuf.endAddr - (uint64_t)endAddr;
+  while (numThreads > 1 &&
+         restore_queue_size(numThreads) + rinfo->old_stack_size > available) {
+    numThreads--;
+  }
+  rinfo->restore_threads = numThreads;
+  if (numThreads > 1) {
+    size_t queueSize = restore_queue_size(numThreads);
+    RestoreQueue *q = (RestoreQueue *)
+      mtcp_sys_mmap(endAddr,
+                    queueSize,
+                    PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE,
+                    -1,
+                    0);
+    MTCP_ASSERT((VA)q == endAddr);
+    VA bufs = endAddr + restore_queue_size(0);
+    for (int i = 0; i < numThreads; i++) {
+      q->helpers[i].blockBuf = bufs + i * BLOCK_COMPRESS_BLOCK_SIZE;
+      q->helpers[i].stackTop = bufs + numThreads * BLOCK_COMPRESS_BLOCK_SIZE +
+                               (i + 1) * RESTORE_STACK_SIZE;
+    }
+    rinfo->restore_queue = (VA)q;
+    endAddr += queueSize;
+  }
+
   uint64_t remaining_restore_area =
     (uint64_t) (rinfo->ckptHdr.restoreBuf.endAddr - (uint64_t) endAddr);
 
@@ -1203,29 +2086,54 @@ remapExistingAreasToReservedArea(RestoreInfo *rinfo,
   rinfo->stack_offset = rinfo->old_stack_addr - rinfo->new_stack_addr;
 }
 
-#ifdef FAST_RST_VIA_MMAP
-static void mmapfile(int fd, void *buf, size_t size, int prot, int flags)
+/* Lazy restore: instead of reading the data of a private anonymous area,
+ * map it privately from the ckpt image, so that the kernel reads each page
+ * on first access.  Writes go to private copies and never reach the image.
+ * This needs an uncompressed image in a regular file, with the data at a
+ * page-aligned offset; see DmtcpCkptHeader::lazyRestore.  Returns 0 if the
+ * data must be read instead.
+ */
+NO_OPTIMIZE
+static int
+map_area_data_lazily(RestoreInfo *rinfo, Area *area, size_t dataSize)
 {
   int mtcp_sys_errno;
+  off_t offset;
   void *addr;
-  int rc;
 
-  /* Use mmap for this portion of checkpoint image. */
-  addr = mmap_fixed_noreplace(buf, size, prot, flags,
-                       fd, mtcp_sys_lseek(fd, 0, SEEK_CUR));
-  if (addr != buf) {
-    if (addr == MAP_FAILED) {
-      MTCP_PRINTF("error %d reading checkpoint file\n", mtcp_sys_errno);
-    } else {
-      MTCP_PRINTF("Requested address %p, but got address %p\n", buf, addr);
-    }
+  if (!rinfo->lazy_restore || !rinfo->ckptHdr.lazyRestore ||
+      (area->flags & (MAP_ANONYMOUS | MAP_PRIVATE)) !=
+        (MAP_ANONYMOUS | MAP_PRIVATE) ||
+      (area->flags & MAP_GROWSDOWN) ||
+      (area->properties & DMTCP_BLOCK_COMPRESSED) ||
+      dataSize != area->size || (dataSize & MTCP_PAGE_OFFSET_MASK) != 0) {
+    return 0;
+  }
+
+  offset = mtcp_sys_lseek(rinfo->fd, 0, SEEK_CUR);
+  if (offset == -1 || (offset & MTCP_PAGE_OFFSET_MASK) != 0) {
+    return 0;
+  }
+
+  /* The area was already mapped by its parent header; replace it.  If the
+   * image cannot be mapped (e.g., PROT_EXEC on a noexec file system), the
+   * kernel fails before touching the old mapping, and we read the data.
+   */
+  addr = mtcp_sys_mmap(area->addr, dataSize, area->prot | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED, rinfo->fd, offset);
+  if (addr == MAP_FAILED) {
+    DPRINTF("error %d mapping %p bytes at %p from the ckpt image\n",
+            mtcp_sys_errno, dataSize, area->addr);
+    return 0;
+  }
+  if (addr != area->addr) {
+    MTCP_PRINTF("Requested address %p, but got address %p\n", area->addr,
+                addr);
     mtcp_abort();
   }
-  /* Now update fd so as to work the same way as readfile() */
-  rc = mtcp_sys_lseek(fd, size, SEEK_CUR);
-  if (rc == -1) {
+  if (mtcp_sys_lseek(rinfo->fd, offset + dataSize, SEEK_SET) == -1) {
     MTCP_PRINTF("mtcp_sys_lseek failed with errno %d\n", mtcp_sys_errno);
     mtcp_abort();
   }
+  return 1;
 }
-#endif
@@ -107,9 +107,7 @@ typedef struct RestoreInfo {
   // void (*post_restart)();
   // void (*restorememoryareas_fptr)();
   int use_gdb;
-#ifdef TIMING
   struct timeval startValue;
-#endif
   volatile int restart_pause;  // Used by env. var. DMTCP_RESTART_PAUSE_WHILE
 
   // The following fields are only valid until mtcp_restart memory is unmapped,
@@ -124,6 +122,35 @@ typedef struct RestoreInfo {
   int simulate;
   int mpiMode;
 
+  // Map the data of anonymous areas from the ckpt image, if it was written
+  // for it (DmtcpCkptHeader::lazyRestore).  Cleared by DMTCP_LAZY_RESTORE=0.
+  int lazy_restore;
+
+  // Scratch space inside the restore buffer for reading one compressed block
+  // of the ckpt image at a time.
+  VA compressed_block_buf;
+
+  // Number of helper threads that read the data of the areas in parallel,
+  // from DMTCP_RESTORE_THREADS.  Their stacks and buffers, and the queue of
+  // areas to read, are at restore_queue inside the restore buffer.  Only used
+  // if the ckpt image is a regular file.
+  int restore_threads;
+  VA restore_queue;
+
+  // CRC32C of the area data read so far, checked against the trailer of the
+  // area index at the end (see include/procmapsarea.h).  Not checked if some
+  // data was mapped lazily instead.
+  uint32_t payload_crc;
+  int payload_unchecked;
+
+  // Scratch space inside the restore buffer for reading the chain of parent
+  // images of an incremental ckpt image (DMTCP_MAX_CKPT_GENERATION entries).
+  VA parent_images;
+
+  // The chunk store of a deduplicated ckpt image (DmtcpCkptHeader::
+  // dedupStore), or -1.
+  int dedup_fd;
+
   DmtcpCkptHeader ckptHdr;
 
   char ckptImage[PATH_MAX];
@@ -237,6 +237,7 @@ struct linux_dirent {
 # define mtcp_sys_read(args ...)  mtcp_inline_syscall(read, 3, args)
 # define mtcp_sys_write(args ...) mtcp_inline_syscall(write, 3, args)
 # define mtcp_sys_lseek(args ...) mtcp_inline_syscall(lseek, 3, args)
+# define mtcp_sys_pread(args ...) mtcp_inline_syscall(pread64, 4, args)
 
 /*
  * As of glibc-2.18, open() has been replaced by openat(). glibc converts
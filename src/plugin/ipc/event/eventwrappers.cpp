@@ -27,6 +27,7 @@
 /* Next three according to earlier standards */
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include "jassert.h"
 #include "dmtcpalloc.h"
@@ -235,40 +236,80 @@ epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
   return ret;
 }
 
-extern "C" int
-epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+// Milliseconds left of a finite epoll timeout, given the time the wait began,
+// clamped to [0, timeout].  After a restart, CLOCK_MONOTONIC is unrelated to
+// 'start'; if it went backwards, wait the full timeout again, as the poll
+// wrapper does.
+static int
+epollTimeLeft(int timeout, const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t elapsed = ((int64_t)now.tv_sec - start->tv_sec) * 1000 +
+                    (now.tv_nsec - start->tv_nsec) / 1000000;
+  if (elapsed < 0) {
+    return timeout;
+  }
+  return elapsed >= timeout ? 0 : timeout - elapsed;
+}
+
+/* The epoll wrappers block in the kernel for the whole timeout, without
+ * holding off checkpoints.  The ckpt signal interrupts the wait (epoll_wait
+ * is never restarted after a signal handler); as in the poll wrapper, a
+ * changed generation tells us to restart it after ckpt/resume or
+ * ckpt/restart, with whatever is left of a finite timeout.
+ */
+static int
+epollWait(int epfd,
+          struct epoll_event *events,
+          int maxevents,
+          int timeout,
+          bool usePwait,
+          const sigset_t *sigmask)
 {
-  int readyFds = 0;
+  struct timespec start;
   int timeLeft = timeout;
-  int mytime;
-
-  // JTRACE("Starting to do wait on epoll fd");
-
-  if (timeout >= 0 && timeout < 1000) {
-    // Short time intervals
-    DMTCP_PLUGIN_DISABLE_CKPT();
-    readyFds = _real_epoll_wait(epfd, events, maxevents, timeout);
-    DMTCP_PLUGIN_ENABLE_CKPT();
-    return readyFds;
-  } else if (timeout >= 1000) {
-    mytime = 1000; // wait time quanta: 1000 ms
-  } else {
-    // In case of indefinite timeout, start with 0 and increment by 1ms.
-    mytime = 0;
+  int rc;
+
+  if (timeout > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
   }
 
-  do {
-    DMTCP_PLUGIN_DISABLE_CKPT();
-    readyFds = _real_epoll_wait(epfd, events, maxevents, mytime);
-    DMTCP_PLUGIN_ENABLE_CKPT();
-    if (timeout < 0 && mytime <= 100) {
-      // Increase timeout if we are going to wait forever.
-      mytime += 1;
+  while (1) {
+    uint32_t orig_generation = dmtcp_get_generation();
+    if (usePwait) {
+      rc = _real_epoll_pwait(epfd, events, maxevents, timeLeft, sigmask);
     } else {
-      timeLeft -= mytime;
+      rc = _real_epoll_wait(epfd, events, maxevents, timeLeft);
     }
-  } while ((timeLeft > 0 || timeout < 0) && readyFds == 0);
-  return readyFds;
+    if (rc == -1 && errno == EINTR &&
+        dmtcp_get_generation() > orig_generation) {
+      if (timeout > 0) {
+        timeLeft = epollTimeLeft(timeout, &start);
+      }
+      continue;  // This was a restart or resume after checkpoint.
+    } else {
+      break;  // The signal interrupting us was not our checkpoint signal.
+    }
+  }
+  return rc;
+}
+
+extern "C" int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+  return epollWait(epfd, events, maxevents, timeout, false, NULL);
+}
+
+extern "C" int
+epoll_pwait(int epfd,
+            struct epoll_event *events,
+            int maxevents,
+            int timeout,
+            const sigset_t *sigmask)
+{
+  return epollWait(epfd, events, maxevents, timeout, true, sigmask);
 }
 #endif // ifdef HAVE_SYS_EPOLL_H
 
@@ -21,10 +21,13 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "jconvert.h"
 #include "jsocket.h"
 #include "dmtcp.h"
 #include "protectedfds.h"
@@ -39,6 +42,11 @@
 using namespace dmtcp;
 constexpr char const *PeerDiscoveryDbRestart = "/plugin/socket/rst";
 
+// How long a restarting process waits for the peers of its sockets to
+// register their restore addresses, in seconds; -1 waits forever.
+#define ENV_VAR_PEER_DISCOVERY_TIMEOUT "DMTCP_SOCKET_PEER_TIMEOUT"
+static const int PeerDiscoveryTimeoutSec = 60;
+
 // FIXME: IP6 Support disabled for now. However, we do go through the exercise
 // of creating the restore socket and all.
 // #define ENABLE_IP6_SUPPORT
@@ -279,26 +287,40 @@ ConnectionRewirer::registerOutgoing(const ConnectionIdentifier &remote,
 void
 ConnectionRewirer::registerNSData()
 {
+  vector<string> keys;
+  vector<string> vals;
+
   registerNSData((void *)&_ip4RestoreAddr, _ip4RestoreAddrlen,
-                 &_pendingIP4Incoming);
+                 &_pendingIP4Incoming, &keys, &vals);
   registerNSData((void *)&_ip6RestoreAddr, _ip6RestoreAddrlen,
-                 &_pendingIP6Incoming);
+                 &_pendingIP6Incoming, &keys, &vals);
   registerNSData((void *)&_udsRestoreAddr, _udsRestoreAddrlen,
-                 &_pendingUDSIncoming);
+                 &_pendingUDSIncoming, &keys, &vals);
+
+  // One coordinator round trip for all the connections.
+  JASSERT(kvdb::mset(PeerDiscoveryDbRestart, keys, vals) ==
+          kvdb::KVDBResponse::SUCCESS);
 }
 
 void
 ConnectionRewirer::registerNSData(void *addr,
                                   socklen_t addrLen,
-                                  ConnectionListT *conList)
+                                  ConnectionListT *conList,
+                                  vector<string> *keys,
+                                  vector<string> *vals)
 {
   iterator i;
 
   JASSERT(theRewirer != NULL);
+  if (conList->empty()) {
+    return;
+  }
+
+  string addrStr = dmtcp::base64::encode((const char*) addr, addrLen);
   for (i = conList->begin(); i != conList->end(); ++i) {
     const ConnectionIdentifier &id = i->first;
-    string addrStr = dmtcp::base64::encode((const char*) addr, addrLen);
-    dmtcp::kvdb::set(PeerDiscoveryDbRestart, id.toString(), addrStr);
+    keys->push_back(id.toString());
+    vals->push_back(addrStr);
 
     /*
     sockaddr_in *sn = (sockaddr_in*) &_restoreAddr;
@@ -315,14 +337,45 @@ void
 ConnectionRewirer::sendQueries()
 {
   iterator i;
+  vector<string> keys;
+  vector<string> vals;
 
   for (i = _pendingOutgoing.begin(); i != _pendingOutgoing.end(); ++i) {
+    keys.push_back(i->first.toString());
+  }
+
+  int timeoutSec = PeerDiscoveryTimeoutSec;
+  const char *timeoutStr = getenv(ENV_VAR_PEER_DISCOVERY_TIMEOUT);
+  if (timeoutStr != NULL) {
+    timeoutSec = jalib::StringToInt(timeoutStr);
+  }
+  int timeoutMs = -1;
+  if (timeoutSec >= 0) {
+    timeoutMs = timeoutSec < INT_MAX / 1000 ? timeoutSec * 1000 : INT_MAX;
+  }
+
+  // Wait for our peers to register their restore addresses.
+  vector<kvdb::KVDBResponse> responses;
+  kvdb::KVDBResponse response =
+    kvdb::mgetWait(PeerDiscoveryDbRestart, keys, &vals, &responses, timeoutMs);
+  if (response != kvdb::KVDBResponse::SUCCESS) {
+    string missing;
+    for (size_t n = 0; n < keys.size(); n++) {
+      if (n >= responses.size() ||
+          responses[n] != kvdb::KVDBResponse::SUCCESS) {
+        missing += " " + keys[n];
+      }
+    }
+    JASSERT(false) (response) (timeoutSec) (missing)
+    .Text("Peers did not register their restore addresses in time; see "
+          ENV_VAR_PEER_DISCOVERY_TIMEOUT);
+  }
+
+  size_t n = 0;
+  for (i = _pendingOutgoing.begin(); i != _pendingOutgoing.end(); ++i, ++n) {
     const ConnectionIdentifier &id = i->first;
     struct RemoteAddr remote;
-    string val;
-    JASSERT(kvdb::get(PeerDiscoveryDbRestart, id.toString(), &val) ==
-            kvdb::KVDBResponse::SUCCESS);
-    string valBinary = dmtcp::base64::decode(val);
+    string valBinary = dmtcp::base64::decode(vals[n]);
     memcpy(&remote.addr, valBinary.data(), valBinary.size());
     remote.len = valBinary.size();
 
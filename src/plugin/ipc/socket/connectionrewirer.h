@@ -59,7 +59,11 @@ class ConnectionRewirer
     void debugPrint() const;
 
   private:
-    void registerNSData(void *addr, socklen_t len, ConnectionListT *conList);
+    void registerNSData(void *addr,
+                        socklen_t len,
+                        ConnectionListT *conList,
+                        vector<string> *keys,
+                        vector<string> *vals);
 
     struct sockaddr_in _ip4RestoreAddr;
     socklen_t _ip4RestoreAddrlen;
@@ -421,16 +421,15 @@ TcpConnection::TcpConnection(const TcpConnection &parent,
   memset(&_bindAddr, 0, sizeof _bindAddr);
 }
 
-void
-TcpConnection::sendPeerInformation()
+bool
+TcpConnection::getPeerInformation(string *keyStr, string *valStr)
 {
   struct sockaddr key = {0}, value = {0};
   socklen_t keysz = 0, valuesz = 0;
-  bool sendPeerInfo = false;
 
   if (!(_sockDomain == AF_INET || _sockDomain == AF_INET6) ||
       _sockType != SOCK_STREAM) {
-    return;
+    return false;
   }
 
   switch (_type) {
@@ -443,7 +442,6 @@ TcpConnection::sendPeerInformation()
     // Information about the accept socket on the server
     valuesz = sizeof(value);
     JASSERT(getpeername(_fds[0], &value, &valuesz) == 0);
-    sendPeerInfo = true;
     break;
   }
   case TCP_ACCEPT:
@@ -454,49 +452,85 @@ TcpConnection::sendPeerInformation()
     // Information about the client connect socket
     valuesz = sizeof(value);
     JASSERT(getpeername(_fds[0], &value, &valuesz) == 0);
-    sendPeerInfo = true;
     break;
   }
   default:
-    break;
+    return false;
   }
 
-  if (sendPeerInfo) {
-    string keyStr = base64::encode((const char*) &key, keysz);
-    string valStr = base64::encode((const char*) &value, valuesz);
-    JASSERT(kvdb::set(PeerDiscoveryDbCkpt, keyStr, valStr) ==
-            kvdb::KVDBResponse::SUCCESS);
-  }
+  *keyStr = base64::encode((const char*) &key, keysz);
+  *valStr = base64::encode((const char*) &value, valuesz);
+  return true;
 }
 
 void
-TcpConnection::recvPeerInformation()
+TcpConnection::sendPeerInformation(vector<TcpConnection *> const& cons)
 {
-  struct sockaddr key = {0}, value = {0};
+  vector<string> keys;
+  vector<string> vals;
+
+  for (size_t i = 0; i < cons.size(); i++) {
+    string keyStr, valStr;
+    if (cons[i]->getPeerInformation(&keyStr, &valStr)) {
+      keys.push_back(keyStr);
+      vals.push_back(valStr);
+    }
+  }
+
+  JASSERT(kvdb::mset(PeerDiscoveryDbCkpt, keys, vals) ==
+          kvdb::KVDBResponse::SUCCESS);
+}
+
+bool
+TcpConnection::getPeerInformationKey(string *keyStr)
+{
+  struct sockaddr key = {0};
   socklen_t keylen = 0;
 
   if (!(_sockDomain == AF_INET || _sockDomain == AF_INET6) ||
       _sockType != SOCK_STREAM) {
-    return;
+    return false;
   }
 
   if (_type == TCP_CONNECT || _type == TCP_ACCEPT ||
       _type == TCP_CONNECT_IN_PROGRESS) {
     keylen = sizeof(key);
     JASSERT(getpeername(_fds[0], &key, &keylen) == 0);
+    *keyStr = base64::encode((const char*) &key, keylen);
+    return true;
+  }
 
-    string keyStr = base64::encode((const char*) &key, keylen);
-    string valStr;
-    if (kvdb::get(PeerDiscoveryDbCkpt, keyStr, &valStr) ==
-        kvdb::KVDBResponse::SUCCESS) {
-      string valBinary = dmtcp::base64::decode(valStr);
+  return false;
+}
+
+void
+TcpConnection::recvPeerInformation(vector<TcpConnection *> const& cons)
+{
+  vector<TcpConnection *> queried;
+  vector<string> keys;
+  vector<string> vals;
+  vector<kvdb::KVDBResponse> responses;
+
+  for (size_t i = 0; i < cons.size(); i++) {
+    string keyStr;
+    if (cons[i]->getPeerInformationKey(&keyStr)) {
+      queried.push_back(cons[i]);
+      keys.push_back(keyStr);
+    }
+  }
+
+  kvdb::mget(PeerDiscoveryDbCkpt, keys, &vals, &responses);
+
+  for (size_t i = 0; i < queried.size(); i++) {
+    if (responses[i] == kvdb::KVDBResponse::SUCCESS) {
+      struct sockaddr value;
+      string valBinary = dmtcp::base64::decode(vals[i]);
       JASSERT(valBinary.size() == sizeof(value));
-      memcpy(&value, valBinary.data(), sizeof(value));
     } else {
-      JWARNING(false) (_fds[0])
+      JWARNING(false) (queried[i]->_fds[0])
        .Text("DMTCP detected an \"external\" connect socket."
              "The socket will be restored as a dead socket.");
-      markExternalConnect();
+      queried[i]->markExternalConnect();
     }
   }
 }
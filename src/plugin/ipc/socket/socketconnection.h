@@ -110,9 +110,11 @@ class TcpConnection : public Connection, public SocketConnection
 
     bool isBlacklistedTcp(const sockaddr *saddr, socklen_t len);
 
-    void sendPeerInformation();
+    // Peer information of all the given connections, in one coordinator
+    // round trip.
+    static void sendPeerInformation(vector<TcpConnection *> const& cons);
 
-    void recvPeerInformation();
+    static void recvPeerInformation(vector<TcpConnection *> const& cons);
 
     // basic commands for updating state from wrappers
 
@@ -153,6 +155,9 @@ class TcpConnection : public Connection, public SocketConnection
 
   private:
     TcpConnection &asTcp();
+
+    bool getPeerInformation(string *keyStr, string *valStr);
+    bool getPeerInformationKey(string *keyStr);
 };
 
 class RawSocketConnection : public Connection, public SocketConnection
@@ -70,9 +70,10 @@ dmtcp_SocketConnList_EventHook(DmtcpEvent_t event, DmtcpEventData_t *data)
     SocketConnList::restart();
     dmtcp_local_barrier("Socket::Restart_Post_Restart");
 
-    // We might be able to mark the next barrier as PRIVATE too.
+    // No global barrier is needed between registering our restore addresses
+    // and querying those of our peers: the queries wait in the coordinator
+    // until the peers have registered them.
     SocketConnList::restartRegisterNSData();
-    dmtcp_global_barrier("Socket::Restart_Ns_Register_Data");
     SocketConnList::restartSendQueries();
     dmtcp_local_barrier("Socket::Restart_Ns_Send_Queries");
     SocketConnList::restartRefill();
@@ -113,6 +114,8 @@ SocketConnList::instance()
 void
 SocketConnList::preCkptRegisterNSData()
 {
+  vector<TcpConnection *> cons;
+
   for (iterator i = begin(); i != end(); ++i) {
     Connection *con = i->second;
     /* NOTE: We need to explicitly call checkLocking() here because
@@ -120,20 +123,24 @@ SocketConnList::preCkptRegisterNSData()
      */
     con->checkLocking();
     if (con->hasLock() && con->conType() == Connection::TCP) {
-      ((TcpConnection *)con)->sendPeerInformation();
+      cons.push_back((TcpConnection *)con);
     }
   }
+  TcpConnection::sendPeerInformation(cons);
 }
 
 void
 SocketConnList::preCkptSendQueries()
 {
+  vector<TcpConnection *> cons;
+
   for (iterator i = begin(); i != end(); ++i) {
     Connection *con = i->second;
     if (con->hasLock() && con->conType() == Connection::TCP) {
-      ((TcpConnection *)con)->recvPeerInformation();
+      cons.push_back((TcpConnection *)con);
     }
   }
+  TcpConnection::recvPeerInformation(cons);
 }
 
 void
@@ -43,6 +43,10 @@ static pid_t _dmtcp_ppid = -1;
 static pid_t _dmtcp_realPid = -1;
 static pid_t _dmtcp_realPpid = -1;
 
+// The real parent pid for which _dmtcp_ppid was last found valid; see
+// getppid().  Reset to -1 whenever the ppid mapping may have changed.
+static pid_t _dmtcp_checkedRealPpid = -1;
+
 
 VirtualPidTable::VirtualPidTable()
   : VirtualIdTable<pid_t>("Pid", _dmtcp_pid)
@@ -68,6 +72,7 @@ VirtualPidTable::resetPidPpid()
 {
   Util::getVirtualPidFromEnvVar(&_dmtcp_pid, &_dmtcp_realPid,
                                 &_dmtcp_ppid, &_dmtcp_realPpid);
+  _dmtcp_checkedRealPpid = -1;
 
   if (_dmtcp_realPid == 0) {
     _dmtcp_realPid = _real_getpid();
@@ -97,17 +102,26 @@ VirtualPidTable::getpid()
 pid_t
 VirtualPidTable::getppid()
 {
+  pid_t realPpid = _real_getppid();
+
+  // The parent can change at any time, so the syscall can't be avoided; but
+  // while it returns the same real pid, the virtual ppid needs no lookup.
+  if (realPpid == _dmtcp_checkedRealPpid) {
+    return _dmtcp_ppid;
+  }
+
   if (_dmtcp_ppid == -1) {
     resetPidPpid();
   }
-  if (_real_getppid() != VIRTUAL_TO_REAL_PID(_dmtcp_ppid)) {
+  if (realPpid != VIRTUAL_TO_REAL_PID(_dmtcp_ppid)) {
     // The original parent died; reset our ppid.
     //
     // On older systems, a process is inherited by init (pid = 1) after its
     // parent dies. However, with the new per-user init process, the parent
     // pid is no longer "1"; it's the pid of the user-specific init process.
-    _dmtcp_ppid = _real_getppid();
+    _dmtcp_ppid = realPpid;
   }
+  _dmtcp_checkedRealPpid = realPpid;
   return _dmtcp_ppid;
 }
 
@@ -130,13 +144,14 @@ VirtualPidTable::gettid()
 void
 VirtualPidTable::postRestart()
 {
+  _dmtcp_checkedRealPpid = -1;
   if (_dmtcp_ppid != 1) {
     updateMapping(_dmtcp_ppid, _real_getppid());
   }
 
   VirtualIdTable<pid_t>::postRestart();
   _do_lock_tbl();
-  _idMapTable[getpid()] = _real_getpid();
+  _setMapping(getpid(), _real_getpid());
   _do_unlock_tbl();
 }
 
@@ -154,7 +169,7 @@ VirtualPidTable::refresh()
     next++;
     if (isIdCreatedByCurrentProcess(i->first)
         && _real_tgkill(_real_pid, i->second, 0) == -1) {
-      _idMapTable.erase(i);
+      _eraseMapping(i->first);
     }
   }
   _do_unlock_tbl();
@@ -182,7 +197,7 @@ VirtualPidTable::resetOnFork()
   resetTid(getpid());
   VirtualIdTable<pid_t>::resetOnFork(getpid());
   _numTids = 1;
-  _idMapTable[getpid()] = _real_getpid();
+  _setMapping(getpid(), _real_getpid());
   refresh();
   printMaps();
 }
@@ -192,7 +207,7 @@ VirtualPidTable::updateMapping(pid_t virtualId, pid_t realId)
 {
   if (virtualId > 0 && realId > 0) {
     _do_lock_tbl();
-    _idMapTable[virtualId] = realId;
+    _setMapping(virtualId, realId);
     _do_unlock_tbl();
   }
 }
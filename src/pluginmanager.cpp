@@ -1,5 +1,6 @@
 #include "pluginmanager.h"
 
+#include "ckpttiming.h"
 #include "coordinatorapi.h"
 #include "config.h"
 #include "dmtcp.h"
@@ -71,6 +72,33 @@ dmtcp_initialize_plugin()
   }
 }
 
+// The handlers of the checkpoint and restart events are timed per plugin, as
+// "<event>/<plugin>"; see CkptTiming.
+static void
+callEventHook(PluginInfo *info, DmtcpEvent_t event, DmtcpEventData_t *data)
+{
+  const char *phase = NULL;
+
+  switch (event) {
+  case DMTCP_EVENT_PRESUSPEND:
+    phase = "presuspend";
+    break;
+  case DMTCP_EVENT_PRECHECKPOINT:
+    phase = "precheckpoint";
+    break;
+  case DMTCP_EVENT_RESTART:
+    phase = "restart";
+    break;
+  default:
+    info->event_hook(event, data);
+    return;
+  }
+
+  uint64_t start = CkptTiming::now();
+  info->event_hook(event, data);
+  CkptTiming::record(phase, info->pluginName.c_str(), start);
+}
+
 void
 PluginManager::eventHook(DmtcpEvent_t event, DmtcpEventData_t *data)
 {
@@ -104,7 +132,7 @@ PluginManager::eventHook(DmtcpEvent_t event, DmtcpEventData_t *data)
     // (i) pre-checkpoint, (ii) resume event, and (iii) restart; respectively.
     for (size_t i = 0; i < pluginManager->pluginInfos.size(); i++) {
       if (pluginManager->pluginInfos[i]->event_hook) {
-        pluginManager->pluginInfos[i]->event_hook(event, data);
+        callEventHook(pluginManager->pluginInfos[i], event, data);
       }
     }
     break;
@@ -132,7 +160,7 @@ PluginManager::eventHook(DmtcpEvent_t event, DmtcpEventData_t *data)
     // is required to support layered software.  See the related comment, above.
     for (int i = pluginManager->pluginInfos.size() - 1; i >= 0; i--) {
       if (pluginManager->pluginInfos[i]->event_hook) {
-        pluginManager->pluginInfos[i]->event_hook(event, data);
+        callEventHook(pluginManager->pluginInfos[i], event, data);
       }
     }
     break;
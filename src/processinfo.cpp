@@ -158,6 +158,9 @@ ProcessInfo::ProcessInfo()
 
   strcpy(ckptSignature, DMTCP_CKPT_SIGNATURE);
   memset(padding, 0, sizeof(padding));
+  ckptGeneration = 0;
+  memset(parentCkptImage, 0, sizeof(parentCkptImage));
+  memset(dedupStore, 0, sizeof(dedupStore));
 
   upid = UniquePid::ThisProcess();
   uppid = UniquePid::ParentProcess();
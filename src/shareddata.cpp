@@ -20,6 +20,7 @@
  ****************************************************************************/
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <syscall.h>
 #include <sys/ipc.h>
@@ -86,6 +87,11 @@ SharedData::initializeHeader(const char *tmpDir,
   sharedDataHeader->barrierInfo.numIn = 0;
   sharedDataHeader->barrierInfo.curRound = 0;
 
+  // All processes of the computation on this node must agree on this.
+  const char *nodeBarriers = getenv(ENV_VAR_NODE_BARRIERS);
+  sharedDataHeader->barrierInfo.nodeBarriers =
+    nodeBarriers != NULL && strcmp(nodeBarriers, "0") != 0;
+
   sharedDataHeader->archMode = archMode;
 
   memcpy(&sharedDataHeader->compId, compId, sizeof(*compId));
@@ -351,6 +357,66 @@ SharedData::waitForBarrier(const string &barrierId)
   }
 }
 
+bool
+SharedData::nodeBarriersEnabled()
+{
+  return sharedDataHeader->barrierInfo.nodeBarriers;
+}
+
+uint32_t
+SharedData::numCkptPeers()
+{
+  return sharedDataHeader->barrierInfo.numCkptPeers;
+}
+
+// Returns true for the last of the numLocalPeers processes to arrive, which
+// then reports all of them to the coordinator.  The others wait in
+// waitForNodeBarrierRelease() for the given round to end.
+bool
+SharedData::arriveAtNodeBarrier(uint32_t numLocalPeers, uint32_t *round)
+{
+  struct BarrierInfo *info = &sharedDataHeader->barrierInfo;
+
+  // The round cannot end before we are counted in.
+  *round = __atomic_load_n(&info->nodeRound, __ATOMIC_ACQUIRE);
+  if (__atomic_add_fetch(&info->nodeNumIn, 1, __ATOMIC_ACQ_REL) <
+        numLocalPeers) {
+    return false;
+  }
+  __atomic_store_n(&info->nodeNumIn, 0, __ATOMIC_RELAXED);
+  return true;
+}
+
+void
+SharedData::releaseNodeBarrier(uint32_t numPeers)
+{
+  struct BarrierInfo *info = &sharedDataHeader->barrierInfo;
+
+  info->nodeNumPeers = numPeers;
+  __atomic_add_fetch(&info->nodeRound, 1, __ATOMIC_RELEASE);
+  _real_syscall(SYS_futex, &info->nodeRound, FUTEX_WAKE, INT_MAX,
+                NULL, NULL, 0);
+}
+
+// Waits for up to a second; returns false if the round has not ended yet,
+// so that the caller can check on its coordinator socket in between.
+bool
+SharedData::waitForNodeBarrierRelease(uint32_t round, uint32_t *numPeers)
+{
+  struct BarrierInfo *info = &sharedDataHeader->barrierInfo;
+  struct timespec timeout = { 1, 0 };
+
+  if (__atomic_load_n(&info->nodeRound, __ATOMIC_ACQUIRE) == round) {
+    _real_syscall(SYS_futex, &info->nodeRound, FUTEX_WAIT, round,
+                  &timeout, NULL, 0);
+    if (__atomic_load_n(&info->nodeRound, __ATOMIC_ACQUIRE) == round) {
+      return false;
+    }
+  }
+  *numPeers = info->nodeNumPeers;
+  return true;
+}
+
 string
 SharedData::coordHost()
 {
@@ -520,154 +586,158 @@ SharedData::getDlsymOffset_m32(void)
   return sharedDataHeader->dlsymOffset_m32;
 }
 
+// See struct IdMap.  Setting bit 32 keeps the key and value of a used slot
+// non-zero even for an id of 0.
+#define ID_MAP_KEY(virt)   ((1ULL << 32) | (uint32_t)(virt))
+#define ID_MAP_VALUE(real) ((1ULL << 32) | (uint32_t)(real))
+
+// Returns the slot of 'virt' in the hash table 'map' of 'numSlots' (a power
+// of two) slots, or NULL if there is none.  With 'insert', a slot is claimed
+// for 'virt' if there is none yet, and counted in 'numMaps'.  Slots are
+// probed linearly from a multiplicative hash of 'virt', which spreads
+// consecutive ids; since slots are never freed, the first free slot ends
+// the search.
+static SharedData::IdMap *
+findIdMap(SharedData::IdMap *map,
+          size_t numSlots,
+          int32_t virt,
+          bool insert = false,
+          uint64_t *numMaps = NULL,
+          size_t maxMaps = 0)
+{
+  uint64_t key = ID_MAP_KEY(virt);
+  size_t i = ((uint32_t)virt * 2654435769U) & (numSlots - 1);
+
+  for (size_t n = 0; n < numSlots; n++, i = (i + 1) & (numSlots - 1)) {
+    uint64_t cur = __atomic_load_n(&map[i].key, __ATOMIC_ACQUIRE);
+    if (cur == 0 && insert &&
+        __atomic_compare_exchange_n(&map[i].key, &cur, key, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      JASSERT(__atomic_add_fetch(numMaps, 1, __ATOMIC_RELAXED) <= maxMaps)
+        (virt) (maxMaps).Text("Too many id maps");
+      return &map[i];
+    }
+
+    // Either the slot was not free, or another process just took it.
+    if (cur == key) {
+      return &map[i];
+    } else if (cur == 0) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+// Returns false if 'slot' is NULL or its value has not been stored yet.
+static bool
+getIdMapValue(SharedData::IdMap *slot, int32_t *real)
+{
+  if (slot == NULL) {
+    return false;
+  }
+
+  uint64_t value = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+  if (value == 0) {
+    return false;
+  }
+  *real = (int32_t)(uint32_t)value;
+  return true;
+}
+
 pid_t
 SharedData::getRealPid(pid_t virt)
 {
-  pid_t res = -1;
+  int32_t res;
 
   if (sharedDataHeader == NULL) {
     initialize();
   }
-  Util::lockFile(PROTECTED_SHM_FD);
-  for (size_t i = 0; i < sharedDataHeader->numPidMaps; i++) {
-    if (sharedDataHeader->pidMap[i].virt == virt) {
-      res = sharedDataHeader->pidMap[i].real;
-    }
+  if (!getIdMapValue(findIdMap(sharedDataHeader->pidMap, PID_MAP_SLOTS, virt),
+                     &res)) {
+    return -1;
   }
-  Util::unlockFile(PROTECTED_SHM_FD);
   return res;
 }
 
 void
 SharedData::setPidMap(pid_t virt, pid_t real)
 {
-  size_t i;
-
   if (sharedDataHeader == NULL) {
     initialize();
   }
-  Util::lockFile(PROTECTED_SHM_FD);
-  for (i = 0; i < sharedDataHeader->numPidMaps; i++) {
-    if (sharedDataHeader->pidMap[i].virt == virt) {
-      sharedDataHeader->pidMap[i].real = real;
-      break;
-    }
-  }
-  if (i == sharedDataHeader->numPidMaps) {
-    JASSERT(sharedDataHeader->numPidMaps < MAX_PID_MAPS);
-    sharedDataHeader->pidMap[i].virt = virt;
-    sharedDataHeader->pidMap[i].real = real;
-    sharedDataHeader->numPidMaps++;
-  }
-  Util::unlockFile(PROTECTED_SHM_FD);
+  IdMap *slot = findIdMap(sharedDataHeader->pidMap, PID_MAP_SLOTS, virt,
+                          true, &sharedDataHeader->numPidMaps, MAX_PID_MAPS);
+  __atomic_store_n(&slot->value, ID_MAP_VALUE(real), __ATOMIC_RELEASE);
 }
 
-int32_t
-SharedData::getRealIPCId(int type, int32_t virt, bool insertIfNotFound)
+static void
+getIPCIdMap(int type, SharedData::IdMap **map, uint64_t **numMaps)
 {
-  int32_t res = -1;
-  uint32_t nmaps = 0;
-  IPCIdMap *map = NULL;
-
-  if (sharedDataHeader == NULL) {
-    initialize();
-  }
-  Util::lockFile(PROTECTED_SHM_FD);
   switch (type) {
   case SYSV_SHM_ID:
-    nmaps = sharedDataHeader->numSysVShmIdMaps;
-    map = sharedDataHeader->sysvShmIdMap;
+    *numMaps = &sharedDataHeader->numSysVShmIdMaps;
+    *map = sharedDataHeader->sysvShmIdMap;
     break;
 
   case SYSV_SEM_ID:
-    nmaps = sharedDataHeader->numSysVSemIdMaps;
-    map = sharedDataHeader->sysvSemIdMap;
+    *numMaps = &sharedDataHeader->numSysVSemIdMaps;
+    *map = sharedDataHeader->sysvSemIdMap;
     break;
 
   case SYSV_MSQ_ID:
-    nmaps = sharedDataHeader->numSysVMsqIdMaps;
-    map = sharedDataHeader->sysvMsqIdMap;
+    *numMaps = &sharedDataHeader->numSysVMsqIdMaps;
+    *map = sharedDataHeader->sysvMsqIdMap;
     break;
 
   case SYSV_SHM_KEY:
-    nmaps = sharedDataHeader->numSysVShmKeyMaps;
-    map = sharedDataHeader->sysvShmKeyMap;
+    *numMaps = &sharedDataHeader->numSysVShmKeyMaps;
+    *map = sharedDataHeader->sysvShmKeyMap;
     break;
 
   default:
     JASSERT(false) (type).Text("Unknown IPC-Id type.");
     break;
   }
+}
 
-  bool found = false;
-  for (size_t i = 0; i < nmaps; i++) {
-    if (map[i].virt == virt) {
-      res = map[i].real;
-      found = true;
-    }
-  }
+int32_t
+SharedData::getRealIPCId(int type, int32_t virt, bool insertIfNotFound)
+{
+  int32_t res = -1;
+  uint64_t *numMaps = NULL;
+  IdMap *map = NULL;
 
-  if (!found && insertIfNotFound) {
-    JASSERT(nmaps < MAX_IPC_ID_MAPS);
-    map[nmaps].virt = virt;
-    map[nmaps].real = virt;
-    res = virt;
-    nmaps++;
+  if (sharedDataHeader == NULL) {
+    initialize();
   }
+  getIPCIdMap(type, &map, &numMaps);
 
-  Util::unlockFile(PROTECTED_SHM_FD);
+  IdMap *slot = findIdMap(map, IPC_ID_MAP_SLOTS, virt, insertIfNotFound,
+                          numMaps, MAX_IPC_ID_MAPS);
+  if (insertIfNotFound) {
+    // Map 'virt' to itself, unless some process has mapped it meanwhile.
+    uint64_t value = 0;
+    __atomic_compare_exchange_n(&slot->value, &value, ID_MAP_VALUE(virt),
+                                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  }
+  getIdMapValue(slot, &res);
   return res;
 }
 
 void
 SharedData::setIPCIdMap(int type, int32_t virt, int32_t real)
 {
-  size_t i;
-  uint64_t *nmaps = NULL;
-  IPCIdMap *map = NULL;
+  uint64_t *numMaps = NULL;
+  IdMap *map = NULL;
 
   if (sharedDataHeader == NULL) {
     initialize();
   }
-  Util::lockFile(PROTECTED_SHM_FD);
-  switch (type) {
-  case SYSV_SHM_ID:
-    nmaps = &sharedDataHeader->numSysVShmIdMaps;
-    map = sharedDataHeader->sysvShmIdMap;
-    break;
-
-  case SYSV_SEM_ID:
-    nmaps = &sharedDataHeader->numSysVSemIdMaps;
-    map = sharedDataHeader->sysvSemIdMap;
-    break;
-
-  case SYSV_MSQ_ID:
-    nmaps = &sharedDataHeader->numSysVMsqIdMaps;
-    map = sharedDataHeader->sysvMsqIdMap;
-    break;
-
-  case SYSV_SHM_KEY:
-    nmaps = &sharedDataHeader->numSysVShmKeyMaps;
-    map = sharedDataHeader->sysvShmKeyMap;
-    break;
+  getIPCIdMap(type, &map, &numMaps);
 
-  default:
-    JASSERT(false) (type).Text("Unknown IPC-Id type.");
-    break;
-  }
-  for (i = 0; i < *nmaps; i++) {
-    if (map[i].virt == virt) {
-      map[i].real = real;
-      break;
-    }
-  }
-  if (i == *nmaps) {
-    JASSERT(*nmaps < MAX_IPC_ID_MAPS);
-    map[i].virt = virt;
-    map[i].real = real;
-    *nmaps += 1;
-  }
-  Util::unlockFile(PROTECTED_SHM_FD);
+  IdMap *slot = findIdMap(map, IPC_ID_MAP_SLOTS, virt, true,
+                          numMaps, MAX_IPC_ID_MAPS);
+  __atomic_store_n(&slot->value, ID_MAP_VALUE(real), __ATOMIC_RELEASE);
 }
 
 void
@@ -684,11 +754,12 @@ SharedData::createVirtualPtyName(const char *real, char *out, uint32_t len)
 
   // FIXME: We should be removing ptys once they are gone.
   JASSERT(sharedDataHeader->numPtyNameMaps < MAX_PTY_NAME_MAPS);
-  size_t n = sharedDataHeader->numPtyNameMaps++;
+  size_t n = sharedDataHeader->numPtyNameMaps;
   JASSERT(strlen(real) < PTS_PATH_MAX);
   JASSERT(virt.length() < PTS_PATH_MAX);
   strcpy(sharedDataHeader->ptyNameMap[n].real, real);
   strcpy(sharedDataHeader->ptyNameMap[n].virt, virt.c_str());
+  __atomic_store_n(&sharedDataHeader->numPtyNameMaps, n + 1, __ATOMIC_RELEASE);
   JASSERT(len > virt.length());
   strcpy(out, virt.c_str());
   Util::unlockFile(PROTECTED_SHM_FD);
@@ -717,15 +788,17 @@ SharedData::getRealPtyName(const char *virt, char *out, uint32_t len)
     initialize();
   }
   *out = '\0';
-  Util::lockFile(PROTECTED_SHM_FD);
-  for (size_t i = 0; i < sharedDataHeader->numPtyNameMaps; i++) {
+
+  // Entries are published by the store of numPtyNameMaps, and never change.
+  size_t n = __atomic_load_n(&sharedDataHeader->numPtyNameMaps,
+                             __ATOMIC_ACQUIRE);
+  for (size_t i = 0; i < n; i++) {
     if (strcmp(virt, sharedDataHeader->ptyNameMap[i].virt) == 0) {
       JASSERT(strlen(sharedDataHeader->ptyNameMap[i].real) < len);
       strcpy(out, sharedDataHeader->ptyNameMap[i].real);
       break;
     }
   }
-  Util::unlockFile(PROTECTED_SHM_FD);
 }
 
 void
@@ -735,15 +808,17 @@ SharedData::getVirtPtyName(const char *real, char *out, uint32_t len)
     initialize();
   }
   *out = '\0';
-  Util::lockFile(PROTECTED_SHM_FD);
-  for (size_t i = 0; i < sharedDataHeader->numPtyNameMaps; i++) {
+
+  // Entries are published by the store of numPtyNameMaps, and never change.
+  size_t n = __atomic_load_n(&sharedDataHeader->numPtyNameMaps,
+                             __ATOMIC_ACQUIRE);
+  for (size_t i = 0; i < n; i++) {
     if (strcmp(real, sharedDataHeader->ptyNameMap[i].real) == 0) {
       JASSERT(strlen(sharedDataHeader->ptyNameMap[i].virt) < len);
       strcpy(out, sharedDataHeader->ptyNameMap[i].virt);
       break;
     }
   }
-  Util::unlockFile(PROTECTED_SHM_FD);
 }
 
 void
@@ -753,11 +828,13 @@ SharedData::insertPtyNameMap(const char *virt, const char *real)
     initialize();
   }
   Util::lockFile(PROTECTED_SHM_FD);
-  size_t n = sharedDataHeader->numPtyNameMaps++;
+  JASSERT(sharedDataHeader->numPtyNameMaps < MAX_PTY_NAME_MAPS);
+  size_t n = sharedDataHeader->numPtyNameMaps;
   JASSERT(strlen(virt) < PTS_PATH_MAX);
   JASSERT(strlen(real) < PTS_PATH_MAX);
   strcpy(sharedDataHeader->ptyNameMap[n].real, real);
   strcpy(sharedDataHeader->ptyNameMap[n].virt, virt);
+  __atomic_store_n(&sharedDataHeader->numPtyNameMaps, n + 1, __ATOMIC_RELEASE);
   Util::unlockFile(PROTECTED_SHM_FD);
 }
 
@@ -93,6 +93,7 @@ struct Thread {
   double ckptReadTime;
 
   uint32_t wrapperLockCount;
+  int32_t wrapperLockSlot;  // How the wrapper lock is held; see threadsync.cpp.
 
   Thread *next;
   Thread *prev;
@@ -13,6 +13,7 @@
 #endif  // if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 11) ||
 // defined(HAS_PR_SET_PTRACER)
 #include "ckptserializer.h"
+#include "ckpttiming.h"
 #include "coordinatorapi.h"
 #include "dmtcpalloc.h"
 #include "dmtcpworker.h"
@@ -408,7 +409,9 @@ checkpointhread(void *dummy)
 
     restoreInProgress = false;
 
+    uint64_t suspendStart = CkptTiming::now();
     ThreadList::suspendThreads();
+    CkptTiming::record("suspend", suspendStart);
 
     JTRACE("Release locks and wait for exiting threads to die.");
     DmtcpWorker::releaseLocks();
@@ -19,11 +19,15 @@
  *  <http://www.gnu.org/licenses/>.                                         *
  ****************************************************************************/
 
+#include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "futex.h"
 #include "jassert.h"
 #include "syscallwrappers.h"
 #include "threadinfo.h"
@@ -59,11 +63,48 @@ using namespace dmtcp;
  *
  * XXX: Currently this security is provided only for the clone wrapper; this
  * should be extended to other calls as well.           -- KAPIL
+ *
+ * Fast path for readers:
+ *   Taking the read lock of _wrapperExecutionLock is a compare-and-swap on
+ *     a word shared by all threads, which makes the wrappers of frequent
+ *     calls (open, close, dup, socket, ...) contend with each other.  So,
+ *     as long as no thread wants the write lock, a thread entering a
+ *     wrapper instead increments one of WRAPPER_LOCK_SLOTS reader counters,
+ *     chosen by its tid, each in its own cache line.  The writer announces
+ *     itself in _wrapperLockWriters, waits until all counters drop to zero,
+ *     and only then takes the write lock.  A reader that finds a writer
+ *     announced takes the read lock of _wrapperExecutionLock as before, and
+ *     thus waits for the writer.  Thread::wrapperLockSlot records how the
+ *     lock is held, so that it can be released the same way.
+ *   Newly created threads always hold the read lock of
+ *     _wrapperExecutionLock (see wrapperExecutionLockLockForNewThread), so
+ *     that the checkpoint thread keeps waiting for them as described above.
  */
 
 // NOTE: PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP is not POSIX.
 static DmtcpRWLock _wrapperExecutionLock;
 
+#define WRAPPER_LOCK_SLOTS 64
+
+// Values of Thread::wrapperLockSlot besides the index of a reader counter.
+#define WRAPPER_LOCK_SHARED (-1)
+#define WRAPPER_LOCK_EXCL   (-2)
+
+struct WrapperLockSlot {
+  uint32_t readers;
+  char pad[64 - sizeof(uint32_t)];
+};
+
+static WrapperLockSlot _wrapperLockSlots[WRAPPER_LOCK_SLOTS]
+  __attribute__((aligned(64)));
+
+// The number of threads that want, or hold, the write lock.
+static uint32_t _wrapperLockWriters = 0;
+
+// Bumped by readers leaving a slot while a writer waits; see
+// waitForWrapperLockSlots().
+static uint32_t _wrapperLockSlotsFutex = 0;
+
 static DmtcpMutex libdlLock = DMTCP_MUTEX_INITIALIZER;
 static pid_t libdlLockOwner = 0;
 
@@ -73,6 +114,58 @@ void
 ThreadSync::initMotherOfAll()
 {
   DmtcpRWLockInit(&_wrapperExecutionLock);
+  memset(_wrapperLockSlots, 0, sizeof(_wrapperLockSlots));
+  _wrapperLockWriters = 0;
+}
+
+static void
+releaseWrapperLockSlot(int32_t slot)
+{
+  __atomic_sub_fetch(&_wrapperLockSlots[slot].readers, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&_wrapperLockWriters, __ATOMIC_SEQ_CST) > 0) {
+    __atomic_add_fetch(&_wrapperLockSlotsFutex, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&_wrapperLockSlotsFutex, INT_MAX);
+  }
+}
+
+// Returns the slot through which the read lock was acquired, or
+// WRAPPER_LOCK_SHARED if a writer is about and the caller must take the
+// read lock of _wrapperExecutionLock instead.
+static int32_t
+acquireWrapperLockSlot(Thread *thread)
+{
+  if (__atomic_load_n(&_wrapperLockWriters, __ATOMIC_RELAXED) > 0) {
+    return WRAPPER_LOCK_SHARED;
+  }
+
+  int32_t slot = (uint32_t)thread->tid % WRAPPER_LOCK_SLOTS;
+  __atomic_add_fetch(&_wrapperLockSlots[slot].readers, 1, __ATOMIC_SEQ_CST);
+
+  // Pairs with the increment of _wrapperLockWriters in
+  // wrapperExecutionLockLockExcl(): either the writer sees our counter, or
+  // we see the writer.
+  if (__atomic_load_n(&_wrapperLockWriters, __ATOMIC_SEQ_CST) > 0) {
+    releaseWrapperLockSlot(slot);
+    return WRAPPER_LOCK_SHARED;
+  }
+  return slot;
+}
+
+static void
+waitForWrapperLockSlots()
+{
+  for (int i = 0; i < WRAPPER_LOCK_SLOTS; i++) {
+    while (true) {
+      uint32_t waitVal =
+        __atomic_load_n(&_wrapperLockSlotsFutex, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&_wrapperLockSlots[i].readers,
+                          __ATOMIC_SEQ_CST) == 0) {
+        break;
+      }
+      int ret = futex_wait(&_wrapperLockSlotsFutex, waitVal);
+      JASSERT(ret == 0 || errno == EAGAIN || errno == EINTR) (JASSERT_ERRNO);
+    }
+  }
 }
 
 void
@@ -107,6 +200,9 @@ void
 ThreadSync::resetLocks(bool resetPresuspendEventHookLock)
 {
   DmtcpRWLockInit(&_wrapperExecutionLock);
+  memset(_wrapperLockSlots, 0, sizeof(_wrapperLockSlots));
+  _wrapperLockWriters = 0;
+  _wrapperLockSlotsFutex = 0;
   Thread *thread = dmtcp_get_current_thread();
   thread->wrapperLockCount = 0;
 
@@ -169,12 +265,17 @@ ThreadSync::wrapperExecutionLockLock()
   Thread *thread = dmtcp_get_current_thread();
 
   if (thread->wrapperLockCount == 0) {
-    // If we don't have a lock, acquire it now.
-    if (DmtcpRWLockRdLock(&_wrapperExecutionLock) != 0) {
+    // If we don't have a lock, acquire it now.  A signal handler may take
+    // and release the lock until wrapperLockCount is set, so wrapperLockSlot
+    // is set only once we hold the lock.
+    int32_t slot = acquireWrapperLockSlot(thread);
+    if (slot == WRAPPER_LOCK_SHARED &&
+        DmtcpRWLockRdLock(&_wrapperExecutionLock) != 0) {
       fprintf(stderr, "ERROR %d at %s:%d %s: Failed to acquire lock\n",
               errno, __FILE__, __LINE__, __PRETTY_FUNCTION__);
       _exit(DMTCP_FAIL_RC);
     }
+    thread->wrapperLockSlot = slot;
   }
   thread->wrapperLockCount++;
 
@@ -193,6 +294,7 @@ ThreadSync::wrapperExecutionLockLockForNewThread(Thread *thread)
     _exit(DMTCP_FAIL_RC);
   }
 
+  thread->wrapperLockSlot = WRAPPER_LOCK_SHARED;
   thread->wrapperLockCount++;
 }
 
@@ -241,10 +343,8 @@ ThreadSync::wrapperExecutionLockUnlockForNewThread(Thread *thread)
  *    sleeps goes to sleep for some time. While thread B is sleeping, thread A
  *    releases the rdlock and reacquires it or some other thread acquires the
  *    rdlock. This would cause the thread B to starve. This scenario can be
- *    easily observed if thread A calls
- *      epoll_wait(fd, events, max_events, -1).
- *    It is wrapped by the epoll_wait wrapper in IPC plugin, which then makes
- *    repeated calls to _real_epoll_wait with smaller timeout.
+ *    easily observed if thread A repeatedly calls a wrapper that blocks
+ *    for a short time while holding the rdlock.
  */
 void
 ThreadSync::wrapperExecutionLockLockExcl()
@@ -258,11 +358,17 @@ ThreadSync::wrapperExecutionLockLockExcl()
 
   Thread *thread = dmtcp_get_current_thread();
 
+  // Turn new readers away from the reader slots, and wait for those inside
+  // a wrapper to leave; the write lock then waits for the remaining readers.
+  __atomic_add_fetch(&_wrapperLockWriters, 1, __ATOMIC_SEQ_CST);
+  waitForWrapperLockSlots();
+
   if (DmtcpRWLockWrLock(&_wrapperExecutionLock) != 0) {
     fprintf(stderr, "ERROR %s:%d %s: Failed to acquire lock\n",
             __FILE__, __LINE__, __PRETTY_FUNCTION__);
     _exit(DMTCP_FAIL_RC);
   }
+  thread->wrapperLockSlot = WRAPPER_LOCK_EXCL;
   thread->wrapperLockCount++;
   errno = saved_errno;
 }
@@ -282,13 +388,19 @@ ThreadSync::wrapperExecutionLockUnlock()
   Thread *thread = dmtcp_get_current_thread();
 
   JASSERT(thread->wrapperLockCount != 0);
+  int32_t slot = thread->wrapperLockSlot;
   thread->wrapperLockCount -= 1;
 
-  if (thread->wrapperLockCount == 0 &&
-      DmtcpRWLockUnlock(&_wrapperExecutionLock) != 0) {
-    fprintf(stderr, "ERROR %s:%d %s: Failed to release lock.\n",
-            __FILE__, __LINE__, __PRETTY_FUNCTION__);
-    _exit(DMTCP_FAIL_RC);
+  if (thread->wrapperLockCount == 0) {
+    if (slot >= 0) {
+      releaseWrapperLockSlot(slot);
+    } else if (DmtcpRWLockUnlock(&_wrapperExecutionLock) != 0) {
+      fprintf(stderr, "ERROR %s:%d %s: Failed to release lock.\n",
+              __FILE__, __LINE__, __PRETTY_FUNCTION__);
+      _exit(DMTCP_FAIL_RC);
+    } else if (slot == WRAPPER_LOCK_EXCL) {
+      __atomic_sub_fetch(&_wrapperLockWriters, 1, __ATOMIC_SEQ_CST);
+    }
   }
 
   errno = saved_errno;
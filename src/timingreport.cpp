@@ -0,0 +1,179 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include "timingreport.h"
+#include "tokenize.h"
+#include "../jalib/jassert.h"
+
+using namespace dmtcp;
+
+#define NOT_REPORTED ((uint64_t)-1)
+
+void
+TimingReport::clear()
+{
+  _processes.clear();
+  _phases.clear();
+  _ns.clear();
+}
+
+// Adds the "<phase> <nanoseconds>" lines of one process; see
+// CkptTiming::toString().
+void
+TimingReport::add(const string &process, const char *timings, size_t len)
+{
+  size_t p = _processes.size();
+  _processes.push_back(process);
+
+  map<string, vector<uint64_t> >::iterator it;
+  for (it = _ns.begin(); it != _ns.end(); it++) {
+    it->second.push_back(NOT_REPORTED);
+  }
+
+  vector<string> lines = tokenizeString(string(timings, strnlen(timings, len)),
+                                        "\n");
+  for (size_t i = 0; i < lines.size(); i++) {
+    size_t sep = lines[i].rfind(' ');
+    if (sep == string::npos || sep == 0) {
+      continue;
+    }
+
+    string name = lines[i].substr(0, sep);
+    it = _ns.find(name);
+    if (it == _ns.end()) {
+      _phases.push_back(name);
+      it = _ns.insert(std::make_pair(name,
+                                     vector<uint64_t>(p + 1, NOT_REPORTED)))
+             .first;
+    }
+    it->second[p] = strtoull(lines[i].c_str() + sep + 1, NULL, 10);
+  }
+}
+
+void
+TimingReport::summarize(vector<Phase> *phases) const
+{
+  for (size_t i = 0; i < _phases.size(); i++) {
+    const vector<uint64_t> &ns = _ns.find(_phases[i])->second;
+    vector<uint64_t> sorted;
+    Phase phase;
+
+    phase.name = _phases[i];
+    phase.maxNs = 0;
+    phase.slowest = 0;
+    for (size_t p = 0; p < ns.size(); p++) {
+      if (ns[p] == NOT_REPORTED) {
+        continue;
+      }
+      sorted.push_back(ns[p]);
+      if (ns[p] >= phase.maxNs) {
+        phase.maxNs = ns[p];
+        phase.slowest = p;
+      }
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    phase.numProcesses = n;
+    phase.minNs = sorted[0];
+    phase.medianNs = (sorted[(n - 1) / 2] + sorted[n / 2]) / 2;
+    phases->push_back(phase);
+  }
+}
+
+void
+TimingReport::writeJson(const string &file,
+                        const vector<Phase> &phases) const
+{
+  ofstream o;
+  o.open(file.c_str());
+  if (!o.is_open()) {
+    JWARNING(false) (file) (JASSERT_ERRNO)
+      .Text("Failed to write checkpoint timings");
+    return;
+  }
+
+  o << "{\n"
+    << "  \"event\": " << std::quoted(_event) << ",\n"
+    << "  \"processes\": " << _processes.size() << ",\n"
+    << "  \"phases\": [";
+  for (size_t i = 0; i < phases.size(); i++) {
+    o << (i == 0 ? "\n    " : ",\n    ")
+      << "{\"phase\": " << std::quoted(phases[i].name)
+      << ", \"processes\": " << phases[i].numProcesses
+      << ", \"min_ns\": " << phases[i].minNs
+      << ", \"median_ns\": " << phases[i].medianNs
+      << ", \"max_ns\": " << phases[i].maxNs
+      << ", \"slowest\": " << std::quoted(_processes[phases[i].slowest])
+      << "}";
+  }
+  o << "\n  ],\n"
+    << "  \"timings_ns\": {";
+  for (size_t p = 0; p < _processes.size(); p++) {
+    o << (p == 0 ? "\n    " : ",\n    ") << std::quoted(_processes[p])
+      << ": {";
+    bool first = true;
+    for (size_t i = 0; i < _phases.size(); i++) {
+      uint64_t ns = _ns.find(_phases[i])->second[p];
+      if (ns != NOT_REPORTED) {
+        o << (first ? "" : ", ") << std::quoted(_phases[i]) << ": " << ns;
+        first = false;
+      }
+    }
+    o << "}";
+  }
+  o << "\n  }\n}\n";
+
+  o.close();
+}
+
+void
+TimingReport::finish(const string &file)
+{
+  if (_processes.empty()) {
+    return;
+  }
+
+  vector<Phase> phases;
+  summarize(&phases);
+
+  ostringstream o;
+  char line[256];
+  o << "Last " << _event << ", " << _processes.size()
+    << " processes (ms):\n";
+  snprintf(line, sizeof(line), "  %-40s %10s %10s %10s  %s\n",
+           "PHASE", "MIN", "MEDIAN", "MAX", "SLOWEST");
+  o << line;
+  for (size_t i = 0; i < phases.size(); i++) {
+    snprintf(line, sizeof(line), "  %-40s %10.3f %10.3f %10.3f  %s\n",
+             phases[i].name.c_str(), phases[i].minNs / 1e6,
+             phases[i].medianNs / 1e6, phases[i].maxNs / 1e6,
+             _processes[phases[i].slowest].c_str());
+    o << line;
+  }
+  _summary = o.str();
+
+  writeJson(file, phases);
+  JTRACE("Wrote phase timings") (_event) (file);
+}
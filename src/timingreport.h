@@ -0,0 +1,69 @@
+/****************************************************************************
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef TIMING_REPORT_H
+#define TIMING_REPORT_H
+
+#include <stdint.h>
+#include "dmtcpalloc.h"
+
+namespace dmtcp
+{
+// The phase timings that the processes of a computation report for a
+// checkpoint or a restart (see CkptTiming), summarized by the coordinator.
+// Once all processes have reported, finish() computes the min, median and
+// max time of each phase across the processes, along with the process that
+// took longest, and writes them to a JSON file together with the timings of
+// each process.  The summary of the last finished report is kept for the
+// status output.
+class TimingReport
+{
+  public:
+    TimingReport(const string &event) : _event(event) {}
+
+    void clear();
+    void add(const string &process, const char *timings, size_t len);
+    void finish(const string &file);
+
+    const string &summary() const { return _summary; }
+
+  private:
+    struct Phase {
+      string name;
+      uint64_t minNs;
+      uint64_t medianNs;
+      uint64_t maxNs;
+      size_t numProcesses;
+      size_t slowest;
+    };
+
+    void summarize(vector<Phase> *phases) const;
+    void writeJson(const string &file, const vector<Phase> &phases) const;
+
+    const string _event;
+    string _summary;
+
+    // The processes in the order in which they reported, the phases in the
+    // order in which they were first reported, and the time of each phase in
+    // each process, or NOT_REPORTED.
+    vector<string> _processes;
+    vector<string> _phases;
+    map<string, vector<uint64_t> > _ns;
+};
+}
+#endif // ifndef TIMING_REPORT_H
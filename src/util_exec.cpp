@@ -603,6 +603,14 @@ Util::getDmtcpArgs(void)
 {
   const char *sigckpt = getenv(ENV_VAR_SIGCKPT);
   const char *compression = getenv(ENV_VAR_COMPRESSION);
+  const char *writerThreads = getenv(ENV_VAR_CKPT_WRITER_THREADS);
+  const char *blockCompression = getenv(ENV_VAR_BLOCK_COMPRESSION);
+  const char *incrementalCkpt = getenv(ENV_VAR_INCREMENTAL_CKPT);
+  const char *forkedCkpt = getenv(ENV_VAR_FORKED_CKPT);
+  const char *lazyRestore = getenv(ENV_VAR_LAZY_RESTORE);
+  const char *ckptDedup = getenv(ENV_VAR_CKPT_DEDUP);
+  const char *nodeBarriers = getenv(ENV_VAR_NODE_BARRIERS);
+  const char *ckptServer = getenv(ENV_VAR_CKPT_SERVER);
   const char *allocPlugin = getenv(ENV_VAR_ALLOC_PLUGIN);
   const char *dlPlugin = getenv(ENV_VAR_DL_PLUGIN);
 
@@ -656,6 +664,41 @@ Util::getDmtcpArgs(void)
     }
   }
 
+  if (blockCompression != NULL && strcmp(blockCompression, "1") == 0) {
+    argVector.push_back("--block-compression");
+  }
+
+  if (writerThreads != NULL) {
+    argVector.push_back("--ckpt-writer-threads");
+    argVector.push_back(writerThreads);
+  }
+
+  if (incrementalCkpt != NULL) {
+    argVector.push_back("--incremental-ckpt");
+    argVector.push_back(incrementalCkpt);
+  }
+
+  if (forkedCkpt != NULL) {
+    argVector.push_back("--forked-ckpt");
+  }
+
+  if (lazyRestore != NULL && strcmp(lazyRestore, "1") == 0) {
+    argVector.push_back("--lazy-restore");
+  }
+
+  if (ckptDedup != NULL && strcmp(ckptDedup, "1") == 0) {
+    argVector.push_back("--dedup");
+  }
+
+  if (nodeBarriers != NULL && strcmp(nodeBarriers, "1") == 0) {
+    argVector.push_back("--node-barriers");
+  }
+
+  if (ckptServer != NULL && ckptServer[0] != '\0') {
+    argVector.push_back("--ckpt-server");
+    argVector.push_back(ckptServer);
+  }
+
   if (allocPlugin != NULL && strcmp(allocPlugin, "0") == 0) {
     argVector.push_back("--disable-alloc-plugin");
   }
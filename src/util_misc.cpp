@@ -25,6 +25,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#if defined(__x86_64__)
+# include <cpuid.h>
+# include <immintrin.h>
+#elif defined(__aarch64__)
+# include <arm_neon.h>
+#endif // if defined(__x86_64__)
 #include "../jalib/jassert.h"
 #include "../jalib/jfilesystem.h"
 #include "dmtcp.h"
@@ -559,30 +565,180 @@ Util::pageMask()
   return page_mask;
 }
 
-/* This function detects if the given pages are zero pages or not. There is
- * scope of improving this function using some optimizations.
- *
- * TODO: One can use /proc/self/pagemap to detect if the page is backed by a
- * shared zero page.
+/* The zero-page check below is on the critical path of writing a checkpoint
+ * image: every page of every anonymous area goes through it.  Non-zero pages
+ * usually fail in the first few bytes, so the cost is dominated by pages that
+ * are (nearly) zero, which are scanned with the widest vector instructions
+ * available.  The variant is picked at run time, since the same binary (and,
+ * after a restart on another host, the same process) may run on CPUs with
+ * different instruction sets.
  */
-bool
-Util::areZeroPages(void *addr, size_t numPages)
+typedef bool (*ZeroScanFn)(const void *addr, size_t len);
+
+#if defined(__x86_64__)
+static bool
+areZeroBytesSSE2(const void *addr, size_t len)
+{
+  const __m128i *p = (const __m128i *)addr;
+  const __m128i *end = p + len / sizeof(*p);
+
+  for (; p + 3 < end; p += 4) {
+    __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p + 0),
+                                          _mm_loadu_si128(p + 1)),
+                             _mm_or_si128(_mm_loadu_si128(p + 2),
+                                          _mm_loadu_si128(p + 3)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((target("avx2")))
+static bool
+areZeroBytesAVX2(const void *addr, size_t len)
 {
-  static size_t page_size = pageSize();
-  long long *buf = (long long *)addr;
-  size_t i;
-  size_t end = numPages * page_size / sizeof(*buf);
+  const __m256i *p = (const __m256i *)addr;
+  const __m256i *end = p + len / sizeof(*p);
+
+  for (; p + 3 < end; p += 4) {
+    __m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(p + 0),
+                                                _mm256_loadu_si256(p + 1)),
+                                _mm256_or_si256(_mm256_loadu_si256(p + 2),
+                                                _mm256_loadu_si256(p + 3)));
+    if (!_mm256_testz_si256(v, v)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((target("avx512f")))
+static bool
+areZeroBytesAVX512(const void *addr, size_t len)
+{
+  const __m512i *p = (const __m512i *)addr;
+  const __m512i *end = p + len / sizeof(*p);
+
+  for (; p + 3 < end; p += 4) {
+    __m512i v = _mm512_or_si512(_mm512_or_si512(_mm512_loadu_si512(p + 0),
+                                                _mm512_loadu_si512(p + 1)),
+                                _mm512_or_si512(_mm512_loadu_si512(p + 2),
+                                                _mm512_loadu_si512(p + 3)));
+    if (_mm512_test_epi64_mask(v, v) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Extended state enabled by the kernel (XCR0).  Written as inline asm so
+// that this file need not be compiled with -mxsave.
+static uint64_t
+xgetbv0()
+{
+  uint32_t eax, edx;
+
+  asm volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return ((uint64_t)edx << 32) | eax;
+}
+
+static ZeroScanFn
+selectZeroScanFn()
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+      !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+    return areZeroBytesSSE2;
+  }
+  uint64_t xcr0 = xgetbv0();
+  if ((xcr0 & 0x6) != 0x6 ||
+      !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return areZeroBytesSSE2;
+  }
+  // Opmask and upper ZMM state (bits 5-7) must be enabled, too.
+  if ((ebx & bit_AVX512F) && (xcr0 & 0xe0) == 0xe0) {
+    return areZeroBytesAVX512;
+  }
+  if (ebx & bit_AVX2) {
+    return areZeroBytesAVX2;
+  }
+  return areZeroBytesSSE2;
+}
+
+#elif defined(__aarch64__)
+static bool
+areZeroBytesNEON(const void *addr, size_t len)
+{
+  const uint64_t *p = (const uint64_t *)addr;
+  const uint64_t *end = p + len / sizeof(*p);
+
+  for (; p + 7 < end; p += 8) {
+    uint64x2_t v = vorrq_u64(vorrq_u64(vld1q_u64(p + 0), vld1q_u64(p + 2)),
+                             vorrq_u64(vld1q_u64(p + 4), vld1q_u64(p + 6)));
+    if (vmaxvq_u32(vreinterpretq_u32_u64(v)) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static ZeroScanFn
+selectZeroScanFn()
+{
+  return areZeroBytesNEON;
+}
+
+#else // if defined(__x86_64__)
+static bool
+areZeroBytesScalar(const void *addr, size_t len)
+{
+  const long long *buf = (const long long *)addr;
+  size_t end = len / sizeof(*buf);
   long long res = 0;
 
-  ASSERT_EQ(sizeof(*buf) - 1, (unsigned)7);
-  for (i = 0; i + 7 < end; i += 8) {
+  for (size_t i = 0; i + 7 < end; i += 8) {
     res = buf[i + 0] | buf[i + 1] | buf[i + 2] | buf[i + 3] |
       buf[i + 4] | buf[i + 5] | buf[i + 6] | buf[i + 7];
     if (res != 0) {
-      break;
+      return false;
     }
   }
-  return res == 0;
+  return true;
+}
+
+static ZeroScanFn
+selectZeroScanFn()
+{
+  return areZeroBytesScalar;
+}
+#endif // if defined(__x86_64__)
+
+static ZeroScanFn zeroScanFn = NULL;
+
+/* Called on first use and again after restart, as the process may now be
+ * running on a CPU without the instructions used before the checkpoint.
+ */
+void
+Util::selectZeroPageScanner()
+{
+  zeroScanFn = selectZeroScanFn();
+}
+
+/* This function detects if the given pages are zero pages or not.  Pages
+ * that were never touched by the process can be found more cheaply through
+ * /proc/self/pagemap; see mtcp_write_anonymous_pages() in writeckpt.cpp.
+ */
+bool
+Util::areZeroPages(void *addr, size_t numPages)
+{
+  static size_t page_size = pageSize();
+
+  if (zeroScanFn == NULL) {
+    selectZeroPageScanner();
+  }
+  return zeroScanFn(addr, numPages * page_size);
 }
 
 /* Caller must allocate exec_path of size at least MTCP_MAX_PATH */
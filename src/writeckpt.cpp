@@ -31,8 +31,12 @@
 #include <sys/stat.h>
 #include "jassert.h"
 #include "jfilesystem.h"
+#include "ckptdedup.h"
+#include "ckptserializer.h"
+#include "ckptwriter.h"
 #include "constants.h"
 #include "dmtcp.h"
+#include "incrementalckpt.h"
 #include "processinfo.h"
 #include "procmapsarea.h"
 #include "procselfmaps.h"
@@ -67,20 +71,53 @@ vector<ProcMapsArea> *nscdAreas = NULL;
 // class can then be careful about allocating memory.
 
 
+// Bits of a /proc/self/pagemap entry.  See Documentation/admin-guide/mm/
+// pagemap.rst in the kernel sources.
+#define PM_SWAP            (1ULL << 62)
+#define PM_PRESENT         (1ULL << 63)
+
+// Number of pagemap entries read with a single pread().
+#define PAGEMAP_BATCH      512
+
+// Shortest range of zero pages that is written as an area of its own.
+#define MIN_ZERO_RUN_PAGES 4
+
+static int pagemap_fd = -1;
+static uint64_t pagemap_buf[PAGEMAP_BATCH];
+static VA pagemap_start = NULL;
+static size_t pagemap_count = 0;
+
 /* Internal routines */
 
 // static void sync_shared_mem(void);
 static void writememoryarea(int fd, Area area);
-static void mtcp_write_anonymous_pages(int fd, Area area);
+static void mtcp_write_anonymous_pages(int fd, Area area, bool use_pagemap);
 
 static void remap_nscd_areas(const vector<ProcMapsArea> &areas);
 
+static bool lazyRestore = false;
+
+static bool
+isCkptImageArea(const Area &area)
+{
+  return Util::strEndsWith(area.name, CKPT_FILE_SUFFIX) ||
+         Util::strEndsWith(area.name, CKPT_FILE_SUFFIX DELETED_FILE_SUFFIX);
+}
+
+// Writes the header of an area followed by the first 'len' bytes of its
+// memory, compressing the memory if block compression is enabled.
 static void
-writeAreaHeader(int fd, Area *area)
+writeAreaHeaderAndData(int fd, Area *area, size_t len)
 {
   JASSERT(area->addr + area->size == area->endAddr)
     ((void*)area->addr)((int)area->size);
-  JASSERT(Util::writeAll(fd, area, sizeof(*area)) == (ssize_t) sizeof(*area));
+  CkptWriter::writeArea(area, len);
+}
+
+static void
+writeAreaHeader(int fd, Area *area)
+{
+  writeAreaHeaderAndData(fd, area, 0);
 }
 
 /*****************************************************************************
@@ -175,6 +212,20 @@ mtcp_writememoryareas(int fd)
   JTRACE("addr and len of restoreBuf (to hold mtcp_restart code)")
     ((void *)ProcessInfo::instance().restoreBuf.startAddr)
     (ProcessInfo::instance().restoreBuf.endAddr);
+
+  // Soft-dirty bits for an incremental checkpoint are read (and reset) before
+  // we start writing.  Any helper threads must be created before we read
+  // /proc/self/maps.
+  IncrementalCkpt::snapshotDirtyPages();
+  // The image starts with two copies of the DmtcpCkptHeader; see
+  // CkptSerializer::writeCkptImage().
+  CkptWriter::init(fd, 2 * sizeof(DmtcpCkptHeader));
+
+  lazyRestore = CkptSerializer::useLazyRestore();
+
+  // Used to skip pages that were never touched; see mtcp_page_is_unpopulated.
+  pagemap_fd = _real_open("/proc/self/pagemap", O_RDONLY, 0);
+
   procSelfMaps = new ProcSelfMaps();
 
   // We must not cause an mmap() here, or the mem regions will not be correct.
@@ -201,13 +252,18 @@ mtcp_writememoryareas(int fd)
     } while (unchecked_area.size != 0);
   }
 
+  // Writes the end of data marker and the area index.
+  CkptWriter::finish();
+  CkptDedup::finish();
+  IncrementalCkpt::finish();
+  if (pagemap_fd != -1) {
+    _real_close(pagemap_fd);
+    pagemap_fd = -1;
+  }
+
   /* It's now safe to do this, since we're done using writememoryarea() */
   remap_nscd_areas(*nscdAreas);
 
-  area.addr = NULL; // End of data
-  area.size = -1; // End of data
-  JASSERT(Util::writeAll(fd, &area, sizeof(area)) == sizeof(area));
-
   /* That's all folks */
   JASSERT(_real_close(fd) == 0);
 }
@@ -224,37 +280,128 @@ remap_nscd_areas(const vector<ProcMapsArea> &areas)
   }
 }
 
+// Writes a range of non-zero pages.  In a delta image, the pages that were not
+// modified since the previous checkpoint get a header without data.
+static void
+mtcp_write_nonzero_pages(int fd, Area *area)
+{
+  if (CkptDedup::isEnabled()) {
+    CkptDedup::writePages(area);
+    return;
+  }
+
+  if (!IncrementalCkpt::isDelta()) {
+    writeAreaHeaderAndData(fd, area, area->size);
+    return;
+  }
+
+  VA endAddr = area->endAddr;
+  while (area->addr < endAddr) {
+    Area a = *area;
+    size_t size;
+    bool dirty = IncrementalCkpt::nextPageRun(a.addr, endAddr - a.addr, &size);
+    a.size = size;
+    a.endAddr = a.addr + a.size;
+    if (dirty) {
+      writeAreaHeaderAndData(fd, &a, a.size);
+    } else {
+      a.properties |= DMTCP_PAGES_IN_PARENT;
+      writeAreaHeader(fd, &a);
+    }
+    area->addr += size;
+  }
+}
+
+/* Is the page backed by neither memory nor swap?  Such a page of a private
+ * anonymous mapping has never been touched (or was discarded), and reads as
+ * zeros.  Checking this in /proc/self/pagemap avoids faulting in the page
+ * just to find out that it is zero, which matters for large, sparsely used
+ * reservations such as those of managed heaps.
+ */
+static bool
+mtcp_page_is_unpopulated(VA pg)
+{
+  static size_t page_size = Util::pageSize();
+
+  if (pagemap_fd == -1) {
+    return false;
+  }
+  if (pg < pagemap_start || pg >= pagemap_start + pagemap_count * page_size) {
+    off_t offset = ((uintptr_t)pg / page_size) * sizeof(pagemap_buf[0]);
+    ssize_t rc = pread(pagemap_fd, pagemap_buf, sizeof(pagemap_buf), offset);
+    if (rc < (ssize_t)sizeof(pagemap_buf[0])) {
+      pagemap_count = 0;
+      return false;
+    }
+    pagemap_start = pg;
+    pagemap_count = rc / sizeof(pagemap_buf[0]);
+  }
+  uint64_t entry = pagemap_buf[(pg - pagemap_start) / page_size];
+  return (entry & (PM_PRESENT | PM_SWAP)) == 0;
+}
+
+/* Returns the number of consecutive zero pages at pg, up to max_pages. */
+static size_t
+mtcp_count_zero_pages(VA pg, VA end, size_t max_pages, bool use_pagemap)
+{
+  static size_t page_size = Util::pageSize();
+  size_t n = 0;
+
+  for (; n < max_pages && pg < end; n++, pg += page_size) {
+    if (!(use_pagemap && mtcp_page_is_unpopulated(pg)) &&
+        !Util::areZeroPages(pg, 1)) {
+      break;
+    }
+  }
+  return n;
+}
+
 /* This function returns a range of zero or non-zero pages. If the first page
  * is non-zero, it searches for all contiguous non-zero pages and returns them.
  * If the first page is all-zero, it searches for contiguous zero pages and
  * returns them.
+ *
+ * Pages are classified one at a time.  A zero range costs an extra area
+ * header in the image (and another one for the non-zero range after it), so
+ * zero ranges shorter than MIN_ZERO_RUN_PAGES are folded into the
+ * surrounding non-zero range unless they end the area.
  */
 static void
-mtcp_get_next_page_range(Area *area, size_t *size, int *is_zero)
+mtcp_get_next_page_range(Area *area, size_t *size, int *is_zero,
+                         bool use_pagemap)
 {
-  char *pg;
-  const size_t one_MB = (1024 * 1024);
-
-  if (area->size < one_MB) {
-    *size = area->size;
-    *is_zero = 0;
+  static size_t page_size = Util::pageSize();
+  VA end = area->addr + area->size;
+  VA pg = area->addr;
+  size_t n;
+
+  n = mtcp_count_zero_pages(pg, end, SIZE_MAX, use_pagemap);
+  if (n >= MIN_ZERO_RUN_PAGES || pg + n * page_size == end) {
+    *size = n * page_size;
+    *is_zero = 1;
     return;
   }
-  *size = one_MB;
-  *is_zero = Util::areZeroPages(area->addr, one_MB / MTCP_PAGE_SIZE);
-  for (pg = area->addr + one_MB;
-       pg < area->addr + area->size;
-       pg += one_MB) {
-    size_t minsize = MIN(one_MB, (size_t)(area->addr + area->size - pg));
-    if (*is_zero != Util::areZeroPages(pg, minsize / MTCP_PAGE_SIZE)) {
+
+  // The first non-zero page is at pg + n.
+  pg += (n + 1) * page_size;
+  while (pg < end) {
+    n = mtcp_count_zero_pages(pg, end, MIN_ZERO_RUN_PAGES, use_pagemap);
+    if (n == MIN_ZERO_RUN_PAGES || pg + n * page_size == end) {
       break;
     }
-    *size += minsize;
+    pg += (n + 1) * page_size;
   }
+  *size = pg - area->addr;
+  *is_zero = 0;
 }
 
+/* If use_pagemap is set, pages that are absent from /proc/self/pagemap are
+ * known to be zero without reading them.  This holds only for private
+ * anonymous mappings: a shared mapping may hold data in pages that are not
+ * (yet) mapped into this process, and a private file mapping reads the file.
+ */
 static void
-mtcp_write_anonymous_pages(int fd, Area area)
+mtcp_write_anonymous_pages(int fd, Area area, bool use_pagemap)
 {
   // Force DMTCP_ZERO_PAGE_PARENT_ENTRY.
   // Each consecutive zero/non-zero chunk will have a separate header.
@@ -263,6 +410,8 @@ mtcp_write_anonymous_pages(int fd, Area area)
   area.properties |= DMTCP_ZERO_PAGE_PARENT_HEADER;
   writeAreaHeader(fd, &area);
   area.properties ^= DMTCP_ZERO_PAGE_PARENT_HEADER;
+  IncrementalCkpt::recordWrittenArea(area.addr, area.size);
+  pagemap_count = 0;
 
   while (area.size > 0) {
     size_t size;
@@ -272,7 +421,7 @@ mtcp_write_anonymous_pages(int fd, Area area)
       size = area.size;
       is_zero = 0;
     } else {
-      mtcp_get_next_page_range(&a, &size, &is_zero);
+      mtcp_get_next_page_range(&a, &size, &is_zero, use_pagemap);
     }
 
     a.properties = is_zero ? DMTCP_ZERO_PAGE : 0;
@@ -280,12 +429,10 @@ mtcp_write_anonymous_pages(int fd, Area area)
     a.size = size;
     a.endAddr = a.addr + a.size;
 
-    writeAreaHeader(fd, &a);
-
     if (!is_zero) {
-      JASSERT(Util::writeAll(fd, a.addr, a.size) == (ssize_t) a.size)
-        .Text("writeAll failed during ckpt");
+      mtcp_write_nonzero_pages(fd, &a);
     } else {
+      writeAreaHeader(fd, &a);
       if (madvise(a.addr, a.size, MADV_DONTNEED) == -1) {
         JTRACE("error doing madvise(..., MADV_DONTNEED)")
           (JASSERT_ERRNO) ((void *)a.addr) ((int)a.size);
@@ -308,8 +455,18 @@ writememoryarea(int fd, Area area)
     return;
   } else if (SharedData::isSharedDataRegion(area.addr)) {
     return;
+  } else if (CkptWriter::isWriterArena(area)) {
+    return;
+  } else if (IncrementalCkpt::isDirtyMap(area)) {
+    return;
+  } else if (CkptDedup::isDedupMapping(area)) {
+    return;
   }
 
+  // Decided before some shared areas are relabeled as private below.
+  bool privateAnonymous = (area.flags & MAP_PRIVATE) &&
+                          (area.flags & MAP_ANONYMOUS);
+
   /* Original comment:  Skip anything in kernel address space ---
    *   beats me what's at FFFFE000..FFFFFFFF - we can't even read it;
    * Added: That's the vdso section for earlier Linux 2.6 kernels.  For later
@@ -445,6 +602,14 @@ writememoryarea(int fd, Area area)
   } else if (Util::isIBShmArea(area)) {
     // TODO(kapil) Add dmtcp_skip_memory_region_ckpting to IB plugin.
     return;
+  } else if ((area.flags & MAP_PRIVATE) && isCkptImageArea(area)) {
+    /* Memory that a lazy restore mapped from the checkpoint image (see
+     *   read_one_memory_area() in src/mtcp/mtcp_restart.c).  It belongs to
+     *   the process; the image may be gone by the next restart.
+     */
+    JTRACE("Saving area mapped from ckpt image as Anonymous") (area.name);
+    area.flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    area.name[0] = '\0';
   } else if (Util::strEndsWith(area.name, DELETED_FILE_SUFFIX)) {
     /* Deleted File */
   } else if (area.name[0] == '/' && strstr(&area.name[1], "/") != NULL) {
@@ -485,10 +650,10 @@ writememoryarea(int fd, Area area)
 
   if ((area.flags & MAP_ANONYMOUS) != 0) {
     // Handle anonymous pages.
-    mtcp_write_anonymous_pages(fd, area);
+    mtcp_write_anonymous_pages(fd, area, privateAnonymous);
   } else if (!jalib::Filesystem::FileExists(area.name)) {
     // Handle non-existing files
-    mtcp_write_anonymous_pages(fd, area);
+    mtcp_write_anonymous_pages(fd, area, false);
   } else {
     JASSERT(strlen(area.name) > 0);
 
@@ -502,22 +667,40 @@ writememoryarea(int fd, Area area)
       } else {
         area.mmapFileSize = statbuf.st_size - area.offset;
       }
+
+      // Keep the data of the following areas page-aligned in the image.  The
+      // tail of the last page of the file is mapped and reads as zeros.
+      if (lazyRestore && area.mmapFileSize > 0) {
+        size_t page_size = Util::pageSize();
+        area.mmapFileSize = MIN((size_t)area.size,
+                                (area.mmapFileSize + page_size - 1) &
+                                ~(page_size - 1));
+      }
     }
 
-    writeAreaHeader(fd, &area);
     // NOTE: We cannot use lseek(SEEK_CUR) to detect how much data was
     // actually written here. This is because fd might be a pipe to gzip.
-    if (area.mmapFileSize > 0) {
-      JASSERT(Util::writeAll(fd, area.addr, area.mmapFileSize) ==
-              (ssize_t)area.mmapFileSize);
+    if (CkptDedup::isEnabled() &&
+        (area.mmapFileSize == 0 || area.mmapFileSize == (off_t)area.size)) {
+      // As for anonymous memory, the parent header maps the file, and the
+      // pages follow as child headers.
+      area.properties |= DMTCP_ZERO_PAGE_PARENT_HEADER;
+      writeAreaHeader(fd, &area);
+      area.properties ^= DMTCP_ZERO_PAGE_PARENT_HEADER;
+      area.properties |= DMTCP_ZERO_PAGE_CHILD_HEADER;
+      CkptDedup::writePages(&area);
+    } else if (area.mmapFileSize > 0) {
+      writeAreaHeaderAndData(fd, &area, area.mmapFileSize);
     } else {
-      JASSERT(Util::writeAll(fd, area.addr, area.size) == (ssize_t)area.size);
+      writeAreaHeaderAndData(fd, &area, area.size);
     }
   }
 
-  
   // Now remove PROT_READ from the area if it didn't have it originally
   if ((area.prot & PROT_READ) == 0) {
+    // Helper threads may still be writing out this area.
+    CkptWriter::drain();
+
     JASSERT(mprotect(area.addr, area.size, area.prot) == 0)
       (JASSERT_ERRNO) ((void*)area.addr) (area.size)
       .Text("error removing PROT_READ from mem region.");
@@ -427,6 +427,21 @@ def free_diskspace(dir):
   s = os.statvfs('.')
   return s.f_bavail * s.f_frsize
 
+# Delta images (DMTCP_INCREMENTAL_CKPT) need the kernel's soft-dirty bits,
+# in which case a page just written is reported as soft-dirty.
+def has_soft_dirty():
+  import ctypes, mmap
+  try:
+    page = mmap.mmap(-1, mmap.PAGESIZE, flags=mmap.MAP_PRIVATE)
+    page[0:1] = b'\1'
+    addr = ctypes.addressof(ctypes.c_char.from_buffer(page))
+    with open("/proc/self/pagemap", "rb") as f:
+      f.seek(addr // mmap.PAGESIZE * 8)
+      entry = int.from_bytes(f.read(8), "little")
+    return entry & (1 << 55) != 0
+  except (OSError, ValueError):
+    return False
+
 # We'll save core dumps in our default directory (usually dmtcp-autotest-*)
 # We can use the lesser of half the free disk space of filesystem or 100 MB.
 if free_diskspace(ckptDir) > 20*1024*1024:
@@ -610,9 +625,36 @@ def runTestRaw(name, numProcs, cmds):
           raise e
       procs.remove(x)
 
+  def killBarrierReporter():
+    #see test/barrier-kill.cpp; only the first checkpoint has a victim, which
+    #is killed after its image has been written
+    if not os.path.exists(barrierKillPidFile + ".armed"):
+      return False
+    os.remove(barrierKillPidFile + ".armed")
+    WAITFOR(lambda: os.path.exists(barrierKillPidFile),
+            lambda: "barrier-kill plugin did not write " + barrierKillPidFile)
+    sleep(1.5)
+    with open(barrierKillPidFile) as f:
+      pid = int(f.read().split()[0])
+    os.kill(pid, signal.SIGKILL)
+    os.remove(barrierKillPidFile)
+    #the other process of its node must be released all the same
+    WAITFOR(lambda: getStatus() == (numProcs - 1, True),
+            lambda: "barrier reporter killed, %d expected, %d found, "
+                    "running=%d" % ((numProcs - 1,) + getStatus()))
+    #a restart waits for every process of the computation, so the victim is
+    #restarted from its image along with the others
+    numFiles = getNumCkptFiles(ckptDir)
+    CHECK(numFiles == numProcs,
+          "unexpected number of checkpoint files, %d procs, %d files"
+          % (numProcs, numFiles))
+    return True
+
   def testCheckpoint():
     #start checkpoint
     runDmtcpCommand(CKPT_CMD)
+    if name == "node-barriers3" and killBarrierReporter():
+      return
 
     #wait for files to appear and status to return to original
     # 'Kc' input to dmtcp_coordinator is equivalent to 'dmtcp_command -kc'
@@ -632,6 +674,14 @@ def runTestRaw(name, numProcs, cmds):
           "unexpected number of checkpoint files, %s procs, %d files"
           % (str(status[0]), numFiles))
 
+    if name.startswith("dedup"):
+      #the images must have gone to the chunk store, not been written plain
+      stores=[f for f in os.listdir(ckptDir)
+                if f.startswith("ckpt_chunks_") and f.endswith(".chunks")]
+      CHECK(len(stores) == 1 and
+            os.path.getsize(ckptDir + "/" + stores[0]) > 0,
+            "no chunk store in %s: %s" % (ckptDir, str(os.listdir(ckptDir))))
+
     if SLOW > 1 and CKPT_CMD != 'Kc':
       #wait and see if some processes will die shortly after checkpointing
       #but if 'Kc' was requested, processes should die (not resume)
@@ -639,6 +689,47 @@ def runTestRaw(name, numProcs, cmds):
       CHECK(doesStatusSatisfy(getStatus(), status),
             "error: processes checkpointed, but died upon resume")
 
+  def getParentImages():
+    return [d + "/" + f for d in os.listdir(ckptDir) if d.endswith("_files")
+              for f in os.listdir(ckptDir + "/" + d) if f.endswith(".dmtcp")]
+
+  def testBlockingCheckpoint():
+    #the coordinator refuses a new checkpoint until it is done with the
+    #previous one, which may be a little after the processes resumed
+    WAITFOR(lambda: subprocess.call((command_cmdline + " bc").split(),
+                                    stdout=devnullFd, stderr=devnullFd) == 0,
+            wfMsg("blocking checkpoint error"))
+
+  def testIncrementalChain(cycle):
+    #the image just written is a full one; the next two are delta images,
+    #and their parents are moved to ckpt_*_files/
+    for j in range(2):
+      testBlockingCheckpoint()
+    parents = getParentImages()
+    CHECK(len(parents) == 2 * numProcs,
+          "expected %d parent images, found %s" % (2 * numProcs, str(parents)))
+    if cycle % 2 == 0:
+      #restart from the delta images
+      return
+
+    #with DMTCP_INCREMENTAL_CKPT=2, the next image is a full one again, and
+    #the parents of the delta image that it replaces are removed
+    testBlockingCheckpoint()
+    parents = getParentImages()
+    CHECK(len(parents) == 0, "stale parent images: " + str(parents))
+
+    #restart from a delta image turned back into a full one
+    testBlockingCheckpoint()
+    CHECK(len(getParentImages()) == numProcs, "no delta image written")
+    for f in os.listdir(ckptDir):
+      if f.endswith(".dmtcp"):
+        cmd = BIN + "dmtcp_ckpt_compact --remove-parents " + ckptDir + "/" + f
+        CHECK(subprocess.call(cmd.split(), stdout=devnullFd) == 0,
+              "dmtcp_ckpt_compact failed on " + f)
+    parents = getParentImages()
+    CHECK(len(parents) == 0, "parent images left by dmtcp_ckpt_compact: "
+                             + str(parents))
+
   def testRestart():
     #build restart command
     cmd=BIN+"dmtcp_restart --quiet"
@@ -701,6 +792,8 @@ def runTestRaw(name, numProcs, cmds):
       #wait for launched processes to settle down, before we try to checkpoint
       sleep(S*SLOW)
       testCheckpoint()
+      if name == "incremental2":
+        testIncrementalChain(i)
       printFixed("PASSED; ")
       testKill()
 
@@ -1081,6 +1174,138 @@ os.environ['DMTCP_GZIP'] = "1"
 runTest("gzip",          1, ["./test/dmtcp1"])
 os.environ['DMTCP_GZIP'] = GZIP
 
+os.environ['DMTCP_GZIP'] = "0"
+os.environ['DMTCP_CKPT_WRITER_THREADS'] = "4"
+runTest("ckpt-writers",  1, ["./test/dmtcp3"])
+del os.environ['DMTCP_CKPT_WRITER_THREADS']
+os.environ['DMTCP_GZIP'] = GZIP
+
+os.environ['DMTCP_BLOCK_COMPRESSION'] = "1"
+runTest("blockcompress", 1, ["./test/dmtcp1"])
+os.environ['DMTCP_CKPT_WRITER_THREADS'] = "4"
+runTest("blockcompress2", 1, ["./test/dmtcp3"])
+del os.environ['DMTCP_CKPT_WRITER_THREADS']
+del os.environ['DMTCP_BLOCK_COMPRESSION']
+
+os.environ['DMTCP_GZIP'] = "0"
+os.environ['DMTCP_INCREMENTAL_CKPT'] = "3"
+runTest("incremental",   1, ["./test/dmtcp1"])
+if has_soft_dirty():
+  os.environ['DMTCP_INCREMENTAL_CKPT'] = "2"
+  runTest("incremental2",  2, ["./test/dmtcp1", "./test/dmtcp1"])
+elif shouldRunTest("incremental2"):
+  #without soft-dirty bits, "incremental" only writes full images, and no
+  #delta chain is tested at all; say so, rather than leave it out quietly
+  printFixed("incremental2", DEFAULT_TESTNAME_WIDTH)
+  print("Skipped (kernel built without CONFIG_MEM_SOFT_DIRTY)")
+del os.environ['DMTCP_INCREMENTAL_CKPT']
+os.environ['DMTCP_GZIP'] = GZIP
+
+os.environ['DMTCP_FORKED_CHECKPOINT'] = "1"
+runTest("forked-ckpt",   1, ["./test/dmtcp1"])
+runTest("forked-ckpt2",  2, ["./test/dmtcp1", "./test/dmtcp2"])
+del os.environ['DMTCP_FORKED_CHECKPOINT']
+
+os.environ['DMTCP_LAZY_RESTORE'] = "1"
+runTest("lazy-restore",  1, ["./test/dmtcp1"])
+runTest("lazy-restore2", 1, ["./test/dmtcp3"])
+del os.environ['DMTCP_LAZY_RESTORE']
+
+os.environ['DMTCP_RESTORE_THREADS'] = "4"
+os.environ['DMTCP_GZIP'] = "0"
+runTest("par-restore",  1, ["./test/dmtcp3"])
+os.environ['DMTCP_BLOCK_COMPRESSION'] = "1"
+runTest("par-restore2", 1, ["./test/dmtcp3"])
+del os.environ['DMTCP_BLOCK_COMPRESSION']
+os.environ['DMTCP_GZIP'] = GZIP
+del os.environ['DMTCP_RESTORE_THREADS']
+
+# Both processes of "dedup" store their common pages in one chunk store.
+os.environ['DMTCP_CKPT_DEDUP'] = "1"
+runTest("dedup",  2, ["./test/dmtcp1", "./test/dmtcp1"])
+os.environ['DMTCP_RESTORE_THREADS'] = "4"
+os.environ['DMTCP_GZIP'] = "0"
+runTest("dedup2", 1, ["./test/dmtcp3"])
+os.environ['DMTCP_GZIP'] = GZIP
+del os.environ['DMTCP_RESTORE_THREADS']
+del os.environ['DMTCP_CKPT_DEDUP']
+
+# The processes of each test meet at node barriers, and only one of them
+# talks to the coordinator at each global barrier.
+os.environ['DMTCP_NODE_BARRIERS'] = "1"
+runTest("node-barriers",  2, ["./test/client-server"])
+runTest("node-barriers2", 3, ["./test/dmtcp1", "./test/dmtcp1",
+                              "./test/dmtcp1"])
+# The first two processes share a node.  On resuming, the first is killed
+# while it reports both to the coordinator at a barrier, which the third one
+# (with a node of its own, by way of another tmpdir) keeps from releasing.
+# The second must still be released.
+barrierKillPidFile = os.path.abspath(ckptDir) + "-barrier-kill.pid"
+barrierKillTmpDir = os.path.abspath(ckptDir) + "-barrier-kill-tmp"
+if shouldRunTest("node-barriers3"):
+  os.mkdir(barrierKillTmpDir)
+  open(barrierKillPidFile + ".armed", "w").close()
+  barrierKillPlugin = "--with-plugin " + PWD + "/test/libdmtcp_barrier-kill.so "
+  runTest("node-barriers3", 3,
+          [barrierKillPlugin + "env BARRIER_KILL_PIDFILE=" +
+             barrierKillPidFile + " ./test/dmtcp1",
+           barrierKillPlugin + "./test/dmtcp1",
+           "--tmpdir " + barrierKillTmpDir + " " + barrierKillPlugin +
+             "env BARRIER_KILL_DELAY=4 ./test/dmtcp1"])
+  os.system("rm -rf " + barrierKillTmpDir + " " + barrierKillPidFile + "*")
+del os.environ['DMTCP_NODE_BARRIERS']
+
+# Stream the images to a dmtcp_ckpt_server on loopback.  It stores them in
+# ckptDir, so that the usual checks and restart command still apply.
+if shouldRunTest("ckpt-server") or shouldRunTest("ckpt-server2"):
+  portFile = os.path.abspath(ckptDir) + "-ckpt-server-port"
+  ckptServer = subprocess.Popen([BIN+"dmtcp_ckpt_server", "--quiet",
+                                 "--port", "0", "--port-file", portFile,
+                                 "--ckptdir", os.path.abspath(ckptDir)],
+                                stdout=devnullFd, stderr=devnullFd)
+  for i in range(100):
+    if os.path.exists(portFile) and os.path.getsize(portFile) > 0:
+      break
+    sleep(0.1)
+  with open(portFile) as f:
+    os.environ['DMTCP_CKPT_SERVER'] = "localhost:" + f.read()
+  runTest("ckpt-server",  1, ["./test/dmtcp1"])
+  os.environ['DMTCP_GZIP'] = "1"
+  runTest("ckpt-server2", 2, ["./test/dmtcp1", "./test/dmtcp2"])
+  os.environ['DMTCP_GZIP'] = GZIP
+  del os.environ['DMTCP_CKPT_SERVER']
+  ckptServer.kill()
+  ckptServer.wait()
+  os.remove(portFile)
+
+# Run some of the tests above again with a coordinator of their own that
+# serves its clients from two I/O threads (dmtcp_coordinator --io-threads),
+# as "io2-<name>".  Each entry is (name, numProcs, cmds, S).
+IO_THREADS_TESTS = [("dmtcp1",         1, ["./test/dmtcp1"],         1),
+                    ("dmtcp2",         1, ["./test/dmtcp2"],         1),
+                    ("epoll1",         2, ["./test/epoll1"],         1),
+                    ("forkexec",       2, ["./test/forkexec"],       1),
+                    ("shared-memory1", 2, ["./test/shared-memory1"], 10),
+                    ("client-server",  2, ["./test/client-server"],  1)]
+if not USE_M32:  # See waitpid above.
+  IO_THREADS_TESTS.append(("waitpid", 2, ["./test/waitpid"], 2))
+if any([shouldRunTest("io2-" + t[0]) for t in IO_THREADS_TESTS]):
+  mainCoordinator = coordinator
+  mainPort = os.environ['DMTCP_COORD_PORT']
+  while os.environ['DMTCP_COORD_PORT'] == mainPort:
+    os.environ['DMTCP_COORD_PORT'] = str(randint(2000,10000))
+  os.environ['DMTCP_COORD_IO_THREADS'] = "2"
+  coordinator = runCmd(coordinator_cmdline)
+  coordinator.wait()  # With --daemon, it returns once it is listening.
+  for (name, numProcs, cmds, sleepFactor) in IO_THREADS_TESTS:
+    S=sleepFactor*DEFAULT_S
+    runTest("io2-" + name, numProcs, cmds)
+  S=DEFAULT_S
+  runDmtcpCommand('q')
+  del os.environ['DMTCP_COORD_IO_THREADS']
+  os.environ['DMTCP_COORD_PORT'] = mainPort
+  coordinator = mainCoordinator
+
 if HAS_READLINE == "yes":
   runTest("readline",    1,  ["./test/readline"])
 
@@ -0,0 +1,67 @@
+// Loaded into the processes of the node-barriers3 test by
+// dmtcp_launch --with-plugin test/libdmtcp_barrier-kill.so.
+//
+// On resuming from a checkpoint, each process meets the others at a global
+// barrier of its own.  With DMTCP_NODE_BARRIERS, the last process of a node
+// to arrive there reports the whole node to the coordinator.  The plugins
+// resume in reverse order, so no local barrier follows it.
+//   BARRIER_KILL_PIDFILE=FILE: write our real pid to FILE, then arrive a
+//     second late, so that autotest.py can kill us while we report our node;
+//   BARRIER_KILL_DELAY=N: arrive N seconds late, so that the coordinator
+//     cannot release the barrier in the meantime.
+// This runs in the checkpoint thread, so it avoids stdio and malloc().
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "dmtcp.h"
+
+static void
+resume()
+{
+  const char *pidFile = getenv("BARRIER_KILL_PIDFILE");
+  const char *delay = getenv("BARRIER_KILL_DELAY");
+
+  if (pidFile != NULL) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%d\n",
+                       (int)dmtcp_virtual_to_real_pid(getpid()));
+    int fd = open(pidFile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd != -1) {
+      if (write(fd, buf, len) != len) {
+        unlink(pidFile);
+      }
+      close(fd);
+    }
+    sleep(1);
+  }
+  if (delay != NULL) {
+    sleep(atoi(delay));
+  }
+  dmtcp_global_barrier("BarrierKill::RESUME");
+}
+
+static void
+barrierKill_EventHook(DmtcpEvent_t event, DmtcpEventData_t *data)
+{
+  switch (event) {
+  case DMTCP_EVENT_RESUME:
+    resume();
+    break;
+
+  default:
+    break;
+  }
+}
+
+DmtcpPluginDescriptor_t barrierKill_plugin = {
+  DMTCP_PLUGIN_API_VERSION,
+  DMTCP_PACKAGE_VERSION,
+  "barrier-kill",
+  "DMTCP",
+  "dmtcp@ccs.neu.edu",
+  "Kills the reporter of a node barrier (autotest)",
+  barrierKill_EventHook
+};
+
+DMTCP_DECL_PLUGIN(barrierKill_plugin);
@@ -0,0 +1,23 @@
+// Manual benchmarks for DMTCP's runtime overhead.
+//
+// These are not autotests and are not built by 'make tests'; build them with
+// 'make -C test bench'.  Each prints a table on stdout.  Compare a native run
+// with one under DMTCP, e.g.:
+//   test/bench/wrapper
+//   bin/dmtcp_launch test/bench/wrapper
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <time.h>
+
+static inline double
+now(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif // ifndef BENCH_H
@@ -0,0 +1,131 @@
+// Wakeup rate and wakeup latency of an idle epoll_wait().
+//
+// A thread waits in epoll_wait() with no timeout on the read end of a pipe,
+// while the main thread writes a timestamp into the pipe every INTERVAL ms
+// (default 100).  Prints how often the waiting thread was woken up
+// (voluntary context switches per second, ideally one per event), its CPU
+// time, and the time from each write until epoll_wait() returned.
+//   test/bench/epoll [-s SECONDS] [INTERVAL]
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static int fds[2];
+static int epfd;
+static double totalLatency = 0;
+static double maxLatency = 0;
+static long numEvents = 0;
+static long numWakeups = 0;
+static double cpuTime = 0;
+
+static void *
+waiterMain(void *arg)
+{
+  struct rusage start;
+  struct rusage end;
+  double cpuStart = now(CLOCK_THREAD_CPUTIME_ID);
+
+  getrusage(RUSAGE_THREAD, &start);
+  while (1) {
+    struct epoll_event event;
+    double sent;
+
+    int rc = epoll_wait(epfd, &event, 1, -1);
+    if (rc == -1) {
+      fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    double received = now(CLOCK_MONOTONIC);
+
+    if (read(fds[0], &sent, sizeof(sent)) != sizeof(sent)) {
+      fprintf(stderr, "read failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    if (sent < 0) {
+      break;
+    }
+
+    double latency = received - sent;
+    totalLatency += latency;
+    if (latency > maxLatency) {
+      maxLatency = latency;
+    }
+    numEvents++;
+  }
+  getrusage(RUSAGE_THREAD, &end);
+
+  cpuTime = now(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+  numWakeups = end.ru_nvcsw - start.ru_nvcsw;
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct epoll_event event;
+  pthread_t waiter;
+  int seconds = 5;
+  int interval = 100;
+  int i = 1;
+
+  if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+    seconds = atoi(argv[i + 1]);
+    i += 2;
+  }
+  if (i < argc) {
+    interval = atoi(argv[i]);
+  }
+  if (seconds < 1 || interval < 1) {
+    fprintf(stderr, "Usage: %s [-s SECONDS] [INTERVAL]\n", argv[0]);
+    return 1;
+  }
+
+  if (pipe(fds) == -1 || (epfd = epoll_create1(0)) == -1) {
+    fprintf(stderr, "setup failed: %s\n", strerror(errno));
+    return 1;
+  }
+  event.events = EPOLLIN;
+  event.data.fd = fds[0];
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event) == -1) {
+    fprintf(stderr, "epoll_ctl failed: %s\n", strerror(errno));
+    return 1;
+  }
+  if (pthread_create(&waiter, NULL, waiterMain, NULL) != 0) {
+    fprintf(stderr, "error creating thread: %s\n", strerror(errno));
+    return 1;
+  }
+
+  double start = now(CLOCK_MONOTONIC);
+  while (now(CLOCK_MONOTONIC) - start < seconds) {
+    usleep(interval * 1000);
+    double sent = now(CLOCK_MONOTONIC);
+    if (write(fds[1], &sent, sizeof(sent)) != sizeof(sent)) {
+      fprintf(stderr, "write failed: %s\n", strerror(errno));
+      return 1;
+    }
+  }
+  double stop = -1;
+  if (write(fds[1], &stop, sizeof(stop)) != sizeof(stop)) {
+    fprintf(stderr, "write failed: %s\n", strerror(errno));
+    return 1;
+  }
+  pthread_join(waiter, NULL);
+
+  double elapsed = now(CLOCK_MONOTONIC) - start;
+  printf("%16s %16s %16s %16s %16s\n", "EVENTS/SEC", "WAKEUPS/SEC",
+         "CPU MS/SEC", "AVG LATENCY US", "MAX LATENCY US");
+  printf("%16.1f %16.1f %16.3f %16.1f %16.1f\n",
+         numEvents / elapsed, numWakeups / elapsed, cpuTime * 1000 / elapsed,
+         numEvents > 0 ? totalLatency / numEvents * 1e6 : 0,
+         maxLatency * 1e6);
+  return 0;
+}
@@ -0,0 +1,81 @@
+// Call rates of getpid(), gettid() and getppid().
+//
+// Makes each call in a tight loop and prints the calls per second and the
+// time per call.
+//   test/bench/pid [-s SECONDS]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static volatile pid_t sink;
+
+static pid_t
+callGetpid()
+{
+  return getpid();
+}
+
+static pid_t
+callGettid()
+{
+#if __GLIBC_PREREQ(2, 30)
+  return gettid();
+#else // if __GLIBC_PREREQ(2, 30)
+  return syscall(SYS_gettid);
+#endif // if __GLIBC_PREREQ(2, 30)
+}
+
+static pid_t
+callGetppid()
+{
+  return getppid();
+}
+
+static void
+run(const char *name, pid_t (*fn)(), int seconds)
+{
+  unsigned long long n = 0;
+  double start = now(CLOCK_MONOTONIC);
+  double elapsed;
+
+  // Check the clock only every 1024 calls, so that it does not dominate.
+  do {
+    int i;
+    for (i = 0; i < 1024; i++) {
+      sink = fn();
+    }
+    n += 1024;
+    elapsed = now(CLOCK_MONOTONIC) - start;
+  } while (elapsed < seconds);
+
+  printf("%10s %16.0f %16.1f\n", name, n / elapsed, elapsed / n * 1e9);
+  fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int seconds = 2;
+
+  if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+    seconds = atoi(argv[2]);
+  } else if (argc != 1) {
+    seconds = 0;
+  }
+  if (seconds < 1) {
+    fprintf(stderr, "Usage: %s [-s SECONDS]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%10s %16s %16s\n", "CALL", "CALLS/SEC", "NS/CALL");
+  run("getpid", callGetpid, seconds);
+  run("gettid", callGettid, seconds);
+  run("getppid", callGetppid, seconds);
+  return 0;
+}
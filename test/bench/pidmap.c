@@ -0,0 +1,112 @@
+// Throughput of virtual-to-real pid lookups as the number of processes grows.
+//
+// Each process calls kill(pid, 0) in a loop for a pid that no process has.
+// Under DMTCP, the pid plugin does not find it among the pids that the
+// process knows of, and so looks it up in the pid map that all processes on
+// the node share.  For each process count (1, 2, 4, ... up to MAX_PROCESSES,
+// by default the number of online CPUs), prints the total number of lookups
+// per second.
+//   test/bench/pidmap [-s SECONDS] [MAX_PROCESSES]
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+struct Shared {
+  volatile int running;
+  volatile int stop;
+  unsigned long long ops[];
+};
+
+static double
+run(struct Shared *shared, int numProcesses, int seconds, pid_t unusedPid)
+{
+  unsigned long long total = 0;
+  double start;
+  int i;
+
+  shared->running = 0;
+  shared->stop = 0;
+  for (i = 0; i < numProcesses; i++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      fprintf(stderr, "fork failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    if (pid == 0) {
+      unsigned long long n = 0;
+      while (!shared->running) {
+      }
+      while (!shared->stop) {
+        kill(unusedPid, 0);
+        n++;
+      }
+      shared->ops[i] = n;
+      _exit(0);
+    }
+  }
+
+  start = now(CLOCK_MONOTONIC);
+  shared->running = 1;
+  sleep(seconds);
+  shared->stop = 1;
+  for (i = 0; i < numProcesses; i++) {
+    wait(NULL);
+  }
+  for (i = 0; i < numProcesses; i++) {
+    total += shared->ops[i];
+  }
+  return total / (now(CLOCK_MONOTONIC) - start);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxProcesses = sysconf(_SC_NPROCESSORS_ONLN);
+  int seconds = 2;
+  int i = 1;
+  int n;
+
+  if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+    seconds = atoi(argv[i + 1]);
+    i += 2;
+  }
+  if (i < argc) {
+    maxProcesses = atoi(argv[i]);
+  }
+  if (maxProcesses < 1 || seconds < 1) {
+    fprintf(stderr, "Usage: %s [-s SECONDS] [MAX_PROCESSES]\n", argv[0]);
+    return 1;
+  }
+
+  // The largest pid not in use (the default pid_max is 4194304).
+  pid_t unusedPid = 4194303;
+  while (kill(unusedPid, 0) == 0 || errno != ESRCH) {
+    unusedPid--;
+  }
+
+  struct Shared *shared = mmap(NULL,
+                               sizeof(*shared) +
+                               maxProcesses * sizeof(unsigned long long),
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  printf("%10s %16s %16s\n", "PROCESSES", "LOOKUPS/SEC", "PER PROCESS");
+  for (n = 1; n <= maxProcesses; n *= 2) {
+    double rate = run(shared, n, seconds, unusedPid);
+    printf("%10d %16.0f %16.0f\n", n, rate, rate / n);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Throughput of wrapped system calls as the number of threads grows.
+//
+// Each thread calls dup() and close(), both of which enter a DMTCP wrapper,
+// in a loop.  For each thread count (1, 2, 4, ... up to MAX_THREADS, by
+// default the number of online CPUs), prints the total number of
+// dup()/close() pairs per second.
+//   test/bench/wrapper [-s SECONDS] [MAX_THREADS]
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static volatile int running = 0;
+static volatile int stop = 0;
+static int fd;
+
+static void *
+threadMain(void *arg)
+{
+  unsigned long long *ops = (unsigned long long *)arg;
+  unsigned long long n = 0;
+
+  while (!running) {
+  }
+
+  while (!stop) {
+    int newFd = dup(fd);
+    if (newFd == -1) {
+      fprintf(stderr, "dup failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    close(newFd);
+    n++;
+  }
+
+  *ops = n;
+  return NULL;
+}
+
+static double
+run(int numThreads, int seconds)
+{
+  pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
+  unsigned long long *ops = calloc(numThreads, sizeof(unsigned long long));
+  unsigned long long total = 0;
+  double start;
+  int i;
+
+  running = 0;
+  stop = 0;
+  for (i = 0; i < numThreads; i++) {
+    if (pthread_create(&threads[i], NULL, threadMain, &ops[i]) != 0) {
+      fprintf(stderr, "error creating thread: %s\n", strerror(errno));
+      exit(1);
+    }
+  }
+
+  start = now(CLOCK_MONOTONIC);
+  running = 1;
+  sleep(seconds);
+  stop = 1;
+  for (i = 0; i < numThreads; i++) {
+    pthread_join(threads[i], NULL);
+    total += ops[i];
+  }
+
+  double ops_per_sec = total / (now(CLOCK_MONOTONIC) - start);
+  free(threads);
+  free(ops);
+  return ops_per_sec;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int seconds = 2;
+  int i = 1;
+  int n;
+
+  if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+    seconds = atoi(argv[i + 1]);
+    i += 2;
+  }
+  if (i < argc) {
+    maxThreads = atoi(argv[i]);
+  }
+  if (maxThreads < 1 || seconds < 1) {
+    fprintf(stderr, "Usage: %s [-s SECONDS] [MAX_THREADS]\n", argv[0]);
+    return 1;
+  }
+
+  fd = dup(1);
+  printf("%8s %16s %16s\n", "THREADS", "PAIRS/SEC", "PER THREAD");
+  for (n = 1; n <= maxThreads; n *= 2) {
+    double rate = run(n, seconds);
+    printf("%8d %16.0f %16.0f\n", n, rate, rate / n);
+    fflush(stdout);
+  }
+  return 0;
+}